@@ -0,0 +1,48 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+
+#include <memory>
+#include <string>
+
+#include "order_service/order.grpc.pb.h"
+#include "server/server.hpp"
+#include "service/order_service.hpp"
+
+// Shared by the benchmarks that drive OrderService, in process or over gRPC.
+
+// The benchmarks' sample order: `items` line items of the same product at
+// rising prices
+inline osv1::Order make_order(int items = 1) {
+    osv1::Order order;
+    order.set_address("123 Maple Street, Springfield");
+    for (int i = 0; i < items; i++) {
+        osv1::Item* item = order.add_items();
+        item->set_id("7c9e6679-7425-40de-944b-e07fc1f90ae7");
+        item->set_name("Laptop");
+        item->set_price(100.5 + i);
+        item->set_quantity(1 + i % 3);
+    }
+    return order;
+}
+
+// An OrderService behind a sync Server, and a stub dialing it over TCP
+struct BenchServer {
+    std::shared_ptr<OrderService> service;
+    std::unique_ptr<Server> server;
+    std::unique_ptr<osv1::OrderService::Stub> stub;
+};
+
+// Throws std::runtime_error if the server cannot start. `args` are the
+// stub's channel arguments.
+inline std::unique_ptr<BenchServer> start_server(const std::string& address, const OrderServiceOptions& options,
+                                                 const std::string& name,
+                                                 const grpc::ChannelArguments& args = grpc::ChannelArguments()) {
+    auto bench = std::make_unique<BenchServer>();
+    bench->service = std::make_shared<OrderService>(options);
+    bench->server = std::make_unique<Server>(address, bench->service, name);
+    bench->server->Start();
+    bench->stub =
+        osv1::OrderService::NewStub(grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(), args));
+    return bench;
+}
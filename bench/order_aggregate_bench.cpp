@@ -0,0 +1,115 @@
+// Cost of the AggregateOrders scans.
+//   BM_AggregateRecords - revenue by status the way it had to be done before,
+//                         over every record of an OrderStore (1M orders)
+//   BM_AggregateColumns - OrderColumns::Aggregate over 1M and 10M orders,
+//                         without grouping, by status and by day, on 1 and 4
+//                         threads
+//   BM_SumProducts      - the kernel against a plain loop over 1024 values
+// Orders are spread over 90 days with every status.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "store/order_columns.hpp"
+#include "store_bench_common.hpp"
+
+namespace {
+
+// Built straight from the records, so 10M orders fit without a store
+OrderColumns& columns(int64_t count) {
+    static std::map<int64_t, std::unique_ptr<OrderColumns>> columns;
+    std::unique_ptr<OrderColumns>& c = columns[count];
+    if (!c) {
+        c = std::make_unique<OrderColumns>();
+        for (int64_t i = 0; i < count; i++) {
+            c->Apply(nullptr, OrderRecord::Create("user", make_store_order(i, true)));
+        }
+    }
+    return *c;
+}
+
+AggregateQuery make_query(int64_t group_by) {
+    AggregateQuery query;
+    query.group_by = static_cast<AggregateQuery::GroupBy>(group_by);
+    query.created_after = kBenchStart;
+    query.created_before = kBenchStart + kBenchDays * kBenchDay;
+    query.bucket_seconds = kBenchDay;
+    return query;
+}
+
+void BM_AggregateRecords(benchmark::State& state) {
+    OrderStore& s = *bench_dataset(1000000, OrderStore::kDefaultShardCount, true).store;
+
+    for (auto _ : state) {
+        std::vector<OrderAggregate> groups(osv1::OrderStatus_ARRAYSIZE);
+        s.Scan([&groups](const OrderStore::OrderPtr& order) {
+            OrderAggregate& group = groups[order->status()];
+            group.count++;
+            group.amount += order->amount();
+            group.items += order->item_count();
+        });
+        benchmark::DoNotOptimize(groups);
+    }
+    state.SetItemsProcessed(state.iterations() * 1000000);
+}
+
+void BM_AggregateColumns(benchmark::State& state) {
+    OrderColumns& c = columns(state.range(0));
+    AggregateQuery query = make_query(state.range(1));
+    unsigned threads = static_cast<unsigned>(state.range(2));
+
+    for (auto _ : state) {
+        std::vector<OrderAggregate> groups = c.Aggregate(query, threads);
+        benchmark::DoNotOptimize(groups);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+std::vector<double> values(std::size_t n, double scale) {
+    std::vector<double> v(n);
+    for (std::size_t i = 0; i < n; i++) {
+        v[i] = static_cast<double>(i % 17) * scale;
+    }
+    return v;
+}
+
+void BM_SumProducts(benchmark::State& state) {
+    std::vector<double> a = values(1024, 0.5);
+    std::vector<double> b = values(1024, 2.0);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(OrderColumns::SumProducts(a.data(), b.data(), a.size()));
+    }
+    state.SetItemsProcessed(state.iterations() * 1024);
+}
+
+void BM_SumProductsLoop(benchmark::State& state) {
+    std::vector<double> a = values(1024, 0.5);
+    std::vector<double> b = values(1024, 2.0);
+
+    for (auto _ : state) {
+        double total = 0.0;
+        for (std::size_t i = 0; i < a.size(); i++) {
+            total += a[i] * b[i];
+        }
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations() * 1024);
+}
+
+}  // namespace
+
+BENCHMARK(BM_AggregateRecords)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_AggregateColumns)
+    ->ArgNames({"orders", "group_by", "threads"})
+    ->ArgsProduct({{1000000, 10000000}, {0, 1, 2}, {1, 4}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_SumProducts);
+BENCHMARK(BM_SumProductsLoop);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,71 @@
+// Cost of serving a GetOrder from a large store: look the order up by its id
+// text and fill a GetOrderResponse, with uniformly random ids so nearly every
+// lookup misses the CPU caches.
+//   BM_GetProtoRecord - the previous layout: string-keyed unordered_map of
+//                       shared osv1::Order records, copied into the response
+//   BM_GetOrderRecord - OrderStore: open-addressing table of OrderRecords,
+//                       converted into the response
+// The argument is the number of orders.
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "store_bench_common.hpp"
+
+namespace {
+
+using ProtoRecords = std::unordered_map<std::string, std::shared_ptr<const osv1::Order>>;
+
+// The same orders as bench_dataset(count), in the previous layout
+ProtoRecords& proto_records(int count) {
+    static std::unordered_map<int, std::unique_ptr<ProtoRecords>> records;
+    std::unique_ptr<ProtoRecords>& r = records[count];
+    if (!r) {
+        r = std::make_unique<ProtoRecords>();
+        for (int i = 0; i < count; i++) {
+            r->emplace(bench_order_id(i), std::make_shared<const osv1::Order>(make_store_order(i)));
+        }
+    }
+    return *r;
+}
+
+void BM_GetProtoRecord(benchmark::State& state) {
+    BenchDataset& d = bench_dataset(state.range(0));
+    ProtoRecords& records = proto_records(static_cast<int>(state.range(0)));
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<std::size_t> pick(0, d.order_ids.size() - 1);
+    osv1::GetOrderResponse response;
+
+    for (auto _ : state) {
+        auto it = records.find(d.order_ids[pick(rng)]);
+        std::shared_ptr<const osv1::Order> order = it->second;
+        response.mutable_order()->CopyFrom(*order);
+        benchmark::DoNotOptimize(response);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_GetOrderRecord(benchmark::State& state) {
+    BenchDataset& d = bench_dataset(state.range(0));
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<std::size_t> pick(0, d.order_ids.size() - 1);
+    osv1::GetOrderResponse response;
+
+    for (auto _ : state) {
+        OrderStore::OrderPtr order = d.store->Get(d.order_ids[pick(rng)]);
+        order->ToProto(response.mutable_order());
+        benchmark::DoNotOptimize(response);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_GetProtoRecord)->ArgName("orders")->Arg(10000)->Arg(1000000);
+BENCHMARK(BM_GetOrderRecord)->ArgName("orders")->Arg(10000)->Arg(1000000);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,63 @@
+// Order id generation throughput.
+//
+// BM_LegacyId is the generator OrderService used before OrderId: a
+// thread-local std::mt19937 and one uniform_int_distribution draw and string
+// append per character. BM_GenerateId formats an OrderId into a stack buffer,
+// BM_GenerateIdString into a std::string as OrderService does. Every case
+// runs from 1 to 16 threads.
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+
+#include "store/order_id.hpp"
+
+namespace {
+
+std::string legacy_id() {
+    thread_local std::mt19937 gen(std::random_device{}());
+
+    std::uniform_int_distribution<> dis(0, 15);
+    static const char* hex = "0123456789abcdef";
+
+    std::string uuid;
+    for (int i = 0; i < 32; i++) {
+        uuid += hex[dis(gen)];
+        if (i == 7 || i == 11 || i == 15 || i == 19) {
+            uuid += '-';
+        }
+    }
+    return uuid;
+}
+
+void BM_LegacyId(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(legacy_id());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_GenerateId(benchmark::State& state) {
+    char text[OrderId::kTextSize];
+    for (auto _ : state) {
+        OrderId::Generate().Format(text);
+        benchmark::DoNotOptimize(text);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_GenerateIdString(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(OrderId::Generate().ToString());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_LegacyId)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_GenerateId)->ThreadRange(1, 16)->UseRealTime();
+BENCHMARK(BM_GenerateIdString)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,96 @@
+// Collision and ordering check for OrderId.
+//
+// Every thread generates its share of N ids (default 10M) as fast as it can
+// and keeps them. The check then verifies that:
+//   - each thread's ids strictly increase
+//   - no id appears twice across all threads
+//   - every id has the UUIDv7 version and variant bits and survives a
+//     Format / Parse round trip
+// and reports the aggregate generation rate. Exits with 1 on any failure.
+//
+// Usage: order-id-check [id_count] [threads]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "store/order_id.hpp"
+
+int main(int argc, char** argv) {
+    long count = argc > 1 ? std::atol(argv[1]) : 10000000;
+    int threads = argc > 2 ? std::atoi(argv[2]) : static_cast<int>(std::thread::hardware_concurrency());
+    if (count <= 0 || threads <= 0) {
+        std::fprintf(stderr, "usage: %s [id_count] [threads]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::vector<OrderId>> ids(static_cast<std::size_t>(threads));
+    for (int t = 0; t < threads; t++) {
+        ids[t].resize(static_cast<std::size_t>(count / threads + (t < count % threads ? 1 : 0)));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&ids, t] {
+            for (OrderId& id : ids[t]) {
+                id = OrderId::Generate();
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("Ids: %ld, threads: %d\n", count, threads);
+    std::printf("Generated in %.3f s, %.1fM ids/s\n", seconds, static_cast<double>(count) / seconds / 1e6);
+
+    bool ok = true;
+    for (int t = 0; t < threads; t++) {
+        if (!std::is_sorted(ids[t].begin(), ids[t].end()) ||
+            std::adjacent_find(ids[t].begin(), ids[t].end()) != ids[t].end()) {
+            std::printf("FAIL: ids of thread %d do not strictly increase\n", t);
+            ok = false;
+        }
+    }
+
+    std::vector<OrderId> all;
+    all.reserve(static_cast<std::size_t>(count));
+    for (const auto& thread_ids : ids) {
+        all.insert(all.end(), thread_ids.begin(), thread_ids.end());
+    }
+    std::sort(all.begin(), all.end());
+    std::size_t duplicates = 0;
+    for (std::size_t i = 1; i < all.size(); i++) {
+        duplicates += all[i] == all[i - 1] ? 1 : 0;
+    }
+    if (duplicates > 0) {
+        std::printf("FAIL: %zu duplicate ids\n", duplicates);
+        ok = false;
+    }
+
+    std::size_t malformed = 0;
+    char text[OrderId::kTextSize];
+    for (const OrderId& id : all) {
+        OrderId parsed;
+        id.Format(text);
+        if (((id.hi >> 12) & 0xf) != 7 || (id.lo >> 62) != 2 ||
+            !OrderId::Parse(std::string_view(text, sizeof(text)), &parsed) || parsed != id) {
+            malformed++;
+        }
+    }
+    if (malformed > 0) {
+        std::printf("FAIL: %zu ids with bad version bits or round trip\n", malformed);
+        ok = false;
+    }
+
+    std::printf("Span: %llu ms, first %s\n",
+                static_cast<unsigned long long>(all.back().unix_ms() - all.front().unix_ms()),
+                all.front().ToString().c_str());
+    std::printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+// Bulk import throughput of OrderService over a local gRPC connection, to a
+// Server (sync mode) running in the benchmark.
+//
+// Every iteration imports kImportSize orders through one of the three paths:
+//   BM_CreateOrder       - one CreateOrder RPC per order
+//   BM_BatchCreateOrders - one BatchCreateOrders RPC for all of them
+//   BM_IngestOrders      - one IngestOrders stream for all of them
+// The argument is 0 without a WAL and 1 with a WAL that makes every RPC wait
+// for its fsync, where the per-order path pays a group commit per order.
+
+#include <benchmark/benchmark.h>
+#include <grpcpp/grpcpp.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench_common.hpp"
+
+namespace {
+
+constexpr const char* kAddresses[2] = {"127.0.0.1:50155", "127.0.0.1:50156"};
+constexpr int kImportSize = 1000;
+constexpr int kUserCount = 100;
+
+std::string wal_path() { return (std::filesystem::temp_directory_path() / "order-ingest-bench.wal").string(); }
+
+// A server per WAL setting, started on first use
+BenchServer& fixture(bool wal) {
+    static std::unique_ptr<BenchServer> servers[2];
+    std::unique_ptr<BenchServer>& server = servers[wal ? 1 : 0];
+    if (server) {
+        return *server;
+    }
+
+    OrderServiceOptions options;
+    if (wal) {
+        std::remove(wal_path().c_str());
+        WalOptions wal_options;
+        wal_options.path = wal_path();
+        options.wal = wal_options;
+    }
+    server = start_server(kAddresses[wal ? 1 : 0], options, "order-ingest-bench");
+    return *server;
+}
+
+osv1::CreateOrderRequest make_request(int i) {
+    osv1::CreateOrderRequest request;
+    request.set_user_id("bench-user-" + std::to_string(i % kUserCount));
+    *request.mutable_order() = make_order();
+    return request;
+}
+
+void BM_CreateOrder(benchmark::State& state) {
+    BenchServer& f = fixture(state.range(0) != 0);
+
+    std::vector<osv1::CreateOrderRequest> requests;
+    for (int i = 0; i < kImportSize; i++) {
+        requests.push_back(make_request(i));
+    }
+
+    for (auto _ : state) {
+        for (const auto& request : requests) {
+            grpc::ClientContext ctx;
+            osv1::CreateOrderResponse response;
+            if (!f.stub->CreateOrder(&ctx, request, &response).ok()) {
+                state.SkipWithError("CreateOrder failed");
+                return;
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kImportSize);
+}
+
+void BM_BatchCreateOrders(benchmark::State& state) {
+    BenchServer& f = fixture(state.range(0) != 0);
+
+    osv1::BatchCreateOrdersRequest request;
+    for (int i = 0; i < kImportSize; i++) {
+        *request.add_orders() = make_request(i);
+    }
+
+    for (auto _ : state) {
+        grpc::ClientContext ctx;
+        osv1::BatchCreateOrdersResponse response;
+        if (!f.stub->BatchCreateOrders(&ctx, request, &response).ok() || response.order_ids_size() != kImportSize) {
+            state.SkipWithError("BatchCreateOrders failed");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kImportSize);
+}
+
+void BM_IngestOrders(benchmark::State& state) {
+    BenchServer& f = fixture(state.range(0) != 0);
+
+    std::vector<osv1::CreateOrderRequest> requests;
+    for (int i = 0; i < kImportSize; i++) {
+        requests.push_back(make_request(i));
+    }
+
+    for (auto _ : state) {
+        grpc::ClientContext ctx;
+        osv1::IngestOrdersResponse response;
+        std::unique_ptr<grpc::ClientWriter<osv1::CreateOrderRequest>> writer = f.stub->IngestOrders(&ctx, &response);
+
+        for (const auto& request : requests) {
+            writer->Write(request);
+        }
+        writer->WritesDone();
+
+        if (!writer->Finish().ok() || response.order_ids_size() != kImportSize) {
+            state.SkipWithError("IngestOrders failed");
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kImportSize);
+}
+
+}  // namespace
+
+BENCHMARK(BM_CreateOrder)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_BatchCreateOrders)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_IngestOrders)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
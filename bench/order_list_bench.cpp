@@ -0,0 +1,144 @@
+// Cost of fetching every order of a user over loopback TCP: ListOrders paged
+// through 1,000 orders at a time, the most one call returns, against one
+// StreamListOrders call, each with and without response compression.
+//
+// Two Servers (sync mode) run in the benchmark on the same seeded orders, the
+// second compressing responses of 64 KiB and more at GRPC_COMPRESS_LEVEL_LOW
+// (gzip). Every iteration reads all of the user's orders; items_per_second
+// counts orders.
+//   BM_ListOrdersPaged/orders/compress  - ListOrders with limit 1000, page after page
+//   BM_StreamListOrders/orders/chunk/compress - one stream, `chunk` orders per message
+// The max_message_bytes counter is the largest message the client received
+// (uncompressed), the most a call holds in memory at once on either side.
+// Loopback is not short of bandwidth, so compression shows its CPU cost
+// here, not what it saves on a real network.
+
+#include <benchmark/benchmark.h>
+#include <grpcpp/grpcpp.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "bench_common.hpp"
+
+namespace {
+
+constexpr const char* kAddresses[2] = {"127.0.0.1:50153", "127.0.0.1:50154"};
+constexpr std::size_t kCompressionThreshold = 64 << 10;
+constexpr int kMaxOrders = 100000;
+constexpr int kPageSize = 1000;
+constexpr int kBatchSize = 10000;
+
+// One user per dataset size, so a listing returns exactly that many orders
+std::string user_name(int orders) { return "list-bench-user-" + std::to_string(orders); }
+
+struct Fixture {
+    std::unique_ptr<BenchServer> servers[2];
+};
+
+void seed(OrderService& service, int orders) {
+    for (int created = 0; created < orders; created += kBatchSize) {
+        osv1::BatchCreateOrdersRequest request;
+        for (int i = created; i < std::min(orders, created + kBatchSize); i++) {
+            osv1::CreateOrderRequest* create = request.add_orders();
+            create->set_user_id(user_name(orders));
+            *create->mutable_order() = make_order();
+        }
+        osv1::BatchCreateOrdersResponse response;
+        service.BatchCreateOrders(nullptr, &request, &response);
+    }
+}
+
+// Started on first use and left running until the process exits
+Fixture& fixture() {
+    static Fixture* f = [] {
+        Fixture* f = new Fixture();
+        for (int compress = 0; compress < 2; compress++) {
+            OrderServiceOptions options;
+            options.compression_threshold_bytes = compress ? kCompressionThreshold : 0;
+            grpc::ChannelArguments args;
+            args.SetMaxReceiveMessageSize(-1);
+            f->servers[compress] = start_server(kAddresses[compress], options, "order-list-bench", args);
+
+            for (int orders = 1000; orders <= kMaxOrders; orders *= 10) {
+                seed(*f->servers[compress]->service, orders);
+            }
+        }
+        return f;
+    }();
+    return *f;
+}
+
+void BM_ListOrdersPaged(benchmark::State& state) {
+    int orders = static_cast<int>(state.range(0));
+    osv1::OrderService::Stub* stub = fixture().servers[state.range(1)]->stub.get();
+
+    osv1::ListOrdersRequest request;
+    request.set_user_id(user_name(orders));
+    request.set_limit(kPageSize);
+
+    std::size_t max_message = 0;
+    for (auto _ : state) {
+        int received = 0;
+        for (int page = 1; received < orders; page++) {
+            request.set_page(page);
+            grpc::ClientContext ctx;
+            osv1::ListOrdersResponse response;
+            grpc::Status status = stub->ListOrders(&ctx, request, &response);
+            if (!status.ok() || response.orders_size() == 0) {
+                state.SkipWithError(status.ok() ? "Short listing" : status.error_message().c_str());
+                return;
+            }
+            received += response.orders_size();
+            max_message = std::max(max_message, response.ByteSizeLong());
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * orders);
+    state.counters["max_message_bytes"] = static_cast<double>(max_message);
+}
+
+void BM_StreamListOrders(benchmark::State& state) {
+    int orders = static_cast<int>(state.range(0));
+    osv1::OrderService::Stub* stub = fixture().servers[state.range(2)]->stub.get();
+
+    osv1::ListOrdersRequest request;
+    request.set_user_id(user_name(orders));
+    request.set_limit(static_cast<int>(state.range(1)));
+
+    std::size_t max_message = 0;
+    for (auto _ : state) {
+        grpc::ClientContext ctx;
+        std::unique_ptr<grpc::ClientReader<osv1::ListOrdersResponse>> reader = stub->StreamListOrders(&ctx, request);
+
+        int received = 0;
+        osv1::ListOrdersResponse response;
+        while (reader->Read(&response)) {
+            received += response.orders_size();
+            max_message = std::max(max_message, response.ByteSizeLong());
+        }
+
+        grpc::Status status = reader->Finish();
+        if (!status.ok() || received != orders) {
+            state.SkipWithError(status.ok() ? "Short listing" : status.error_message().c_str());
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * orders);
+    state.counters["max_message_bytes"] = static_cast<double>(max_message);
+}
+
+}  // namespace
+
+BENCHMARK(BM_ListOrdersPaged)
+    ->ArgNames({"orders", "compress"})
+    ->ArgsProduct({{1000, 10000, kMaxOrders}, {0, 1}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_StreamListOrders)
+    ->ArgNames({"orders", "chunk", "compress"})
+    ->ArgsProduct({{1000, 10000, kMaxOrders}, {100, 1000}, {0, 1}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
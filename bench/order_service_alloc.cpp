@@ -0,0 +1,217 @@
+// Allocation benchmark for the OrderService request path.
+//
+// Global operator new is replaced to count heap allocations, and every method
+// reports mallocs/RPC and bytes/RPC for two ways of holding its messages:
+//   heap  - a fresh request and response per call, as the sync server does
+//   arena - a recycled CallArena, as the async engine does
+// BM_GetOrderCached serves GetOrder from the response cache instead.
+// An iteration parses the request from its wire bytes, runs the handler and
+// serializes the response: the part of an RPC the service owns. Allocations
+// made by gRPC itself are not included.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "bench_common.hpp"
+#include "service/call_arena.hpp"
+
+namespace {
+
+thread_local bool counting = false;
+thread_local std::size_t alloc_count = 0;
+thread_local std::size_t alloc_bytes = 0;
+
+void* allocate(std::size_t size) {
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+constexpr int kOrderCount = 100;
+const std::string kUserId = "bench-user";
+
+OrderService& service() {
+    static OrderService* s = [] {
+        OrderServiceOptions options;
+        options.response_cache_bytes = 1 << 20;
+        return new OrderService(options);
+    }();
+    return *s;
+}
+
+std::string create_order() {
+    osv1::CreateOrderRequest request;
+    request.set_user_id(kUserId);
+    *request.mutable_order() = make_order(2);
+
+    osv1::CreateOrderResponse response;
+    service().CreateOrder(nullptr, &request, &response);
+    return response.order().id();
+}
+
+const std::vector<std::string>& order_ids() {
+    static std::vector<std::string> ids = [] {
+        std::vector<std::string> ids;
+        for (int i = 0; i < kOrderCount; i++) {
+            ids.push_back(create_order());
+        }
+        return ids;
+    }();
+    return ids;
+}
+
+// Runs `handler` once per iteration on messages held the way `arena` asks
+// for. `prepare` runs before each call, outside the timing and the counters.
+template <typename Request, typename Response>
+void run(benchmark::State& state, bool arena, Status (OrderService::*handler)(ServerContext*, const Request*, Response*),
+         const std::function<Request()>& make_request, const std::function<void(Request&)>& prepare = nullptr) {
+    OrderService& s = service();
+    CallArena<Request, Response> call;
+    Request prototype = make_request();
+    std::string wire = prototype.SerializeAsString();
+    std::string out;
+
+    alloc_count = 0;
+    alloc_bytes = 0;
+
+    for (auto _ : state) {
+        if (prepare) {
+            state.PauseTiming();
+            prepare(prototype);
+            wire = prototype.SerializeAsString();
+            state.ResumeTiming();
+        }
+
+        counting = true;
+        if (arena) {
+            call.Reset();
+            call.request()->ParseFromString(wire);
+            (s.*handler)(nullptr, call.request(), call.response());
+            call.response()->SerializeToString(&out);
+        } else {
+            Request request;
+            Response response;
+            request.ParseFromString(wire);
+            (s.*handler)(nullptr, &request, &response);
+            response.SerializeToString(&out);
+        }
+        counting = false;
+    }
+
+    state.counters["mallocs/RPC"] = benchmark::Counter(static_cast<double>(alloc_count), benchmark::Counter::kAvgIterations);
+    state.counters["bytes/RPC"] = benchmark::Counter(static_cast<double>(alloc_bytes), benchmark::Counter::kAvgIterations);
+}
+
+void BM_GetOrder(benchmark::State& state, bool arena) {
+    run<osv1::GetOrderRequest, osv1::GetOrderResponse>(state, arena, &OrderService::GetOrder, [] {
+        osv1::GetOrderRequest request;
+        request.set_order_id(order_ids()[kOrderCount / 2]);
+        return request;
+    });
+}
+
+// Raw GetOrder on a warm cache: the request bytes go in and the cached
+// response bytes come out
+void BM_GetOrderCached(benchmark::State& state) {
+    OrderService& s = service();
+    osv1::GetOrderRequest prototype;
+    prototype.set_order_id(order_ids()[kOrderCount / 2]);
+
+    std::string wire = prototype.SerializeAsString();
+    grpc::Slice slice(wire);
+    grpc::ByteBuffer request(&slice, 1);
+    grpc::ByteBuffer response;
+    s.GetOrderRaw(nullptr, &request, &response);
+
+    alloc_count = 0;
+    alloc_bytes = 0;
+
+    for (auto _ : state) {
+        counting = true;
+        s.GetOrderRaw(nullptr, &request, &response);
+        counting = false;
+        benchmark::DoNotOptimize(response);
+    }
+
+    state.counters["mallocs/RPC"] = benchmark::Counter(static_cast<double>(alloc_count), benchmark::Counter::kAvgIterations);
+    state.counters["bytes/RPC"] = benchmark::Counter(static_cast<double>(alloc_bytes), benchmark::Counter::kAvgIterations);
+}
+
+void BM_ListOrders(benchmark::State& state, bool arena) {
+    run<osv1::ListOrdersRequest, osv1::ListOrdersResponse>(state, arena, &OrderService::ListOrders, [] {
+        order_ids();
+        osv1::ListOrdersRequest request;
+        request.set_user_id(kUserId);
+        request.set_limit(10);
+        return request;
+    });
+}
+
+void BM_CreateOrder(benchmark::State& state, bool arena) {
+    run<osv1::CreateOrderRequest, osv1::CreateOrderResponse>(state, arena, &OrderService::CreateOrder, [] {
+        osv1::CreateOrderRequest request;
+        request.set_user_id(kUserId);
+        *request.mutable_order() = make_order(2);
+        return request;
+    });
+}
+
+// UpdateOrder's request and response types are swapped in the proto
+void BM_UpdateOrder(benchmark::State& state, bool arena) {
+    run<osv1::UpdateOrderResponse, osv1::UpdateOrderRequest>(state, arena, &OrderService::UpdateOrder, [] {
+        osv1::GetOrderRequest get;
+        osv1::GetOrderResponse current;
+        get.set_order_id(order_ids()[kOrderCount / 2]);
+        service().GetOrder(nullptr, &get, &current);
+
+        osv1::UpdateOrderResponse request;
+        *request.mutable_order() = current.order();
+        request.mutable_order()->set_status(osv1::OrderStatus::PROCESSING);
+        return request;
+    });
+}
+
+void BM_DeleteOrder(benchmark::State& state, bool arena) {
+    run<osv1::DeleteOrderRequest, osv1::DeleteOrderResponse>(
+        state, arena, &OrderService::DeleteOrder, [] { return osv1::DeleteOrderRequest(); },
+        [](osv1::DeleteOrderRequest& request) { request.set_order_id(create_order()); });
+}
+
+}  // namespace
+
+BENCHMARK_CAPTURE(BM_GetOrder, heap, false);
+BENCHMARK_CAPTURE(BM_GetOrder, arena, true);
+BENCHMARK(BM_GetOrderCached);
+BENCHMARK_CAPTURE(BM_ListOrders, heap, false);
+BENCHMARK_CAPTURE(BM_ListOrders, arena, true);
+BENCHMARK_CAPTURE(BM_CreateOrder, heap, false);
+BENCHMARK_CAPTURE(BM_CreateOrder, arena, true);
+BENCHMARK_CAPTURE(BM_UpdateOrder, heap, false);
+BENCHMARK_CAPTURE(BM_UpdateOrder, arena, true);
+BENCHMARK_CAPTURE(BM_DeleteOrder, heap, false);
+BENCHMARK_CAPTURE(BM_DeleteOrder, arena, true);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,337 @@
+// Cost of the OrderService handlers called in process, without gRPC.
+//
+// Every case runs against a service preloaded with `orders` orders of `items`
+// line items each, owned by orders / 10 users. With `skew` (Zipf exponent
+// times 100) above 0 both the owners and the targets follow a Zipf
+// distribution: a few users own most orders and a few orders get most
+// requests. Requests are built up front, a pool per thread, and each handler
+// is called with a reused synthetic ServerContext.
+//   BM_GetOrder    - 1K to 10M orders, 1 and 8 items, uniform and skewed
+//   BM_ListOrders  - first page of 10 of the orders of the owner of a random
+//                    order, skew sets how many the hot users own
+//   BM_CreateOrder - into a store of 1K and 1M orders
+//   BM_UpdateOrder - status change of an existing order
+//   BM_DeleteOrder - of orders created for it, outside the timing
+// Each runs on 1 to 8 threads; items_per_second over real time is the
+// throughput, so the thread series is the scaling curve. Global operator
+// new is replaced to report allocs/op and bytes/op.
+//
+// To compare two builds:
+//   order-service-bench --benchmark_out=before.json --benchmark_out_format=json
+//   compare.py benchmarks before.json after.json   # from google/benchmark tools
+
+#include <benchmark/benchmark.h>
+#include <grpcpp/server_context.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench_common.hpp"
+
+namespace {
+
+thread_local bool counting = false;
+thread_local std::size_t alloc_count = 0;
+thread_local std::size_t alloc_bytes = 0;
+
+void* allocate(std::size_t size) {
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+constexpr std::size_t kPoolSize = 4096;  // Requests per thread, cycled through
+constexpr int kLoadBatch = 1000;
+constexpr int kDeleteRefill = 1024;
+
+// Ranks 0 to n - 1 with P(k) ~ 1 / (k + 1)^s, drawn through the inverse CDF
+// of the continuous distribution, so no table of n entries is needed. Uniform
+// when s is 0.
+class Zipf {
+   public:
+    Zipf(uint64_t n, double s) : n_(static_cast<double>(n)), s_(s) {}
+
+    uint64_t operator()(std::mt19937_64& rng) const {
+        double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double x;
+        if (this->s_ == 0.0) {
+            x = 1.0 + u * this->n_;
+        } else if (std::abs(this->s_ - 1.0) < 1e-9) {
+            x = std::pow(this->n_ + 1.0, u);
+        } else {
+            double e = 1.0 - this->s_;
+            x = std::pow(u * (std::pow(this->n_ + 1.0, e) - 1.0) + 1.0, 1.0 / e);
+        }
+        return std::min(static_cast<uint64_t>(x) - 1, static_cast<uint64_t>(this->n_) - 1);
+    }
+
+   private:
+    double n_;
+    double s_;
+};
+
+std::string user_name(uint64_t user) { return "bench-user-" + std::to_string(user); }
+
+struct Dataset {
+    int64_t orders = -1;
+    int items = 0;
+    int skew = -1;
+    bool grown = false;  // CreateOrder added orders, reload before the next case
+    std::unique_ptr<OrderService> service;
+    std::vector<OrderId> ids;     // In load order, Zipf rank 0 first
+    std::vector<uint32_t> owner;  // User of every order in `ids`
+    uint64_t users = 0;
+
+    Zipf targets() const { return Zipf(this->ids.size(), this->skew / 100.0); }
+    Zipf owners() const { return Zipf(this->users, this->skew / 100.0); }
+};
+
+std::mutex dataset_mutex;
+
+// One dataset at a time, rebuilt when a case asks for another. Cases are
+// registered so consecutive ones share it. Every thread of a case calls this,
+// the first one loads and the others wait for it.
+Dataset& dataset(int64_t orders, int items, int skew) {
+    static Dataset d;
+    std::lock_guard<std::mutex> lock(dataset_mutex);
+    if (d.orders == orders && d.items == items && d.skew == skew && !d.grown) {
+        return d;
+    }
+
+    d.service.reset();
+    d.ids = {};
+    d.owner = {};
+    d.orders = orders;
+    d.items = items;
+    d.skew = skew;
+    d.grown = false;
+    d.users = static_cast<uint64_t>(std::max<int64_t>(1, orders / 10));
+    d.service = std::make_unique<OrderService>();
+    d.ids.reserve(static_cast<std::size_t>(orders));
+    d.owner.reserve(static_cast<std::size_t>(orders));
+
+    std::mt19937_64 rng(42);
+    Zipf owners = d.owners();
+    osv1::Order order = make_order(items);
+    for (int64_t loaded = 0; loaded < orders; loaded += kLoadBatch) {
+        osv1::BatchCreateOrdersRequest request;
+        int64_t n = std::min<int64_t>(kLoadBatch, orders - loaded);
+        for (int64_t i = 0; i < n; i++) {
+            d.owner.push_back(static_cast<uint32_t>(owners(rng)));
+            osv1::CreateOrderRequest* create = request.add_orders();
+            create->set_user_id(user_name(d.owner.back()));
+            *create->mutable_order() = order;
+        }
+
+        osv1::BatchCreateOrdersResponse response;
+        d.service->BatchCreateOrders(nullptr, &request, &response);
+        for (const std::string& id : response.order_ids()) {
+            OrderId parsed;
+            OrderId::Parse(id, &parsed);
+            d.ids.push_back(parsed);
+        }
+    }
+    return d;
+}
+
+// Runs `handler` over the thread's pool of requests, counting allocations
+template <typename Request, typename Response>
+void run(benchmark::State& state, OrderService& service,
+         Status (OrderService::*handler)(ServerContext*, const Request*, Response*),
+         const std::vector<Request>& pool) {
+    grpc::ServerContext context;
+    Response response;
+    std::size_t next = 0;
+
+    alloc_count = 0;
+    alloc_bytes = 0;
+
+    for (auto _ : state) {
+        counting = true;
+        response.Clear();
+        Status status = (service.*handler)(&context, &pool[next], &response);
+        counting = false;
+
+        if (!status.ok()) {
+            state.SkipWithError(status.error_message().c_str());
+            return;
+        }
+        next = next + 1 == pool.size() ? 0 : next + 1;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["allocs/op"] = benchmark::Counter(static_cast<double>(alloc_count), benchmark::Counter::kAvgIterations);
+    state.counters["bytes/op"] = benchmark::Counter(static_cast<double>(alloc_bytes), benchmark::Counter::kAvgIterations);
+}
+
+std::mt19937_64 thread_rng(const benchmark::State& state) {
+    return std::mt19937_64(1000 + static_cast<uint64_t>(state.thread_index()));
+}
+
+void BM_GetOrder(benchmark::State& state) {
+    Dataset& d = dataset(state.range(0), static_cast<int>(state.range(1)), static_cast<int>(state.range(2)));
+
+    std::mt19937_64 rng = thread_rng(state);
+    Zipf targets = d.targets();
+    std::vector<osv1::GetOrderRequest> pool(kPoolSize);
+    for (auto& request : pool) {
+        request.set_order_id(d.ids[targets(rng)].ToString());
+    }
+
+    run(state, *d.service, &OrderService::GetOrder, pool);
+}
+
+void BM_ListOrders(benchmark::State& state) {
+    Dataset& d = dataset(state.range(0), 1, static_cast<int>(state.range(1)));
+
+    // The owner of a random order, so users are asked for as often as they
+    // own orders and never for none
+    std::mt19937_64 rng = thread_rng(state);
+    std::uniform_int_distribution<std::size_t> orders(0, d.owner.size() - 1);
+    std::vector<osv1::ListOrdersRequest> pool(kPoolSize);
+    for (auto& request : pool) {
+        request.set_user_id(user_name(d.owner[orders(rng)]));
+        request.set_limit(10);
+    }
+
+    run(state, *d.service, &OrderService::ListOrders, pool);
+}
+
+void BM_CreateOrder(benchmark::State& state) {
+    Dataset& d = dataset(state.range(0), static_cast<int>(state.range(1)), 0);
+
+    std::mt19937_64 rng = thread_rng(state);
+    Zipf owners = d.owners();
+    std::vector<osv1::CreateOrderRequest> pool(kPoolSize);
+    for (auto& request : pool) {
+        request.set_user_id(user_name(owners(rng)));
+        *request.mutable_order() = make_order(d.items);
+    }
+
+    run(state, *d.service, &OrderService::CreateOrder, pool);
+
+    // Every thread is past the timing loop by now
+    std::lock_guard<std::mutex> lock(dataset_mutex);
+    d.grown = true;
+}
+
+// UpdateOrder's request and response types are swapped in the proto
+void BM_UpdateOrder(benchmark::State& state) {
+    Dataset& d = dataset(state.range(0), 1, static_cast<int>(state.range(1)));
+
+    std::mt19937_64 rng = thread_rng(state);
+    Zipf targets = d.targets();
+    std::vector<osv1::UpdateOrderResponse> pool(kPoolSize);
+    for (std::size_t i = 0; i < pool.size(); i++) {
+        osv1::GetOrderRequest get;
+        osv1::GetOrderResponse current;
+        get.set_order_id(d.ids[targets(rng)].ToString());
+        d.service->GetOrder(nullptr, &get, &current);
+
+        *pool[i].mutable_order() = current.order();
+        pool[i].mutable_order()->set_status(i % 2 ? osv1::OrderStatus::PROCESSING : osv1::OrderStatus::SHIPPED);
+    }
+
+    run(state, *d.service, &OrderService::UpdateOrder, pool);
+}
+
+// Deletes orders the thread created, refilled with the timing paused, so the
+// store stays at its size
+void BM_DeleteOrder(benchmark::State& state) {
+    Dataset& d = dataset(state.range(0), 1, 0);
+    OrderService& service = *d.service;
+
+    osv1::CreateOrderRequest create;
+    create.set_user_id(user_name(static_cast<uint64_t>(state.thread_index())));
+    *create.mutable_order() = make_order(1);
+
+    grpc::ServerContext context;
+    std::vector<osv1::DeleteOrderRequest> pending;
+    osv1::DeleteOrderResponse response;
+
+    alloc_count = 0;
+    alloc_bytes = 0;
+
+    for (auto _ : state) {
+        if (pending.empty()) {
+            state.PauseTiming();
+            for (int i = 0; i < kDeleteRefill; i++) {
+                osv1::CreateOrderResponse created;
+                service.CreateOrder(nullptr, &create, &created);
+                pending.emplace_back().set_order_id(created.order().id());
+            }
+            state.ResumeTiming();
+        }
+
+        counting = true;
+        Status status = service.DeleteOrder(&context, &pending.back(), &response);
+        counting = false;
+
+        if (!status.ok()) {
+            state.SkipWithError(status.error_message().c_str());
+            return;
+        }
+        pending.pop_back();
+    }
+
+    // Left over orders go, so the next case finds the store as loaded
+    for (const auto& request : pending) {
+        service.DeleteOrder(nullptr, &request, &response);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["allocs/op"] = benchmark::Counter(static_cast<double>(alloc_count), benchmark::Counter::kAvgIterations);
+    state.counters["bytes/op"] = benchmark::Counter(static_cast<double>(alloc_bytes), benchmark::Counter::kAvgIterations);
+}
+
+}  // namespace
+
+BENCHMARK(BM_GetOrder)
+    ->ArgNames({"orders", "items", "skew"})
+    ->ArgsProduct({{1000, 100000, 1000000, 10000000}, {1, 8}, {0, 99}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_ListOrders)
+    ->ArgNames({"orders", "skew"})
+    ->ArgsProduct({{1000, 1000000}, {0, 99}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_CreateOrder)
+    ->ArgNames({"orders", "items"})
+    ->ArgsProduct({{1000, 1000000}, {1, 8}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_UpdateOrder)
+    ->ArgNames({"orders", "skew"})
+    ->ArgsProduct({{1000, 1000000}, {0, 99}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_DeleteOrder)->ArgNames({"orders"})->Arg(1000)->Arg(1000000)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
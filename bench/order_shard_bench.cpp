@@ -0,0 +1,119 @@
+// GetOrder throughput as SO_REUSEPORT server shards are added.
+//
+// For 1, 2, 4, ... up to max_shards shards, starts an async mode Server on
+// 127.0.0.1:port with one completion queue and one poller per shard, pinned
+// to cores 0 to shards - 1, and drives it with the load generator at 100%
+// GetOrder: one client thread, 8 connections and 64 RPCs in flight per shard,
+// so the load grows with the server. Reports RPCs per second, the speedup
+// over one shard and the latency percentiles.
+//
+// Client and server share the machine, give it twice max_shards cores at
+// least (max_shards defaults to half of them) or the client becomes the
+// bottleneck.
+//
+// Usage: order-shard-bench [max_shards] [seconds] [port]
+
+#include <grpcpp/grpcpp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client/load_generator.hpp"
+#include "server/server.hpp"
+#include "service/async_order_service.hpp"
+#include "service/order_service.hpp"
+
+namespace {
+
+LoadReport run(const std::string& address, int shards, int seconds) {
+    std::shared_ptr<OrderService> service = std::make_shared<OrderService>(OrderServiceOptions{});
+    Server server(address, service, "order-shard-bench");
+
+    ServerOptions options;
+    options.shards = shards;
+    server.SetOptions(options);
+    server.SetAsyncEngine([service](int shard) {
+        AsyncOptions async_options;
+        async_options.first_core = shard;
+        return std::make_unique<AsyncOrderService>(service, async_options);
+    });
+
+    std::thread server_thread([&server] {
+        try {
+            server.Run();
+        } catch (const std::exception& e) {
+            std::fprintf(stderr, "%s\n", e.what());
+        }
+    });
+
+    // Run gives up at once if the port is taken, the seeding then fails
+    std::shared_ptr<grpc::Channel> channel = grpc::CreateChannel(address, grpc::InsecureChannelCredentials());
+    channel->WaitForConnected(std::chrono::system_clock::now() + std::chrono::seconds(5));
+
+    LoadOptions load;
+    load.address = address;
+    load.concurrency = 64 * shards;
+    load.channels = 8 * shards;
+    load.threads = shards;
+    load.duration = std::chrono::seconds(seconds);
+    load.warmup = std::chrono::seconds(1);
+    load.mix = {100, 0, 0, 0, 0, 0};
+
+    LoadReport report;
+    try {
+        report = LoadGenerator(load).Run();
+    } catch (...) {
+        server.Stop();
+        server_thread.join();
+        throw;
+    }
+
+    server.Stop();
+    server_thread.join();
+    return report;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    int max_shards = argc > 1 ? std::atoi(argv[1]) : std::max(1, cores / 2);
+    int seconds = argc > 2 ? std::atoi(argv[2]) : 5;
+    std::string port = argc > 3 ? argv[3] : "50151";
+    if (max_shards <= 0 || seconds <= 0) {
+        std::fprintf(stderr, "usage: %s [max_shards] [seconds] [port]\n", argv[0]);
+        return 1;
+    }
+    std::string address = "127.0.0.1:" + port;
+
+    std::vector<std::string> rows;
+    double base = 0.0;
+    for (int shards = 1; shards <= max_shards; shards *= 2) {
+        LoadReport report = run(address, shards, seconds);
+
+        const OpReport& get = report.ops[static_cast<int>(LoadOp::kGet)];
+        double rate = static_cast<double>(get.ok) / std::chrono::duration<double>(report.elapsed).count();
+        if (shards == 1) {
+            base = rate;
+        }
+
+        char row[160];
+        std::snprintf(row, sizeof(row), "%6d %12.0f %8.2fx %10.1f %10.1f %8lu\n", shards, rate,
+                      base > 0.0 ? rate / base : 0.0, static_cast<double>(get.latency.ValueAt(50)) / 1e3,
+                      static_cast<double>(get.latency.ValueAt(99)) / 1e3, static_cast<unsigned long>(get.errors));
+        rows.push_back(row);
+    }
+
+    std::printf("\nCores: %d, %d s per run\n", cores, seconds);
+    std::printf("%6s %12s %9s %10s %10s %8s\n", "shards", "rpc/s", "speedup", "p50 us", "p99 us", "errors");
+    for (const std::string& row : rows) {
+        std::printf("%s", row.c_str());
+    }
+    return 0;
+}
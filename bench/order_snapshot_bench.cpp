@@ -0,0 +1,78 @@
+// Cold start benchmark for OrderSnapshot.
+//
+// For 10k to 1M orders, compares the time from process start to the first
+// GetOrder answer when the snapshot is mapped and served lazily
+// (BM_OpenAndGet) against loading every order into the store up front
+// (BM_OpenAndLoad), which is what a full deserialization on startup costs.
+//
+// The snapshot files are written to $TMPDIR (default /tmp) and reused across
+// runs of the same size.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "store/order_snapshot.hpp"
+#include "store_bench_common.hpp"
+
+namespace {
+
+// Path of a snapshot holding `count` orders, written on first use
+const std::string& snapshot_path(int count) {
+    static std::map<int, std::string> paths;
+
+    auto it = paths.find(count);
+    if (it != paths.end()) {
+        return it->second;
+    }
+
+    const char* tmp = std::getenv("TMPDIR");
+    std::string path = std::string(tmp ? tmp : "/tmp") + "/order-snapshot-bench-" + std::to_string(count) + ".snap";
+
+    OrderStore store;
+    fill_store(store, count);
+    OrderSnapshot::Write(path, store);
+
+    return paths.emplace(count, path).first->second;
+}
+
+void BM_OpenAndGet(benchmark::State& state) {
+    int count = static_cast<int>(state.range(0));
+    const std::string& path = snapshot_path(count);
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> pick(0, count - 1);
+
+    for (auto _ : state) {
+        OrderStore store;
+        store.AttachSnapshot(OrderSnapshot::Open(path));
+        OrderStore::OrderPtr order = store.Get(bench_order_id(pick(rng)));
+        benchmark::DoNotOptimize(order);
+    }
+}
+
+void BM_OpenAndLoad(benchmark::State& state) {
+    const std::string& path = snapshot_path(static_cast<int>(state.range(0)));
+
+    for (auto _ : state) {
+        auto store = std::make_unique<OrderStore>();
+        store->AttachSnapshot(OrderSnapshot::Open(path));
+        benchmark::DoNotOptimize(store->LoadSnapshot());
+
+        // Tearing the store down is not part of the startup cost
+        state.PauseTiming();
+        store.reset();
+        state.ResumeTiming();
+    }
+}
+
+}  // namespace
+
+BENCHMARK(BM_OpenAndGet)->ArgName("orders")->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_OpenAndLoad)->ArgName("orders")->RangeMultiplier(10)->Range(10000, 1000000)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
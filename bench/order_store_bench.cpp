@@ -0,0 +1,91 @@
+// Contention benchmark for OrderStore.
+//
+// Every benchmark is run with 1 shard (equivalent to the old service-wide
+// lock) and with the default shard count, from 1 to 64 threads, so the
+// scaling curve of the sharded store can be compared against the baseline.
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <string>
+
+#include "store_bench_common.hpp"
+
+namespace {
+
+constexpr int kOrderCount = 100000;
+
+// The dataset is shared by all threads of a run, one per shard count
+BenchDataset& fixture(std::size_t shard_count) { return bench_dataset(kOrderCount, shard_count); }
+
+void BM_Get(benchmark::State& state) {
+    static BenchDataset* f = nullptr;
+    if (state.thread_index() == 0) {
+        f = &fixture(state.range(0));
+    }
+
+    std::mt19937 rng(state.thread_index());
+    std::uniform_int_distribution<int> pick(0, kOrderCount - 1);
+    osv1::Order out;
+
+    for (auto _ : state) {
+        OrderStore::OrderPtr order = f->store->Get(f->order_ids[pick(rng)]);
+        order->ToProto(&out);
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ListByUser(benchmark::State& state) {
+    static BenchDataset* f = nullptr;
+    if (state.thread_index() == 0) {
+        f = &fixture(state.range(0));
+    }
+
+    std::mt19937 rng(state.thread_index());
+    std::uniform_int_distribution<int> pick(0, kBenchUserCount - 1);
+
+    for (auto _ : state) {
+        auto orders = f->store->ListByUser(f->user_ids[pick(rng)]);
+        benchmark::DoNotOptimize(orders);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// 90% GetOrder, 10% UpdateOrder over random keys
+void BM_Mixed(benchmark::State& state) {
+    static BenchDataset* f = nullptr;
+    if (state.thread_index() == 0) {
+        f = &fixture(state.range(0));
+    }
+
+    std::mt19937 rng(state.thread_index());
+    std::uniform_int_distribution<int> pick(0, kOrderCount - 1);
+    std::uniform_int_distribution<int> op(0, 9);
+
+    for (auto _ : state) {
+        int i = pick(rng);
+        if (op(rng) == 0) {
+            f->store->Update(make_store_order(i));
+        } else {
+            benchmark::DoNotOptimize(f->store->Get(f->order_ids[i]));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void shard_args(benchmark::internal::Benchmark* b) {
+    b->ArgName("shards");
+    b->Arg(1);
+    b->Arg(OrderStore::kDefaultShardCount);
+    b->ThreadRange(1, 64);
+    b->UseRealTime();
+}
+
+}  // namespace
+
+BENCHMARK(BM_Get)->Apply(shard_args);
+BENCHMARK(BM_ListByUser)->Apply(shard_args);
+BENCHMARK(BM_Mixed)->Apply(shard_args);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,140 @@
+// Memory footprint report for the order store.
+//
+// Loads N orders (default 1M) into three layouts:
+//   - the original one, where every order was held as a full osv1::Order both
+//     in the id map and in the per-user vector
+//   - the protobuf record store: one shared osv1::Order per order in a
+//     string-keyed map, users indexed by (created_at, order id string)
+//   - OrderStore: flat OrderRecords in open-addressing tables, binary ids and
+//     interned strings
+// Heap usage is read from glibc's mallinfo2 before and after each load.
+//
+// Usage: order-store-memory [order_count]
+
+#include <malloc.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "store_bench_common.hpp"
+
+namespace {
+
+std::size_t heap_in_use() {
+    malloc_trim(0);
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+void report(const char* layout, std::size_t bytes, int count) {
+    std::printf("%-28s %12.1f MiB %10.1f bytes/order\n", layout, bytes / (1024.0 * 1024.0),
+                static_cast<double>(bytes) / count);
+}
+
+// The layout OrderService used before OrderStore: a full copy in each map
+std::size_t measure_legacy(int count) {
+    std::size_t before = heap_in_use();
+    std::size_t used = 0;
+    {
+        auto orders = std::make_unique<std::unordered_map<std::string, osv1::Order>>();
+        auto user_orders = std::make_unique<std::unordered_map<std::string, std::vector<osv1::Order>>>();
+
+        for (int i = 0; i < count; i++) {
+            osv1::Order order = make_store_order(i);
+            (*orders)[order.id()] = order;
+            (*user_orders)[bench_user_id(i)].push_back(order);
+        }
+        used = heap_in_use() - before;
+    }
+    return used;
+}
+
+// The layout OrderStore used before OrderRecord, without the sharding
+std::size_t measure_proto_records(int count) {
+    struct Entry {
+        std::shared_ptr<const osv1::Order> order;
+        std::string user_id;
+    };
+    using IndexSet = std::set<std::pair<int64_t, std::string>>;
+    struct UserIndex {
+        IndexSet by_created;
+        std::map<int, IndexSet> by_status;
+    };
+
+    std::size_t before = heap_in_use();
+    std::size_t used = 0;
+    {
+        auto orders = std::make_unique<std::unordered_map<std::string, Entry>>();
+        auto users = std::make_unique<std::unordered_map<std::string, UserIndex>>();
+
+        for (int i = 0; i < count; i++) {
+            auto order = std::make_shared<const osv1::Order>(make_store_order(i));
+            UserIndex& index = (*users)[bench_user_id(i)];
+            index.by_created.emplace(order->created_at(), order->id());
+            index.by_status[order->status()].emplace(order->created_at(), order->id());
+            orders->emplace(order->id(), Entry{order, bench_user_id(i)});
+        }
+        used = heap_in_use() - before;
+    }
+    return used;
+}
+
+std::size_t measure_store(int count, std::size_t* after_delete) {
+    std::size_t before = heap_in_use();
+    std::size_t used = 0;
+    {
+        OrderStore store;
+        for (int i = 0; i < count; i++) {
+            store.Insert(bench_user_id(i), make_store_order(i));
+        }
+        used = heap_in_use() - before;
+
+        InternedString::Stats pool = InternedString::PoolStats();
+        std::printf("  records and tables: %.1f bytes/order, %zu interned strings\n",
+                    static_cast<double>(store.allocated_bytes()) / count, pool.strings);
+
+        // Delete every other order, the memory must come back
+        for (int i = 0; i < count; i += 2) {
+            store.Erase(bench_order_id(i));
+        }
+        *after_delete = heap_in_use() - before;
+    }
+    return used;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    if (count <= 0) {
+        std::fprintf(stderr, "usage: %s [order_count]\n", argv[0]);
+        return 1;
+    }
+
+    std::printf("Orders: %d, users: %d, products: %d\n", count, kBenchUserCount, kBenchProductCount);
+    std::printf("------------------------\n");
+
+    std::size_t legacy = measure_legacy(count);
+    report("duplicated (original)", legacy, count);
+
+    std::size_t proto_records = measure_proto_records(count);
+    report("protobuf records (before)", proto_records, count);
+
+    std::size_t after_delete = 0;
+    std::size_t store = measure_store(count, &after_delete);
+    report("OrderStore (after)", store, count);
+    report("OrderStore, half deleted", after_delete, count);
+
+    std::printf("------------------------\n");
+    std::printf("Reduction vs protobuf records: %.1fx\n", static_cast<double>(proto_records) / store);
+    std::printf("Reduction vs original: %.1fx\n", static_cast<double>(legacy) / store);
+    return 0;
+}
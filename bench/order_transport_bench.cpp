@@ -0,0 +1,186 @@
+// Cost of every unary RPC through the in-process channel against loopback
+// TCP, on one Server (sync mode) running in the benchmark.
+//
+// The argument picks the transport: 0 dials 127.0.0.1 over TCP, 1 uses
+// ChannelFactory's "inproc" target. Each thread has its own stub. Real time
+// per call on 1 thread is the latency, items_per_second on 1 to 8 threads the
+// throughput.
+//   BM_GetOrder / BM_ListOrders - over 1,000 seeded orders of 100 users
+//   BM_CreateOrder              - the store grows as it runs
+//   BM_UpdateOrder              - flips the status of the thread's order
+//   BM_DeleteOrder              - of orders created in batches, outside the timing
+
+#include <benchmark/benchmark.h>
+#include <grpcpp/grpcpp.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench_common.hpp"
+#include "client/channel_factory.hpp"
+
+namespace {
+
+constexpr const char* kAddress = "127.0.0.1:50152";
+constexpr int kSeedOrders = 1000;
+constexpr int kUserCount = 100;
+constexpr int kDeleteRefill = 256;
+
+std::string user_name(int i) { return "bench-user-" + std::to_string(i % kUserCount); }
+
+struct Fixture {
+    std::unique_ptr<BenchServer> bench;
+    std::vector<std::string> ids;
+};
+
+// Started on first use and left running until the process exits
+Fixture& fixture() {
+    static Fixture* f = [] {
+        Fixture* f = new Fixture();
+        f->bench = start_server(kAddress, OrderServiceOptions(), "order-transport-bench");
+
+        Server* server = f->bench->server.get();
+        ChannelFactory::RegisterInProcess(
+            [server](const grpc::ChannelArguments& args) { return server->InProcessChannel(args); });
+
+        osv1::BatchCreateOrdersRequest request;
+        for (int i = 0; i < kSeedOrders; i++) {
+            osv1::CreateOrderRequest* create = request.add_orders();
+            create->set_user_id(user_name(i));
+            *create->mutable_order() = make_order();
+        }
+        osv1::BatchCreateOrdersResponse response;
+        f->bench->service->BatchCreateOrders(nullptr, &request, &response);
+        f->ids.assign(response.order_ids().begin(), response.order_ids().end());
+        return f;
+    }();
+    return *f;
+}
+
+std::unique_ptr<osv1::OrderService::Stub> stub(const benchmark::State& state) {
+    return ChannelFactory::NewStub(state.range(0) != 0 ? ChannelFactory::kInProcessTarget : kAddress);
+}
+
+// Calls `rpc` with `request` once per iteration, on the thread's own stub
+template <typename Request, typename Response>
+void run(benchmark::State& state,
+         grpc::Status (osv1::OrderService::Stub::*rpc)(grpc::ClientContext*, const Request&, Response*),
+         const Request& request) {
+    std::unique_ptr<osv1::OrderService::Stub> s = stub(state);
+
+    for (auto _ : state) {
+        grpc::ClientContext ctx;
+        Response response;
+        grpc::Status status = ((*s).*rpc)(&ctx, request, &response);
+        if (!status.ok()) {
+            state.SkipWithError(status.error_message().c_str());
+            return;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_GetOrder(benchmark::State& state) {
+    Fixture& f = fixture();
+    osv1::GetOrderRequest request;
+    request.set_order_id(f.ids[static_cast<std::size_t>(state.thread_index()) * 97 % f.ids.size()]);
+    run(state, &osv1::OrderService::Stub::GetOrder, request);
+}
+
+void BM_ListOrders(benchmark::State& state) {
+    fixture();
+    osv1::ListOrdersRequest request;
+    request.set_user_id(user_name(state.thread_index()));
+    request.set_limit(10);
+    run(state, &osv1::OrderService::Stub::ListOrders, request);
+}
+
+void BM_CreateOrder(benchmark::State& state) {
+    fixture();
+    osv1::CreateOrderRequest request;
+    request.set_user_id(user_name(state.thread_index()));
+    *request.mutable_order() = make_order();
+    run(state, &osv1::OrderService::Stub::CreateOrder, request);
+}
+
+// UpdateOrder's request and response types are swapped in the proto
+void BM_UpdateOrder(benchmark::State& state) {
+    Fixture& f = fixture();
+    std::unique_ptr<osv1::OrderService::Stub> s = stub(state);
+
+    osv1::CreateOrderRequest create;
+    create.set_user_id(user_name(state.thread_index()));
+    *create.mutable_order() = make_order();
+    osv1::CreateOrderResponse created;
+    f.bench->service->CreateOrder(nullptr, &create, &created);
+
+    osv1::UpdateOrderResponse requests[2];
+    for (int i = 0; i < 2; i++) {
+        *requests[i].mutable_order() = created.order();
+        requests[i].mutable_order()->set_status(i ? osv1::OrderStatus::PROCESSING : osv1::OrderStatus::SHIPPED);
+    }
+
+    int next = 0;
+    for (auto _ : state) {
+        grpc::ClientContext ctx;
+        osv1::UpdateOrderRequest response;
+        grpc::Status status = s->UpdateOrder(&ctx, requests[next], &response);
+        if (!status.ok()) {
+            state.SkipWithError(status.error_message().c_str());
+            return;
+        }
+        next ^= 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_DeleteOrder(benchmark::State& state) {
+    Fixture& f = fixture();
+    std::unique_ptr<osv1::OrderService::Stub> s = stub(state);
+
+    osv1::BatchCreateOrdersRequest refill;
+    for (int i = 0; i < kDeleteRefill; i++) {
+        osv1::CreateOrderRequest* create = refill.add_orders();
+        create->set_user_id(user_name(state.thread_index()));
+        *create->mutable_order() = make_order();
+    }
+
+    std::vector<osv1::DeleteOrderRequest> pending;
+    for (auto _ : state) {
+        if (pending.empty()) {
+            state.PauseTiming();
+            osv1::BatchCreateOrdersResponse created;
+            f.bench->service->BatchCreateOrders(nullptr, &refill, &created);
+            for (const std::string& id : created.order_ids()) {
+                pending.emplace_back().set_order_id(id);
+            }
+            state.ResumeTiming();
+        }
+
+        grpc::ClientContext ctx;
+        osv1::DeleteOrderResponse response;
+        grpc::Status status = s->DeleteOrder(&ctx, pending.back(), &response);
+        if (!status.ok()) {
+            state.SkipWithError(status.error_message().c_str());
+            return;
+        }
+        pending.pop_back();
+    }
+
+    for (const auto& request : pending) {
+        osv1::DeleteOrderResponse response;
+        f.bench->service->DeleteOrder(nullptr, &request, &response);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_GetOrder)->ArgName("inproc")->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_ListOrders)->ArgName("inproc")->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_CreateOrder)->ArgName("inproc")->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_UpdateOrder)->ArgName("inproc")->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_DeleteOrder)->ArgName("inproc")->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
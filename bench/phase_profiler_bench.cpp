@@ -0,0 +1,81 @@
+// Cost the phase timers add to a call.
+//
+// Every iteration is what a GetOrder does in the store: enters a handler,
+// takes a shard's read lock and times a copy under it. Run with the profiler
+// disabled (the default in production), aggregating and capturing, from 1 to
+// 8 threads sharing one lock.
+//   BM_TimedCall/mode:0 - disabled, one relaxed load and branch per timer
+//   BM_TimedCall/mode:1 - aggregating into the thread's cells
+//   BM_TimedCall/mode:2 - capturing events as well; past kMaxTraceEvents per
+//                         thread they are counted as dropped, so long runs
+//                         measure the dropped path
+// BM_Untimed is the same work with a plain std::shared_lock, the baseline.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+
+#include "metrics/phase_profiler.hpp"
+
+namespace {
+
+std::shared_mutex shard_mutex;
+uint64_t shared_value = 42;
+
+void BM_Untimed(benchmark::State& state) {
+    uint64_t copied = 0;
+    for (auto _ : state) {
+        std::shared_lock<std::shared_mutex> lock(shard_mutex);
+        copied += shared_value;
+        benchmark::DoNotOptimize(copied);
+    }
+}
+
+void start_mode(const benchmark::State& state) {
+    if (state.range(0) == 1) {
+        PhaseProfiler::Enable();
+    } else if (state.range(0) == 2) {
+        PhaseProfiler::StartCapture();
+    }
+}
+
+void stop_mode(const benchmark::State& state) {
+    if (state.range(0) == 1) {
+        PhaseProfiler::Disable();
+    } else if (state.range(0) == 2) {
+        // Written for the cost of it, without logging between results
+        std::string path = "/tmp/phase-profiler-bench.json";
+        std::streambuf* out = std::cout.rdbuf(nullptr);
+        PhaseProfiler::StopCapture(path);
+        std::cout.rdbuf(out);
+        std::remove(path.c_str());
+    }
+}
+
+void BM_TimedCall(benchmark::State& state) {
+    uint64_t copied = 0;
+    for (auto _ : state) {
+        ScopedHandler handler("GetOrder");
+        ProfiledLock<std::shared_lock<std::shared_mutex>> lock(shard_mutex);
+        ScopedPhase timer(PhaseProfiler::kCopy);
+        copied += shared_value;
+        benchmark::DoNotOptimize(copied);
+    }
+}
+
+}  // namespace
+
+BENCHMARK(BM_Untimed)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_TimedCall)
+    ->ArgName("mode")
+    ->DenseRange(0, 2)
+    ->ThreadRange(1, 8)
+    ->Setup(start_mode)
+    ->Teardown(stop_mode)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "store/order_id.hpp"
+#include "store/order_store.hpp"
+
+// Shared by the benchmarks that drive OrderStore directly. Order i always has
+// the same id, user and contents, so every bench measures the same orders.
+
+constexpr int kBenchUserCount = 1000;
+constexpr int kBenchProductCount = 500;
+constexpr int64_t kBenchStart = 1700000000;
+constexpr int64_t kBenchDay = 86400;
+constexpr int64_t kBenchDays = 90;
+
+// Ids shaped like the ones OrderService generates, but reproducible
+inline std::string bench_order_id(int64_t i) {
+    return OrderId{(uint64_t{1700000000000} + static_cast<uint64_t>(i) / 64) << 16 | 0x7000,
+                   uint64_t{2} << 62 | static_cast<uint64_t>(i) * 0x9e3779b97f4a7c1ULL >> 2}
+        .ToString();
+}
+
+inline std::string bench_product_id(int p) {
+    return OrderId{0x5d1c3e7a00004000ULL | static_cast<uint64_t>(p) << 16, uint64_t{2} << 62 | static_cast<uint64_t>(p)}
+        .ToString();
+}
+
+inline std::string bench_user_id(int64_t i) { return "user" + std::to_string(i % kBenchUserCount); }
+
+// Order i: two line items out of kBenchProductCount products. With `varied`,
+// amounts, statuses and item counts change from order to order and creation
+// dates spread over kBenchDays, for the benches that group or filter on them.
+inline osv1::Order make_store_order(int64_t i, bool varied = false) {
+    static const char* const kProductNames[] = {"Laptop", "Smartphone", "Headphones", "Monitor", "Keyboard"};
+
+    osv1::Order order;
+    order.set_id(bench_order_id(i));
+    order.set_amount(varied ? 10.0 + static_cast<double>(i % 1000) / 4 : 134.5);
+    order.set_status(varied ? static_cast<osv1::OrderStatus>(i % osv1::OrderStatus_ARRAYSIZE)
+                            : osv1::OrderStatus::PENDING);
+    order.set_address(std::to_string(i % kBenchUserCount) + " Wallnut street, Springfield");
+    order.set_created_at(varied ? kBenchStart + (i * 7919) % (kBenchDays * kBenchDay) : kBenchStart + i);
+    order.set_updated_at(order.created_at());
+
+    int items = varied ? 1 + static_cast<int>(i % 3) : 2;
+    for (int j = 0; j < items; j++) {
+        int product = static_cast<int>((i * 7 + j) % kBenchProductCount);
+        osv1::Item* item = order.add_items();
+        item->set_id(bench_product_id(product));
+        item->set_name(kProductNames[product % 5]);
+        item->set_price(34.0);
+        item->set_quantity(2);
+    }
+    return order;
+}
+
+// Inserts orders 0 to count - 1
+inline void fill_store(OrderStore& store, int64_t count, bool varied = false) {
+    for (int64_t i = 0; i < count; i++) {
+        store.Insert(bench_user_id(i), make_store_order(i, varied));
+    }
+}
+
+struct BenchDataset {
+    std::unique_ptr<OrderStore> store;
+    std::vector<std::string> order_ids;  // order_ids[i] is the id of order i
+    std::vector<std::string> user_ids;
+};
+
+// A store of `count` orders, built on first use and kept for the rest of the
+// run. Not thread safe, benches share it by building it from thread 0.
+inline BenchDataset& bench_dataset(int64_t count, std::size_t shard_count = OrderStore::kDefaultShardCount,
+                                   bool varied = false) {
+    static std::map<std::tuple<int64_t, std::size_t, bool>, std::unique_ptr<BenchDataset>> datasets;
+    std::unique_ptr<BenchDataset>& d = datasets[{count, shard_count, varied}];
+    if (d) {
+        return *d;
+    }
+
+    d = std::make_unique<BenchDataset>();
+    d->store = std::make_unique<OrderStore>(shard_count);
+    fill_store(*d->store, count, varied);
+    for (int64_t i = 0; i < count; i++) {
+        d->order_ids.push_back(bench_order_id(i));
+    }
+    for (int u = 0; u < kBenchUserCount; u++) {
+        d->user_ids.push_back(bench_user_id(u));
+    }
+    return *d;
+}
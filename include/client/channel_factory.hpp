@@ -0,0 +1,34 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "order_service/order.grpc.pb.h"
+
+namespace osv1 = order_service::v1;
+
+// Channels to OrderService by target. "inproc" is the server registered with
+// RegisterInProcess, running in this process: calls skip TCP, HTTP/2 framing
+// and the syscalls, and callers keep the same Stub API. Any other target is
+// an address dialed over TCP.
+class ChannelFactory {
+   public:
+    static constexpr const char* kInProcessTarget = "inproc";
+
+    using InProcessChannel = std::function<std::shared_ptr<grpc::Channel>(const grpc::ChannelArguments&)>;
+
+    // Serve "inproc" from `channel`, typically bound to Server::InProcessChannel.
+    // Process wide; an empty function unregisters it.
+    static void RegisterInProcess(InProcessChannel channel);
+
+    static bool IsInProcess(const std::string& target) { return target == kInProcessTarget; }
+
+    // Throws std::invalid_argument for "inproc" when no server is registered
+    static std::shared_ptr<grpc::Channel> Create(const std::string& target,
+                                                 const grpc::ChannelArguments& args = grpc::ChannelArguments());
+
+    static std::unique_ptr<osv1::OrderService::Stub> NewStub(const std::string& target);
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-size log-linear histogram of latencies in nanoseconds, in the style of
+// HdrHistogram.
+//
+// Values below 128 get one bucket each. Above that, every power of two range
+// is split into 64 equal buckets, so a recorded value is off by less than
+// 1/64 (about 1.6%) of itself at any magnitude. Recording is an index
+// computation and an increment. Each thread keeps its own histogram and the
+// results are merged at the end.
+class LatencyHistogram {
+   public:
+    void Record(uint64_t value);
+    void Merge(const LatencyHistogram& other);
+
+    // Highest value equivalent to the one at `percentile` (0 to 100)
+    uint64_t ValueAt(double percentile) const;
+
+    uint64_t count() const { return this->count_; }
+    uint64_t min() const { return this->count_ ? this->min_ : 0; }
+    uint64_t max() const { return this->max_; }
+    double mean() const { return this->count_ ? static_cast<double>(this->sum_) / this->count_ : 0.0; }
+
+   private:
+    static constexpr int kSubBucketBits = 7;
+    static constexpr uint64_t kSubBucketCount = 1 << kSubBucketBits;
+    static constexpr uint64_t kHalfSubBucketCount = kSubBucketCount / 2;
+    static constexpr std::size_t kBucketCount = (64 - kSubBucketBits + 1) * kHalfSubBucketCount + kHalfSubBucketCount;
+
+    std::array<uint64_t, kBucketCount> counts_{};
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+
+    static std::size_t index_of(uint64_t value);
+    static uint64_t highest_equivalent(std::size_t index);
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "client/latency_histogram.hpp"
+#include "order_service/order.grpc.pb.h"
+#include "order_service/order.pb.h"
+
+namespace osv1 = order_service::v1;
+
+enum class LoadOp { kGet, kList, kCreate, kUpdate, kDelete, kStream };
+
+struct LoadOptions {
+    std::string address = "0.0.0.0:8080";  // Or ChannelFactory::kInProcessTarget
+
+    // Closed loop keeps `concurrency` RPCs in flight, open loop starts `rps`
+    // RPCs per second whatever the server's latency
+    bool open_loop = false;
+    int concurrency = 64;
+    int rps = 1000;
+
+    int channels = 4;  // Each one is its own connection
+    int threads = 4;   // Each one drives its own completion queue
+
+    std::chrono::seconds duration{10};
+    std::chrono::seconds warmup{2};        // Run but not measured
+    std::chrono::seconds rpc_timeout{10};  // Deadline of every RPC
+
+    // Relative weights, indexed by LoadOp
+    std::array<int, 6> mix{60, 15, 10, 10, 5, 0};
+
+    int seed_orders = 1000;  // Created before the run for Get, Update and Stream to target
+    int seed_users = 100;
+
+    // Parses "get=60,list=15,create=10,update=10,delete=5,stream=0". Ops
+    // left out get weight 0; throws std::invalid_argument on a bad entry or
+    // a weight that is not a whole, non-negative integer.
+    static std::array<int, 6> ParseMix(const std::string& mix);
+};
+
+struct OpReport {
+    uint64_t ok = 0;
+    uint64_t errors = 0;
+    LatencyHistogram latency;  // Nanoseconds, successful RPCs only
+};
+
+struct LoadReport {
+    std::chrono::nanoseconds elapsed{0};  // Measured window
+    std::array<OpReport, 6> ops;
+    LatencyHistogram total;
+
+    void Print(std::ostream& out) const;
+};
+
+// Load generator for OrderService over async stubs.
+//
+// Every thread owns a completion queue and starts RPCs on stubs spread over
+// `channels` connections. In closed loop a thread starts its next RPC when
+// one completes. In open loop it starts RPCs on a fixed schedule. The
+// latency is taken from the scheduled start rather than the actual one, so a
+// server that falls behind shows up in the percentiles (no coordinated
+// omission).
+//
+// Get, Update and Stream target orders created up front. Delete removes
+// orders this run created and turns into a Create when there are none left.
+// Stream measures the time to the first update of the order (the CREATED
+// snapshot), then cancels.
+class LoadGenerator {
+   public:
+    explicit LoadGenerator(LoadOptions options);
+    ~LoadGenerator();
+
+    // Seeds the orders, runs warmup plus duration and waits for the RPCs
+    // still in flight. Throws std::runtime_error if seeding fails.
+    LoadReport Run();
+
+    static const char* OpName(LoadOp op);
+
+   private:
+    class Worker;
+
+    LoadOptions options_;
+    std::vector<std::shared_ptr<grpc::Channel>> channels_;
+    std::vector<std::unique_ptr<osv1::OrderService::Stub>> stubs_;
+
+    std::vector<osv1::Order> orders_;  // Seeded, with their ids
+    std::vector<std::string> users_;
+
+    void seed();
+    static osv1::Order make_order();
+};
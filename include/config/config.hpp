@@ -1,30 +1,416 @@
 #pragma once
 
+#include <algorithm>
+#include <charconv>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 
 inline std::string getEnv(const std::string& key, const std::string& default_value) {
     const char* value = std::getenv(key.c_str());
     return value ? std::string(value) : default_value;
 }
 
+// Throws std::invalid_argument unless the whole value is an int
+inline int getEnvInt(const std::string& key, int default_value) {
+    const char* value = std::getenv(key.c_str());
+    if (!value) {
+        return default_value;
+    }
+
+    int parsed = 0;
+    const char* end = value + std::strlen(value);
+    auto [number_end, ec] = std::from_chars(value, end, parsed);
+    if (ec != std::errc() || number_end != end) {
+        throw std::invalid_argument(key + " must be an integer, got '" + value + "'");
+    }
+    return parsed;
+}
+
+inline bool getEnvBool(const std::string& key, bool default_value) {
+    const char* value = std::getenv(key.c_str());
+    if (!value) {
+        return default_value;
+    }
+
+    std::string v(value);
+    return v == "1" || v == "true" || v == "yes" || v == "on";
+}
+
+inline std::string trimSpace(const std::string& value) {
+    std::size_t begin = value.find_first_not_of(" \t\r");
+    std::size_t end = value.find_last_not_of(" \t\r");
+    return begin == std::string::npos ? "" : value.substr(begin, end - begin + 1);
+}
+
+// Reads KEY=VALUE lines ('#' starts a comment) into the environment, leaving
+// alone the variables that are already set
+inline void loadConfigFile(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Cannot read config file " + path);
+    }
+
+    std::string line;
+    for (int number = 1; std::getline(in, line); number++) {
+        line = trimSpace(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+
+        std::size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            throw std::invalid_argument(path + ":" + std::to_string(number) + ": expected KEY=VALUE, got '" + line +
+                                        "'");
+        }
+        setenv(trimSpace(line.substr(0, eq)).c_str(), trimSpace(line.substr(eq + 1)).c_str(), 0);
+    }
+}
+
+inline void requireNonNegative(const std::string& key, int value) {
+    if (value < 0) {
+        throw std::invalid_argument(key + " must not be negative, got " + std::to_string(value));
+    }
+}
+
+// For counts and intervals where 0 would leave a thread spinning
+inline void requirePositive(const std::string& key, int value) {
+    if (value < 1) {
+        throw std::invalid_argument(key + " must be at least 1, got " + std::to_string(value));
+    }
+}
+
+// Read from the environment, and from the file CONFIG_FILE names for the
+// variables the environment does not set
 struct Config {
+    std::string config_file;
+
     std::string host;
     std::string port;
 
+    // "sync" uses gRPC's synchronous thread pool, "async" the completion
+    // queue engine configured below
+    std::string server_mode;
+
+    // Servers sharing the port through SO_REUSEPORT, each with the queues
+    // and pollers below
+    int server_shards;
+    int async_cqs;
+    int async_pollers_per_cq;
+    bool async_pin_pollers;
+
+    // gRPC sync server queues and pollers, unused in async mode
+    int sync_cqs;
+    int sync_min_pollers;
+    int sync_max_pollers;
+    int sync_cq_timeout_ms;
+
+    // gRPC transport limits and keepalive, 0 means none where gRPC has none
+    int max_concurrent_streams;
+    int max_receive_message_bytes;
+    int max_send_message_bytes;
+    int keepalive_time_ms;
+    int keepalive_timeout_ms;
+    bool keepalive_permit_without_calls;
+    int keepalive_min_ping_interval_ms;
+    int max_connection_idle_ms;
+    int max_connection_age_ms;
+    int max_connection_age_grace_ms;
+
+    // gRPC resource quota, unlimited when 0
+    int resource_quota_mb;
+    int resource_quota_threads;
+
+    // Write-ahead log, disabled when wal_path is empty
+    std::string wal_path;
+    int wal_sync_interval_ms;
+    int wal_sync_bytes;
+    bool wal_wait_for_sync;
+    int wal_replay_threads;
+
+    // Snapshots, disabled when snapshot_path is empty
+    std::string snapshot_path;
+    int snapshot_interval_s;
+    int snapshot_load_threads;
+
+    // Serialized GetOrder responses, disabled when 0
+    int response_cache_mb;
+
+    // ListOrders responses of at least this size go out compressed,
+    // disabled when 0; the level is 'low', 'medium' or 'high'
+    int compression_threshold_bytes;
+    std::string compression_level;
+
+    // Phase timers, aggregated into the metrics from startup when enabled;
+    // SIGUSR1 toggles a trace capture, written to <prefix>-<time>.json
+    bool profile_enabled;
+    std::string profile_trace_prefix;
+
+    // Threads an AggregateOrders scan may use, 0 for one per core
+    int aggregate_threads;
+
+    // Longest the server waits for calls in flight on shutdown
+    int shutdown_deadline_ms;
+
+    // Admission control, disabled when admission_limit is 0
+    int admission_limit;
+    int admission_min_limit;
+    int admission_max_limit;
+    bool admission_adaptive;
+    int admission_max_queue_delay_ms;
+
+    // Retention, enabled by TTLs ("DELIVERED=30d,CANCELLED=7d") or a memory
+    // budget; evicted orders go to the archive when it has a path
+    std::string retention_ttls;
+    int retention_memory_mb;
+    int retention_step_ms;
+    int retention_interval_ms;
+    std::string archive_path;
+
+    // Prometheus text file, not written when metrics_path is empty
+    std::string metrics_path;
+    int metrics_interval_s;
+
+    // Access log of the RPCs, written to stdout when log_path is empty
+    std::string log_path;
+    std::string log_level;
+    int log_sample_every;
+    int log_buffer_records;
+    int log_flush_ms;
+
     static Config New() {
         Config config;
+        config.config_file = getEnv("CONFIG_FILE", "");
+        if (!config.config_file.empty()) {
+            loadConfigFile(config.config_file);
+        }
+
         config.host = getEnv("HOST", "0.0.0.0");
         config.port = getEnv("PORT", "8080");
 
+        int cores = static_cast<int>(std::thread::hardware_concurrency());
+        config.server_mode = getEnv("SERVER_MODE", "sync");
+        config.server_shards = getEnvInt("SERVER_SHARDS", 1);
+        config.async_cqs = getEnvInt("ASYNC_CQS", std::max(1, cores / std::max(1, config.server_shards)));
+        config.async_pollers_per_cq = getEnvInt("ASYNC_POLLERS_PER_CQ", 1);
+        config.async_pin_pollers = getEnvBool("ASYNC_PIN_POLLERS", true);
+
+        config.sync_cqs = getEnvInt("SYNC_CQS", 1);
+        config.sync_min_pollers = getEnvInt("SYNC_MIN_POLLERS", 1);
+        config.sync_max_pollers = getEnvInt("SYNC_MAX_POLLERS", 2);
+        config.sync_cq_timeout_ms = getEnvInt("SYNC_CQ_TIMEOUT_MS", 10000);
+
+        config.max_concurrent_streams = getEnvInt("MAX_CONCURRENT_STREAMS", 0);
+        config.max_receive_message_bytes = getEnvInt("MAX_RECEIVE_MESSAGE_BYTES", 4 << 20);
+        config.max_send_message_bytes = getEnvInt("MAX_SEND_MESSAGE_BYTES", 0);
+        config.keepalive_time_ms = getEnvInt("KEEPALIVE_TIME_MS", 2 * 60 * 60 * 1000);
+        config.keepalive_timeout_ms = getEnvInt("KEEPALIVE_TIMEOUT_MS", 20000);
+        config.keepalive_permit_without_calls = getEnvBool("KEEPALIVE_PERMIT_WITHOUT_CALLS", false);
+        config.keepalive_min_ping_interval_ms = getEnvInt("KEEPALIVE_MIN_PING_INTERVAL_MS", 5 * 60 * 1000);
+        config.max_connection_idle_ms = getEnvInt("MAX_CONNECTION_IDLE_MS", 0);
+        config.max_connection_age_ms = getEnvInt("MAX_CONNECTION_AGE_MS", 0);
+        config.max_connection_age_grace_ms = getEnvInt("MAX_CONNECTION_AGE_GRACE_MS", 0);
+
+        config.resource_quota_mb = getEnvInt("RESOURCE_QUOTA_MB", 0);
+        config.resource_quota_threads = getEnvInt("RESOURCE_QUOTA_THREADS", 0);
+
+        config.wal_path = getEnv("WAL_PATH", "");
+        config.wal_sync_interval_ms = getEnvInt("WAL_SYNC_INTERVAL_MS", 2);
+        config.wal_sync_bytes = getEnvInt("WAL_SYNC_BYTES", 1 << 20);
+        config.wal_wait_for_sync = getEnvBool("WAL_WAIT_FOR_SYNC", true);
+        config.wal_replay_threads = getEnvInt("WAL_REPLAY_THREADS", 0);
+
+        config.snapshot_path = getEnv("SNAPSHOT_PATH", "");
+        config.snapshot_interval_s = getEnvInt("SNAPSHOT_INTERVAL_S", 300);
+        config.snapshot_load_threads = getEnvInt("SNAPSHOT_LOAD_THREADS", 0);
+
+        config.response_cache_mb = getEnvInt("RESPONSE_CACHE_MB", 64);
+
+        config.compression_threshold_bytes = getEnvInt("COMPRESSION_THRESHOLD_BYTES", 64 << 10);
+        config.compression_level = getEnv("COMPRESSION_LEVEL", "low");
+
+        config.profile_enabled = getEnvBool("PROFILE_ENABLED", false);
+        config.profile_trace_prefix = getEnv("PROFILE_TRACE_PREFIX", "/tmp/order-service-trace");
+
+        config.aggregate_threads = getEnvInt("AGGREGATE_THREADS", 0);
+
+        config.shutdown_deadline_ms = getEnvInt("SHUTDOWN_DEADLINE_MS", 10000);
+
+        config.admission_limit = getEnvInt("ADMISSION_LIMIT", 256);
+        config.admission_min_limit = getEnvInt("ADMISSION_MIN_LIMIT", 8);
+        config.admission_max_limit = getEnvInt("ADMISSION_MAX_LIMIT", 4096);
+        config.admission_adaptive = getEnvBool("ADMISSION_ADAPTIVE", true);
+        config.admission_max_queue_delay_ms = getEnvInt("ADMISSION_MAX_QUEUE_DELAY_MS", 20);
+
+        config.retention_ttls = getEnv("RETENTION_TTLS", "");
+        config.retention_memory_mb = getEnvInt("RETENTION_MEMORY_MB", 0);
+        config.retention_step_ms = getEnvInt("RETENTION_STEP_MS", 1);
+        config.retention_interval_ms = getEnvInt("RETENTION_INTERVAL_MS", 10);
+        config.archive_path = getEnv("ARCHIVE_PATH", "");
+
+        config.metrics_path = getEnv("METRICS_PATH", "");
+        config.metrics_interval_s = getEnvInt("METRICS_INTERVAL_S", 10);
+
+        config.log_path = getEnv("LOG_PATH", "");
+        config.log_level = getEnv("LOG_LEVEL", "info");
+        config.log_sample_every = getEnvInt("LOG_SAMPLE_EVERY", 1);
+        config.log_buffer_records = getEnvInt("LOG_BUFFER_RECORDS", 4096);
+        config.log_flush_ms = getEnvInt("LOG_FLUSH_MS", 100);
+
+        if (config.server_mode != "sync" && config.server_mode != "async") {
+            throw std::invalid_argument("SERVER_MODE must be 'sync' or 'async', got '" + config.server_mode + "'");
+        }
+        requirePositive("SERVER_SHARDS", config.server_shards);
+        requirePositive("ASYNC_CQS", config.async_cqs);
+        requirePositive("ASYNC_POLLERS_PER_CQ", config.async_pollers_per_cq);
+        if (config.sync_cqs < 1 || config.sync_min_pollers < 1 || config.sync_max_pollers < config.sync_min_pollers) {
+            throw std::invalid_argument("SYNC_CQS and SYNC_MIN_POLLERS must be at least 1 and SYNC_MAX_POLLERS at "
+                                        "least SYNC_MIN_POLLERS");
+        }
+        requireNonNegative("SYNC_CQ_TIMEOUT_MS", config.sync_cq_timeout_ms);
+        requireNonNegative("MAX_CONCURRENT_STREAMS", config.max_concurrent_streams);
+        requireNonNegative("MAX_RECEIVE_MESSAGE_BYTES", config.max_receive_message_bytes);
+        requireNonNegative("MAX_SEND_MESSAGE_BYTES", config.max_send_message_bytes);
+        requireNonNegative("KEEPALIVE_TIME_MS", config.keepalive_time_ms);
+        requireNonNegative("KEEPALIVE_TIMEOUT_MS", config.keepalive_timeout_ms);
+        requireNonNegative("KEEPALIVE_MIN_PING_INTERVAL_MS", config.keepalive_min_ping_interval_ms);
+        requireNonNegative("MAX_CONNECTION_IDLE_MS", config.max_connection_idle_ms);
+        requireNonNegative("MAX_CONNECTION_AGE_MS", config.max_connection_age_ms);
+        requireNonNegative("MAX_CONNECTION_AGE_GRACE_MS", config.max_connection_age_grace_ms);
+        requireNonNegative("RESOURCE_QUOTA_MB", config.resource_quota_mb);
+        requireNonNegative("RESOURCE_QUOTA_THREADS", config.resource_quota_threads);
+        requirePositive("WAL_SYNC_INTERVAL_MS", config.wal_sync_interval_ms);
+        requireNonNegative("WAL_SYNC_BYTES", config.wal_sync_bytes);
+        requireNonNegative("WAL_REPLAY_THREADS", config.wal_replay_threads);
+        requirePositive("SNAPSHOT_INTERVAL_S", config.snapshot_interval_s);
+        requireNonNegative("SNAPSHOT_LOAD_THREADS", config.snapshot_load_threads);
+        requireNonNegative("RESPONSE_CACHE_MB", config.response_cache_mb);
+        requireNonNegative("COMPRESSION_THRESHOLD_BYTES", config.compression_threshold_bytes);
+        if (config.compression_level != "low" && config.compression_level != "medium" &&
+            config.compression_level != "high") {
+            throw std::invalid_argument("COMPRESSION_LEVEL must be 'low', 'medium' or 'high', got '" +
+                                        config.compression_level + "'");
+        }
+        if (config.profile_trace_prefix.empty()) {
+            throw std::invalid_argument("PROFILE_TRACE_PREFIX cannot be empty");
+        }
+        requireNonNegative("AGGREGATE_THREADS", config.aggregate_threads);
+        requireNonNegative("SHUTDOWN_DEADLINE_MS", config.shutdown_deadline_ms);
+        requireNonNegative("ADMISSION_LIMIT", config.admission_limit);
+        requireNonNegative("ADMISSION_MAX_QUEUE_DELAY_MS", config.admission_max_queue_delay_ms);
+        if (config.admission_limit > 0 && (config.admission_min_limit < 1 ||
+                                           config.admission_min_limit > config.admission_limit ||
+                                           config.admission_limit > config.admission_max_limit)) {
+            throw std::invalid_argument("ADMISSION_MIN_LIMIT must be at least 1, and at most ADMISSION_LIMIT, "
+                                        "itself at most ADMISSION_MAX_LIMIT");
+        }
+        requireNonNegative("RETENTION_MEMORY_MB", config.retention_memory_mb);
+        requirePositive("RETENTION_STEP_MS", config.retention_step_ms);
+        requirePositive("RETENTION_INTERVAL_MS", config.retention_interval_ms);
+        requirePositive("METRICS_INTERVAL_S", config.metrics_interval_s);
+        requirePositive("LOG_SAMPLE_EVERY", config.log_sample_every);
+        requireNonNegative("LOG_BUFFER_RECORDS", config.log_buffer_records);
+        requirePositive("LOG_FLUSH_MS", config.log_flush_ms);
+        if (config.log_level != "info" && config.log_level != "warn" && config.log_level != "error" &&
+            config.log_level != "off") {
+            throw std::invalid_argument("LOG_LEVEL must be 'info', 'warn', 'error' or 'off', got '" +
+                                        config.log_level + "'");
+        }
+
         return config;
     };
 
+    bool retention_enabled() const { return !this->retention_ttls.empty() || this->retention_memory_mb > 0; }
+
     void display() {
+        // 0 limits read as none, as the server applies them
+        auto limit = [](int value, const std::string& unit) {
+            return value > 0 ? std::to_string(value) + unit : std::string("none");
+        };
+
         std::cout << "Configuration:" << std::endl;
+        std::cout << "Config file: " << (this->config_file.empty() ? "none" : this->config_file) << std::endl;
         std::cout << "Host: " << this->host << std::endl;
         std::cout << "Port: " << this->port << std::endl;
+        std::cout << "Server mode: " << this->server_mode << std::endl;
+        std::cout << "Server shards: " << this->server_shards << std::endl;
+        if (this->server_mode == "async") {
+            std::cout << "Completion queues: " << this->async_cqs << std::endl;
+            std::cout << "Pollers per queue: " << this->async_pollers_per_cq << std::endl;
+            std::cout << "Pin pollers: " << (this->async_pin_pollers ? "yes" : "no") << std::endl;
+        } else {
+            std::cout << "Sync completion queues: " << this->sync_cqs << std::endl;
+            std::cout << "Sync pollers: " << this->sync_min_pollers << " to " << this->sync_max_pollers << std::endl;
+            std::cout << "Sync queue timeout: " << this->sync_cq_timeout_ms << "ms" << std::endl;
+        }
+        std::cout << "Max concurrent streams: " << limit(this->max_concurrent_streams, " per connection") << std::endl;
+        std::cout << "Max receive message: " << limit(this->max_receive_message_bytes, " bytes") << std::endl;
+        std::cout << "Max send message: " << limit(this->max_send_message_bytes, " bytes") << std::endl;
+        std::cout << "Keepalive: ping after " << this->keepalive_time_ms << "ms idle, timeout "
+                  << this->keepalive_timeout_ms << "ms, " << (this->keepalive_permit_without_calls ? "" : "not ")
+                  << "without calls, clients at most every " << this->keepalive_min_ping_interval_ms << "ms"
+                  << std::endl;
+        std::cout << "Max connection idle: " << limit(this->max_connection_idle_ms, "ms") << std::endl;
+        std::cout << "Max connection age: " << limit(this->max_connection_age_ms, "ms") << ", grace "
+                  << limit(this->max_connection_age_grace_ms, "ms") << std::endl;
+        std::cout << "Resource quota: " << limit(this->resource_quota_mb, "MB") << ", threads "
+                  << limit(this->resource_quota_threads, "") << std::endl;
+        std::cout << "WAL: " << (this->wal_path.empty() ? "disabled" : this->wal_path) << std::endl;
+        if (!this->wal_path.empty()) {
+            std::cout << "WAL sync interval: " << this->wal_sync_interval_ms << "ms" << std::endl;
+            std::cout << "WAL sync bytes: " << this->wal_sync_bytes << std::endl;
+            std::cout << "WAL wait for sync: " << (this->wal_wait_for_sync ? "yes" : "no") << std::endl;
+        }
+        std::cout << "Snapshot: " << (this->snapshot_path.empty() ? "disabled" : this->snapshot_path) << std::endl;
+        if (!this->snapshot_path.empty()) {
+            std::cout << "Snapshot interval: " << this->snapshot_interval_s << "s" << std::endl;
+        }
+        std::cout << "Response cache: "
+                  << (this->response_cache_mb > 0 ? std::to_string(this->response_cache_mb) + "MB" : "disabled")
+                  << std::endl;
+        if (this->compression_threshold_bytes > 0) {
+            std::cout << "Response compression: " << this->compression_level << " from "
+                      << this->compression_threshold_bytes << " bytes" << std::endl;
+        } else {
+            std::cout << "Response compression: disabled" << std::endl;
+        }
+        std::cout << "Phase profiler: " << (this->profile_enabled ? "enabled" : "disabled")
+                  << ", SIGUSR1 captures to " << this->profile_trace_prefix << "-<time>.json" << std::endl;
+        std::cout << "Aggregate threads: "
+                  << (this->aggregate_threads > 0 ? std::to_string(this->aggregate_threads) : "one per core")
+                  << std::endl;
+        std::cout << "Shutdown deadline: " << this->shutdown_deadline_ms << "ms" << std::endl;
+        if (this->admission_limit == 0) {
+            std::cout << "Admission control: disabled" << std::endl;
+        } else if (this->admission_adaptive) {
+            std::cout << "Admission control: " << this->admission_limit << " calls in flight, adapting between "
+                      << this->admission_min_limit << " and " << this->admission_max_limit << " to a queueing delay of "
+                      << this->admission_max_queue_delay_ms << "ms" << std::endl;
+        } else {
+            std::cout << "Admission control: " << this->admission_limit << " calls in flight" << std::endl;
+        }
+        if (this->retention_enabled()) {
+            std::cout << "Retention: TTLs " << (this->retention_ttls.empty() ? "none" : this->retention_ttls)
+                      << ", memory budget " << limit(this->retention_memory_mb, "MB") << ", "
+                      << this->retention_step_ms << "ms steps every " << this->retention_interval_ms << "ms"
+                      << std::endl;
+        } else {
+            std::cout << "Retention: disabled" << std::endl;
+        }
+        std::cout << "Archive: " << (this->archive_path.empty() ? "disabled" : this->archive_path) << std::endl;
+        std::cout << "Metrics: " << (this->metrics_path.empty() ? "not exported" : this->metrics_path) << std::endl;
+        if (!this->metrics_path.empty()) {
+            std::cout << "Metrics interval: " << this->metrics_interval_s << "s" << std::endl;
+        }
+        std::cout << "Access log: " << (this->log_path.empty() ? "stdout" : this->log_path) << std::endl;
+        std::cout << "Log level: " << this->log_level << std::endl;
+        if (this->log_level != "off") {
+            std::cout << "Log sampling: 1 in " << this->log_sample_every << " successful RPCs" << std::endl;
+        }
         std::cout << "------------------------" << std::endl;
     }
 };
@@ -1,30 +1,64 @@
 #pragma once
 
+#include <grpcpp/server_context.h>
 #include <grpcpp/support/interceptor.h>
 #include <grpcpp/support/server_interceptor.h>
 
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "logging/access_log.hpp"
+
+// Hands every RPC to the access log when it sends its status. The log decides
+// first whether the RPC is logged at all, so the peer is only looked up for
+// the ones that are. An RPC that ends without a status is logged as
+// CANCELLED, without its peer, unless it never reached a hook point.
 class LoggerInterceptor final : public grpc::experimental::Interceptor {
    public:
-    explicit LoggerInterceptor(grpc::experimental::ServerRpcInfo* info) {
-        // Constructor to initialize the intercepto
-        std::string method = info->method();
+    LoggerInterceptor(AccessLog* log, grpc::experimental::ServerRpcInfo* info)
+        : log_(log), info_(info), start_(std::chrono::steady_clock::now()) {}
 
-        if (method == "unknown") {
-            std::cout << "Unknown method called" << std::endl;
-            return;
+    ~LoggerInterceptor() override {
+        if (this->started_ && !this->logged_ && this->log_->Sample(grpc::CANCELLED)) {
+            this->log_->Append(this->info_->method(), "", grpc::CANCELLED, this->elapsed());
         }
-
-        std::cout << "Method called: " << method << std::endl;
     }
 
     void Intercept(grpc::experimental::InterceptorBatchMethods* methods) override {
+        this->started_ = true;
+        if (!this->logged_ &&
+            methods->QueryInterceptionHookPoint(grpc::experimental::InterceptionHookPoints::PRE_SEND_STATUS)) {
+            this->logged_ = true;
+
+            grpc::StatusCode code = methods->GetSendStatus().error_code();
+            if (this->log_->Sample(code)) {
+                this->log_->Append(this->info_->method(), this->info_->server_context()->peer(), code,
+                                   this->elapsed());
+            }
+        }
         methods->Proceed();  // Important !!
     }
+
+   private:
+    AccessLog* log_;
+    grpc::experimental::ServerRpcInfo* info_;
+    std::chrono::steady_clock::time_point start_;
+    bool started_ = false;  // An RPC still pending at shutdown is never intercepted
+    bool logged_ = false;
+
+    std::chrono::nanoseconds elapsed() const { return std::chrono::steady_clock::now() - this->start_; }
 };
 
 class LoggerInterceptorFactory final : public grpc::experimental::ServerInterceptorFactoryInterface {
    public:
+    explicit LoggerInterceptorFactory(std::shared_ptr<AccessLog> log) : log_(std::move(log)) {}
+
     grpc::experimental::Interceptor* CreateServerInterceptor(grpc::experimental::ServerRpcInfo* info) override {
-        return new LoggerInterceptor(info);
+        return new LoggerInterceptor(this->log_.get(), info);
     }
+
+   private:
+    std::shared_ptr<AccessLog> log_;
 };
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <grpcpp/support/interceptor.h>
+#include <grpcpp/support/server_interceptor.h>
+
+#include <chrono>
+#include <memory>
+#include <utility>
+
+#include "metrics/rpc_metrics.hpp"
+
+// Times every RPC from the moment the server picks it up until it sends the
+// status, and records it in RpcMetrics by method and status code. An RPC that
+// ends without a status (the client went away) is recorded as CANCELLED.
+// Requests still posted when the server shuts down get an interceptor too,
+// but never reach a hook point and are not counted.
+class MetricsInterceptor final : public grpc::experimental::Interceptor {
+   public:
+    MetricsInterceptor(RpcMetrics* metrics, grpc::experimental::ServerRpcInfo* info)
+        : metrics_(metrics), method_(metrics->MethodIndex(info->method())), start_(std::chrono::steady_clock::now()) {}
+
+    ~MetricsInterceptor() override {
+        if (this->started_ && !this->recorded_) {
+            this->record(grpc::CANCELLED);
+        }
+    }
+
+    void Intercept(grpc::experimental::InterceptorBatchMethods* methods) override {
+        if (!this->started_) {
+            this->started_ = true;
+            this->metrics_->Started(this->method_);
+        }
+
+        if (!this->recorded_ &&
+            methods->QueryInterceptionHookPoint(grpc::experimental::InterceptionHookPoints::PRE_SEND_STATUS)) {
+            this->record(methods->GetSendStatus().error_code());
+        }
+        methods->Proceed();
+    }
+
+   private:
+    RpcMetrics* metrics_;
+    std::size_t method_;
+    std::chrono::steady_clock::time_point start_;
+    bool started_ = false;  // An RPC still pending at shutdown is never intercepted
+    bool recorded_ = false;
+
+    void record(grpc::StatusCode code) {
+        this->recorded_ = true;
+        this->metrics_->Finished(this->method_, code, std::chrono::steady_clock::now() - this->start_);
+    }
+};
+
+class MetricsInterceptorFactory final : public grpc::experimental::ServerInterceptorFactoryInterface {
+   public:
+    explicit MetricsInterceptorFactory(std::shared_ptr<RpcMetrics> metrics) : metrics_(std::move(metrics)) {}
+
+    grpc::experimental::Interceptor* CreateServerInterceptor(grpc::experimental::ServerRpcInfo* info) override {
+        return new MetricsInterceptor(this->metrics_.get(), info);
+    }
+
+   private:
+    std::shared_ptr<RpcMetrics> metrics_;
+};
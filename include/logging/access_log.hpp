@@ -0,0 +1,124 @@
+#pragma once
+
+#include <grpcpp/support/status.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+enum class LogLevel { kInfo, kWarn, kError, kOff };
+
+struct AccessLogOptions {
+    std::string path;  // Appended to, stdout when empty
+
+    LogLevel level = LogLevel::kInfo;  // RPCs below it are not logged
+    int sample_every = 1;              // Logs one in N info RPCs, warnings and errors are always logged
+
+    std::size_t buffer_records = 4096;  // Per thread, rounded up to a power of two
+    std::chrono::milliseconds flush_interval{100};
+};
+
+// Access log of the RPCs, one JSON line per RPC.
+//
+// Request threads never format or write anything. Each one appends fixed-size
+// binary records to its own single-producer ring, and a background thread
+// drains the rings every flush interval, formats the lines and writes them
+// in one batch. When a ring is full the record is dropped and counted, the
+// request thread never waits for the writer. A thread's ring is retired when
+// the thread exits and freed by the writer once it has been drained.
+class AccessLog {
+   public:
+    struct Stats {
+        uint64_t written = 0;
+        uint64_t dropped = 0;  // Ring full
+    };
+
+    // Throws std::runtime_error if the file cannot be opened
+    explicit AccessLog(AccessLogOptions options = {});
+    ~AccessLog();
+
+    AccessLog(const AccessLog&) = delete;
+    AccessLog& operator=(const AccessLog&) = delete;
+
+    // Whether the RPC passes the level filter and the sampling. Call it before
+    // gathering what Append needs.
+    bool Sample(grpc::StatusCode code);
+
+    // Long method names and peers are truncated
+    void Append(std::string_view method, std::string_view peer, grpc::StatusCode code,
+                std::chrono::nanoseconds duration);
+
+    // Writes out the records appended so far and returns once they are
+    // written, instead of waiting for the next flush interval
+    void Flush();
+
+    Stats stats() const;
+
+    // Parses "info", "warn", "error" or "off", throws std::invalid_argument
+    static LogLevel ParseLevel(const std::string& level);
+    static LogLevel LevelOf(grpc::StatusCode code);
+
+   private:
+    struct Record {
+        int64_t time_ns;  // Since the epoch, when the status was sent
+        int64_t duration_ns;
+        grpc::StatusCode code;
+        uint8_t method_size;
+        uint8_t peer_size;
+        char method[96];
+        char peer[64];
+    };
+
+    struct Ring {
+        explicit Ring(std::size_t capacity) : records(capacity), mask(capacity - 1) {}
+
+        std::vector<Record> records;
+        std::size_t mask;
+
+        alignas(64) std::atomic<uint64_t> head{0};  // Next record written by the producer
+        uint64_t cached_tail = 0;                   // Producer's last view of tail
+        uint64_t sampled = 0;                       // Info RPCs seen, for sampling
+        std::atomic<uint64_t> dropped{0};           // Single writer: the producer
+
+        alignas(64) std::atomic<uint64_t> tail{0};  // Next record read by the writer
+        std::atomic<bool> retired{false};           // Set when the producer exits
+        bool drained_retired = false;               // Writer only: retired before its last drain
+    };
+
+    // Owns the calling thread's rings, one per log, and retires them when the
+    // thread exits
+    struct RingOwner;
+
+    AccessLogOptions options_;
+    std::size_t ring_capacity_;
+    int fd_;
+    uint64_t id_;  // Tells logs apart in the thread-local ring cache
+
+    mutable std::mutex mutex_;  // Guards rings_, stopping_ and the flush counters
+    std::vector<std::shared_ptr<Ring>> rings_;
+    uint64_t retired_dropped_ = 0;  // Dropped records of the rings freed
+    std::condition_variable stop_cv_;
+    std::condition_variable flushed_cv_;
+    bool stopping_ = false;
+    uint64_t flush_requested_ = 0;
+    uint64_t flush_done_ = 0;
+
+    std::atomic<uint64_t> written_{0};
+    std::thread writer_;
+
+    Ring& local_ring();
+    void run();
+    void drain(std::string& batch);
+    void write(std::string& batch);
+
+    static void format(const Record& record, std::string& out);
+};
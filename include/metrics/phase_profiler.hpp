@@ -0,0 +1,217 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Where the time of a call goes, phase by phase: the handler, waiting for and
+// holding the store's shard locks, copying orders between protobuf and
+// records, serializing responses and waiting for the WAL.
+//
+// Scoped timers read the TSC (steady_clock off x86). Disabled, a timer is one
+// relaxed load and a branch. Enabled, every thread adds its timings into its
+// own cells, per method and phase, with no lock and no atomic
+// read-modify-write; WritePrometheus merges them. Phases timed outside any
+// handler (the sweeper, the snapshot loader, WAL replay) count under
+// "background".
+//
+// A capture also records every timed phase as an event, up to
+// kMaxTraceEvents per thread, and writes them as a Chrome trace-event file
+// (chrome://tracing, Perfetto) when it stops. Thread ids are the kernel's, so
+// a capture lines up with `perf record` of the same run. A thread frees its
+// event buffer on its first timing after the capture stops.
+//
+// When a thread exits its cells are folded into a base set and its log is
+// freed, once the capture running then has written its events.
+//
+// Process-wide: the timers sit deep in the store, where no registry is
+// passed down.
+class PhaseProfiler {
+   public:
+    enum Phase : uint8_t { kHandler, kLockWait, kLockHold, kCopy, kSerialize, kWalWait, kPhaseCount };
+
+    static constexpr std::size_t kMaxMethods = 32;  // Any more share the last slot
+    static constexpr std::size_t kMaxTraceEvents = 1 << 18;
+
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    // Aggregates, outside of captures too
+    static void Enable();
+    static void Disable();
+
+    // Starts recording events, enabling the profiler until the capture
+    // stops. Returns false if a capture is already running.
+    static bool StartCapture();
+
+    // Writes the events of the capture to `path` through a temporary file.
+    // Returns false, and logs, if no capture was running or the write failed.
+    static bool StopCapture(const std::string& path);
+
+    static bool capturing();
+
+    // Seconds, calls and longest time per method and phase, in Prometheus
+    // text format
+    static void WritePrometheus(std::ostream& out);
+
+    // TSC cycles, steady_clock nanoseconds off x86
+    static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    static void Record(Phase phase, uint64_t begin, uint64_t end);
+
+    // Counts the phases of this thread under `method`, a string literal,
+    // until LeaveHandler. Returns false, changing nothing, inside another
+    // handler: a handler calling another counts as one call.
+    static bool EnterHandler(const char* method);
+    static void LeaveHandler();
+
+   private:
+    struct Cell {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> cycles{0};
+        std::atomic<uint64_t> max_cycles{0};
+    };
+
+    struct Event {
+        uint64_t begin;
+        uint64_t end;
+        uint8_t phase;
+        uint8_t method;
+    };
+
+    // Only its thread writes to it, readers merge or copy it under mutex_
+    struct alignas(64) ThreadLog {
+        int tid = 0;
+        std::size_t method = 0;
+        std::array<std::array<Cell, kPhaseCount>, kMaxMethods> cells{};
+
+        // Events of the capture numbered `generation`, allocated on the
+        // thread's first event of any capture
+        std::unique_ptr<Event[]> events;
+        std::atomic<std::size_t> event_count{0};
+        std::atomic<uint64_t> generation{0};
+        std::atomic<uint64_t> dropped{0};
+
+        bool retired = false;  // Its thread exited, kept for the capture's events
+    };
+
+    // Retires the calling thread's log when it exits
+    struct LogOwner;
+
+    static std::atomic<bool> enabled_;
+    static std::atomic<bool> capturing_;
+    static std::atomic<uint64_t> generation_;
+
+    static std::mutex mutex_;  // Guards everything below
+    static bool aggregating_;
+    static double cycles_per_ns_;  // 0 until calibrated
+    static uint64_t capture_start_;
+    static std::vector<std::unique_ptr<ThreadLog>>* logs_;  // Never freed, threads may exit during static destruction
+    static std::array<std::array<Cell, kPhaseCount>, kMaxMethods> retired_;  // Cells of the threads that exited
+    static std::array<std::atomic<const char*>, kMaxMethods> methods_;
+    static std::atomic<std::size_t> method_count_;
+
+    static ThreadLog& local_log();
+    static void retire(ThreadLog* log);
+    static void release_events(ThreadLog& log);
+    static std::size_t method_index(const char* name);
+    static void calibrate();
+    static void increment(std::atomic<uint64_t>& counter, uint64_t by);
+    static const char* method_name(std::size_t method);
+    static const char* phase_name(std::size_t phase);
+};
+
+// Times the enclosing scope as `phase`
+class ScopedPhase {
+   public:
+    explicit ScopedPhase(PhaseProfiler::Phase phase)
+        : phase_(phase), begin_(PhaseProfiler::enabled() ? PhaseProfiler::Now() : 0) {}
+
+    ~ScopedPhase() {
+        if (this->begin_) {
+            PhaseProfiler::Record(this->phase_, this->begin_, PhaseProfiler::Now());
+        }
+    }
+
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+   private:
+    PhaseProfiler::Phase phase_;
+    uint64_t begin_;
+};
+
+// Times a handler, and counts the phases inside it under `method`
+class ScopedHandler {
+   public:
+    explicit ScopedHandler(const char* method) {
+        if (PhaseProfiler::enabled() && PhaseProfiler::EnterHandler(method)) {
+            this->begin_ = PhaseProfiler::Now();
+        }
+    }
+
+    ~ScopedHandler() {
+        if (this->begin_) {
+            PhaseProfiler::Record(PhaseProfiler::kHandler, this->begin_, PhaseProfiler::Now());
+            PhaseProfiler::LeaveHandler();
+        }
+    }
+
+    ScopedHandler(const ScopedHandler&) = delete;
+    ScopedHandler& operator=(const ScopedHandler&) = delete;
+
+   private:
+    uint64_t begin_ = 0;
+};
+
+// std::unique_lock or std::shared_lock over `mutex`, timing the wait for it
+// and, once released, how long it was held
+template <typename Lock>
+class ProfiledLock {
+   public:
+    explicit ProfiledLock(typename Lock::mutex_type& mutex) : lock_(mutex, std::defer_lock) {
+        if (!PhaseProfiler::enabled()) {
+            this->lock_.lock();
+            return;
+        }
+
+        uint64_t begin = PhaseProfiler::Now();
+        this->lock_.lock();
+        this->locked_at_ = PhaseProfiler::Now();
+        PhaseProfiler::Record(PhaseProfiler::kLockWait, begin, this->locked_at_);
+    }
+
+    ~ProfiledLock() {
+        if (!this->locked_at_) {
+            return;  // Unlocked by lock_
+        }
+
+        uint64_t unlocked_at = PhaseProfiler::Now();
+        this->lock_.unlock();
+        PhaseProfiler::Record(PhaseProfiler::kLockHold, this->locked_at_, unlocked_at);
+    }
+
+    ProfiledLock(const ProfiledLock&) = delete;
+    ProfiledLock& operator=(const ProfiledLock&) = delete;
+
+   private:
+    Lock lock_;
+    uint64_t locked_at_ = 0;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <grpcpp/support/status.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Per-method RPC counters and latency histograms.
+//
+// Every thread records into its own shard, and each shard has a single
+// writer. An update is a relaxed load and store on the shard's own cache
+// lines: no lock, no atomic read-modify-write, no sharing between threads.
+// Readers merge the shards when they write out the metrics. When a thread
+// exits, its shard is folded into a base shard and freed.
+//
+// Latencies go into log-linear buckets: one per microsecond below 16 us,
+// then 8 per power of two, about 9% wide. That bounds the error of a
+// reported quantile.
+class RpcMetrics {
+   public:
+    using Collector = std::function<void(std::ostream&)>;
+
+    static constexpr std::size_t kMaxMethods = 64;  // Any more share the last slot
+    static constexpr std::size_t kStatusCodes = 17;
+
+    RpcMetrics();
+    ~RpcMetrics();
+
+    RpcMetrics(const RpcMetrics&) = delete;
+    RpcMetrics& operator=(const RpcMetrics&) = delete;
+
+    // Slot of a full method name ("/package.Service/Method"). Lock-free when
+    // called with the same pointer again, which gRPC does for every call of
+    // a registered method.
+    std::size_t MethodIndex(const char* method);
+
+    void Started(std::size_t method);
+    void Finished(std::size_t method, grpc::StatusCode code, std::chrono::nanoseconds latency);
+
+    // Extra metrics written after the RPC ones
+    void AddCollector(Collector collector);
+
+    // Prometheus text exposition format
+    void WritePrometheus(std::ostream& out) const;
+
+    // Writes the metrics to `path` through a temporary file, so a reader
+    // (e.g. node_exporter's textfile collector) never sees a partial file.
+    // Returns false and logs on I/O errors.
+    bool ExportTo(const std::string& path) const;
+
+    // Exports every `interval` on a background thread, and one last time
+    // when the registry is destroyed
+    void StartExport(const std::string& path, std::chrono::seconds interval);
+
+    static void WriteCounter(std::ostream& out, const std::string& name, const std::string& help, uint64_t value);
+    static void WriteGauge(std::ostream& out, const std::string& name, const std::string& help, double value);
+
+    // "NOT_FOUND" for grpc::NOT_FOUND, "UNKNOWN" for codes past kStatusCodes
+    static const char* StatusName(grpc::StatusCode code);
+
+   private:
+    static constexpr std::size_t kBucketCount = 208;
+
+    struct Cell {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum_ns{0};
+        std::array<std::atomic<uint64_t>, kBucketCount> buckets{};
+    };
+
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, kMaxMethods> started{};
+        // Allocated by the owning thread on its first RPC with that method and
+        // status, then freed with the shard
+        std::array<std::array<std::atomic<Cell*>, kStatusCodes>, kMaxMethods> cells{};
+
+        ~Shard();
+    };
+
+    // Retires the calling thread's shards, one per registry, when it exits
+    struct ShardOwner;
+
+    uint64_t id_;  // Tells registries apart in the thread-local shard cache
+
+    mutable std::mutex mutex_;  // Guards everything below except the lock-free lookup
+    std::vector<std::unique_ptr<Shard>> shards_;
+    Shard retired_;  // Counts of the threads that exited
+    std::array<std::atomic<const char*>, kMaxMethods> method_keys_{};
+    std::atomic<std::size_t> method_count_{0};
+    std::vector<std::string> method_names_;
+    std::vector<Collector> collectors_;
+
+    std::thread exporter_;
+    std::string export_path_;
+    std::condition_variable stop_cv_;
+    bool stopping_ = false;
+
+    Shard& local_shard();
+    void retire(Shard* shard);
+
+    static void increment(std::atomic<uint64_t>& counter, uint64_t by = 1);
+    static std::size_t bucket_of(uint64_t nanos);
+    static uint64_t bucket_upper_bound(std::size_t bucket);
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <grpcpp/impl/service_type.h>
+#include <grpcpp/server_builder.h>
+
+// Completion queue engine that Server can run instead of gRPC's synchronous
+// thread pool. Server registers service() and calls the hooks in order:
+// Attach before BuildAndStart, Start once the server is up, and Shutdown after
+// the server itself has been shut down.
+class AsyncEngine {
+   public:
+    virtual ~AsyncEngine() = default;
+
+    virtual grpc::Service* service() = 0;
+
+    // Add the completion queues to the builder
+    virtual void Attach(grpc::ServerBuilder& builder) = 0;
+    // Post the initial requests and spawn the poller threads
+    virtual void Start() = 0;
+    // Shut the completion queues down, drain them and join the pollers
+    virtual void Shutdown() = 0;
+};
@@ -2,30 +2,128 @@
 
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/impl/service_type.h>
+#include <grpcpp/resource_quota.h>
 #include <grpcpp/security/server_credentials.h>
 #include <grpcpp/server.h>
 #include <grpcpp/server_builder.h>
 #include <grpcpp/support/interceptor.h>
 #include <grpcpp/support/server_interceptor.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
 #include "interceptors/logger.hpp"
+#include "interceptors/metrics.hpp"
+#include "logging/access_log.hpp"
+#include "metrics/rpc_metrics.hpp"
+#include "server/async_engine.hpp"
+
+// Transport and threading settings applied to the builder in Server::Run. The
+// defaults are gRPC's own; 0 stands for no limit where gRPC has none.
+struct ServerOptions {
+    // Sync server only, the async engine brings its own queues and pollers
+    int sync_cqs = 1;
+    int sync_min_pollers = 1;
+    int sync_max_pollers = 2;
+    int sync_cq_timeout_ms = 10000;
+
+    int max_concurrent_streams = 0;  // Per connection
+    int max_receive_message_bytes = 4 << 20;
+    int max_send_message_bytes = 0;
+
+    int keepalive_time_ms = 2 * 60 * 60 * 1000;  // Between server pings on an idle connection
+    int keepalive_timeout_ms = 20000;            // For the ping ack before closing
+    bool keepalive_permit_without_calls = false;
+    int keepalive_min_ping_interval_ms = 5 * 60 * 1000;  // Clients pinging more often are disconnected
+
+    int max_connection_idle_ms = 0;
+    int max_connection_age_ms = 0;
+    int max_connection_age_grace_ms = 0;
+
+    // Caps every server allocation and thread, sync pollers included
+    std::size_t resource_quota_bytes = 0;
+    int resource_quota_threads = 0;
+
+    // Stop waits this long for the calls in flight, then cancels them
+    std::chrono::milliseconds shutdown_deadline{10000};
+
+    // gRPC servers bound to the address together with SO_REUSEPORT, the
+    // kernel spreads the connections across them. Every shard has its own
+    // pollers and completion queues, the service and its store are shared.
+    int shards = 1;
+};
 
 class Server {
+   public:
+    // Makes the engine of one shard, numbered from 0
+    using AsyncEngineFactory = std::function<std::unique_ptr<AsyncEngine>(int shard)>;
+
    private:
-    std::shared_ptr<grpc::Server> server_;
+    // Guards servers_ and async_engines_: Stop runs on the signal thread,
+    // InProcessChannel on callers' threads
+    mutable std::mutex mutex_;
+    std::vector<std::shared_ptr<grpc::Server>> servers_;  // One per shard
     std::shared_ptr<grpc::Service> service_;
     std::string addr_;
     std::string service_name_;
-    std::vector<std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>> interceptors_;
+    std::shared_ptr<RpcMetrics> metrics_;
+    std::shared_ptr<AccessLog> access_log_;
+    AsyncEngineFactory async_engine_factory_;
+    std::vector<std::unique_ptr<AsyncEngine>> async_engines_;  // One per shard in async mode
+    ServerOptions options_;
+    std::function<void()> drain_;
+    std::function<void()> flush_;
+    std::atomic<unsigned> next_in_process_{0};
+
+    std::shared_ptr<grpc::Server> build_shard(int shard);
+    void apply_options(grpc::ServerBuilder& builder) const;
 
    public:
     explicit Server(const std::string& addr, std::shared_ptr<grpc::Service> service,
                     const std::string& service_name = "gRPC::Server");
 
+    // Serve every shard through an engine made by `factory` instead of the
+    // synchronous service, must be called before Run
+    void SetAsyncEngine(AsyncEngineFactory factory);
+
+    // Log every RPC to `log`, must be called before Run. Without one RPCs
+    // are not logged.
+    void SetAccessLog(std::shared_ptr<AccessLog> log);
+
+    // Must be called before Run, the defaults are used otherwise
+    void SetOptions(const ServerOptions& options);
+
+    // Stop runs `drain` first, to end the long-lived calls (streams) and turn
+    // new ones away, and `flush` once every call is done, to write out what
+    // they left buffered
+    void SetShutdownHooks(std::function<void()> drain, std::function<void()> flush);
+
+    // Builds and starts every shard, throws std::runtime_error if one fails
+    void Start();
+
+    // Blocks until Stop has shut every shard down
+    void Wait();
+
+    // Start then Wait
     void Run();
+
+    // Channel to the running server that skips TCP and HTTP/2 framing, for
+    // callers in the same process. Interceptors still run. Rotates over the
+    // shards; valid between Start and Stop, throws std::runtime_error
+    // otherwise.
+    std::shared_ptr<grpc::Channel> InProcessChannel(const grpc::ChannelArguments& args = grpc::ChannelArguments());
+
+    // Stops accepting calls, drains the ones in flight for up to the
+    // shutdown deadline and cancels the rest, then flushes the buffers.
+    // Reports how long each step took.
     void Stop();
+
+    // Filled by the metrics interceptor for every RPC
+    std::shared_ptr<RpcMetrics> metrics() const { return this->metrics_; }
 };
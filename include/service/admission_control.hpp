@@ -0,0 +1,131 @@
+#pragma once
+
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/status.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct AdmissionOptions {
+    int initial_limit = 256;  // Calls in flight before the first adjustment
+    int min_limit = 8;
+    int max_limit = 4096;
+    bool adaptive = true;  // Keep the limit at initial_limit when false
+
+    // Estimated queueing delay past which the limit is lowered
+    std::chrono::milliseconds max_queue_delay{20};
+};
+
+// Bounds the calls a service works on at once, and turns the rest away with
+// RESOURCE_EXHAUSTED before doing any work for them.
+//
+// Every method is a lane with a priority. High priority calls may fill the
+// whole limit, normal ones 90% of it and low ones half, so cheap reads still
+// get through while expensive scans are shed. A call whose deadline already
+// passed is failed with DEADLINE_EXCEEDED without running.
+//
+// The limit adapts with AIMD. Queueing delay cannot be observed directly, so
+// it is estimated as the latency of a call above the lowest latency seen on
+// its lane recently. Every window (10 ms and 16 sampled calls at least) the
+// limit is cut by 10% when the mean estimated delay exceeds max_queue_delay,
+// and grows by one when the window used at least half of it.
+class AdmissionControl {
+   public:
+    enum class Priority { kHigh, kNormal, kLow };
+
+    struct Lane {
+        std::string method;  // Label of its counters
+        Priority priority;
+        bool sample_latency;  // False when the latency depends on the request size more than on the load
+    };
+
+    // A slot held by an admitted call, given back when destroyed
+    class Ticket {
+       public:
+        Ticket() = default;
+        ~Ticket();
+
+        Ticket(const Ticket&) = delete;
+        Ticket& operator=(const Ticket&) = delete;
+
+       private:
+        friend class AdmissionControl;
+
+        AdmissionControl* control_ = nullptr;
+        std::size_t lane_ = 0;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    static constexpr std::size_t kMaxLanes = 16;
+
+    AdmissionControl(AdmissionOptions options, std::vector<Lane> lanes);
+
+    AdmissionControl(const AdmissionControl&) = delete;
+    AdmissionControl& operator=(const AdmissionControl&) = delete;
+
+    // OK with `ticket` holding a slot, or the status to fail the call with.
+    // `context` may be null, the deadline is not checked then.
+    grpc::Status Admit(const grpc::ServerContextBase* context, std::size_t lane, Ticket* ticket);
+
+    // The same decision without taking a slot, for streams, which last as
+    // long as the client wants
+    grpc::Status Check(const grpc::ServerContextBase* context, std::size_t lane);
+
+    int limit() const { return this->limit_.load(std::memory_order_relaxed); }
+    int64_t in_flight() const { return this->in_flight_.load(std::memory_order_relaxed); }
+
+    // Decisions by method, the limit and its adjustments, in Prometheus text format
+    void WritePrometheus(std::ostream& out) const;
+
+   private:
+    static constexpr std::chrono::milliseconds kWindow{10};
+    static constexpr uint64_t kMinWindowSamples = 16;
+    static constexpr std::chrono::seconds kMinLatencyPeriod{10};  // A lowest latency is kept one to two of these
+    static constexpr double kBackoff = 0.9;
+
+    struct alignas(64) LaneState {
+        Lane lane;
+        std::atomic<uint64_t> admitted{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> expired{0};
+
+        // Lowest latency of this period and of the one being collected
+        std::atomic<int64_t> min_ns{INT64_MAX};
+        std::atomic<int64_t> next_min_ns{INT64_MAX};
+    };
+
+    AdmissionOptions options_;
+    std::size_t lane_count_;
+    std::array<LaneState, kMaxLanes> lanes_;
+
+    std::atomic<int> limit_;
+    std::atomic<int64_t> in_flight_{0};
+
+    // Current window, closed by whichever finishing call gets the mutex
+    alignas(64) std::atomic<int64_t> window_delay_ns_{0};
+    std::atomic<uint64_t> window_samples_{0};
+    std::atomic<int64_t> window_peak_{0};
+    std::atomic<int64_t> window_end_ns_{0};
+    std::mutex window_mutex_;
+    int64_t next_min_period_ns_ = 0;  // Guarded by window_mutex_
+
+    std::atomic<int64_t> last_delay_ns_{0};  // Mean of the last closed window
+    std::atomic<uint64_t> increases_{0};
+    std::atomic<uint64_t> decreases_{0};
+
+    grpc::Status decide(const grpc::ServerContextBase* context, std::size_t lane, bool take);
+    void finish(std::size_t lane, std::chrono::steady_clock::time_point start);
+    void close_window(int64_t now_ns);
+    int64_t allowed(Priority priority) const;
+
+    static void lower(std::atomic<int64_t>& value, int64_t candidate);
+    static void raise(std::atomic<int64_t>& value, int64_t candidate);
+    static int64_t now_ns();
+};
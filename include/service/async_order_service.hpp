@@ -0,0 +1,65 @@
+#pragma once
+
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/server_builder.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "order_service/order.grpc.pb.h"
+#include "server/async_engine.hpp"
+#include "service/order_service.hpp"
+
+struct AsyncOptions {
+    int cq_count = 1;
+    int pollers_per_cq = 1;
+    bool pin_pollers = true;  // Pin poller i to core (first_core + i) % hardware_concurrency
+    int first_core = 0;       // Shards start past the cores of the ones before
+};
+
+// Serves OrderService from completion queues instead of the sync thread pool.
+//
+// Every RPC is a small state machine that is its own completion queue tag. The
+// unary handlers are the OrderService methods, run inline on the poller thread.
+// Those that change orders, and IngestOrders, do not wait for the WAL there:
+// the call finishes from the WAL's callback once the changes are durable, so a
+// poller never blocks on an fsync. StreamOrderUpdates is paced with a grpc::Alarm instead of a sleeping
+// thread, so a fixed set of pollers can carry thousands of open streams.
+// IngestOrders reads one request per completion and creates the orders a
+// chunk at a time, like the sync handler, and StreamListOrders reads the next
+// chunk of orders only once the last one was written.
+// Unary calls keep their messages on a CallArena and are recycled once
+// finished, so steady-state traffic does not allocate per call. GetOrder is a
+// raw method, its requests and responses stay ByteBuffers so cached responses
+// are sent as they are. So is StreamOrderUpdates, which writes the change
+// feed's events as they were serialized.
+class AsyncOrderService final : public AsyncEngine {
+   public:
+    AsyncOrderService(std::shared_ptr<OrderService> service, AsyncOptions options);
+    ~AsyncOrderService() override;
+
+    grpc::Service* service() override { return &this->async_service_; }
+
+    void Attach(grpc::ServerBuilder& builder) override;
+    void Start() override;
+    void Shutdown() override;
+
+    using Service = osv1::OrderService::WithRawMethod_GetOrder<osv1::OrderService::WithAsyncMethod_ListOrders<
+        osv1::OrderService::WithAsyncMethod_StreamListOrders<osv1::OrderService::WithAsyncMethod_CreateOrder<
+            osv1::OrderService::WithAsyncMethod_BatchCreateOrders<osv1::OrderService::WithAsyncMethod_IngestOrders<
+                osv1::OrderService::WithAsyncMethod_UpdateOrder<osv1::OrderService::WithRawMethod_StreamOrderUpdates<
+                    osv1::OrderService::WithAsyncMethod_DeleteOrder<
+                        osv1::OrderService::WithAsyncMethod_AggregateOrders<osv1::OrderService::Service>>>>>>>>>>;
+
+   private:
+    std::shared_ptr<OrderService> service_;
+    AsyncOptions options_;
+    Service async_service_;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs_;
+    std::vector<std::thread> pollers_;
+
+    void spawn_calls(grpc::ServerCompletionQueue* cq);
+    static void poll(grpc::ServerCompletionQueue* cq);
+    static void pin_to_core(std::thread& thread, int index);
+};
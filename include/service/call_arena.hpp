@@ -0,0 +1,58 @@
+#pragma once
+
+#include <google/protobuf/arena.h>
+
+#include <algorithm>
+#include <cstddef>
+
+// Request and response of one RPC, allocated on a protobuf arena.
+//
+// The arena's first block lives inside the object, so parsing the request,
+// building the response and every nested message and repeated field of both
+// come out of it without touching the heap; only what does not fit (and the
+// character data of strings longer than the small string buffer) is
+// allocated. Reset() drops both messages and keeps the inline block for the
+// next call, so a recycled CallArena starts from zero allocations again.
+template <typename Request, typename Response, std::size_t kInlineSize = 4096>
+class CallArena {
+   public:
+    CallArena() : arena_(options(this->block_)) { this->create(); }
+
+    CallArena(const CallArena&) = delete;
+    CallArena& operator=(const CallArena&) = delete;
+
+    Request* request() { return this->request_; }
+    Response* response() { return this->response_; }
+
+    void Reset() {
+        this->arena_.Reset();
+        this->create();
+    }
+
+    // Bytes handed out by the arena for the current call, inline block included
+    std::size_t space_used() const { return static_cast<std::size_t>(this->arena_.SpaceUsed()); }
+
+   private:
+    // Declared before the arena, which is constructed on top of it
+    alignas(alignof(std::max_align_t)) char block_[kInlineSize];
+    google::protobuf::Arena arena_;
+
+    Request* request_ = nullptr;
+    Response* response_ = nullptr;
+
+    // Blocks beyond the inline one are at least as large, so a big response
+    // grows the arena in a few steps rather than from the 256 byte default
+    static google::protobuf::ArenaOptions options(char* block) {
+        google::protobuf::ArenaOptions options;
+        options.initial_block = block;
+        options.initial_block_size = kInlineSize;
+        options.start_block_size = kInlineSize;
+        options.max_block_size = std::max(options.max_block_size, 8 * kInlineSize);
+        return options;
+    }
+
+    void create() {
+        this->request_ = google::protobuf::Arena::CreateMessage<Request>(&this->arena_);
+        this->response_ = google::protobuf::Arena::CreateMessage<Response>(&this->arena_);
+    }
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <grpcpp/support/byte_buffer.h>
+
+#include "order_service/order.pb.h"
+#include "store/order_id.hpp"
+#include "store/order_store.hpp"
+
+namespace osv1 = order_service::v1;
+
+// Publish/subscribe feed of order changes for StreamOrderUpdates.
+//
+// The store publishes every change; when an order has subscribers the feed
+// builds one immutable event, serialized once, and hands the same pointer to
+// each of their bounded queues, then fires the subscriber's notifier. Orders
+// nobody watches cost a single shared-locked lookup of their key per change,
+// nothing is allocated.
+class OrderFeed {
+   public:
+    struct Event {
+        grpc::ByteBuffer message;  // Serialized StreamOrderUpdatesResponse
+        bool deleted = false;      // The order is gone, message is empty
+        bool last = false;     // Deleted or final status, nothing will follow
+    };
+
+    using EventPtr = std::shared_ptr<const Event>;
+    using Notifier = std::function<void()>;
+
+    static constexpr std::size_t kDefaultShardCount = 64;
+    static constexpr std::size_t kDefaultQueueCapacity = 64;
+
+    // A subscriber's queue. When it is full the oldest event is dropped and
+    // counted, publishers never wait on a slow stream. Unsubscribes on
+    // destruction.
+    class Subscription {
+       public:
+        ~Subscription();
+
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+
+        bool TryNext(EventPtr* event);
+        // Returns false if nothing arrived within `timeout`, or right away
+        // once the feed is closed and the queue empty
+        bool WaitNext(EventPtr* event, std::chrono::milliseconds timeout);
+
+        uint64_t dropped() const;
+
+        // The feed was closed, no event follows the queued ones
+        bool closed() const;
+
+       private:
+        friend class OrderFeed;
+
+        Subscription(OrderFeed* feed, std::string order_id, Notifier notifier, std::size_t capacity);
+
+        void push(const EventPtr& event);
+        void close();
+
+        OrderFeed* feed_;
+        std::string order_id_;
+        OrderId key_;  // OrderRecord::KeyOf(order_id_)
+        Notifier notifier_;
+        std::size_t capacity_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable cv_;
+        std::deque<EventPtr> queue_;
+        uint64_t dropped_ = 0;
+        bool closed_ = false;
+    };
+
+    explicit OrderFeed(std::size_t shard_count = kDefaultShardCount);
+
+    OrderFeed(const OrderFeed&) = delete;
+    OrderFeed& operator=(const OrderFeed&) = delete;
+
+    // `notifier` runs on the publishing thread after each push, it must be
+    // cheap and must not block
+    std::unique_ptr<Subscription> Subscribe(const std::string& order_id, Notifier notifier = nullptr,
+                                            std::size_t capacity = kDefaultQueueCapacity);
+
+    // OrderStore::Observer signature
+    void Publish(const OrderStore::OrderPtr& before, const OrderStore::OrderPtr& after);
+
+    // Ends the streams of an order deleted while it was not in the store
+    void PublishDeleted(const std::string& order_id);
+
+    // Closes every subscription and fires its notifier, so streams end on
+    // shutdown instead of waiting for changes. Later subscriptions start
+    // closed.
+    void Close();
+
+    // Serializes `message` once, every stream then writes the same bytes
+    static EventPtr MakeEvent(const osv1::StreamOrderUpdatesResponse& message);
+
+    static bool IsFinalStatus(osv1::OrderStatus status);
+
+   private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<OrderId, std::vector<Subscription*>, OrderIdHash> subscribers;
+    };
+
+    std::size_t shard_mask_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<bool> closed_{false};
+
+    Shard& shard(const OrderId& key) const;
+    static const EventPtr& deleted_event();
+    void unsubscribe(Subscription* subscription);
+};
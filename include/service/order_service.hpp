@@ -4,39 +4,228 @@
 #include <grpcpp/server_context.h>
 #include <grpcpp/support/status.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
-#include <unordered_map>
-#include <vector>
+#include <thread>
 
 #include "google/protobuf/map.h"
 #include "order_service/order.grpc.pb.h"
 #include "order_service/order.pb.h"
+#include "service/admission_control.hpp"
+#include "service/order_feed.hpp"
+#include "service/response_cache.hpp"
+#include "store/order_archive.hpp"
+#include "store/order_columns.hpp"
+#include "store/order_retention.hpp"
+#include "store/order_snapshot.hpp"
+#include "store/order_store.hpp"
+#include "store/order_wal.hpp"
 
 namespace osv1 = order_service::v1;
 
 using grpc::ServerContext;
+using grpc::ServerReader;
 using grpc::ServerWriter;
 using grpc::Status;
 
-class OrderService final : public osv1::OrderService::Service {
+struct OrderServiceOptions {
+    std::optional<WalOptions> wal;            // Persist every change and restore on startup when set
+    std::optional<SnapshotOptions> snapshot;  // Start from a snapshot and write one every interval when set
+    std::size_t response_cache_bytes = 0;     // Serialized GetOrder responses to keep, 0 disables the cache
+    unsigned aggregate_threads = 0;           // Threads an AggregateOrders scan may use, 0 = hardware concurrency
+    std::optional<AdmissionOptions> admission;  // Shed calls over an adaptive concurrency limit when set
+    std::optional<RetentionOptions> retention;  // Evict old orders in the background when set
+    std::string archive_path;                   // Cold tier of the evicted orders, dropped when empty
+
+    // ListOrders responses, and StreamListOrders messages, of at least this
+    // many bytes go out compressed at compression_level, 0 never compresses.
+    // gRPC maps the level to an algorithm the client accepts.
+    std::size_t compression_threshold_bytes = 0;
+    grpc_compression_level compression_level = GRPC_COMPRESS_LEVEL_LOW;
+};
+
+// GetOrder is served as a raw (ByteBuffer) method so cached responses go out
+// without any protobuf work, every other method is a regular sync one.
+//
+// With an archive, evicted orders stay readable: GetOrder and
+// StreamOrderUpdates fall back to it, and UpdateOrder and DeleteOrder fault
+// the order back into the store first. ListOrders, StreamListOrders and
+// AggregateOrders only cover the orders in memory.
+class OrderService final : public osv1::OrderService::WithRawCallbackMethod_StreamOrderUpdates<
+                               osv1::OrderService::WithRawCallbackMethod_GetOrder<osv1::OrderService::Service>> {
    public:
-    OrderService();
+    explicit OrderService(OrderServiceOptions options = {});
+    ~OrderService();
 
     Status GetOrder(ServerContext* context, const osv1::GetOrderRequest* request, osv1::GetOrderResponse* response) override;
     Status ListOrders(ServerContext* context, const osv1::ListOrdersRequest* request, osv1::ListOrdersResponse* response) override;
+    Status StreamListOrders(ServerContext* context, const osv1::ListOrdersRequest* request,
+                            ServerWriter<osv1::ListOrdersResponse>* writer) override;
     Status CreateOrder(ServerContext* context, const osv1::CreateOrderRequest* request, osv1::CreateOrderResponse* response) override;
+    Status BatchCreateOrders(ServerContext* context, const osv1::BatchCreateOrdersRequest* request,
+                             osv1::BatchCreateOrdersResponse* response) override;
+    Status IngestOrders(ServerContext* context, ServerReader<osv1::CreateOrderRequest>* reader,
+                        osv1::IngestOrdersResponse* response) override;
     Status UpdateOrder(ServerContext* context, const osv1::UpdateOrderResponse* request, osv1::UpdateOrderRequest* response) override;
     Status DeleteOrder(ServerContext* context, const osv1::DeleteOrderRequest* request, osv1::DeleteOrderResponse* response) override;
-    Status StreamOrderUpdates(ServerContext* context, const osv1::StreamOrderUpdatesRequest* request,
-                              ServerWriter<osv1::StreamOrderUpdatesResponse>* writer) override;
+    Status AggregateOrders(ServerContext* context, const osv1::AggregateOrdersRequest* request,
+                           osv1::AggregateOrdersResponse* response) override;
+
+    // Raw GetOrder as registered with the sync server, runs GetOrderRaw
+    grpc::ServerUnaryReactor* GetOrder(grpc::CallbackServerContext* context, const grpc::ByteBuffer* request,
+                                       grpc::ByteBuffer* response) override;
+
+    // GetOrder on wire bytes. Answers from the response cache when it holds the
+    // order, otherwise runs GetOrder and caches the serialized response.
+    Status GetOrderRaw(ServerContext* context, const grpc::ByteBuffer* request, grpc::ByteBuffer* response);
+
+    // Raw StreamOrderUpdates as registered with the sync server. The feed's
+    // events are written as serialized, and the stream holds no thread while
+    // it waits for one.
+    grpc::ServerWriteReactor<grpc::ByteBuffer>* StreamOrderUpdates(grpc::CallbackServerContext* context,
+                                                                   const grpc::ByteBuffer* request) override;
+
+    // Subscribes to the order's change feed and builds the initial CREATED
+    // event, once admission control let the stream in. Subscribing before
+    // reading the order means no change can fall between the snapshot and the
+    // first event.
+    Status StartOrderUpdates(const grpc::ServerContextBase* ctx, const grpc::ByteBuffer* request,
+                             OrderFeed::Notifier notifier, std::unique_ptr<OrderFeed::Subscription>* subscription,
+                             OrderFeed::EventPtr* first);
+
+    // IngestOrders buffers this many requests before creating them
+    static constexpr int kIngestChunkSize = 1024;
+
+    // Admission and WAL check of a new IngestOrders stream, before its first
+    // read
+    Status StartIngest(const grpc::ServerContextBase* ctx);
+
+    // StreamListOrders messages hold this many orders unless the request's
+    // limit asks for another size
+    static constexpr int kListChunkSize = 100;
+
+    // Where a StreamListOrders call is between two messages
+    struct ListStream {
+        std::string user_id;
+        OrderQuery query;
+        int total = 0;
+        bool done = false;
+    };
+
+    // Admission check of a new StreamListOrders call, then fills its first
+    // message, sent even when no order matches. Sets the call's compression
+    // level when compression is on.
+    Status StartListStream(grpc::ServerContextBase* ctx, const osv1::ListOrdersRequest& request, ListStream* stream,
+                           osv1::ListOrdersResponse* response);
+
+    // Fills the next message, resuming past the last order sent. Returns
+    // false once every order was sent.
+    bool NextListChunk(ListStream* stream, osv1::ListOrdersResponse* response);
+
+    // Messages under the compression threshold go out uncompressed
+    grpc::WriteOptions ListChunkOptions(const osv1::ListOrdersResponse& response) const;
+
+    // Creates the orders in one pass over the store and appends their ids in
+    // request order. Does not wait for the WAL, FinishIngest does. Shared by
+    // the batch and streaming handlers and the async engine.
+    void CreateOrders(const google::protobuf::RepeatedPtrField<osv1::CreateOrderRequest>& requests,
+                      google::protobuf::RepeatedPtrField<std::string>* order_ids);
+
+    // Waits for the WAL to make the orders created by CreateOrders durable.
+    // A stream admitted before the WAL failed still ends OK, its orders are
+    // kept.
+    Status FinishIngest();
+
+    // Runs a handler that changes orders without blocking on the WAL, for the
+    // async engine's pollers. `done` gets the handler's status once its
+    // changes are durable: right away without a WAL, otherwise from the WAL's
+    // flusher thread. Faulting an archived order in still blocks, as reading
+    // the archive does.
+    void RunDeferred(const std::function<Status()>& handler, std::function<void(const Status&)> done);
+
+    // Ends the StreamOrderUpdates streams with UNAVAILABLE once their queued
+    // changes are sent, and turns new ones away. First step of a shutdown.
+    void Drain();
+
+    // Writes and fsyncs what the WAL holds, once no call is left to append
+    // to it. Returns false if the log failed to write.
+    bool Flush();
+
+    // Writes a snapshot of every order and, with a WAL, rotates the log so
+    // recovery only replays what changed after it. Returns false (and logs)
+    // on failure or when snapshots are not configured.
+    bool TakeSnapshot();
+
+    // nullptr when the cache is disabled
+    const ResponseCache* response_cache() const { return this->response_cache_.get(); }
+
+    // nullptr when admission control is disabled
+    const AdmissionControl* admission() const { return this->admission_.get(); }
+
+    // nullptr when retention is disabled
+    const OrderRetention* retention() const { return this->retention_.get(); }
+
+    // nullptr without an archive
+    const OrderArchive* archive() const { return this->archive_.get(); }
+
+    // True once the WAL failed to write, every change is turned away after
+    bool wal_failed() const { return this->wal_ && this->wal_->failed(); }
 
    private:
-    std::unordered_map<std::string, osv1::Order> orders_;
-    std::unordered_map<std::string, std::vector<osv1::Order>> user_orders_;
-    std::mutex mutex_;
+    static constexpr int kMaxPageSize = 1000;    // Upper bound for ListOrdersRequest.limit
+    static constexpr int kMaxBatchSize = 10000;        // Upper bound for BatchCreateOrdersRequest.orders
+    static constexpr int kMaxAggregateBuckets = 10000;  // Upper bound for BY_CREATED_AT groups
+
+    // Declared before the store so they outlive it publishing into them
+    OrderFeed feed_;
+    OrderColumns columns_;
+    OrderStore store_;
+    std::unique_ptr<OrderWal> wal_;
+    std::unique_ptr<ResponseCache> response_cache_;
+    std::unique_ptr<AdmissionControl> admission_;
+    std::mutex fault_mutex_;  // Faulting an order in against erasing its archived copy
+    std::unique_ptr<OrderArchive> archive_;
+    std::unique_ptr<OrderRetention> retention_;  // Its sweeper stops before anything it uses goes
+
+    std::optional<SnapshotOptions> snapshot_options_;
+    unsigned aggregate_threads_;
+    std::size_t compression_threshold_bytes_;
+    grpc_compression_level compression_level_;
+    std::atomic<uint64_t> changes_{0};  // Since the last snapshot
+    std::mutex snapshot_mutex_;         // One snapshot at a time
+    std::mutex stop_mutex_;
+    std::condition_variable stop_cv_;
+    bool stopping_ = false;
+    std::thread loader_;       // Copies the startup snapshot into the store
+    std::thread snapshotter_;  // Writes a snapshot every interval
+
+    // Unary calls hold `ticket` until they return, streams are only checked
+    Status admit(const grpc::ServerContextBase* ctx, std::size_t lane, AdmissionControl::Ticket* ticket);
+    Status check_admission(const grpc::ServerContextBase* ctx, std::size_t lane);
+    Status get_order_raw(const grpc::ServerContextBase* ctx, const grpc::ByteBuffer* request,
+                         grpc::ByteBuffer* response);
+
+    void fill_chunk(const OrderStore::Page& page, ListStream* stream, osv1::ListOrdersResponse* response) const;
+
+    bool fault_in(const std::string& order_id);
+    bool erase_archived(const std::string& order_id);
+
+    bool restore(const OrderServiceOptions& options);
+    void snapshot_loop();
+    void seed_mock_data();
+    Status check_wal() const;
+    void commit();
 
+    static osv1::Order build_order(const osv1::CreateOrderRequest& request, int64_t now);
     static std::string generate_id();
     static int64_t get_current_timestamp();
+    static Status parse_filters(const google::protobuf::Map<std::string, std::string>& filters, OrderQuery* query);
+    static Status parse_aggregate(const osv1::AggregateOrdersRequest& request, AggregateQuery* query);
 };
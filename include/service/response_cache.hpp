@@ -0,0 +1,93 @@
+#pragma once
+
+#include <grpcpp/support/byte_buffer.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Bounded cache of serialized responses, keyed by order id.
+//
+// Values are grpc::ByteBuffers, whose slices are reference counted: a hit
+// hands out the cached bytes without copying or serializing them.
+//
+// The cache is split into shards by key hash, each evicting with CLOCK. A hit
+// only sets the entry's reference bit under the shard's shared lock. When an
+// insert pushes the shard over its share of the capacity, the clock hand gives
+// referenced entries a second chance and evicts the first unreferenced one.
+//
+// A fill can race with the change that invalidates it and put back bytes of
+// the old record. Lookup() returns the shard's invalidation epoch on a miss,
+// and Insert() drops the fill if the shard saw an invalidation since then.
+class ResponseCache {
+   public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t inserts = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+    };
+
+    static constexpr std::size_t kDefaultShardCount = 16;
+
+    explicit ResponseCache(std::size_t capacity_bytes, std::size_t shard_count = kDefaultShardCount);
+
+    ResponseCache(const ResponseCache&) = delete;
+    ResponseCache& operator=(const ResponseCache&) = delete;
+
+    // True and `value` set on a hit. On a miss `epoch` is set for Insert().
+    bool Lookup(std::string_view key, grpc::ByteBuffer* value, uint64_t* epoch);
+
+    // Caches `value` unless `key` was invalidated since the Lookup() that
+    // returned `epoch`, or the value is larger than a shard
+    void Insert(std::string_view key, const grpc::ByteBuffer& value, uint64_t epoch);
+
+    void Invalidate(std::string_view key);
+
+    Stats stats() const;
+    std::size_t capacity() const { return this->capacity_; }
+
+   private:
+    // Accounted on top of the key and value bytes of every entry
+    static constexpr std::size_t kEntryOverhead = 128;
+
+    struct Entry {
+        std::string key;
+        grpc::ByteBuffer value;
+        std::size_t bytes = 0;
+        std::atomic<bool> referenced{false};
+    };
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string_view, std::size_t> index;  // Key -> slot, keys point into the entries
+        std::vector<std::unique_ptr<Entry>> slots;                // The clock, null slots are free
+        std::vector<std::size_t> free_slots;
+        std::size_t hand = 0;
+        std::size_t bytes = 0;
+        uint64_t epoch = 0;  // Bumped on every invalidation
+
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> inserts{0};
+        std::atomic<uint64_t> evictions{0};
+        std::atomic<uint64_t> invalidations{0};
+    };
+
+    std::size_t capacity_;
+    std::size_t shard_capacity_;
+    std::vector<Shard> shards_;
+
+    Shard& shard_for(std::string_view key);
+    static void remove(Shard& shard, std::size_t slot);
+    static void evict_one(Shard& shard);
+};
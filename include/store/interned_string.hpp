@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+// Reference-counted handle to a string in a process-wide intern pool.
+//
+// Equal strings share one pooled copy, so a value repeated across millions of
+// orders ("Laptop", a user's address) is stored once. A handle is a single
+// pointer; copying one bumps an atomic count and the pooled copy is freed when
+// the last handle goes away. Reading the value takes no lock. The empty string
+// is not pooled.
+class InternedString {
+   public:
+    struct Stats {
+        std::size_t strings = 0;
+        std::size_t bytes = 0;  // Characters held by the pool
+    };
+
+    InternedString() = default;
+    explicit InternedString(std::string_view value);
+
+    InternedString(const InternedString& other) : entry_(other.entry_) { retain(this->entry_); }
+    InternedString(InternedString&& other) noexcept : entry_(std::exchange(other.entry_, nullptr)) {}
+
+    InternedString& operator=(InternedString other) noexcept {
+        std::swap(this->entry_, other.entry_);
+        return *this;
+    }
+
+    ~InternedString() { release(this->entry_); }
+
+    std::string_view view() const {
+        return this->entry_ ? std::string_view(this->entry_->data(), this->entry_->size) : std::string_view();
+    }
+
+    // Pooled strings are unique, so handles compare by address
+    bool operator==(const InternedString& other) const { return this->entry_ == other.entry_; }
+    bool operator!=(const InternedString& other) const { return this->entry_ != other.entry_; }
+
+    static Stats PoolStats();
+
+   private:
+    struct Entry {
+        std::atomic<uint32_t> refs;
+        uint32_t size;
+        uint32_t shard;
+
+        const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    };
+
+    Entry* entry_ = nullptr;
+
+    static void retain(Entry* entry) {
+        if (entry) {
+            entry->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    static void release(Entry* entry);
+
+    friend struct InternPool;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "order_service/order.pb.h"
+#include "store/order_id.hpp"
+#include "store/order_store.hpp"
+
+namespace osv1 = order_service::v1;
+
+// Cold tier of the store: an append-only file of the orders evicted from
+// memory, with an in-memory index from order key to record so a lookup is a
+// single pread. An archived order costs about 64 bytes of memory.
+//
+// File layout: an 8 byte header ("OARC" + u32 version) followed by records
+// framed as in OrderWal,
+//   u32 payload length | u32 crc32(payload) | payload
+// where the payload is
+//   u8 op | u32 order id length | order id | u32 user id length | user id | serialized osv1::Order (put only)
+// The last record of an order wins. Opening the file rebuilds the index from
+// the ids alone, without parsing any order, and cuts off a torn tail. The
+// file only grows: the space of orders faulted back in or erased is not
+// reclaimed.
+class OrderArchive {
+   public:
+    // Opens the archive at `path`, creating it if needed. Throws
+    // std::runtime_error on I/O errors or if the file is not an archive.
+    explicit OrderArchive(std::string path);
+    ~OrderArchive();
+
+    OrderArchive(const OrderArchive&) = delete;
+    OrderArchive& operator=(const OrderArchive&) = delete;
+
+    // Writes the orders in one write and fdatasyncs them. Returns false,
+    // leaving the archive as it was, if the write failed.
+    bool Append(const std::vector<OrderStore::OrderPtr>& orders);
+
+    // Fills `order`, and `user_id` unless null. Returns false if the order is
+    // not archived or its record cannot be read.
+    bool Get(std::string_view order_id, osv1::Order* order, std::string* user_id = nullptr) const;
+
+    bool Contains(std::string_view order_id) const;
+
+    // Writes and syncs a tombstone, so the order stays gone after a restart.
+    // Returns false if the order is not archived or the write failed.
+    bool Erase(std::string_view order_id);
+
+    std::size_t size() const;
+    uint64_t file_bytes() const;
+    const std::string& path() const { return this->path_; }
+
+   private:
+    enum Op : uint8_t { kPut = 1, kErase = 2 };
+
+    static constexpr uint32_t kMagic = 0x4352414f;  // "OARC"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr std::size_t kHeaderSize = 8;
+    static constexpr std::size_t kRecordHeaderSize = 8;
+
+    // Where a put record is, its header included
+    struct Location {
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    std::string path_;
+    int fd_ = -1;
+
+    std::mutex write_mutex_;  // One writer at a time, readers never take it
+    uint64_t end_ = 0;        // Guarded by write_mutex_
+
+    mutable std::shared_mutex index_mutex_;
+    std::unordered_map<OrderId, Location, OrderIdHash> index_;
+    uint64_t file_bytes_ = 0;  // Guarded by index_mutex_
+
+    void rebuild_index();
+    bool write_out(const std::string& data);
+    static void frame(std::string& out, Op op, std::string_view order_id, std::string_view user_id,
+                      const osv1::Order* order);
+};
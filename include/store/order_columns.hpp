@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "order_service/order.pb.h"
+#include "store/order_id.hpp"
+#include "store/order_record.hpp"
+
+namespace osv1 = order_service::v1;
+
+// Filter and grouping for OrderColumns::Aggregate
+struct AggregateQuery {
+    enum class GroupBy { kNone, kStatus, kCreatedAt };
+
+    GroupBy group_by = GroupBy::kNone;
+    std::vector<osv1::OrderStatus> statuses;  // All statuses when empty
+    std::optional<int64_t> created_after;     // Inclusive, unix seconds
+    std::optional<int64_t> created_before;    // Exclusive, unix seconds
+
+    // kCreatedAt buckets are this wide and start at created_after. Needs both
+    // bounds, and the caller keeps the number of buckets in check.
+    int64_t bucket_seconds = 0;
+};
+
+struct OrderAggregate {
+    int64_t key = 0;  // The status or the start of the bucket, 0 without grouping
+    uint64_t count = 0;
+    double amount = 0.0;
+    uint64_t items = 0;  // Line items
+};
+
+// Column copies of the fields orders are aggregated on (amount, status,
+// created_at, item count), kept in sync with the store by registering Apply()
+// as a load observer.
+//
+// Each partition holds its columns as plain arrays, one row per order, and a
+// map from order key to row; erasing moves the last row into the hole.
+// Partitions are picked with the low bits of the key's hash, as the store
+// picks shards, so with as many partitions as shards a partition only ever
+// has the writers of one shard. Aggregate() reads the arrays in blocks with
+// branch-free loops the compiler turns into SIMD, never the records.
+class OrderColumns {
+   public:
+    static constexpr std::size_t kDefaultPartitionCount = 64;
+
+    explicit OrderColumns(std::size_t partition_count = kDefaultPartitionCount);
+
+    OrderColumns(const OrderColumns&) = delete;
+    OrderColumns& operator=(const OrderColumns&) = delete;
+
+    // Mirrors one store change, see OrderStore::Observer
+    void Apply(const OrderRecord::Ptr& before, const OrderRecord::Ptr& after);
+
+    // Totals of the orders matching `query`, sorted by key. kNone returns a
+    // single group, the others leave out groups without orders. Orders whose
+    // status is not an OrderStatus value never match. Partitions are split
+    // across up to `threads` threads (0 = hardware concurrency), small scans
+    // stay on the calling one.
+    std::vector<OrderAggregate> Aggregate(const AggregateQuery& query, unsigned threads = 1) const;
+
+    // Sum of a[i] * b[i], the kernel of Aggregate(). Fewer than 8 products are
+    // added in order, so small inputs total exactly as a plain loop would.
+    static double SumProducts(const double* a, const double* b, std::size_t n);
+
+    std::size_t size() const;
+    std::size_t allocated_bytes() const;
+
+   private:
+    struct alignas(64) Partition {
+        mutable std::shared_mutex mutex;
+        std::vector<double> amount;
+        std::vector<double> created_at;  // Exact below 2^53 seconds, compared without AVX
+        std::vector<int32_t> items;
+        std::vector<uint8_t> status_bit;  // 1 << status, 0 when not an OrderStatus value
+        std::vector<OrderId> keys;
+        std::unordered_map<OrderId, uint32_t, OrderIdHash> rows;
+    };
+
+    // Query bounds resolved once for every block
+    struct Scan;
+
+    static constexpr std::size_t kBlockRows = 1024;         // Per pass of the kernels, fits in L1
+    static constexpr std::size_t kRowsPerThread = 1 << 17;  // Less is not worth a thread
+
+    static_assert(osv1::OrderStatus_ARRAYSIZE <= 8, "status_bit holds a bit per OrderStatus");
+
+    std::size_t partition_mask_;
+    std::unique_ptr<Partition[]> partitions_;
+
+    Partition& partition(const OrderId& key) const;
+    static void set_row(Partition& partition, std::size_t row, const OrderRecord& order);
+    static void erase_row(Partition& partition, std::size_t row);
+    static void scan_partition(const Partition& partition, const Scan& scan, OrderAggregate* groups);
+};
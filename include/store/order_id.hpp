@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// 128-bit order id in the UUIDv7 layout (RFC 9562):
+//   48 bits unix milliseconds | version 7 | 74 bits per-thread sequence
+// with the variant bits in between. Ids sort by creation time to the
+// millisecond across threads, and strictly increase within a thread.
+//
+// Each thread draws a random starting point from its own generator every
+// millisecond and counts up from it, so generating an id takes no lock and
+// touches no shared state.
+struct OrderId {
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    static constexpr std::size_t kTextSize = 36;  // 8-4-4-4-12 hex digits
+
+    static OrderId Generate();
+
+    // Accepts the 36 char form in either case, returns false on anything else
+    static bool Parse(std::string_view text, OrderId* id);
+
+    // Lowercase only, the form Format writes, so the text converts back as is
+    static bool ParseCanonical(std::string_view text, OrderId* id);
+
+    // Writes kTextSize lowercase chars to `out`, no terminator
+    void Format(char* out) const;
+    std::string ToString() const;
+
+    // FNV-1a of an id's text, stable across builds unlike std::hash. Keys the
+    // ids that are not UUIDs and indexes the snapshots.
+    static uint64_t HashText(std::string_view text);
+
+    uint64_t unix_ms() const { return this->hi >> 16; }
+
+    bool operator==(const OrderId& other) const { return this->hi == other.hi && this->lo == other.lo; }
+    bool operator!=(const OrderId& other) const { return !(*this == other); }
+    bool operator<(const OrderId& other) const {
+        return this->hi < other.hi || (this->hi == other.hi && this->lo < other.lo);
+    }
+};
+
+struct OrderIdHash {
+    std::size_t operator()(const OrderId& id) const {
+        // The sequence bits are random, folding in the time is enough
+        return static_cast<std::size_t>(id.lo ^ (id.hi * 0x9e3779b97f4a7c15ULL));
+    }
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "order_service/order.pb.h"
+#include "store/interned_string.hpp"
+#include "store/order_id.hpp"
+
+namespace osv1 = order_service::v1;
+
+// Immutable, flat in-memory form of an order, the store's unit of storage.
+//
+// Everything lives in one allocation: a fixed header, the items, and then
+// the text of any id that is not a UUID. Ids that are UUIDs take 16 bytes;
+// the address, user id and item names are interned. Records are reference
+// counted in place and shared through Ptr, and converted to and from
+// osv1::Order only where an order enters or leaves the service.
+class OrderRecord {
+   public:
+    class Ptr {
+       public:
+        Ptr() = default;
+        Ptr(std::nullptr_t) {}
+        Ptr(const Ptr& other) : record_(other.record_) { retain(this->record_); }
+        Ptr(Ptr&& other) noexcept : record_(std::exchange(other.record_, nullptr)) {}
+
+        Ptr& operator=(Ptr other) noexcept {
+            std::swap(this->record_, other.record_);
+            return *this;
+        }
+
+        ~Ptr() { release(this->record_); }
+
+        const OrderRecord* get() const { return this->record_; }
+        const OrderRecord* operator->() const { return this->record_; }
+        const OrderRecord& operator*() const { return *this->record_; }
+        explicit operator bool() const { return this->record_ != nullptr; }
+
+        bool operator==(std::nullptr_t) const { return this->record_ == nullptr; }
+        bool operator!=(std::nullptr_t) const { return this->record_ != nullptr; }
+
+       private:
+        OrderRecord* record_ = nullptr;
+
+        explicit Ptr(OrderRecord* record) : record_(record) {}
+
+        static void retain(OrderRecord* record) {
+            if (record) {
+                record->refs_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        static void release(OrderRecord* record);
+
+        friend class OrderRecord;
+    };
+
+    OrderRecord(const OrderRecord&) = delete;
+    OrderRecord& operator=(const OrderRecord&) = delete;
+
+    static Ptr Create(std::string_view user_id, const osv1::Order& order);
+    static Ptr Create(InternedString user_id, const osv1::Order& order);
+
+    // The key an order id is stored under: the id itself when it is a UUID in
+    // canonical (lowercase) form, otherwise a hash of the text with the
+    // version bits cleared, so the two kinds of key never meet
+    static OrderId KeyOf(std::string_view order_id);
+
+    // Replaces the contents of `order`
+    void ToProto(osv1::Order* order) const;
+
+    const OrderId& key() const { return this->key_; }
+    std::string id() const;
+
+    // Whether `order_id`, which has the same key, really is this order's id.
+    // Only false when the hashes of two non-UUID ids collide.
+    bool HasId(std::string_view order_id) const;
+
+    std::string_view user_id() const { return this->user_id_.view(); }
+    const InternedString& interned_user_id() const { return this->user_id_; }
+    std::string_view address() const { return this->address_.view(); }
+    osv1::OrderStatus status() const { return static_cast<osv1::OrderStatus>(this->status_); }
+    double amount() const { return this->amount_; }
+    int64_t created_at() const { return this->created_at_; }
+    int64_t updated_at() const { return this->updated_at_; }
+    std::size_t item_count() const { return this->item_count_; }
+
+    // Heap bytes of this record, interned strings not included
+    std::size_t allocated_bytes() const;
+
+   private:
+    // Ids that are UUIDs are kept in binary, any other one as text in the tail
+    static constexpr uint32_t kBinaryId = UINT32_MAX;
+    static constexpr uint64_t kVersionMask = uint64_t{0xf} << 12;  // In OrderId::hi
+
+    struct Item {
+        InternedString name;
+        double price;
+        int32_t quantity;
+        uint32_t id_size;  // Text bytes in the tail, or kBinaryId for 16 bytes
+    };
+
+    OrderId key_;
+    double amount_;
+    int64_t created_at_;
+    int64_t updated_at_;
+    InternedString user_id_;
+    InternedString address_;
+    mutable std::atomic<uint32_t> refs_{1};
+    uint32_t item_count_;
+    uint32_t id_size_;  // Text bytes in the tail, or kBinaryId when key_ is the id
+    int32_t status_;
+
+    OrderRecord() = default;
+    ~OrderRecord() = default;
+
+    Item* items() { return reinterpret_cast<Item*>(this + 1); }
+    const Item* items() const { return reinterpret_cast<const Item*>(this + 1); }
+    char* tail() { return reinterpret_cast<char*>(this->items() + this->item_count_); }
+    const char* tail() const { return reinterpret_cast<const char*>(this->items() + this->item_count_); }
+
+    static bool parse_uuid(std::string_view text, OrderId* id);
+};
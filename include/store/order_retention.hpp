@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "order_service/order.pb.h"
+#include "store/order_archive.hpp"
+#include "store/order_store.hpp"
+
+namespace osv1 = order_service::v1;
+
+struct RetentionOptions {
+    // Orders in these statuses go once they were last changed this long ago
+    std::map<osv1::OrderStatus, std::chrono::seconds> ttls;
+
+    // Above it the least recently changed orders go as well, 0 = no budget
+    std::size_t memory_budget_bytes = 0;
+
+    std::chrono::milliseconds step_time{1};       // Longest a sweep step walks the store
+    std::chrono::milliseconds step_interval{10};  // Pause between steps
+};
+
+// Evicts orders from the store in the background so its memory stays bounded.
+//
+// A sweeper thread walks the order shards a slice of table slots at a time,
+// holding one shard's read lock for a slice only, and stops each step after
+// step_time, so neither readers nor writers ever wait on more than a slice.
+// An order is evicted when its status has a TTL and it was last changed
+// (updated_at, or created_at when later) longer ago than that; or, while the
+// store is over its memory budget, when it is among the least recently
+// changed ones.
+//
+// The budget is enforced a pass behind. Each pass over the store adds up the
+// bytes of its tables and records, as OrderStore::allocated_bytes counts
+// them, and samples when the orders were last changed. A pass that ends over
+// budget sets a cutoff from the samples, and the next pass evicts the orders
+// changed before it and a share of those changed at it, to go 10% under the
+// budget.
+//
+// Evicted orders are written to the archive, when there is one, and synced
+// before they leave the store, so they can be faulted back in. The WAL, the
+// columns and the response cache see an eviction as an erase, the
+// StreamOrderUpdates feed does not: the order still exists and its streams
+// stay open. An order changed after it was picked stays.
+class OrderRetention {
+   public:
+    // Starts the sweeper. `archive` may be null, evicted orders are dropped
+    // then; it must outlive this object, as must `store`.
+    OrderRetention(RetentionOptions options, OrderStore& store, OrderArchive* archive);
+    ~OrderRetention();
+
+    OrderRetention(const OrderRetention&) = delete;
+    OrderRetention& operator=(const OrderRetention&) = delete;
+
+    // Parses "STATUS=<n><unit>,..." with units s, m, h and d, for example
+    // "DELIVERED=30d,CANCELLED=7d". Throws std::invalid_argument.
+    static std::map<osv1::OrderStatus, std::chrono::seconds> ParseTtls(const std::string& text);
+
+    // Evictions and the store size of the last pass, in Prometheus text format
+    void WritePrometheus(std::ostream& out) const;
+
+   private:
+    static constexpr std::size_t kSlotsPerSlice = 1024;
+    static constexpr std::size_t kMaxStepEvictions = 1024;  // Bounds an archive write
+    static constexpr std::size_t kSamples = 1024;
+    static constexpr double kBudgetHeadroom = 0.9;
+    static constexpr uint64_t kTieBuckets = 1024;
+
+    RetentionOptions options_;
+    OrderStore& store_;
+    OrderArchive* archive_;
+    std::vector<int64_t> ttl_by_status_;  // Seconds, -1 where the status has none
+
+    // Sweeper state, only touched by its thread
+    std::size_t shard_ = 0;
+    std::size_t slot_ = 0;
+    std::size_t pass_bytes_ = 0;  // Of the tables
+    std::size_t pass_record_bytes_ = 0;
+    uint64_t pass_seen_ = 0;
+    std::vector<int64_t> samples_;  // Reservoir of last change times
+    std::minstd_rand random_;
+    std::optional<int64_t> budget_cutoff_;  // Set by the last pass when it ended over budget
+    uint64_t tie_buckets_ = 0;              // Of kTieBuckets, for the orders changed at the cutoff
+
+    std::atomic<uint64_t> evicted_{0};
+    std::atomic<uint64_t> kept_{0};  // Changed after being picked
+    std::atomic<uint64_t> archive_failures_{0};
+    std::atomic<uint64_t> passes_{0};
+    std::atomic<std::size_t> bytes_{0};
+
+    std::mutex stop_mutex_;
+    std::condition_variable stop_cv_;
+    bool stopping_ = false;
+    std::thread sweeper_;
+
+    void sweep_loop();
+    void step();
+    bool expired(const OrderRecord& order, int64_t now);
+    void sample(int64_t changed);
+    void end_pass();
+    void evict(const std::vector<OrderStore::OrderPtr>& orders);
+
+    static int64_t last_change(const OrderRecord& order);
+};
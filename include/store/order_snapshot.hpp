@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "order_service/order.pb.h"
+
+namespace osv1 = order_service::v1;
+
+class OrderStore;
+
+struct SnapshotOptions {
+    std::string path;
+    std::chrono::seconds interval{300};  // Skipped when nothing changed since the last one
+    unsigned load_threads = 0;           // 0 = hardware concurrency
+};
+
+// Read-only, memory-mapped point-in-time image of an OrderStore.
+//
+// File layout, integers in host byte order:
+//   header  u32 magic ("OSNP") | u32 version | u64 count | u64 index offset | i64 created at | 32 bytes reserved
+//   records u32 id length | u32 user id length | u32 order length | id | user id | serialized osv1::Order
+//   index   count x { u64 OrderId::HashText(order id) | u64 record offset }, sorted by hash
+// Records are written in index order, so the i-th index entry points at the
+// i-th record and a range of entries is a contiguous range of the file.
+//
+// Opening maps the file and checks the header; nothing is parsed until an
+// order is looked up, so opening costs the same for any number of orders.
+class OrderSnapshot {
+   public:
+    struct Record {
+        std::string_view order_id;
+        std::string_view user_id;
+        std::string_view order;  // Serialized osv1::Order
+    };
+
+    ~OrderSnapshot();
+
+    OrderSnapshot(const OrderSnapshot&) = delete;
+    OrderSnapshot& operator=(const OrderSnapshot&) = delete;
+
+    // Returns nullptr if there is no snapshot at `path`, throws
+    // std::runtime_error if the file is not a valid snapshot
+    static std::shared_ptr<const OrderSnapshot> Open(const std::string& path);
+
+    // Writes every order of `store` to `path` through a temporary file that
+    // replaces it atomically once it is on disk. Returns the number of orders
+    // written; throws std::runtime_error on I/O errors.
+    static std::size_t Write(const std::string& path, const OrderStore& store);
+
+    // Binary search over the index, false if the order is not in the snapshot
+    bool Find(std::string_view order_id, Record* record) const;
+    static bool Parse(const Record& record, osv1::Order* order);
+
+    // The i-th record in file order
+    Record at(std::size_t i) const;
+
+    std::size_t size() const { return this->count_; }
+    int64_t created_at() const { return this->created_at_; }
+
+   private:
+    struct IndexEntry {
+        uint64_t hash;
+        uint64_t offset;
+    };
+
+    static constexpr uint32_t kMagic = 0x504e534f;  // "OSNP"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr std::size_t kHeaderSize = 64;
+    static constexpr std::size_t kRecordHeaderSize = 12;
+
+    OrderSnapshot() = default;
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t count_ = 0;
+    const IndexEntry* index_ = nullptr;
+    int64_t created_at_ = 0;
+};
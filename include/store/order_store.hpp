@@ -0,0 +1,242 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "order_service/order.pb.h"
+#include "store/order_id.hpp"
+#include "store/order_record.hpp"
+#include "store/order_table.hpp"
+
+namespace osv1 = order_service::v1;
+
+class OrderSnapshot;
+
+// Where a walk over a user's orders stopped, see OrderQuery::after
+struct OrderCursor {
+    int64_t created_at;
+    OrderId key;
+};
+
+// Filter and page selection for OrderStore::Query
+struct OrderQuery {
+    std::optional<osv1::OrderStatus> status;
+    std::optional<int64_t> created_after;   // Inclusive, unix seconds
+    std::optional<int64_t> created_before;  // Exclusive, unix seconds
+    std::string address_prefix;
+
+    std::size_t offset = 0;
+    std::size_t limit = 10;
+
+    // Starts the page past this order instead of skipping `offset` matches,
+    // and leaves the total uncounted, so walking every match a page at a time
+    // costs each match once rather than once per page
+    std::optional<OrderCursor> after;
+};
+
+// Sharded in-memory order store.
+//
+// Orders are hash-partitioned by id across N shards and the per-user index is
+// partitioned by user id, each shard guarded by its own reader/writer lock.
+// Each order is stored exactly once, as a compact OrderRecord in the shard's
+// open-addressing table; the per-user index only holds order keys, so it
+// always resolves to the live record and never keeps a deleted one alive.
+//
+// Published records are immutable: readers grab a reference under a shared
+// lock and convert it to protobuf after releasing it, writers publish a fresh
+// record (copy-on-write). Reads never block each other and writes that land on
+// different shards run in parallel.
+//
+// Writers always take the order shard before the user shard and keep it until
+// the user index is updated, so index changes for one order apply in the same
+// order as the record changes. Readers never hold both.
+class OrderStore {
+   public:
+    using OrderPtr = OrderRecord::Ptr;
+    using ScanFn = std::function<void(const OrderPtr& order)>;
+
+    // Called after every change with the record before and after it: before
+    // is null for an insert, after is null for an erase. Observers run while
+    // the order's shard is write locked, so they see the changes of one order
+    // in commit order and must not call back into the store.
+    using Observer = std::function<void(const OrderPtr& before, const OrderPtr& after)>;
+
+    struct NewOrder {
+        std::string user_id;
+        osv1::Order order;
+    };
+
+    struct Page {
+        std::vector<OrderPtr> orders;
+        std::size_t total = 0;  // Matches across all pages
+    };
+
+    static constexpr std::size_t kDefaultShardCount = 64;
+
+    explicit OrderStore(std::size_t shard_count = kDefaultShardCount);
+
+    OrderStore(const OrderStore&) = delete;
+    OrderStore& operator=(const OrderStore&) = delete;
+
+    // Returns nullptr if the order does not exist
+    OrderPtr Get(std::string_view order_id) const;
+
+    // All orders of a user, oldest first
+    std::vector<OrderPtr> ListByUser(const std::string& user_id) const;
+
+    // Fills `page` with the orders of a user matching `query`, oldest first.
+    // Status and created_at are answered from the index, so their cost is
+    // proportional to the matches; the address prefix is checked against the
+    // records that pass the indexed filters. Returns false if the user has no
+    // orders at all.
+    bool Query(const std::string& user_id, const OrderQuery& query, Page* page) const;
+
+    // Cursor resuming a walk past `order`, for OrderQuery::after
+    static OrderCursor CursorAfter(const OrderRecord& order) { return {order.created_at(), order.key()}; }
+
+    // Returns false if an order with the same id already exists
+    bool Insert(const std::string& user_id, const osv1::Order& order);
+    bool Update(const osv1::Order& order);
+    bool Erase(std::string_view order_id);
+
+    // Evicts the order only while `expected` is still its record, so an
+    // eviction never drops a change made after the order was picked.
+    // Observers registered without `evictions` do not hear about it.
+    bool EraseIf(const OrderPtr& expected);
+
+    // Inserts an evicted order back, as Insert. Observers registered without
+    // `evictions` do not hear about it either.
+    bool Restore(const std::string& user_id, const osv1::Order& order);
+
+    // Inserts many orders in one pass over the shards: each order shard is
+    // locked once for all of its orders, and while it is held each user shard
+    // is locked once for all of their index entries. Observers are called as
+    // for Insert. Returns, in input order, whether each order was inserted;
+    // false when an order with the same id already exists.
+    std::vector<bool> InsertBatch(const std::vector<NewOrder>& orders);
+
+    // Inserts the order, or replaces the record with the same id
+    void Put(const std::string& user_id, const osv1::Order& order);
+
+    // Not synchronised with the writers, register observers before serving.
+    // With `loads` the observer also hears, as an insert, about every
+    // snapshot order copied into the store, for state that must cover all of
+    // the orders rather than just the changes. Without `evictions` it does
+    // not hear about EraseIf and Restore, for state about the orders that
+    // exist rather than the ones in memory.
+    void AddObserver(Observer observer, bool loads = false, bool evictions = true);
+
+    // Serves the orders of `snapshot` until LoadSnapshot() has copied them
+    // in. ListByUser, Query, Scan and size need the full user index and wait
+    // for the load to finish. Call once, on an empty store, before serving.
+    void AttachSnapshot(std::shared_ptr<const OrderSnapshot> snapshot);
+
+    // Copies every snapshot order that was not written or erased since it was
+    // attached into the store on `threads` threads (0 = hardware concurrency),
+    // then drops the snapshot. Only load observers are called. Returns the
+    // number of orders loaded.
+    std::size_t LoadSnapshot(unsigned threads = 0);
+
+    // Blocks until LoadSnapshot() has finished, returns at once when no
+    // snapshot is attached
+    void WaitLoaded() const;
+
+    // Calls `fn` for every order. Each shard is copied under its shared lock
+    // and `fn` runs after the lock is released, so a slow consumer never holds
+    // up writers. Orders changed during the scan may be seen before or after.
+    void Scan(const ScanFn& fn) const;
+
+    // One step of an incremental walk over order shard `shard`: calls `fn`
+    // for the orders in slots [begin, end) of its table while the shard is
+    // read locked, so `fn` must be quick and must not call back into the
+    // store. Returns the table's capacity, where the walk over the shard
+    // ends, and sets `table_bytes` to the table's heap bytes. Orders move
+    // when the table grows, so a walk may see one twice or miss it.
+    std::size_t ScanSlots(std::size_t shard, std::size_t begin, std::size_t end, const ScanFn& fn,
+                          std::size_t* table_bytes = nullptr) const;
+
+    std::size_t size() const;
+    std::size_t shard_count() const { return this->shard_mask_ + 1; }
+
+    // Heap bytes of the records and order tables, interned strings and the
+    // user index not included
+    std::size_t allocated_bytes() const;
+
+   private:
+    // (created_at, order key), so index sets iterate oldest first
+    using IndexKey = std::pair<int64_t, OrderId>;
+    using IndexSet = std::set<IndexKey>;
+
+    struct UserIndex {
+        IndexSet by_created;
+        std::map<int, IndexSet> by_status;
+
+        void add(const OrderRecord& order);
+        void remove(const OrderRecord& order);
+    };
+
+    // Keep every shard on its own cache line so lock traffic on one shard
+    // does not invalidate its neighbours
+    struct alignas(64) OrderShard {
+        mutable std::shared_mutex mutex;
+        OrderTable orders;
+        std::unordered_set<OrderId, OrderIdHash> erased;  // Snapshot orders erased before they were loaded
+    };
+
+    struct alignas(64) UserShard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, UserIndex> users;
+    };
+
+    std::size_t shard_mask_;
+    std::unique_ptr<OrderShard[]> order_shards_;
+    std::unique_ptr<UserShard[]> user_shards_;
+    std::vector<Observer> observers_;
+    std::vector<Observer> load_observers_;      // Also in observers_
+    std::vector<Observer> eviction_observers_;  // Also in observers_
+
+    // Accessed with std::atomic_load/atomic_store, null once loaded
+    std::shared_ptr<const OrderSnapshot> snapshot_;
+    mutable std::mutex load_mutex_;
+    mutable std::condition_variable load_cv_;
+    std::atomic<bool> loading_{false};  // Checked without the mutex on every read
+
+    OrderShard& order_shard(const OrderId& key) const;
+    UserShard& user_shard(std::string_view user_id) const;
+    std::size_t user_shard_index(std::string_view user_id) const;
+
+    // Looks the order up with its shard write locked, copying it in from the
+    // snapshot if it was not loaded yet. Returns nullptr if it does not exist.
+    OrderPtr* find_locked(OrderShard& shard, const OrderId& key, std::string_view order_id);
+
+    bool insert(const std::string& user_id, const osv1::Order& order, bool restored);
+    void index_add(const OrderRecord& order);
+    void index_remove(const OrderRecord& order);
+    void index_replace(const OrderRecord& old_order, const OrderRecord& new_order);
+    void notify(const OrderPtr& before, const OrderPtr& after) const;
+    void notify_residency(const OrderPtr& before, const OrderPtr& after) const;  // EraseIf and Restore
+    void notify_loaded(const OrderPtr& order) const;
+    std::vector<OrderPtr> resolve(const std::vector<OrderId>& keys) const;
+
+    // Index keys an address-filtered cursor query reads per user shard lock
+    static constexpr std::size_t kMinFilteredBatch = 256;
+
+    bool query_after(const std::string& user_id, const OrderQuery& query, Page* page) const;
+    static bool index_range(const UserIndex& user, const OrderQuery& query, IndexSet::const_iterator* first,
+                            IndexSet::const_iterator* last);
+};
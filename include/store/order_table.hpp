@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "store/order_id.hpp"
+#include "store/order_record.hpp"
+
+// Open-addressing hash table from an order's key to its record, one per store
+// shard. Slots are {key, record} pairs, 24 bytes each, in one array probed
+// linearly, so a lookup usually costs one cache line before the record
+// itself. Erase shifts the following entries back instead of leaving
+// tombstones. Not synchronised, the store shard's lock guards it.
+class OrderTable {
+   public:
+    OrderTable() = default;
+
+    OrderTable(const OrderTable&) = delete;
+    OrderTable& operator=(const OrderTable&) = delete;
+
+    // nullptr if there is no record with this key
+    OrderRecord::Ptr* Find(const OrderId& key);
+    const OrderRecord::Ptr* Find(const OrderId& key) const;
+
+    // Returns false, leaving the table as it is, if the key is taken
+    bool Insert(OrderRecord::Ptr record);
+
+    // Returns the removed record, or nullptr if there was none
+    OrderRecord::Ptr Erase(const OrderId& key);
+
+    template <typename Fn>
+    void ForEach(Fn&& fn) const {
+        this->ForEachIn(0, this->capacity(), fn);
+    }
+
+    // ForEach over the slots [begin, end), for walks that take the table a
+    // slice at a time
+    template <typename Fn>
+    void ForEachIn(std::size_t begin, std::size_t end, Fn&& fn) const {
+        end = std::min(end, this->capacity());
+        for (std::size_t i = begin; i < end; i++) {
+            if (this->slots_[i].record) {
+                fn(this->slots_[i].record);
+            }
+        }
+    }
+
+    std::size_t size() const { return this->size_; }
+    std::size_t capacity() const { return this->slots_ ? this->mask_ + 1 : 0; }
+    std::size_t allocated_bytes() const { return this->capacity() * sizeof(Slot); }
+
+   private:
+    struct Slot {
+        OrderId key;
+        OrderRecord::Ptr record;  // Null for an empty slot
+    };
+
+    static constexpr std::size_t kMinCapacity = 16;
+
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t mask_ = 0;
+    std::size_t size_ = 0;
+    int shift_ = 64;
+
+    // The store picks shards with the low bits of the same hash, so the slot
+    // comes from the high bits of its product with the golden ratio
+    std::size_t home(const OrderId& key) const {
+        return static_cast<std::size_t>((OrderIdHash{}(key) * 0x9e3779b97f4a7c15ULL) >> this->shift_);
+    }
+
+    std::size_t find_slot(const OrderId& key) const;
+    void rehash(std::size_t capacity);
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "store/order_store.hpp"
+
+struct WalOptions {
+    std::string path;
+    std::chrono::milliseconds sync_interval{2};  // Longest a record waits for its fsync
+    std::size_t sync_bytes = 1 << 20;            // Flush early once this much is buffered
+    bool wait_for_sync = true;                   // Commit() blocks until the caller's records are durable
+    unsigned replay_threads = 0;                 // 0 = hardware concurrency
+};
+
+// Append-only write-ahead log of order mutations.
+//
+// File layout: an 8 byte header ("OWAL" + u32 version) followed by records of
+//   u32 payload length | u32 crc32(payload) | payload
+// where the payload is
+//   u8 op | u32 user id length | user id | serialized osv1::Order (put) or order id (delete)
+// Integers are written in host byte order.
+//
+// Appends only copy into an in-memory buffer; a background thread writes the
+// buffer out and fsyncs it every sync_interval or sync_bytes, whichever comes
+// first, so concurrent writers share one fsync (group commit).
+//
+// When a snapshot starts, Rotate() moves the log aside to RotatedPath() and
+// starts a fresh one; once the snapshot is on disk it covers the rotated log
+// and DropRotated() deletes it. Recovery replays the rotated log, if any, and
+// then the current one on top of the snapshot.
+class OrderWal {
+   public:
+    explicit OrderWal(WalOptions options);
+    ~OrderWal();
+
+    OrderWal(const OrderWal&) = delete;
+    OrderWal& operator=(const OrderWal&) = delete;
+
+    // OrderStore::Observer, runs under the order's shard lock
+    void Append(const OrderStore::OrderPtr& before, const OrderStore::OrderPtr& after);
+
+    // Waits until everything the calling thread appended is on disk. Returns
+    // false if the log failed to write.
+    bool Commit();
+
+    // Commit() without blocking: calls `done` once everything the calling
+    // thread appended is on disk, false if the log failed to write. Runs it
+    // right away when there is nothing to wait for, otherwise on the flusher
+    // thread under the log's lock, so `done` must not call back into the log.
+    void CommitAsync(std::function<void(bool)> done);
+
+    // Writes and fsyncs everything appended so far
+    bool Flush();
+
+    // Starts a new log file, keeping the current one at RotatedPath(). Returns
+    // false without rotating if an earlier rotated log is still there, that is
+    // the snapshot meant to cover it never completed. Throws
+    // std::runtime_error on I/O errors.
+    bool Rotate();
+
+    // Deletes the rotated log once a snapshot covers it
+    void DropRotated();
+
+    // Applies the log at `path` to `store`, parsing the records on `threads`
+    // threads. Only the last record of each order is applied, as a put or an
+    // erase, so replaying on top of a snapshot or an older log is safe. A torn
+    // or corrupt tail is cut off so new appends start on a record boundary.
+    // Returns the number of orders applied; throws std::runtime_error if the
+    // file is not a log.
+    static std::size_t Replay(const std::string& path, OrderStore& store, unsigned threads = 0);
+
+    static std::string RotatedPath(const std::string& path) { return path + ".old"; }
+
+    // Set for good by the first failed write, the log takes no batch after it
+    bool failed() const { return this->failed_.load(std::memory_order_acquire); }
+
+    const std::string& path() const { return this->options_.path; }
+
+    // CRC-32 (IEEE) of the record payloads, the archive frames its records alike
+    static uint32_t Crc32(const char* data, std::size_t size);
+
+   private:
+    enum Op : uint8_t { kPut = 1, kDelete = 2 };
+
+    static constexpr uint32_t kMagic = 0x4c41574f;  // "OWAL"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr std::size_t kHeaderSize = 8;
+    static constexpr std::size_t kRecordHeaderSize = 8;
+
+    WalOptions options_;
+
+    std::mutex io_mutex_;  // Serialises writes to fd_ with Rotate()
+    int fd_ = -1;
+
+    std::mutex mutex_;
+    std::condition_variable flush_cv_;    // Wakes the flusher
+    std::condition_variable durable_cv_;  // Wakes committers
+    std::string buffer_;
+    uint64_t appended_seq_ = 0;
+    uint64_t durable_seq_ = 0;
+    int waiters_ = 0;  // Committers waiting, the flusher starts a batch right away
+    std::multimap<uint64_t, std::function<void(bool)>> callbacks_;  // CommitAsync's, by the sequence they wait for
+    std::atomic<bool> failed_{false};  // Written under mutex_
+    bool stopping_ = false;
+    std::thread flusher_;
+
+    void flush_loop();
+    static bool write_out(int fd, const std::string& data);
+    static std::string header();
+    bool wait_durable(uint64_t seq);
+    void run_callbacks();
+};
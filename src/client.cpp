@@ -11,6 +11,9 @@
 #include <sstream>
 #include <string>
 
+#include "client/channel_factory.hpp"
+#include "client/load_generator.hpp"
+#include "config/config.hpp"
 #include "google/protobuf/util/json_util.h"
 #include "order_service/order.grpc.pb.h"
 #include "order_service/order.pb.h"
@@ -70,7 +73,7 @@ class OrderClient {
    public:
     OrderClient(const std::string addr_) : addr_(addr_) {
         std::cout << "OrderClient initialized with address: " << addr_ << std::endl;
-        this->channel_ = grpc::CreateChannel(this->addr_, grpc::InsecureChannelCredentials());
+        this->channel_ = ChannelFactory::Create(this->addr_);
         this->stub_ = osv1::OrderService::NewStub(this->channel_);
     }
 
@@ -95,9 +98,67 @@ class OrderClient {
     std::string addr_;
 };
 
-int main() {
-    // Create the client and request
-    OrderClient client("0.0.0.0:8080");
+// Load test settings, see the README for what each one does
+LoadOptions load_options_from_env() {
+    std::string mode = getEnv("LOAD_MODE", "closed");
+    if (mode != "closed" && mode != "open") {
+        throw std::invalid_argument("LOAD_MODE must be 'closed' or 'open', got '" + mode + "'");
+    }
+
+    LoadOptions options;
+    options.address = getEnv("SERVER_ADDR", options.address);
+    options.open_loop = mode == "open";
+    options.concurrency = getEnvInt("LOAD_CONCURRENCY", options.concurrency);
+    options.rps = getEnvInt("LOAD_RPS", options.rps);
+    options.channels = getEnvInt("LOAD_CHANNELS", options.channels);
+    options.threads = getEnvInt("LOAD_THREADS", options.threads);
+    options.duration = std::chrono::seconds(getEnvInt("LOAD_DURATION_S", static_cast<int>(options.duration.count())));
+    options.warmup = std::chrono::seconds(getEnvInt("LOAD_WARMUP_S", static_cast<int>(options.warmup.count())));
+    options.rpc_timeout =
+        std::chrono::seconds(getEnvInt("LOAD_TIMEOUT_S", static_cast<int>(options.rpc_timeout.count())));
+    options.seed_orders = getEnvInt("LOAD_SEED_ORDERS", options.seed_orders);
+    options.seed_users = getEnvInt("LOAD_SEED_USERS", options.seed_users);
+
+    std::string mix = getEnv("LOAD_MIX", "");
+    if (!mix.empty()) {
+        options.mix = LoadOptions::ParseMix(mix);
+    }
+    return options;
+}
+
+int run_load() {
+    try {
+        LoadOptions options = load_options_from_env();
+
+        std::cout << "Load test against " << options.address << ": "
+                  << (options.open_loop ? std::to_string(options.rps) + " RPC/s open loop"
+                                        : std::to_string(options.concurrency) + " in flight closed loop")
+                  << ", " << options.threads << " threads, " << options.channels << " channels, "
+                  << options.warmup.count() << "s warmup + " << options.duration.count() << "s" << std::endl;
+
+        LoadGenerator generator(options);
+        LoadReport report = generator.Run();
+        report.Print(std::cout);
+    } catch (const std::exception& e) {
+        std::cerr << "Load test failed: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "load") {
+        return run_load();
+    }
+
+    // Create the client and request, "inproc" has no server to reach here
+    std::unique_ptr<OrderClient> client;
+    try {
+        client = std::make_unique<OrderClient>(getEnv("SERVER_ADDR", "0.0.0.0:8080"));
+    } catch (const std::exception& e) {
+        std::cerr << "An error occurred: " << e.what() << std::endl;
+        return 1;
+    }
 
     // Build the request message
     osv1::ListOrdersRequest request;
@@ -109,7 +170,7 @@ int main() {
     std::cout << "Sending request: " << ProtoFormatter::ToJson(request) << std::endl;
 
     try {
-        auto response = client.ListOrders(request);
+        auto response = client->ListOrders(request);
         std::cout << "Response received successfully!" << std::endl;
 
         std::cout << "Found " << response.orders_size() << " orders (Total in system: " << response.total() << ")"
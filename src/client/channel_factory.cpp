@@ -0,0 +1,41 @@
+#include "client/channel_factory.hpp"
+
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+std::mutex in_process_mutex;
+ChannelFactory::InProcessChannel in_process;
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+void ChannelFactory::RegisterInProcess(InProcessChannel channel) {
+    std::lock_guard<std::mutex> lock(in_process_mutex);
+    in_process = std::move(channel);
+}
+
+std::shared_ptr<grpc::Channel> ChannelFactory::Create(const std::string& target, const grpc::ChannelArguments& args) {
+    if (!IsInProcess(target)) {
+        return grpc::CreateCustomChannel(target, grpc::InsecureChannelCredentials(), args);
+    }
+
+    InProcessChannel channel;
+    {
+        std::lock_guard<std::mutex> lock(in_process_mutex);
+        channel = in_process;
+    }
+    if (!channel) {
+        throw std::invalid_argument(std::string("No server registered for '") + kInProcessTarget +
+                                    "' in this process");
+    }
+    return channel(args);
+}
+
+std::unique_ptr<osv1::OrderService::Stub> ChannelFactory::NewStub(const std::string& target) {
+    return osv1::OrderService::NewStub(Create(target));
+}
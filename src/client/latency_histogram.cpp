@@ -0,0 +1,71 @@
+#include "client/latency_histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+void LatencyHistogram::Record(uint64_t value) {
+    this->counts_[index_of(value)]++;
+    this->count_++;
+    this->sum_ += value;
+    this->min_ = std::min(this->min_, value);
+    this->max_ = std::max(this->max_, value);
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    for (std::size_t i = 0; i < kBucketCount; i++) {
+        this->counts_[i] += other.counts_[i];
+    }
+    this->count_ += other.count_;
+    this->sum_ += other.sum_;
+    this->min_ = std::min(this->min_, other.min_);
+    this->max_ = std::max(this->max_, other.max_);
+}
+
+uint64_t LatencyHistogram::ValueAt(double percentile) const {
+    if (this->count_ == 0) {
+        return 0;
+    }
+
+    double clamped = std::min(std::max(percentile, 0.0), 100.0);
+    uint64_t target = static_cast<uint64_t>(std::ceil(clamped / 100.0 * static_cast<double>(this->count_)));
+    target = std::max<uint64_t>(target, 1);
+
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBucketCount; i++) {
+        seen += this->counts_[i];
+        if (seen >= target) {
+            return std::min(highest_equivalent(i), this->max_);
+        }
+    }
+    return this->max_;
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+//
+// Values in [2^(k+6), 2^(k+7)) for k >= 1 are shifted right by k, which
+// leaves them in [64, 128), and land in the k-th group of 64 buckets after
+// the first 128
+std::size_t LatencyHistogram::index_of(uint64_t value) {
+    if (value < kSubBucketCount) {
+        return static_cast<std::size_t>(value);
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - kSubBucketBits + 1;
+    return (static_cast<std::size_t>(shift) << (kSubBucketBits - 1)) + static_cast<std::size_t>(value >> shift);
+}
+
+uint64_t LatencyHistogram::highest_equivalent(std::size_t index) {
+    if (index < kSubBucketCount) {
+        return index;
+    }
+
+    int shift = static_cast<int>(index >> (kSubBucketBits - 1)) - 1;
+    uint64_t lowest = static_cast<uint64_t>(index - (static_cast<std::size_t>(shift) << (kSubBucketBits - 1))) << shift;
+    return lowest + ((uint64_t{1} << shift) - 1);
+}
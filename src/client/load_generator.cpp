@@ -0,0 +1,499 @@
+#include "client/load_generator.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <iomanip>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "client/channel_factory.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr const char* kOpNames[] = {"get", "list", "create", "update", "delete", "stream"};
+
+// Base of every RPC in flight, the object pointer is the completion queue tag
+class Rpc {
+   public:
+    Rpc(LoadOp op, Clock::time_point start) : op_(op), start_(start) {}
+    virtual ~Rpc() = default;
+
+    // Returns true once the RPC is complete
+    virtual bool Proceed(bool ok) = 0;
+
+    virtual bool succeeded() const { return this->status_.ok(); }
+
+    LoadOp op() const { return this->op_; }
+    Clock::time_point start() const { return this->start_; }
+    Clock::time_point end() const { return this->end_; }
+
+   protected:
+    LoadOp op_;
+    Clock::time_point start_;
+    Clock::time_point end_;
+    grpc::ClientContext ctx_;
+    grpc::Status status_;
+};
+
+template <typename Request, typename Response>
+class UnaryRpc final : public Rpc {
+   public:
+    using Prepare = std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> (osv1::OrderService::Stub::*)(
+        grpc::ClientContext*, const Request&, grpc::CompletionQueue*);
+    using OnSuccess = std::function<void(const Response&)>;
+
+    UnaryRpc(LoadOp op, Clock::time_point start, std::chrono::system_clock::time_point deadline,
+             osv1::OrderService::Stub* stub, Prepare prepare, const Request& request, grpc::CompletionQueue* cq,
+             OnSuccess on_success = nullptr)
+        : Rpc(op, start), on_success_(std::move(on_success)) {
+        this->ctx_.set_deadline(deadline);
+        this->reader_ = (stub->*prepare)(&this->ctx_, request, cq);
+        this->reader_->StartCall();
+        this->reader_->Finish(&this->response_, &this->status_, this);
+    }
+
+    bool Proceed(bool ok) override {
+        this->end_ = Clock::now();
+        if (this->status_.ok() && this->on_success_) {
+            this->on_success_(this->response_);
+        }
+        return true;
+    }
+
+   private:
+    Response response_;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> reader_;
+    OnSuccess on_success_;
+};
+
+// Succeeds on the first message, the stream is cancelled right after it
+class StreamRpc final : public Rpc {
+   public:
+    StreamRpc(Clock::time_point start, std::chrono::system_clock::time_point deadline, osv1::OrderService::Stub* stub,
+              const osv1::StreamOrderUpdatesRequest& request, grpc::CompletionQueue* cq)
+        : Rpc(LoadOp::kStream, start) {
+        this->ctx_.set_deadline(deadline);
+        this->reader_ = stub->PrepareAsyncStreamOrderUpdates(&this->ctx_, request, cq);
+        this->reader_->StartCall(this);
+    }
+
+    bool Proceed(bool ok) override {
+        switch (this->state_) {
+            case State::kStarting:
+                if (ok) {
+                    this->state_ = State::kReading;
+                    this->reader_->Read(&this->response_, this);
+                } else {
+                    this->finish();
+                }
+                return false;
+
+            case State::kReading:
+                if (ok) {
+                    this->end_ = Clock::now();
+                    this->received_ = true;
+                    this->ctx_.TryCancel();
+                }
+                this->finish();
+                return false;
+
+            case State::kFinishing:
+                if (!this->received_) {
+                    this->end_ = Clock::now();
+                }
+                return true;
+        }
+        return true;
+    }
+
+    bool succeeded() const override { return this->received_; }
+
+   private:
+    enum class State { kStarting, kReading, kFinishing };
+
+    State state_ = State::kStarting;
+    bool received_ = false;
+    osv1::StreamOrderUpdatesResponse response_;
+    std::unique_ptr<grpc::ClientAsyncReader<osv1::StreamOrderUpdatesResponse>> reader_;
+
+    void finish() {
+        this->state_ = State::kFinishing;
+        this->reader_->Finish(&this->status_, this);
+    }
+};
+
+double to_micros(uint64_t nanos) { return static_cast<double>(nanos) / 1000.0; }
+
+}  // namespace
+
+// One thread, its completion queue and the RPCs it started
+class LoadGenerator::Worker {
+   public:
+    Worker(LoadGenerator* generator, int index, Clock::time_point begin, Clock::time_point measure_from,
+           Clock::time_point end)
+        : generator_(generator),
+          options_(generator->options_),
+          index_(index),
+          begin_(begin),
+          measure_from_(measure_from),
+          end_(end),
+          rng_(std::random_device{}()),
+          pick_op_(options_.mix.begin(), options_.mix.end()),
+          next_stub_(static_cast<std::size_t>(index)) {}
+
+    void Run() {
+        if (this->options_.open_loop) {
+            this->run_open_loop();
+        } else {
+            this->run_closed_loop();
+        }
+
+        this->cq_.Shutdown();
+        void* tag = nullptr;
+        bool ok = false;
+        while (this->cq_.Next(&tag, &ok)) {
+            delete static_cast<Rpc*>(tag);
+        }
+    }
+
+    const std::array<OpReport, 6>& ops() const { return this->ops_; }
+
+   private:
+    LoadGenerator* generator_;
+    const LoadOptions& options_;
+    int index_;
+    Clock::time_point begin_;
+    Clock::time_point measure_from_;
+    Clock::time_point end_;
+
+    grpc::CompletionQueue cq_;
+    std::mt19937_64 rng_;
+    std::discrete_distribution<int> pick_op_;
+    std::size_t next_stub_;
+    std::vector<std::string> created_;  // Orders this worker created and Delete can remove
+    int in_flight_ = 0;
+    std::array<OpReport, 6> ops_;
+
+    void run_closed_loop() {
+        int concurrency = this->options_.concurrency / this->options_.threads +
+                          (this->index_ < this->options_.concurrency % this->options_.threads ? 1 : 0);
+        for (int i = 0; i < concurrency; i++) {
+            this->start(Clock::now());
+        }
+
+        while (Clock::now() < this->end_ || this->in_flight_ > 0) {
+            Rpc* rpc = this->next(Clock::now() < this->end_ ? this->end_ : this->drain_deadline());
+            if (!rpc) {
+                continue;
+            }
+
+            this->complete(rpc);
+            if (Clock::now() < this->end_) {
+                this->start(Clock::now());
+            }
+        }
+    }
+
+    // Worker i of n starts at begin + i * interval / n, so the threads
+    // together send at an even pace
+    void run_open_loop() {
+        auto interval = std::chrono::nanoseconds(static_cast<int64_t>(1e9 * this->options_.threads / this->options_.rps));
+        Clock::time_point scheduled = this->begin_ + interval * this->index_ / this->options_.threads;
+
+        while (Clock::now() < this->end_ || this->in_flight_ > 0) {
+            Clock::time_point now = Clock::now();
+            for (; scheduled <= now && scheduled < this->end_; scheduled += interval) {
+                this->start(scheduled);
+            }
+
+            Rpc* rpc = this->next(now < this->end_ ? std::min(scheduled, this->end_) : this->drain_deadline());
+            if (rpc) {
+                this->complete(rpc);
+            }
+        }
+    }
+
+    // Next RPC that completed by `deadline`, nullptr on timeout
+    Rpc* next(Clock::time_point deadline) {
+        void* tag = nullptr;
+        bool ok = false;
+        auto system_deadline = std::chrono::system_clock::now() + (deadline - Clock::now());
+
+        if (this->cq_.AsyncNext(&tag, &ok, system_deadline) != grpc::CompletionQueue::GOT_EVENT) {
+            return nullptr;
+        }
+
+        Rpc* rpc = static_cast<Rpc*>(tag);
+        return rpc->Proceed(ok) ? rpc : nullptr;
+    }
+
+    // Every RPC has a deadline, so waiting for the ones still in flight ends
+    Clock::time_point drain_deadline() const { return Clock::now() + this->options_.rpc_timeout; }
+
+    // Records and frees a finished RPC. Only RPCs started in the measured
+    // window count.
+    void complete(Rpc* rpc) {
+        this->in_flight_--;
+
+        if (rpc->start() >= this->measure_from_ && rpc->start() < this->end_) {
+            OpReport& report = this->ops_[static_cast<int>(rpc->op())];
+            if (rpc->succeeded()) {
+                report.ok++;
+                report.latency.Record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(rpc->end() - rpc->start()).count()));
+            } else {
+                report.errors++;
+            }
+        }
+
+        delete rpc;
+    }
+
+    void start(Clock::time_point scheduled) {
+        const std::vector<std::unique_ptr<osv1::OrderService::Stub>>& stubs = this->generator_->stubs_;
+        osv1::OrderService::Stub* stub = stubs[this->next_stub_++ % stubs.size()].get();
+        auto deadline = std::chrono::system_clock::now() + this->options_.rpc_timeout;
+
+        const std::vector<osv1::Order>& orders = this->generator_->orders_;
+        const std::vector<std::string>& users = this->generator_->users_;
+        const osv1::Order& target = orders[this->rng_() % orders.size()];
+        const std::string& user = users[this->rng_() % users.size()];
+
+        LoadOp op = static_cast<LoadOp>(this->pick_op_(this->rng_));
+        if (op == LoadOp::kDelete && this->created_.empty()) {
+            op = LoadOp::kCreate;
+        }
+
+        switch (op) {
+            case LoadOp::kGet: {
+                osv1::GetOrderRequest request;
+                request.set_order_id(target.id());
+                new UnaryRpc<osv1::GetOrderRequest, osv1::GetOrderResponse>(
+                    op, scheduled, deadline, stub, &osv1::OrderService::Stub::PrepareAsyncGetOrder, request, &this->cq_);
+                break;
+            }
+            case LoadOp::kList: {
+                osv1::ListOrdersRequest request;
+                request.set_user_id(user);
+                request.set_limit(10);
+                new UnaryRpc<osv1::ListOrdersRequest, osv1::ListOrdersResponse>(
+                    op, scheduled, deadline, stub, &osv1::OrderService::Stub::PrepareAsyncListOrders, request,
+                    &this->cq_);
+                break;
+            }
+            case LoadOp::kCreate: {
+                osv1::CreateOrderRequest request;
+                request.set_user_id(user);
+                *request.mutable_order() = make_order();
+                new UnaryRpc<osv1::CreateOrderRequest, osv1::CreateOrderResponse>(
+                    op, scheduled, deadline, stub, &osv1::OrderService::Stub::PrepareAsyncCreateOrder, request,
+                    &this->cq_,
+                    [this](const osv1::CreateOrderResponse& response) { this->created_.push_back(response.order().id()); });
+                break;
+            }
+            case LoadOp::kUpdate: {
+                // UpdateOrder's request and response types are swapped in the proto
+                osv1::UpdateOrderResponse request;
+                *request.mutable_order() = target;
+                request.mutable_order()->set_status(this->rng_() % 2 ? osv1::OrderStatus::PROCESSING
+                                                                     : osv1::OrderStatus::PENDING);
+                new UnaryRpc<osv1::UpdateOrderResponse, osv1::UpdateOrderRequest>(
+                    op, scheduled, deadline, stub, &osv1::OrderService::Stub::PrepareAsyncUpdateOrder, request,
+                    &this->cq_);
+                break;
+            }
+            case LoadOp::kDelete: {
+                osv1::DeleteOrderRequest request;
+                request.set_order_id(this->created_.back());
+                this->created_.pop_back();
+                new UnaryRpc<osv1::DeleteOrderRequest, osv1::DeleteOrderResponse>(
+                    op, scheduled, deadline, stub, &osv1::OrderService::Stub::PrepareAsyncDeleteOrder, request,
+                    &this->cq_);
+                break;
+            }
+            case LoadOp::kStream: {
+                osv1::StreamOrderUpdatesRequest request;
+                request.set_order_id(target.id());
+                new StreamRpc(scheduled, deadline, stub, request, &this->cq_);
+                break;
+            }
+        }
+
+        this->in_flight_++;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+LoadGenerator::LoadGenerator(LoadOptions options) : options_(std::move(options)) {
+    if (this->options_.threads < 1 || this->options_.channels < 1) {
+        throw std::invalid_argument("Threads and channels must be at least 1");
+    }
+    if (this->options_.open_loop ? this->options_.rps < 1 : this->options_.concurrency < 1) {
+        throw std::invalid_argument("Open loop needs a positive rate, closed loop a positive concurrency");
+    }
+    if (std::all_of(this->options_.mix.begin(), this->options_.mix.end(), [](int weight) { return weight <= 0; })) {
+        throw std::invalid_argument("The request mix is empty");
+    }
+    if (this->options_.seed_orders < 1 || this->options_.seed_users < 1) {
+        throw std::invalid_argument("Seed orders and users must be at least 1");
+    }
+
+    // Channels with the same arguments share their connection unless each
+    // keeps its own subchannel pool
+    for (int i = 0; i < this->options_.channels; i++) {
+        grpc::ChannelArguments args;
+        args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        this->channels_.push_back(ChannelFactory::Create(this->options_.address, args));
+        this->stubs_.push_back(osv1::OrderService::NewStub(this->channels_.back()));
+    }
+}
+
+LoadGenerator::~LoadGenerator() = default;
+
+LoadReport LoadGenerator::Run() {
+    this->seed();
+
+    Clock::time_point begin = Clock::now();
+    Clock::time_point measure_from = begin + this->options_.warmup;
+    Clock::time_point end = measure_from + this->options_.duration;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < this->options_.threads; i++) {
+        workers.push_back(std::make_unique<Worker>(this, i, begin, measure_from, end));
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back(&Worker::Run, worker.get());
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    LoadReport report;
+    report.elapsed = end - measure_from;
+    for (auto& worker : workers) {
+        for (std::size_t op = 0; op < report.ops.size(); op++) {
+            const OpReport& from = worker->ops()[op];
+            report.ops[op].ok += from.ok;
+            report.ops[op].errors += from.errors;
+            report.ops[op].latency.Merge(from.latency);
+            report.total.Merge(from.latency);
+        }
+    }
+    return report;
+}
+
+std::array<int, 6> LoadOptions::ParseMix(const std::string& mix) {
+    std::array<int, 6> weights{};
+
+    std::size_t pos = 0;
+    while (pos < mix.size()) {
+        std::size_t comma = mix.find(',', pos);
+        std::string entry = mix.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        pos = comma == std::string::npos ? mix.size() : comma + 1;
+
+        std::size_t eq = entry.find('=');
+        auto name = std::find(std::begin(kOpNames), std::end(kOpNames), entry.substr(0, eq));
+        if (eq == std::string::npos || name == std::end(kOpNames)) {
+            throw std::invalid_argument("Bad request mix entry '" + entry + "', expected <op>=<weight> with op one of "
+                                        "get, list, create, update, delete, stream");
+        }
+
+        int weight = 0;
+        const char* begin = entry.data() + eq + 1;
+        const char* end = entry.data() + entry.size();
+        auto [number_end, ec] = std::from_chars(begin, end, weight);
+        if (ec != std::errc() || number_end != end) {
+            throw std::invalid_argument("Bad weight in request mix entry '" + entry + "', expected an integer");
+        }
+        if (weight < 0) {
+            throw std::invalid_argument("Negative weight in request mix: " + entry);
+        }
+        weights[name - std::begin(kOpNames)] = weight;
+    }
+
+    return weights;
+}
+
+const char* LoadGenerator::OpName(LoadOp op) { return kOpNames[static_cast<int>(op)]; }
+
+void LoadReport::Print(std::ostream& out) const {
+    double seconds = std::chrono::duration<double>(this->elapsed).count();
+    uint64_t errors = 0;
+    for (const OpReport& op : this->ops) {
+        errors += op.errors;
+    }
+
+    out << std::fixed << std::setprecision(1);
+    out << "Measured " << seconds << "s: " << this->total.count() << " RPCs, " << errors << " errors, "
+        << this->total.count() / seconds << " RPC/s" << std::endl;
+    out << "Latency in microseconds" << std::endl;
+    out << std::left << std::setw(8) << "op" << std::right << std::setw(10) << "ok" << std::setw(8) << "errors"
+        << std::setw(11) << "RPC/s" << std::setw(10) << "p50" << std::setw(10) << "p90" << std::setw(10) << "p99"
+        << std::setw(10) << "p99.9" << std::setw(10) << "max" << std::endl;
+
+    auto row = [&](const char* name, uint64_t ok, uint64_t errors, const LatencyHistogram& latency) {
+        out << std::left << std::setw(8) << name << std::right << std::setw(10) << ok << std::setw(8) << errors
+            << std::setw(11) << ok / seconds << std::setw(10) << to_micros(latency.ValueAt(50)) << std::setw(10)
+            << to_micros(latency.ValueAt(90)) << std::setw(10) << to_micros(latency.ValueAt(99)) << std::setw(10)
+            << to_micros(latency.ValueAt(99.9)) << std::setw(10) << to_micros(latency.max()) << std::endl;
+    };
+
+    for (std::size_t op = 0; op < this->ops.size(); op++) {
+        if (this->ops[op].ok + this->ops[op].errors > 0) {
+            row(kOpNames[op], this->ops[op].ok, this->ops[op].errors, this->ops[op].latency);
+        }
+    }
+    row("total", this->total.count(), errors, this->total);
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+void LoadGenerator::seed() {
+    for (int i = 0; i < this->options_.seed_users; i++) {
+        this->users_.push_back("load-user-" + std::to_string(i));
+    }
+
+    for (int i = 0; i < this->options_.seed_orders; i++) {
+        grpc::ClientContext context;
+        context.set_deadline(std::chrono::system_clock::now() + this->options_.rpc_timeout);
+
+        osv1::CreateOrderRequest request;
+        request.set_user_id(this->users_[i % this->users_.size()]);
+        *request.mutable_order() = make_order();
+
+        osv1::CreateOrderResponse response;
+        grpc::Status status = this->stubs_[i % this->stubs_.size()]->CreateOrder(&context, request, &response);
+        if (!status.ok()) {
+            throw std::runtime_error("Failed to seed orders: " + status.error_message());
+        }
+        this->orders_.push_back(response.order());
+    }
+}
+
+osv1::Order LoadGenerator::make_order() {
+    osv1::Order order;
+    order.set_address("123 Maple Street, Springfield");
+
+    osv1::Item* item = order.add_items();
+    item->set_id("7c9e6679-7425-40de-944b-e07fc1f90ae7");
+    item->set_name("Laptop");
+    item->set_price(100.5);
+    item->set_quantity(1);
+
+    item = order.add_items();
+    item->set_id("9b2d3c1f-5e4a-4b8c-9d7e-1f2a3b4c5d6e");
+    item->set_name("Smartphone");
+    item->set_price(34.0);
+    item->set_quantity(2);
+    return order;
+}
@@ -0,0 +1,326 @@
+#include "logging/access_log.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include "metrics/rpc_metrics.hpp"
+
+namespace {
+
+constexpr const char* kLevelNames[] = {"info", "warn", "error"};
+
+constexpr std::size_t kBatchBytes = 64 << 10;  // Written out once a batch grows past it
+
+std::atomic<uint64_t> next_log_id{1};
+
+std::size_t copy_truncated(char* into, std::size_t size, std::string_view from) {
+    std::size_t n = std::min(size, from.size());
+    std::memcpy(into, from.data(), n);
+    return n;
+}
+
+// Method names of unknown methods come from the client, so escape anything
+// that would break the line
+void append_escaped(std::string& out, const char* data, std::size_t size) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    for (std::size_t i = 0; i < size; i++) {
+        unsigned char c = static_cast<unsigned char>(data[i]);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20 || c >= 0x7f) {
+            out += "\\u00";
+            out += kHex[c >> 4];
+            out += kHex[c & 0xf];
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+}
+
+}  // namespace
+
+// Shares each ring with its log, so retiring it is safe even once the log is
+// gone
+struct AccessLog::RingOwner {
+    std::vector<std::pair<uint64_t, std::shared_ptr<Ring>>> rings;
+
+    ~RingOwner() {
+        for (const auto& [id, ring] : this->rings) {
+            ring->retired.store(true, std::memory_order_release);
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+AccessLog::AccessLog(AccessLogOptions options)
+    : options_(std::move(options)),
+      ring_capacity_(1),
+      fd_(STDOUT_FILENO),
+      id_(next_log_id.fetch_add(1)) {
+    while (this->ring_capacity_ < std::max<std::size_t>(this->options_.buffer_records, 2)) {
+        this->ring_capacity_ <<= 1;
+    }
+    this->options_.sample_every = std::max(this->options_.sample_every, 1);
+
+    if (!this->options_.path.empty()) {
+        this->fd_ = ::open(this->options_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (this->fd_ < 0) {
+            throw std::runtime_error("Failed to open access log " + this->options_.path + ": " +
+                                     std::strerror(errno));
+        }
+    }
+
+    this->writer_ = std::thread(&AccessLog::run, this);
+}
+
+AccessLog::~AccessLog() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stopping_ = true;
+    }
+    this->stop_cv_.notify_all();
+    this->writer_.join();
+
+    if (this->fd_ != STDOUT_FILENO) {
+        ::close(this->fd_);
+    }
+}
+
+bool AccessLog::Sample(grpc::StatusCode code) {
+    LogLevel level = LevelOf(code);
+    if (level < this->options_.level) {
+        return false;
+    }
+    if (level != LogLevel::kInfo || this->options_.sample_every == 1) {
+        return true;
+    }
+
+    Ring& ring = this->local_ring();
+    return ring.sampled++ % static_cast<uint64_t>(this->options_.sample_every) == 0;
+}
+
+void AccessLog::Append(std::string_view method, std::string_view peer, grpc::StatusCode code,
+                       std::chrono::nanoseconds duration) {
+    Ring& ring = this->local_ring();
+
+    // Only this thread moves head, and tail is re-read only when the ring
+    // looks full
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.cached_tail == ring.records.size()) {
+        ring.cached_tail = ring.tail.load(std::memory_order_acquire);
+        if (head - ring.cached_tail == ring.records.size()) {
+            ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    Record& record = ring.records[head & ring.mask];
+    record.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+    record.duration_ns = duration.count();
+    record.code = code;
+    record.method_size = static_cast<uint8_t>(copy_truncated(record.method, sizeof(record.method), method));
+    record.peer_size = static_cast<uint8_t>(copy_truncated(record.peer, sizeof(record.peer), peer));
+
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void AccessLog::Flush() {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    if (this->stopping_) {
+        return;
+    }
+
+    uint64_t ticket = ++this->flush_requested_;
+    this->stop_cv_.notify_all();
+    this->flushed_cv_.wait(lock, [this, ticket] { return this->flush_done_ >= ticket; });
+}
+
+AccessLog::Stats AccessLog::stats() const {
+    Stats stats;
+    stats.written = this->written_.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    stats.dropped = this->retired_dropped_;
+    for (const auto& ring : this->rings_) {
+        stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+LogLevel AccessLog::ParseLevel(const std::string& level) {
+    if (level == "info") {
+        return LogLevel::kInfo;
+    }
+    if (level == "warn") {
+        return LogLevel::kWarn;
+    }
+    if (level == "error") {
+        return LogLevel::kError;
+    }
+    if (level == "off") {
+        return LogLevel::kOff;
+    }
+    throw std::invalid_argument("Log level must be 'info', 'warn', 'error' or 'off', got '" + level + "'");
+}
+
+// Errors of the server are errors, the ones caused by the request warnings
+LogLevel AccessLog::LevelOf(grpc::StatusCode code) {
+    switch (code) {
+        case grpc::OK:
+            return LogLevel::kInfo;
+        case grpc::UNKNOWN:
+        case grpc::RESOURCE_EXHAUSTED:
+        case grpc::UNIMPLEMENTED:
+        case grpc::INTERNAL:
+        case grpc::UNAVAILABLE:
+        case grpc::DATA_LOSS:
+            return LogLevel::kError;
+        default:
+            return LogLevel::kWarn;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+//
+// Each thread keeps its ring per log. Log ids are never reused, so the entry
+// of a destroyed log is never matched again.
+AccessLog::Ring& AccessLog::local_ring() {
+    thread_local RingOwner owner;
+
+    for (const auto& [id, ring] : owner.rings) {
+        if (id == this->id_) {
+            return *ring;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->rings_.push_back(std::make_shared<Ring>(this->ring_capacity_));
+    owner.rings.emplace_back(this->id_, this->rings_.back());
+    return *this->rings_.back();
+}
+
+void AccessLog::run() {
+    std::string batch;
+    batch.reserve(kBatchBytes + 512);
+
+    bool stopping = false;
+    while (!stopping) {
+        uint64_t requested;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->stop_cv_.wait_for(lock, this->options_.flush_interval, [this] {
+                return this->stopping_ || this->flush_requested_ != this->flush_done_;
+            });
+            stopping = this->stopping_;
+            requested = this->flush_requested_;
+        }
+        this->drain(batch);
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->flush_done_ = requested;
+        }
+        this->flushed_cv_.notify_all();
+    }
+}
+
+// A ring retired before it is drained holds its thread's last records, so it
+// is freed right after
+void AccessLog::drain(std::string& batch) {
+    std::vector<Ring*> rings;
+    bool retired = false;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        for (const auto& ring : this->rings_) {
+            ring->drained_retired = ring->retired.load(std::memory_order_acquire);
+            retired = retired || ring->drained_retired;
+            rings.push_back(ring.get());
+        }
+    }
+
+    uint64_t written = 0;
+    for (Ring* ring : rings) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+
+        for (; tail != head; tail++) {
+            format(ring->records[tail & ring->mask], batch);
+            written++;
+
+            if (batch.size() >= kBatchBytes) {
+                this->write(batch);
+            }
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+
+    this->write(batch);
+    this->written_.fetch_add(written, std::memory_order_relaxed);
+
+    if (retired) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        auto freed = std::stable_partition(this->rings_.begin(), this->rings_.end(),
+                                           [](const std::shared_ptr<Ring>& ring) { return !ring->drained_retired; });
+        for (auto it = freed; it != this->rings_.end(); ++it) {
+            this->retired_dropped_ += (*it)->dropped.load(std::memory_order_relaxed);
+        }
+        this->rings_.erase(freed, this->rings_.end());
+    }
+}
+
+void AccessLog::write(std::string& batch) {
+    std::size_t offset = 0;
+    while (offset < batch.size()) {
+        ssize_t n = ::write(this->fd_, batch.data() + offset, batch.size() - offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Failed to write access log: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        offset += static_cast<std::size_t>(n);
+    }
+    batch.clear();
+}
+
+void AccessLog::format(const Record& record, std::string& out) {
+    std::time_t seconds = static_cast<std::time_t>(record.time_ns / 1000000000);
+    std::tm utc;
+    gmtime_r(&seconds, &utc);
+
+    char time[40];
+    std::size_t size = std::strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(time + size, sizeof(time) - size, ".%06dZ",
+                  static_cast<int>(record.time_ns % 1000000000 / 1000));
+
+    out += "{\"time\":\"";
+    out += time;
+    out += "\",\"level\":\"";
+    out += kLevelNames[static_cast<int>(LevelOf(record.code))];
+    out += "\",\"method\":\"";
+    append_escaped(out, record.method, record.method_size);
+    out += "\",\"peer\":\"";
+    append_escaped(out, record.peer, record.peer_size);
+    out += "\",\"code\":\"";
+    out += RpcMetrics::StatusName(record.code);
+    out += "\",\"duration_us\":";
+    out += std::to_string(record.duration_ns / 1000);
+    out += "}\n";
+}
@@ -1,47 +1,276 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <ctime>
 #include <sstream>
+#include <stdexcept>
 
 #include "common.hpp"
 #include "config/config.hpp"
+#include "metrics/phase_profiler.hpp"
 #include "order_service/order.grpc.pb.h"
 #include "server/server.hpp"
+#include "service/async_order_service.hpp"
 #include "service/order_service.hpp"
 
 namespace osv1 = order_service::v1;
 
 std::unique_ptr<Server> server = nullptr;
-std::mutex lockdown_mutex;
-std::condition_variable lockdown_cv;
-bool shutdown_requested = false;
+
+// Self-pipe: the handler only writes the signal number, the shutdown thread
+// reads it and does the rest outside of signal context. 0 wakes the thread
+// without a signal.
+int signal_pipe[2] = {-1, -1};
+volatile std::sig_atomic_t signals_received = 0;
 
 void handler(int signum) {
-    std::lock_guard<std::mutex> lock(lockdown_mutex);
-    shutdown_requested = true;
-    lockdown_cv.notify_one();
-    std::cout << "Received signal " << signum << ", shutting down..." << std::endl;
+    // A second stop signal does not wait for the drain
+    if (signum != SIGUSR1 && signals_received++ > 0) {
+        _exit(128 + signum);
+    }
+
+    int saved_errno = errno;
+    unsigned char byte = static_cast<unsigned char>(signum);
+    ssize_t written = ::write(signal_pipe[1], &byte, 1);
+    (void)written;
+    errno = saved_errno;
+}
+
+void install_signal_handlers() {
+    if (::pipe2(signal_pipe, O_CLOEXEC) != 0 || ::fcntl(signal_pipe[1], F_SETFL, O_NONBLOCK) != 0) {
+        throw std::runtime_error("Failed to create the signal pipe");
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    sigaction(SIGUSR1, &action, nullptr);
+}
+
+// The signal number, or 0 when woken by wake_shutdown_thread
+int wait_for_signal() {
+    unsigned char byte = 0;
+    while (::read(signal_pipe[0], &byte, 1) < 0 && errno == EINTR) {
+    }
+    return byte;
+}
+
+// SIGUSR1 starts a capture, the next one writes it to
+// <prefix>-<local time>.json
+void toggle_capture(const std::string& prefix) {
+    if (PhaseProfiler::StartCapture()) {
+        std::cout << "Profile capture started, send SIGUSR1 again to write it" << std::endl;
+        return;
+    }
+
+    char stamp[32];
+    std::time_t now = std::time(nullptr);
+    std::tm local = {};
+    localtime_r(&now, &local);
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+    PhaseProfiler::StopCapture(prefix + "-" + stamp + ".json");
+}
+
+void wake_shutdown_thread() {
+    unsigned char byte = 0;
+    ssize_t written = ::write(signal_pipe[1], &byte, 1);
+    (void)written;
 }
 
 int main() {
     Config config;
 
-    std::signal(SIGINT, handler);
-    std::signal(SIGTERM, handler);
-
     try {
+        install_signal_handlers();
+
         config = Config::New();
+        config.display();
 
         std::ostringstream addr;
         addr << config.host << ":" << config.port;
 
-        std::shared_ptr<OrderService> oService = std::make_shared<OrderService>();
+        OrderServiceOptions service_options;
+        if (!config.wal_path.empty()) {
+            WalOptions wal;
+            wal.path = config.wal_path;
+            wal.sync_interval = std::chrono::milliseconds(config.wal_sync_interval_ms);
+            wal.sync_bytes = static_cast<std::size_t>(config.wal_sync_bytes);
+            wal.wait_for_sync = config.wal_wait_for_sync;
+            wal.replay_threads = static_cast<unsigned>(config.wal_replay_threads);
+            service_options.wal = wal;
+        }
+        if (!config.snapshot_path.empty()) {
+            SnapshotOptions snapshot;
+            snapshot.path = config.snapshot_path;
+            snapshot.interval = std::chrono::seconds(config.snapshot_interval_s);
+            snapshot.load_threads = static_cast<unsigned>(config.snapshot_load_threads);
+            service_options.snapshot = snapshot;
+        }
+        if (config.response_cache_mb > 0) {
+            service_options.response_cache_bytes = static_cast<std::size_t>(config.response_cache_mb) << 20;
+        }
+        service_options.compression_threshold_bytes = static_cast<std::size_t>(config.compression_threshold_bytes);
+        service_options.compression_level = config.compression_level == "high"     ? GRPC_COMPRESS_LEVEL_HIGH
+                                            : config.compression_level == "medium" ? GRPC_COMPRESS_LEVEL_MED
+                                                                                   : GRPC_COMPRESS_LEVEL_LOW;
+        service_options.aggregate_threads = static_cast<unsigned>(config.aggregate_threads);
+        if (config.admission_limit > 0) {
+            AdmissionOptions admission;
+            admission.initial_limit = config.admission_limit;
+            admission.min_limit = config.admission_min_limit;
+            admission.max_limit = config.admission_max_limit;
+            admission.adaptive = config.admission_adaptive;
+            admission.max_queue_delay = std::chrono::milliseconds(config.admission_max_queue_delay_ms);
+            service_options.admission = admission;
+        }
+        if (config.retention_enabled()) {
+            RetentionOptions retention;
+            retention.ttls = OrderRetention::ParseTtls(config.retention_ttls);
+            retention.memory_budget_bytes = static_cast<std::size_t>(config.retention_memory_mb) << 20;
+            retention.step_time = std::chrono::milliseconds(config.retention_step_ms);
+            retention.step_interval = std::chrono::milliseconds(config.retention_interval_ms);
+            service_options.retention = retention;
+        }
+        service_options.archive_path = config.archive_path;
+
+        std::shared_ptr<OrderService> oService = std::make_shared<OrderService>(service_options);
         server = std::make_unique<Server>(addr.str(), oService, osv1::OrderService::service_full_name());
 
-        std::thread shutdown_thread([&]() {
-            std::unique_lock<std::mutex> lock(lockdown_mutex);
-            lockdown_cv.wait(lock, [] { return shutdown_requested; });
-            server->Stop();
+        ServerOptions server_options;
+        server_options.sync_cqs = config.sync_cqs;
+        server_options.sync_min_pollers = config.sync_min_pollers;
+        server_options.sync_max_pollers = config.sync_max_pollers;
+        server_options.sync_cq_timeout_ms = config.sync_cq_timeout_ms;
+        server_options.max_concurrent_streams = config.max_concurrent_streams;
+        server_options.max_receive_message_bytes = config.max_receive_message_bytes;
+        server_options.max_send_message_bytes = config.max_send_message_bytes;
+        server_options.keepalive_time_ms = config.keepalive_time_ms;
+        server_options.keepalive_timeout_ms = config.keepalive_timeout_ms;
+        server_options.keepalive_permit_without_calls = config.keepalive_permit_without_calls;
+        server_options.keepalive_min_ping_interval_ms = config.keepalive_min_ping_interval_ms;
+        server_options.max_connection_idle_ms = config.max_connection_idle_ms;
+        server_options.max_connection_age_ms = config.max_connection_age_ms;
+        server_options.max_connection_age_grace_ms = config.max_connection_age_grace_ms;
+        server_options.resource_quota_bytes = static_cast<std::size_t>(config.resource_quota_mb) << 20;
+        server_options.resource_quota_threads = config.resource_quota_threads;
+        server_options.shutdown_deadline = std::chrono::milliseconds(config.shutdown_deadline_ms);
+        server_options.shards = config.server_shards;
+        server->SetOptions(server_options);
+        server->SetShutdownHooks([oService] { oService->Drain(); },
+                                 [oService] {
+                                     if (!oService->Flush()) {
+                                         std::cerr << "Failed to flush the WAL on shutdown" << std::endl;
+                                     }
+                                 });
+
+        if (config.server_mode == "async") {
+            AsyncOptions options;
+            options.cq_count = config.async_cqs;
+            options.pollers_per_cq = config.async_pollers_per_cq;
+            options.pin_pollers = config.async_pin_pollers;
+            server->SetAsyncEngine([oService, options](int shard) {
+                // Every shard pins its pollers to cores of its own
+                AsyncOptions shard_options = options;
+                shard_options.first_core = shard * options.cq_count * options.pollers_per_cq;
+                return std::make_unique<AsyncOrderService>(oService, shard_options);
+            });
+        }
+
+        if (config.log_level != "off") {
+            AccessLogOptions log_options;
+            log_options.path = config.log_path;
+            log_options.level = AccessLog::ParseLevel(config.log_level);
+            log_options.sample_every = config.log_sample_every;
+            log_options.buffer_records = static_cast<std::size_t>(config.log_buffer_records);
+            log_options.flush_interval = std::chrono::milliseconds(config.log_flush_ms);
+
+            std::shared_ptr<AccessLog> access_log = std::make_shared<AccessLog>(log_options);
+            server->SetAccessLog(access_log);
+            server->metrics()->AddCollector([access_log](std::ostream& out) {
+                AccessLog::Stats stats = access_log->stats();
+                RpcMetrics::WriteCounter(out, "access_log_written_total", "RPCs written to the access log.",
+                                         stats.written);
+                RpcMetrics::WriteCounter(out, "access_log_dropped_total",
+                                         "RPCs not logged because the thread's log buffer was full.", stats.dropped);
+            });
+        }
+
+        if (oService->response_cache()) {
+            server->metrics()->AddCollector([oService](std::ostream& out) {
+                ResponseCache::Stats stats = oService->response_cache()->stats();
+                RpcMetrics::WriteCounter(out, "order_service_response_cache_hits_total",
+                                         "GetOrder responses served from the cache.", stats.hits);
+                RpcMetrics::WriteCounter(out, "order_service_response_cache_misses_total",
+                                         "GetOrder requests not found in the cache.", stats.misses);
+                RpcMetrics::WriteCounter(out, "order_service_response_cache_evictions_total",
+                                         "Cached responses evicted to stay within the size bound.", stats.evictions);
+                RpcMetrics::WriteCounter(out, "order_service_response_cache_invalidations_total",
+                                         "Cached responses dropped because their order changed.",
+                                         stats.invalidations);
+                RpcMetrics::WriteGauge(out, "order_service_response_cache_bytes", "Memory held by cached responses.",
+                                       static_cast<double>(stats.bytes));
+            });
+        }
+        if (oService->admission()) {
+            server->metrics()->AddCollector(
+                [oService](std::ostream& out) { oService->admission()->WritePrometheus(out); });
+        }
+        if (oService->retention()) {
+            server->metrics()->AddCollector(
+                [oService](std::ostream& out) { oService->retention()->WritePrometheus(out); });
+        }
+        if (oService->archive()) {
+            server->metrics()->AddCollector([oService](std::ostream& out) {
+                RpcMetrics::WriteGauge(out, "order_service_archive_orders", "Orders in the archive.",
+                                       static_cast<double>(oService->archive()->size()));
+                RpcMetrics::WriteGauge(out, "order_service_archive_file_bytes",
+                                       "Size of the archive file, records of orders no longer archived included.",
+                                       static_cast<double>(oService->archive()->file_bytes()));
+            });
+        }
+        if (service_options.wal) {
+            server->metrics()->AddCollector([oService](std::ostream& out) {
+                RpcMetrics::WriteGauge(out, "order_service_wal_failed",
+                                       "1 once a write to the WAL failed, changes are turned away after.",
+                                       oService->wal_failed() ? 1 : 0);
+            });
+        }
+        if (config.profile_enabled) {
+            PhaseProfiler::Enable();
+        }
+        server->metrics()->AddCollector([](std::ostream& out) { PhaseProfiler::WritePrometheus(out); });
+        if (!config.metrics_path.empty()) {
+            server->metrics()->StartExport(config.metrics_path, std::chrono::seconds(config.metrics_interval_s));
+        }
+
+        std::thread shutdown_thread([trace_prefix = config.profile_trace_prefix]() {
+            int signum;
+            while ((signum = wait_for_signal()) == SIGUSR1) {
+                toggle_capture(trace_prefix);
+            }
+
+            if (signum != 0) {
+                std::cout << "Received signal " << signum << ", shutting down..." << std::endl;
+                server->Stop();
+            }
+
+            // A capture running at shutdown is written with the drained calls
+            if (PhaseProfiler::capturing()) {
+                toggle_capture(trace_prefix);
+            }
         });
 
-        server->Run();
+        try {
+            server->Run();
+        } catch (...) {
+            wake_shutdown_thread();
+            shutdown_thread.join();
+            throw;
+        }
 
         shutdown_thread.join();
     } catch (const std::exception& e) {
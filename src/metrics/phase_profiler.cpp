@@ -0,0 +1,368 @@
+#include "metrics/phase_profiler.hpp"
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+std::atomic<bool> PhaseProfiler::enabled_{false};
+std::atomic<bool> PhaseProfiler::capturing_{false};
+std::atomic<uint64_t> PhaseProfiler::generation_{0};
+
+std::mutex PhaseProfiler::mutex_;
+bool PhaseProfiler::aggregating_ = false;
+double PhaseProfiler::cycles_per_ns_ = 0;
+uint64_t PhaseProfiler::capture_start_ = 0;
+std::vector<std::unique_ptr<PhaseProfiler::ThreadLog>>* PhaseProfiler::logs_ =
+    new std::vector<std::unique_ptr<PhaseProfiler::ThreadLog>>();
+std::array<std::array<PhaseProfiler::Cell, PhaseProfiler::kPhaseCount>, PhaseProfiler::kMaxMethods>
+    PhaseProfiler::retired_{};
+std::array<std::atomic<const char*>, PhaseProfiler::kMaxMethods> PhaseProfiler::methods_{};
+std::atomic<std::size_t> PhaseProfiler::method_count_{1};  // Slot 0 is background
+
+struct PhaseProfiler::LogOwner {
+    ThreadLog* log = nullptr;
+
+    ~LogOwner() {
+        if (this->log) {
+            PhaseProfiler::retire(this->log);
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+void PhaseProfiler::Enable() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    calibrate();
+    aggregating_ = true;
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void PhaseProfiler::Disable() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    aggregating_ = false;
+    enabled_.store(capturing_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+bool PhaseProfiler::StartCapture() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capturing_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    calibrate();
+    capture_start_ = Now();
+    generation_.fetch_add(1, std::memory_order_relaxed);
+    capturing_.store(true, std::memory_order_release);
+    enabled_.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+bool PhaseProfiler::StopCapture(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!capturing_.load(std::memory_order_relaxed)) {
+        std::cerr << "No profile capture is running" << std::endl;
+        return false;
+    }
+    capturing_.store(false, std::memory_order_relaxed);
+    enabled_.store(aggregating_, std::memory_order_relaxed);
+
+    // A thread still recording its last event is either seen or not, the
+    // count is published after the event
+    uint64_t generation = generation_.load(std::memory_order_relaxed);
+    double ns_per_cycle = 1.0 / cycles_per_ns_;
+    int pid = static_cast<int>(::getpid());
+
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Failed to open trace file " << tmp << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid
+        << ",\"tid\":0,\"args\":{\"name\":\"order-service\"}}";
+
+    std::size_t written = 0;
+    uint64_t dropped = 0;
+    for (const auto& log : *logs_) {
+        if (log->generation.load(std::memory_order_acquire) != generation) {
+            continue;
+        }
+
+        std::size_t count = log->event_count.load(std::memory_order_acquire);
+        dropped += log->dropped.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < count; i++) {
+            const Event& event = log->events[i];
+            if (event.begin < capture_start_) {
+                continue;  // Started before the capture
+            }
+
+            // Handlers are named after their method, the other phases nest in them
+            const char* method = method_name(event.method);
+            const char* name = event.phase == kHandler ? method : phase_name(event.phase);
+            out << ",\n{\"name\":\"" << name << "\",\"cat\":\"" << phase_name(event.phase)
+                << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << log->tid
+                << ",\"ts\":" << static_cast<double>(event.begin - capture_start_) * ns_per_cycle / 1000
+                << ",\"dur\":" << static_cast<double>(event.end - event.begin) * ns_per_cycle / 1000
+                << ",\"args\":{\"method\":\"" << method << "\"}}";
+            written++;
+        }
+    }
+    out << "\n]}\n";
+    out.close();
+
+    // The logs of the threads that exited during the capture are written
+    logs_->erase(std::remove_if(logs_->begin(), logs_->end(),
+                                [](const std::unique_ptr<ThreadLog>& log) { return log->retired; }),
+                 logs_->end());
+
+    if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to write trace file " << path << ": " << std::strerror(errno) << std::endl;
+        std::remove(tmp.c_str());
+        return false;
+    }
+
+    std::cout << "Wrote " << written << " trace events to " << path;
+    if (dropped > 0) {
+        std::cout << ", " << dropped << " more dropped past " << kMaxTraceEvents << " per thread";
+    }
+    std::cout << std::endl;
+    return true;
+}
+
+bool PhaseProfiler::capturing() { return capturing_.load(std::memory_order_relaxed); }
+
+void PhaseProfiler::WritePrometheus(std::ostream& out) {
+    struct Merged {
+        uint64_t count = 0;
+        uint64_t cycles = 0;
+        uint64_t max_cycles = 0;
+    };
+
+    std::array<std::array<Merged, kPhaseCount>, kMaxMethods> merged{};
+    std::size_t methods;
+    double seconds_per_cycle;
+    bool enabled;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        methods = method_count_.load(std::memory_order_acquire);
+        seconds_per_cycle = cycles_per_ns_ > 0 ? 1e-9 / cycles_per_ns_ : 0;
+        enabled = enabled_.load(std::memory_order_relaxed);
+
+        auto merge = [&](const std::array<std::array<Cell, kPhaseCount>, kMaxMethods>& cells) {
+            for (std::size_t m = 0; m < methods; m++) {
+                for (std::size_t p = 0; p < kPhaseCount; p++) {
+                    const Cell& cell = cells[m][p];
+                    Merged& into = merged[m][p];
+                    into.count += cell.count.load(std::memory_order_relaxed);
+                    into.cycles += cell.cycles.load(std::memory_order_relaxed);
+                    into.max_cycles = std::max(into.max_cycles, cell.max_cycles.load(std::memory_order_relaxed));
+                }
+            }
+        };
+
+        merge(retired_);
+        for (const auto& log : *logs_) {
+            if (!log->retired) {
+                merge(log->cells);
+            }
+        }
+    }
+
+    out << "# HELP order_service_profiler_enabled Whether the phases of the calls are being timed.\n";
+    out << "# TYPE order_service_profiler_enabled gauge\n";
+    out << "order_service_profiler_enabled " << (enabled ? 1 : 0) << "\n";
+
+    // Only the method and phase pairs timed at least once
+    auto write = [&](const char* name, const char* help, const char* type, auto value) {
+        out << "# HELP " << name << " " << help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+        for (std::size_t m = 0; m < methods; m++) {
+            for (std::size_t p = 0; p < kPhaseCount; p++) {
+                if (merged[m][p].count > 0) {
+                    out << name << "{method=\"" << method_name(m) << "\",phase=\"" << phase_name(p) << "\"} "
+                        << value(merged[m][p]) << "\n";
+                }
+            }
+        }
+    };
+    write("order_service_phase_seconds_total", "Time spent in each phase of the calls, by method.", "counter",
+          [&](const Merged& cell) { return static_cast<double>(cell.cycles) * seconds_per_cycle; });
+    write("order_service_phase_total", "Times each phase of the calls was timed, by method.", "counter",
+          [](const Merged& cell) { return cell.count; });
+    write("order_service_phase_max_seconds", "Longest time spent in one phase of a call, by method.", "gauge",
+          [&](const Merged& cell) { return static_cast<double>(cell.max_cycles) * seconds_per_cycle; });
+}
+
+void PhaseProfiler::Record(Phase phase, uint64_t begin, uint64_t end) {
+    ThreadLog& log = local_log();
+    uint64_t cycles = end > begin ? end - begin : 0;
+
+    Cell& cell = log.cells[log.method][phase];
+    increment(cell.count, 1);
+    increment(cell.cycles, cycles);
+    if (cycles > cell.max_cycles.load(std::memory_order_relaxed)) {
+        cell.max_cycles.store(cycles, std::memory_order_relaxed);
+    }
+
+    if (!capturing_.load(std::memory_order_acquire)) {
+        if (log.events) {
+            release_events(log);
+        }
+        return;
+    }
+
+    // The first event of a capture on this thread drops the last capture's
+    uint64_t generation = generation_.load(std::memory_order_relaxed);
+    if (log.generation.load(std::memory_order_relaxed) != generation) {
+        if (!log.events) {
+            log.events.reset(new Event[kMaxTraceEvents]);
+        }
+        log.event_count.store(0, std::memory_order_relaxed);
+        log.dropped.store(0, std::memory_order_relaxed);
+        log.generation.store(generation, std::memory_order_release);
+    }
+
+    std::size_t count = log.event_count.load(std::memory_order_relaxed);
+    if (count == kMaxTraceEvents) {
+        increment(log.dropped, 1);
+        return;
+    }
+    log.events[count] = Event{begin, end, phase, static_cast<uint8_t>(log.method)};
+    log.event_count.store(count + 1, std::memory_order_release);
+}
+
+bool PhaseProfiler::EnterHandler(const char* method) {
+    ThreadLog& log = local_log();
+    if (log.method != 0) {
+        return false;
+    }
+    log.method = method_index(method);
+    return true;
+}
+
+void PhaseProfiler::LeaveHandler() { local_log().method = 0; }
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+PhaseProfiler::ThreadLog& PhaseProfiler::local_log() {
+    thread_local LogOwner owner;
+    if (owner.log) {
+        return *owner.log;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    logs_->push_back(std::make_unique<ThreadLog>());
+    owner.log = logs_->back().get();
+    owner.log->tid = static_cast<int>(::syscall(SYS_gettid));
+    return *owner.log;
+}
+
+// Runs on the exiting thread. A log with events of the running capture stays
+// until StopCapture has written them.
+void PhaseProfiler::retire(ThreadLog* log) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t m = 0; m < kMaxMethods; m++) {
+        for (std::size_t p = 0; p < kPhaseCount; p++) {
+            const Cell& cell = log->cells[m][p];
+            Cell& into = retired_[m][p];
+            increment(into.count, cell.count.load(std::memory_order_relaxed));
+            increment(into.cycles, cell.cycles.load(std::memory_order_relaxed));
+            uint64_t max_cycles = cell.max_cycles.load(std::memory_order_relaxed);
+            if (max_cycles > into.max_cycles.load(std::memory_order_relaxed)) {
+                into.max_cycles.store(max_cycles, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    log->retired = true;
+    if (capturing_.load(std::memory_order_relaxed) &&
+        log->generation.load(std::memory_order_relaxed) == generation_.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    auto it = std::find_if(logs_->begin(), logs_->end(),
+                           [log](const std::unique_ptr<ThreadLog>& owned) { return owned.get() == log; });
+    logs_->erase(it);
+}
+
+// Under mutex_, so a StopCapture reading the events is done with them
+void PhaseProfiler::release_events(ThreadLog& log) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    log.generation.store(0, std::memory_order_relaxed);
+    log.event_count.store(0, std::memory_order_relaxed);
+    log.events.reset();
+}
+
+// Lock-free when called with a pointer seen before, which handlers do with
+// their string literal
+std::size_t PhaseProfiler::method_index(const char* name) {
+    std::size_t count = method_count_.load(std::memory_order_acquire);
+    for (std::size_t i = 1; i < count; i++) {
+        if (methods_[i].load(std::memory_order_relaxed) == name) {
+            return i;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    count = method_count_.load(std::memory_order_relaxed);
+    for (std::size_t i = 1; i < count; i++) {
+        if (std::strcmp(methods_[i].load(std::memory_order_relaxed), name) == 0) {
+            return i;
+        }
+    }
+    if (count == kMaxMethods) {
+        return kMaxMethods - 1;
+    }
+
+    std::size_t index = count;
+    methods_[index].store(index == kMaxMethods - 1 ? "other" : name, std::memory_order_relaxed);
+    method_count_.store(index + 1, std::memory_order_release);
+    return index;
+}
+
+// Measures the TSC against steady_clock once, before the first timing
+void PhaseProfiler::calibrate() {
+    if (cycles_per_ns_ > 0) {
+        return;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    auto start = std::chrono::steady_clock::now();
+    uint64_t begin = Now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t end = Now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    cycles_per_ns_ = static_cast<double>(end - begin) / static_cast<double>(elapsed.count());
+#else
+    cycles_per_ns_ = 1.0;
+#endif
+}
+
+// Only the owning thread writes a log, so a plain load and store are enough
+void PhaseProfiler::increment(std::atomic<uint64_t>& counter, uint64_t by) {
+    counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+const char* PhaseProfiler::method_name(std::size_t method) {
+    return method == 0 ? "background" : methods_[method].load(std::memory_order_relaxed);
+}
+
+const char* PhaseProfiler::phase_name(std::size_t phase) {
+    static constexpr const char* kNames[kPhaseCount] = {"handler", "lock_wait", "lock_hold",
+                                                        "copy",    "serialize", "wal_wait"};
+    return kNames[phase];
+}
@@ -0,0 +1,415 @@
+#include "metrics/rpc_metrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+constexpr const char* kStatusNames[] = {"OK",
+                                        "CANCELLED",
+                                        "UNKNOWN",
+                                        "INVALID_ARGUMENT",
+                                        "DEADLINE_EXCEEDED",
+                                        "NOT_FOUND",
+                                        "ALREADY_EXISTS",
+                                        "PERMISSION_DENIED",
+                                        "RESOURCE_EXHAUSTED",
+                                        "FAILED_PRECONDITION",
+                                        "ABORTED",
+                                        "OUT_OF_RANGE",
+                                        "UNIMPLEMENTED",
+                                        "INTERNAL",
+                                        "UNAVAILABLE",
+                                        "DATA_LOSS",
+                                        "UNAUTHENTICATED"};
+
+constexpr double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+std::atomic<uint64_t> next_registry_id{1};
+
+// Registries alive by id, a thread exiting only retires its shards into
+// these. Never destroyed, threads may still exit during static destruction.
+struct LiveRegistries {
+    std::mutex mutex;
+    std::unordered_map<uint64_t, RpcMetrics*> registries;
+};
+
+LiveRegistries& live_registries() {
+    static LiveRegistries* live = new LiveRegistries();
+    return *live;
+}
+
+// grpc_service="package.Service",grpc_method="Method" from "/package.Service/Method"
+std::string method_labels(const std::string& method) {
+    std::size_t slash = method.rfind('/');
+    if (slash == std::string::npos || slash == 0) {
+        return "grpc_service=\"\",grpc_method=\"" + method + "\"";
+    }
+    std::size_t begin = method[0] == '/' ? 1 : 0;
+    return "grpc_service=\"" + method.substr(begin, slash - begin) + "\",grpc_method=\"" + method.substr(slash + 1) +
+           "\"";
+}
+
+}  // namespace
+
+struct RpcMetrics::ShardOwner {
+    std::vector<std::pair<uint64_t, Shard*>> shards;
+
+    // Under the live lock, so the registry cannot go meanwhile
+    ~ShardOwner() {
+        LiveRegistries& live = live_registries();
+        std::lock_guard<std::mutex> lock(live.mutex);
+        for (const auto& [id, shard] : this->shards) {
+            auto it = live.registries.find(id);
+            if (it != live.registries.end()) {
+                it->second->retire(shard);
+            }
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+RpcMetrics::RpcMetrics() : id_(next_registry_id.fetch_add(1)) {
+    LiveRegistries& live = live_registries();
+    std::lock_guard<std::mutex> lock(live.mutex);
+    live.registries.emplace(this->id_, this);
+}
+
+RpcMetrics::~RpcMetrics() {
+    {
+        LiveRegistries& live = live_registries();
+        std::lock_guard<std::mutex> lock(live.mutex);
+        live.registries.erase(this->id_);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stopping_ = true;
+    }
+    this->stop_cv_.notify_all();
+
+    if (this->exporter_.joinable()) {
+        this->exporter_.join();
+        this->ExportTo(this->export_path_);
+    }
+}
+
+RpcMetrics::Shard::~Shard() {
+    for (auto& method : this->cells) {
+        for (auto& cell : method) {
+            delete cell.load();
+        }
+    }
+}
+
+std::size_t RpcMetrics::MethodIndex(const char* method) {
+    std::size_t count = this->method_count_.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < count; i++) {
+        if (this->method_keys_[i].load(std::memory_order_relaxed) == method) {
+            return i;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    for (std::size_t i = 0; i < this->method_names_.size(); i++) {
+        if (this->method_names_[i] == method) {
+            return i;
+        }
+    }
+
+    if (this->method_names_.size() == kMaxMethods - 1) {
+        this->method_names_.push_back("other");
+    }
+    if (this->method_names_.size() == kMaxMethods) {
+        return kMaxMethods - 1;
+    }
+
+    std::size_t index = this->method_names_.size();
+    this->method_names_.push_back(method);
+    this->method_keys_[index].store(method, std::memory_order_relaxed);
+    this->method_count_.store(index + 1, std::memory_order_release);
+    return index;
+}
+
+void RpcMetrics::Started(std::size_t method) { increment(this->local_shard().started[method]); }
+
+void RpcMetrics::Finished(std::size_t method, grpc::StatusCode code, std::chrono::nanoseconds latency) {
+    std::size_t status = static_cast<std::size_t>(code) < kStatusCodes ? static_cast<std::size_t>(code)
+                                                                        : static_cast<std::size_t>(grpc::UNKNOWN);
+    std::atomic<Cell*>& slot = this->local_shard().cells[method][status];
+
+    Cell* cell = slot.load(std::memory_order_relaxed);
+    if (!cell) {
+        cell = new Cell();
+        slot.store(cell, std::memory_order_release);
+    }
+
+    uint64_t nanos = latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0;
+    increment(cell->count);
+    increment(cell->sum_ns, nanos);
+    increment(cell->buckets[bucket_of(nanos)]);
+}
+
+void RpcMetrics::AddCollector(Collector collector) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->collectors_.push_back(std::move(collector));
+}
+
+void RpcMetrics::WritePrometheus(std::ostream& out) const {
+    struct Merged {
+        uint64_t count = 0;
+        uint64_t sum_ns = 0;
+        std::array<uint64_t, kBucketCount> buckets{};
+    };
+
+    std::vector<std::string> names;
+    std::vector<uint64_t> started;
+    std::vector<std::array<Merged, kStatusCodes>> merged;
+    std::vector<Collector> collectors;
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        names = this->method_names_;
+        collectors = this->collectors_;
+        started.resize(names.size());
+        merged.resize(names.size());
+
+        auto merge = [&](const Shard& shard) {
+            for (std::size_t m = 0; m < names.size(); m++) {
+                started[m] += shard.started[m].load(std::memory_order_relaxed);
+
+                for (std::size_t s = 0; s < kStatusCodes; s++) {
+                    const Cell* cell = shard.cells[m][s].load(std::memory_order_acquire);
+                    if (!cell) {
+                        continue;
+                    }
+
+                    Merged& into = merged[m][s];
+                    into.count += cell->count.load(std::memory_order_relaxed);
+                    into.sum_ns += cell->sum_ns.load(std::memory_order_relaxed);
+                    for (std::size_t b = 0; b < kBucketCount; b++) {
+                        into.buckets[b] += cell->buckets[b].load(std::memory_order_relaxed);
+                    }
+                }
+            }
+        };
+
+        merge(this->retired_);
+        for (const auto& shard : this->shards_) {
+            merge(*shard);
+        }
+    }
+
+    std::vector<std::string> labels;
+    for (const std::string& name : names) {
+        labels.push_back(method_labels(name));
+    }
+
+    out << "# HELP grpc_server_started_total RPCs started on the server.\n";
+    out << "# TYPE grpc_server_started_total counter\n";
+    for (std::size_t m = 0; m < names.size(); m++) {
+        out << "grpc_server_started_total{" << labels[m] << "} " << started[m] << "\n";
+    }
+
+    out << "# HELP grpc_server_handled_total RPCs completed on the server, by status code.\n";
+    out << "# TYPE grpc_server_handled_total counter\n";
+    for (std::size_t m = 0; m < names.size(); m++) {
+        for (std::size_t s = 0; s < kStatusCodes; s++) {
+            if (merged[m][s].count > 0) {
+                out << "grpc_server_handled_total{" << labels[m] << ",grpc_code=\""
+                    << StatusName(static_cast<grpc::StatusCode>(s)) << "\"} " << merged[m][s].count << "\n";
+            }
+        }
+    }
+
+    // Read shard by shard while RPCs run, so it can be off by a few
+    out << "# HELP grpc_server_in_flight RPCs started and not completed yet.\n";
+    out << "# TYPE grpc_server_in_flight gauge\n";
+    for (std::size_t m = 0; m < names.size(); m++) {
+        uint64_t handled = 0;
+        for (const Merged& cell : merged[m]) {
+            handled += cell.count;
+        }
+        out << "grpc_server_in_flight{" << labels[m] << "} " << (started[m] > handled ? started[m] - handled : 0)
+            << "\n";
+    }
+
+    out << "# HELP grpc_server_handling_seconds Time from the server picking an RPC up to sending its status.\n";
+    out << "# TYPE grpc_server_handling_seconds summary\n";
+    for (std::size_t m = 0; m < names.size(); m++) {
+        for (std::size_t s = 0; s < kStatusCodes; s++) {
+            const Merged& cell = merged[m][s];
+            if (cell.count == 0) {
+                continue;
+            }
+
+            std::string series = labels[m] + ",grpc_code=\"" + StatusName(static_cast<grpc::StatusCode>(s)) + "\"";
+            for (double quantile : kQuantiles) {
+                uint64_t target = static_cast<uint64_t>(quantile * static_cast<double>(cell.count) + 0.5);
+                target = std::max<uint64_t>(target, 1);
+
+                uint64_t seen = 0;
+                std::size_t bucket = 0;
+                for (; bucket < kBucketCount - 1; bucket++) {
+                    seen += cell.buckets[bucket];
+                    if (seen >= target) {
+                        break;
+                    }
+                }
+
+                out << "grpc_server_handling_seconds{" << series << ",quantile=\"" << quantile << "\"} "
+                    << static_cast<double>(bucket_upper_bound(bucket)) / 1e9 << "\n";
+            }
+            out << "grpc_server_handling_seconds_sum{" << series << "} " << static_cast<double>(cell.sum_ns) / 1e9
+                << "\n";
+            out << "grpc_server_handling_seconds_count{" << series << "} " << cell.count << "\n";
+        }
+    }
+
+    for (const Collector& collector : collectors) {
+        collector(out);
+    }
+}
+
+bool RpcMetrics::ExportTo(const std::string& path) const {
+    std::ostringstream text;
+    this->WritePrometheus(text);
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        file << text.str();
+        if (!file.flush()) {
+            std::cerr << "Failed to write metrics to " << tmp_path << std::endl;
+            return false;
+        }
+    }
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to replace metrics file " << path << std::endl;
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void RpcMetrics::StartExport(const std::string& path, std::chrono::seconds interval) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (this->exporter_.joinable()) {
+        return;
+    }
+
+    this->export_path_ = path;
+    this->exporter_ = std::thread([this, interval] {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        while (!this->stop_cv_.wait_for(lock, interval, [this] { return this->stopping_; })) {
+            lock.unlock();
+            this->ExportTo(this->export_path_);
+            lock.lock();
+        }
+    });
+}
+
+void RpcMetrics::WriteCounter(std::ostream& out, const std::string& name, const std::string& help, uint64_t value) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " counter\n";
+    out << name << " " << value << "\n";
+}
+
+void RpcMetrics::WriteGauge(std::ostream& out, const std::string& name, const std::string& help, double value) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " gauge\n";
+    out << name << " " << value << "\n";
+}
+
+const char* RpcMetrics::StatusName(grpc::StatusCode code) {
+    std::size_t index = static_cast<std::size_t>(code);
+    return index < std::size(kStatusNames) ? kStatusNames[index] : "UNKNOWN";
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+//
+// Each thread keeps its shard per registry. Registry ids are never reused,
+// so the entry of a destroyed registry is never matched again.
+RpcMetrics::Shard& RpcMetrics::local_shard() {
+    thread_local ShardOwner owner;
+
+    for (const auto& [id, shard] : owner.shards) {
+        if (id == this->id_) {
+            return *shard;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->shards_.push_back(std::make_unique<Shard>());
+    owner.shards.emplace_back(this->id_, this->shards_.back().get());
+    return *this->shards_.back();
+}
+
+// Runs on the exiting thread, the shard's only writer
+void RpcMetrics::retire(Shard* shard) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    for (std::size_t m = 0; m < kMaxMethods; m++) {
+        increment(this->retired_.started[m], shard->started[m].load(std::memory_order_relaxed));
+
+        for (std::size_t s = 0; s < kStatusCodes; s++) {
+            const Cell* cell = shard->cells[m][s].load(std::memory_order_relaxed);
+            if (!cell) {
+                continue;
+            }
+
+            std::atomic<Cell*>& slot = this->retired_.cells[m][s];
+            Cell* into = slot.load(std::memory_order_relaxed);
+            if (!into) {
+                into = new Cell();
+                slot.store(into, std::memory_order_release);
+            }
+            increment(into->count, cell->count.load(std::memory_order_relaxed));
+            increment(into->sum_ns, cell->sum_ns.load(std::memory_order_relaxed));
+            for (std::size_t b = 0; b < kBucketCount; b++) {
+                increment(into->buckets[b], cell->buckets[b].load(std::memory_order_relaxed));
+            }
+        }
+    }
+
+    auto it = std::find_if(this->shards_.begin(), this->shards_.end(),
+                           [shard](const std::unique_ptr<Shard>& owned) { return owned.get() == shard; });
+    this->shards_.erase(it);
+}
+
+// Only the owning thread writes a shard, so a plain load and store are enough
+void RpcMetrics::increment(std::atomic<uint64_t>& counter, uint64_t by) {
+    counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+// Nanoseconds are counted in 1.024 us units: one bucket per unit below 16,
+// then 8 buckets per power of two up to about 4.5 minutes
+std::size_t RpcMetrics::bucket_of(uint64_t nanos) {
+    uint64_t units = std::min<uint64_t>(nanos >> 10, (uint64_t{1} << 28) - 1);
+    if (units < 16) {
+        return static_cast<std::size_t>(units);
+    }
+
+    int shift = 63 - __builtin_clzll(units) - 3;
+    return (static_cast<std::size_t>(shift) << 3) + static_cast<std::size_t>(units >> shift);
+}
+
+uint64_t RpcMetrics::bucket_upper_bound(std::size_t bucket) {
+    if (bucket < 16) {
+        return static_cast<uint64_t>(bucket + 1) << 10;
+    }
+
+    int shift = static_cast<int>(bucket >> 3) - 1;
+    uint64_t lowest = static_cast<uint64_t>(bucket - (static_cast<std::size_t>(shift) << 3)) << shift;
+    return (lowest + (uint64_t{1} << shift)) << 10;
+}
@@ -1,47 +1,232 @@
 #include "server/server.hpp"
 
+#include <algorithm>
+#include <stdexcept>
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
 Server::Server(const std::string& addr, std::shared_ptr<grpc::Service> service, const std::string& service_name)
-    : service_(service), addr_(addr), service_name_(service_name) {
-    // Register the interceptors
-    this->interceptors_.emplace_back(std::make_unique<LoggerInterceptorFactory>());
+    : service_(service), addr_(addr), service_name_(service_name), metrics_(std::make_shared<RpcMetrics>()) {}
+
+void Server::SetAsyncEngine(AsyncEngineFactory factory) { this->async_engine_factory_ = std::move(factory); }
+
+void Server::SetAccessLog(std::shared_ptr<AccessLog> log) { this->access_log_ = std::move(log); }
+
+void Server::SetOptions(const ServerOptions& options) { this->options_ = options; }
+
+void Server::SetShutdownHooks(std::function<void()> drain, std::function<void()> flush) {
+    this->drain_ = std::move(drain);
+    this->flush_ = std::move(flush);
+}
+
+void Server::Start() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+
+    int shards = std::max(1, this->options_.shards);
+    try {
+        for (int shard = 0; shard < shards; shard++) {
+            this->servers_.push_back(this->build_shard(shard));
+        }
+    } catch (...) {
+        // The shards already up go down before their engines
+        for (auto& server : this->servers_) {
+            server->Shutdown();
+        }
+        for (auto& engine : this->async_engines_) {
+            engine->Shutdown();
+        }
+        this->servers_.clear();
+        this->async_engines_.clear();
+        throw;
+    }
+
+    for (auto& engine : this->async_engines_) {
+        engine->Start();
+    }
+
+    std::cout << "Server " << this->service_name_ << ", started at " << this->addr_;
+    if (shards > 1) {
+        std::cout << " with " << shards << " shards";
+    }
+    std::cout << std::endl;
+}
+
+void Server::Wait() {
+    // On copies, as Stop releases them
+    std::vector<std::shared_ptr<grpc::Server>> servers;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        servers = this->servers_;
+    }
+    for (auto& server : servers) {
+        server->Wait();
+    }
 }
 
 void Server::Run() {
+    this->Start();
+    this->Wait();
+}
+
+std::shared_ptr<grpc::Channel> Server::InProcessChannel(const grpc::ChannelArguments& args) {
+    std::shared_ptr<grpc::Server> server;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (this->servers_.empty()) {
+            throw std::runtime_error("Server " + this->service_name_ + " is not running");
+        }
+        unsigned shard = this->next_in_process_.fetch_add(1, std::memory_order_relaxed) % this->servers_.size();
+        server = this->servers_[shard];
+    }
+    return server->InProcessChannel(args);
+}
+
+void Server::Stop() {
+    // Stop method to stop the server
+    std::cout << "Stopping server " << this->service_name_ << ", please wait" << std::endl;
+
+    // Taken out under the lock and shut down outside it, the engines stay
+    // until the server is destroyed
+    std::vector<std::shared_ptr<grpc::Server>> servers;
+    std::vector<AsyncEngine*> engines;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        servers.swap(this->servers_);
+        for (auto& engine : this->async_engines_) {
+            engines.push_back(engine.get());
+        }
+    }
+    if (servers.empty()) {
+        std::cout << "Server " << this->service_name_ << " is not running." << std::endl;
+        return;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    auto ms = [](Clock::duration d) { return std::chrono::duration_cast<std::chrono::milliseconds>(d).count(); };
+    Clock::time_point start = Clock::now();
+
+    // Open streams would otherwise hold the shutdown until the deadline
+    if (this->drain_) {
+        this->drain_();
+    }
+    Clock::time_point drained = Clock::now();
+
+    // Stops listening right away, then waits for the calls in flight and
+    // cancels those still running at the deadline, which all shards share
+    auto deadline = std::chrono::system_clock::now() + this->options_.shutdown_deadline;
+    for (auto& server : servers) {
+        server->Shutdown(deadline);
+    }
+    for (AsyncEngine* engine : engines) {
+        engine->Shutdown();
+    }
+    servers.clear();
+    Clock::time_point shut_down = Clock::now();
+
+    if (this->access_log_) {
+        this->access_log_->Flush();
+    }
+    if (this->flush_) {
+        this->flush_();
+    }
+    Clock::time_point flushed = Clock::now();
+
+    std::cout << "Server " << this->service_name_ << " stopped in " << ms(flushed - start) << "ms: streams closed in "
+              << ms(drained - start) << "ms, calls finished in " << ms(shut_down - drained) << "ms"
+              << (shut_down - drained >= this->options_.shutdown_deadline ? " (deadline reached, the rest cancelled)"
+                                                                           : "")
+              << ", buffers flushed in " << ms(flushed - shut_down) << "ms" << std::endl;
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+std::shared_ptr<grpc::Server> Server::build_shard(int shard) {
     grpc::ServerBuilder builder;
 
-    // Bind the listening address
+    // Bind the listening address, shards share the port
     builder.AddListeningPort(this->addr_, grpc::InsecureServerCredentials());
+    if (this->options_.shards > 1) {
+        builder.AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, 1);
+    }
 
-    // Register the interceptor
-    builder.experimental().SetInterceptorCreators(std::move(this->interceptors_));
+    // Pollers, limits, keepalive and the resource quota
+    this->apply_options(builder);
 
-    // Register the services
-    builder.RegisterService(this->service_.get());
+    // Register the interceptors, metrics first so its timing covers the
+    // others. Every shard records into the same metrics and access log.
+    std::vector<std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>> interceptors;
+    interceptors.emplace_back(std::make_unique<MetricsInterceptorFactory>(this->metrics_));
+    if (this->access_log_) {
+        interceptors.emplace_back(std::make_unique<LoggerInterceptorFactory>(this->access_log_));
+    }
+    builder.experimental().SetInterceptorCreators(std::move(interceptors));
+
+    // Register the services, the async engine brings its own service and
+    // completion queues
+    if (this->async_engine_factory_) {
+        this->async_engines_.push_back(this->async_engine_factory_(shard));
+        AsyncEngine* engine = this->async_engines_.back().get();
+        builder.RegisterService(engine->service());
+        engine->Attach(builder);
+    } else {
+        builder.RegisterService(this->service_.get());
+    }
 
     // Build the server and start it
-    this->server_ = builder.BuildAndStart();
+    std::shared_ptr<grpc::Server> server = builder.BuildAndStart();
 
-    if (!this->server_) {
-        std::cerr << "Failed to start server at " << this->addr_ << std::endl;
+    if (!server) {
+        std::cerr << "Failed to start server shard " << shard << " at " << this->addr_ << std::endl;
         throw std::runtime_error("Server failed to start");
     }
+    return server;
+}
 
-    std::cout << "Server " << this->service_name_ << ", started at " << this->addr_ << std::endl;
+void Server::apply_options(grpc::ServerBuilder& builder) const {
+    const ServerOptions& options = this->options_;
 
-    // Wait until it shutsdown
-    this->server_->Wait();
-}
+    if (!this->async_engine_factory_) {
+        builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::NUM_CQS, options.sync_cqs);
+        builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MIN_POLLERS, options.sync_min_pollers);
+        builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MAX_POLLERS, options.sync_max_pollers);
+        builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::CQ_TIMEOUT_MSEC,
+                                    options.sync_cq_timeout_ms);
+    }
 
-void Server::Stop() {
-    // Stop method to stop the server
-    std::cout << "Stopping server " << this->service_name_ << ", please wait" << std::endl;
+    if (options.max_concurrent_streams > 0) {
+        builder.AddChannelArgument(GRPC_ARG_MAX_CONCURRENT_STREAMS, options.max_concurrent_streams);
+    }
+    builder.SetMaxReceiveMessageSize(options.max_receive_message_bytes > 0 ? options.max_receive_message_bytes : -1);
+    builder.SetMaxSendMessageSize(options.max_send_message_bytes > 0 ? options.max_send_message_bytes : -1);
 
-    // Stop the server if it is running
-    if (this->server_) {
-        this->server_->Shutdown();
-        this->server_.reset();
-        std::cout << "Server " << this->service_name_ << " stopped." << std::endl;
-    } else {
-        std::cout << "Server " << this->service_name_ << " is not running." << std::endl;
+    builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIME_MS, options.keepalive_time_ms);
+    builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, options.keepalive_timeout_ms);
+    builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, options.keepalive_permit_without_calls ? 1 : 0);
+    builder.AddChannelArgument(GRPC_ARG_HTTP2_MIN_RECV_PING_INTERVAL_WITHOUT_DATA_MS,
+                               options.keepalive_min_ping_interval_ms);
+
+    if (options.max_connection_idle_ms > 0) {
+        builder.AddChannelArgument(GRPC_ARG_MAX_CONNECTION_IDLE_MS, options.max_connection_idle_ms);
+    }
+    if (options.max_connection_age_ms > 0) {
+        builder.AddChannelArgument(GRPC_ARG_MAX_CONNECTION_AGE_MS, options.max_connection_age_ms);
+    }
+    if (options.max_connection_age_grace_ms > 0) {
+        builder.AddChannelArgument(GRPC_ARG_MAX_CONNECTION_AGE_GRACE_MS, options.max_connection_age_grace_ms);
+    }
+
+    // Under memory pressure gRPC shrinks its buffers and rejects new
+    // connections rather than growing past the quota
+    if (options.resource_quota_bytes > 0 || options.resource_quota_threads > 0) {
+        grpc::ResourceQuota quota("order-service");
+        if (options.resource_quota_bytes > 0) {
+            quota.Resize(options.resource_quota_bytes);
+        }
+        if (options.resource_quota_threads > 0) {
+            quota.SetMaxThreads(options.resource_quota_threads);
+        }
+        builder.SetResourceQuota(quota);
     }
 }
@@ -0,0 +1,197 @@
+#include "service/admission_control.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+using grpc::Status;
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+AdmissionControl::Ticket::~Ticket() {
+    if (this->control_) {
+        this->control_->finish(this->lane_, this->start_);
+    }
+}
+
+AdmissionControl::AdmissionControl(AdmissionOptions options, std::vector<Lane> lanes)
+    : options_(options), lane_count_(lanes.size()), limit_(options.initial_limit) {
+    if (lanes.size() > kMaxLanes) {
+        throw std::invalid_argument("AdmissionControl supports at most " + std::to_string(kMaxLanes) + " lanes");
+    }
+    for (std::size_t i = 0; i < lanes.size(); i++) {
+        this->lanes_[i].lane = std::move(lanes[i]);
+    }
+}
+
+Status AdmissionControl::Admit(const grpc::ServerContextBase* context, std::size_t lane, Ticket* ticket) {
+    Status status = this->decide(context, lane, true);
+    if (status.ok()) {
+        ticket->control_ = this;
+        ticket->lane_ = lane;
+        if (this->lanes_[lane].lane.sample_latency) {
+            ticket->start_ = std::chrono::steady_clock::now();
+        }
+    }
+    return status;
+}
+
+Status AdmissionControl::Check(const grpc::ServerContextBase* context, std::size_t lane) {
+    return this->decide(context, lane, false);
+}
+
+void AdmissionControl::WritePrometheus(std::ostream& out) const {
+    out << "# HELP order_service_admission_total Calls admitted, rejected as over the limit, or expired before "
+           "they started.\n";
+    out << "# TYPE order_service_admission_total counter\n";
+    for (std::size_t i = 0; i < this->lane_count_; i++) {
+        const LaneState& state = this->lanes_[i];
+        const std::pair<const char*, uint64_t> decisions[] = {
+            {"admitted", state.admitted.load(std::memory_order_relaxed)},
+            {"rejected", state.rejected.load(std::memory_order_relaxed)},
+            {"expired", state.expired.load(std::memory_order_relaxed)}};
+
+        for (const auto& [decision, count] : decisions) {
+            out << "order_service_admission_total{grpc_method=\"" << state.lane.method << "\",decision=\""
+                << decision << "\"} " << count << "\n";
+        }
+    }
+
+    out << "# HELP order_service_admission_limit Calls allowed in flight at once.\n";
+    out << "# TYPE order_service_admission_limit gauge\n";
+    out << "order_service_admission_limit " << this->limit() << "\n";
+
+    out << "# HELP order_service_admission_in_flight Admitted calls not finished yet.\n";
+    out << "# TYPE order_service_admission_in_flight gauge\n";
+    out << "order_service_admission_in_flight " << this->in_flight() << "\n";
+
+    out << "# HELP order_service_admission_queue_delay_seconds Mean estimated queueing delay of the last window.\n";
+    out << "# TYPE order_service_admission_queue_delay_seconds gauge\n";
+    out << "order_service_admission_queue_delay_seconds "
+        << static_cast<double>(this->last_delay_ns_.load(std::memory_order_relaxed)) / 1e9 << "\n";
+
+    out << "# HELP order_service_admission_limit_changes_total Adjustments of the limit, by direction.\n";
+    out << "# TYPE order_service_admission_limit_changes_total counter\n";
+    out << "order_service_admission_limit_changes_total{direction=\"increase\"} "
+        << this->increases_.load(std::memory_order_relaxed) << "\n";
+    out << "order_service_admission_limit_changes_total{direction=\"decrease\"} "
+        << this->decreases_.load(std::memory_order_relaxed) << "\n";
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+Status AdmissionControl::decide(const grpc::ServerContextBase* context, std::size_t lane, bool take) {
+    LaneState& state = this->lanes_[lane];
+
+    // Without a deadline this is time_point::max()
+    if (context && context->deadline() <= std::chrono::system_clock::now()) {
+        state.expired.fetch_add(1, std::memory_order_relaxed);
+        return Status(grpc::DEADLINE_EXCEEDED, "Deadline exceeded before the call started");
+    }
+
+    int64_t allowed = this->allowed(state.lane.priority);
+    int64_t current = take ? this->in_flight_.fetch_add(1, std::memory_order_relaxed)
+                           : this->in_flight_.load(std::memory_order_relaxed);
+    if (current >= allowed) {
+        if (take) {
+            this->in_flight_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        state.rejected.fetch_add(1, std::memory_order_relaxed);
+        return Status(grpc::RESOURCE_EXHAUSTED, "Server overloaded, retry later");
+    }
+
+    state.admitted.fetch_add(1, std::memory_order_relaxed);
+    raise(this->window_peak_, current + 1);
+    return Status::OK;
+}
+
+void AdmissionControl::finish(std::size_t lane, std::chrono::steady_clock::time_point start) {
+    this->in_flight_.fetch_sub(1, std::memory_order_relaxed);
+
+    LaneState& state = this->lanes_[lane];
+    if (!state.lane.sample_latency || !this->options_.adaptive) {
+        return;
+    }
+
+    int64_t now = now_ns();
+    int64_t latency = now - std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
+    lower(state.min_ns, latency);
+    lower(state.next_min_ns, latency);
+
+    this->window_delay_ns_.fetch_add(latency - state.min_ns.load(std::memory_order_relaxed),
+                                     std::memory_order_relaxed);
+    this->window_samples_.fetch_add(1, std::memory_order_relaxed);
+    if (now >= this->window_end_ns_.load(std::memory_order_relaxed)) {
+        this->close_window(now);
+    }
+}
+
+// A window short of samples stays open, so a quiet server does not move the
+// limit on the strength of a few calls
+void AdmissionControl::close_window(int64_t now) {
+    std::unique_lock<std::mutex> lock(this->window_mutex_, std::try_to_lock);
+    if (!lock.owns_lock() || now < this->window_end_ns_.load(std::memory_order_relaxed) ||
+        this->window_samples_.load(std::memory_order_relaxed) < kMinWindowSamples) {
+        return;
+    }
+
+    uint64_t samples = this->window_samples_.exchange(0, std::memory_order_relaxed);
+    int64_t delay = this->window_delay_ns_.exchange(0, std::memory_order_relaxed) / static_cast<int64_t>(samples);
+    int64_t peak = this->window_peak_.exchange(this->in_flight(), std::memory_order_relaxed);
+    this->last_delay_ns_.store(delay, std::memory_order_relaxed);
+
+    int limit = this->limit();
+    if (delay > std::chrono::duration_cast<std::chrono::nanoseconds>(this->options_.max_queue_delay).count()) {
+        int lowered = std::max(this->options_.min_limit, static_cast<int>(limit * kBackoff));
+        if (lowered < limit) {
+            this->limit_.store(lowered, std::memory_order_relaxed);
+            this->decreases_.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else if (peak * 2 >= limit && limit < this->options_.max_limit) {
+        this->limit_.store(limit + 1, std::memory_order_relaxed);
+        this->increases_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (now >= this->next_min_period_ns_) {
+        for (std::size_t i = 0; i < this->lane_count_; i++) {
+            LaneState& state = this->lanes_[i];
+            state.min_ns.store(state.next_min_ns.exchange(INT64_MAX, std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+        }
+        this->next_min_period_ns_ = now + std::chrono::nanoseconds(kMinLatencyPeriod).count();
+    }
+    this->window_end_ns_.store(now + std::chrono::nanoseconds(kWindow).count(), std::memory_order_relaxed);
+}
+
+// Never below one call, so a lane is never shut out for good
+int64_t AdmissionControl::allowed(Priority priority) const {
+    int64_t limit = this->limit();
+    switch (priority) {
+        case Priority::kHigh:
+            return limit;
+        case Priority::kNormal:
+            return std::max<int64_t>(1, limit * 9 / 10);
+        case Priority::kLow:
+            return std::max<int64_t>(1, limit / 2);
+    }
+    return limit;
+}
+
+void AdmissionControl::lower(std::atomic<int64_t>& value, int64_t candidate) {
+    int64_t current = value.load(std::memory_order_relaxed);
+    while (candidate < current && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+    }
+}
+
+void AdmissionControl::raise(std::atomic<int64_t>& value, int64_t candidate) {
+    int64_t current = value.load(std::memory_order_relaxed);
+    while (candidate > current && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+    }
+}
+
+int64_t AdmissionControl::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
@@ -0,0 +1,667 @@
+#include "service/async_order_service.hpp"
+
+#include <grpcpp/alarm.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "service/call_arena.hpp"
+
+namespace {
+
+using AsyncService = AsyncOrderService::Service;
+
+// Base of every in-flight RPC, the object pointer is the completion queue tag
+class Call {
+   public:
+    virtual ~Call() = default;
+    virtual void Proceed(bool ok) = 0;
+};
+
+// Messages of a raw method, reused the same way as a CallArena
+class RawMessages {
+   public:
+    grpc::ByteBuffer* request() { return &this->request_; }
+    grpc::ByteBuffer* response() { return &this->response_; }
+
+    void Reset() {
+        this->request_.Clear();
+        this->response_.Clear();
+    }
+
+   private:
+    grpc::ByteBuffer request_;
+    grpc::ByteBuffer response_;
+};
+
+// Finishes a call that changed orders once the WAL has its changes, without
+// blocking the poller on the fsync. Of the poller returning from Run and the
+// WAL's callback, the second finishes the call: the poller inline, the
+// callback through an immediate alarm that brings the call back onto its queue.
+class DeferredCommit {
+   public:
+    // Runs `handler` through OrderService::RunDeferred. Returns true if its
+    // changes are already durable, otherwise `tag` comes back on `cq` once
+    // they are. Either way status() then holds the handler's status.
+    bool Run(OrderService* service, const std::function<Status()>& handler, grpc::CompletionQueue* cq, void* tag) {
+        this->handed_off_.store(false, std::memory_order_relaxed);
+        service->RunDeferred(handler, [this, cq, tag](const Status& status) {
+            this->status_ = status;
+            if (this->handed_off_.exchange(true, std::memory_order_acq_rel)) {
+                this->alarm_.Set(cq, std::chrono::system_clock::now(), tag);
+            }
+        });
+        return this->handed_off_.exchange(true, std::memory_order_acq_rel);
+    }
+
+    const Status& status() const { return this->status_; }
+
+   private:
+    grpc::Alarm alarm_;
+    Status status_;
+    std::atomic<bool> handed_off_{false};
+};
+
+// Unary RPC. Its messages live on a CallArena, and a finished call goes back to
+// a per-thread free list instead of being freed, so a warmed up server handles
+// a unary RPC without allocating the call, its context or its messages.
+// Handlers that change orders finish once the WAL has the changes, through a
+// DeferredCommit.
+template <typename Request, typename Response, typename Messages = CallArena<Request, Response>>
+class UnaryCall final : public Call {
+   public:
+    using RequestMethod = void (AsyncService::*)(grpc::ServerContext*, Request*, grpc::ServerAsyncResponseWriter<Response>*,
+                                                 grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void*);
+    using Handler = Status (OrderService::*)(ServerContext*, const Request*, Response*);
+
+    // Posts a call for the next request of `method` on `cq`. `writes` is set
+    // for the handlers that change orders.
+    static void Spawn(AsyncService* async_service, OrderService* service, grpc::ServerCompletionQueue* cq,
+                      RequestMethod method, Handler handler, bool writes = false) {
+        std::vector<UnaryCall*>& free = free_list().calls;
+
+        UnaryCall* call;
+        if (free.empty()) {
+            call = new UnaryCall();
+        } else {
+            call = free.back();
+            free.pop_back();
+        }
+        call->start(async_service, service, cq, method, handler, writes);
+    }
+
+    void Proceed(bool ok) override {
+        switch (this->state_) {
+            case State::kRequested:
+                if (!ok) {
+                    this->recycle();
+                    return;
+                }
+
+                // Keep one request posted per method and queue before handling this one
+                Spawn(this->async_service_, this->service_, this->cq_, this->method_, this->handler_, this->writes_);
+                this->handle();
+                return;
+
+            case State::kCommitting:
+                this->finish(this->commit_.status());
+                return;
+
+            case State::kFinishing:
+                this->recycle();
+                return;
+        }
+    }
+
+   private:
+    enum class State { kRequested, kCommitting, kFinishing };
+
+    static constexpr std::size_t kMaxFreeCalls = 64;  // Per thread and method
+
+    struct FreeList {
+        std::vector<UnaryCall*> calls;
+
+        ~FreeList() {
+            for (UnaryCall* call : this->calls) {
+                delete call;
+            }
+        }
+    };
+
+    AsyncService* async_service_ = nullptr;
+    OrderService* service_ = nullptr;
+    grpc::ServerCompletionQueue* cq_ = nullptr;
+    RequestMethod method_ = nullptr;
+    Handler handler_ = nullptr;
+    bool writes_ = false;
+
+    // A ServerContext serves a single RPC, it is rebuilt in place for each one
+    std::optional<grpc::ServerContext> ctx_;
+    Messages messages_;
+    std::optional<grpc::ServerAsyncResponseWriter<Response>> responder_;
+    DeferredCommit commit_;
+    State state_ = State::kRequested;
+
+    UnaryCall() = default;
+
+    static FreeList& free_list() {
+        thread_local FreeList list;
+        return list;
+    }
+
+    void start(AsyncService* async_service, OrderService* service, grpc::ServerCompletionQueue* cq,
+               RequestMethod method, Handler handler, bool writes) {
+        this->async_service_ = async_service;
+        this->service_ = service;
+        this->cq_ = cq;
+        this->method_ = method;
+        this->handler_ = handler;
+        this->writes_ = writes;
+        this->state_ = State::kRequested;
+
+        this->ctx_.emplace();
+        this->responder_.emplace(&*this->ctx_);
+        (this->async_service_->*this->method_)(&*this->ctx_, this->messages_.request(), &*this->responder_,
+                                               this->cq_, this->cq_, this);
+    }
+
+    void handle() {
+        auto handler = [this] {
+            return (this->service_->*this->handler_)(&*this->ctx_, this->messages_.request(),
+                                                     this->messages_.response());
+        };
+        if (!this->writes_) {
+            this->finish(handler());
+            return;
+        }
+
+        // Set first, the WAL's alarm may bring the call back on another poller
+        this->state_ = State::kCommitting;
+        if (this->commit_.Run(this->service_, handler, this->cq_, this)) {
+            this->finish(this->commit_.status());
+        }
+    }
+
+    void finish(const Status& status) {
+        this->state_ = State::kFinishing;
+        this->responder_->Finish(*this->messages_.response(), status, this);
+    }
+
+    void recycle() {
+        this->responder_.reset();
+        this->ctx_.reset();
+        this->messages_.Reset();
+
+        std::vector<UnaryCall*>& free = free_list().calls;
+        if (free.size() >= kMaxFreeCalls) {
+            delete this;
+            return;
+        }
+        free.push_back(this);
+    }
+};
+
+// IngestOrders. Only one operation is ever pending, so the call needs no lock:
+// each completed read queues the request and posts the next read, and the end
+// of the stream creates the rest and finishes once the WAL has them.
+class IngestCall final : public Call {
+   public:
+    IngestCall(AsyncService* async_service, OrderService* service, grpc::ServerCompletionQueue* cq)
+        : async_service_(async_service), service_(service), cq_(cq), reader_(&ctx_) {
+        this->async_service_->RequestIngestOrders(&this->ctx_, &this->reader_, this->cq_, this->cq_, this);
+    }
+
+    void Proceed(bool ok) override {
+        switch (this->state_) {
+            case State::kRequested:
+                if (!ok) {
+                    delete this;
+                    return;
+                }
+
+                new IngestCall(this->async_service_, this->service_, this->cq_);
+                this->start();
+                return;
+
+            case State::kReading:
+                if (ok) {
+                    this->queue();
+                    this->reader_.Read(&this->request_, this);
+                } else {
+                    this->commit();  // The client closed its side of the stream
+                }
+                return;
+
+            case State::kCommitting:
+                this->finish(this->commit_.status());
+                return;
+
+            case State::kFinishing:
+                delete this;
+                return;
+        }
+    }
+
+   private:
+    enum class State { kRequested, kReading, kCommitting, kFinishing };
+
+    AsyncService* async_service_;
+    OrderService* service_;
+    grpc::ServerCompletionQueue* cq_;
+
+    grpc::ServerContext ctx_;
+    osv1::CreateOrderRequest request_;
+    osv1::BatchCreateOrdersRequest chunk_;
+    osv1::IngestOrdersResponse response_;
+    grpc::ServerAsyncReader<osv1::IngestOrdersResponse, osv1::CreateOrderRequest> reader_;
+    DeferredCommit commit_;
+    State state_ = State::kRequested;
+
+    // Reads the first request once admission control let the stream in
+    void start() {
+        Status status = this->service_->StartIngest(&this->ctx_);
+        if (!status.ok()) {
+            this->state_ = State::kFinishing;
+            this->reader_.FinishWithError(status, this);
+            return;
+        }
+
+        this->state_ = State::kReading;
+        this->reader_.Read(&this->request_, this);
+    }
+
+    // A full chunk is created only once the next request is in, so the last
+    // chunk is always created on the poller thread that hands it to the WAL
+    void queue() {
+        if (this->chunk_.orders_size() == OrderService::kIngestChunkSize) {
+            this->service_->CreateOrders(this->chunk_.orders(), this->response_.mutable_order_ids());
+            this->chunk_.clear_orders();
+        }
+        this->chunk_.add_orders()->Swap(&this->request_);
+    }
+
+    // Set first, the WAL's alarm may bring the call back on another poller
+    void commit() {
+        this->state_ = State::kCommitting;
+        auto handler = [this] {
+            this->service_->CreateOrders(this->chunk_.orders(), this->response_.mutable_order_ids());
+            return this->service_->FinishIngest();
+        };
+        if (this->commit_.Run(this->service_, handler, this->cq_, this)) {
+            this->finish(this->commit_.status());
+        }
+    }
+
+    void finish(const Status& status) {
+        this->state_ = State::kFinishing;
+        if (status.ok()) {
+            this->reader_.Finish(this->response_, status, this);
+        } else {
+            this->reader_.FinishWithError(status, this);
+        }
+    }
+};
+
+// StreamListOrders. Like IngestCall only one operation is ever pending: each
+// completed write reads the next chunk from the store and writes it, so a
+// slow client holds the call back rather than chunks piling up in memory.
+class ListStreamCall final : public Call {
+   public:
+    ListStreamCall(AsyncService* async_service, OrderService* service, grpc::ServerCompletionQueue* cq)
+        : async_service_(async_service), service_(service), cq_(cq), writer_(&ctx_) {
+        this->async_service_->RequestStreamListOrders(&this->ctx_, &this->request_, &this->writer_, this->cq_,
+                                                      this->cq_, this);
+    }
+
+    void Proceed(bool ok) override {
+        switch (this->state_) {
+            case State::kRequested:
+                if (!ok) {
+                    delete this;
+                    return;
+                }
+
+                new ListStreamCall(this->async_service_, this->service_, this->cq_);
+                this->start();
+                return;
+
+            case State::kWriting:
+                if (!ok) {
+                    this->finish(Status(grpc::CANCELLED, "Stream cancelled by client"));
+                } else if (this->service_->NextListChunk(&this->stream_, &this->response_)) {
+                    this->write();
+                } else {
+                    this->finish(Status::OK);
+                }
+                return;
+
+            case State::kFinishing:
+                delete this;
+                return;
+        }
+    }
+
+   private:
+    enum class State { kRequested, kWriting, kFinishing };
+
+    AsyncService* async_service_;
+    OrderService* service_;
+    grpc::ServerCompletionQueue* cq_;
+
+    grpc::ServerContext ctx_;
+    osv1::ListOrdersRequest request_;
+    osv1::ListOrdersResponse response_;
+    grpc::ServerAsyncWriter<osv1::ListOrdersResponse> writer_;
+    OrderService::ListStream stream_;
+    State state_ = State::kRequested;
+
+    void start() {
+        Status status = this->service_->StartListStream(&this->ctx_, this->request_, &this->stream_, &this->response_);
+        if (!status.ok()) {
+            this->finish(status);
+            return;
+        }
+        this->write();
+    }
+
+    void write() {
+        this->state_ = State::kWriting;
+        this->writer_.Write(this->response_, this->service_->ListChunkOptions(this->response_), this);
+    }
+
+    void finish(const Status& status) {
+        this->state_ = State::kFinishing;
+        this->writer_.Finish(status, this);
+    }
+};
+
+// StreamOrderUpdates. The call sits idle without any pending operation until
+// the change feed notifies it, then an immediate alarm brings it back onto its
+// completion queue to write the queued events. The done tag tells it about
+// client cancellation while idle.
+class StreamCall final : public Call {
+   public:
+    StreamCall(AsyncService* async_service, OrderService* service, grpc::ServerCompletionQueue* cq)
+        : async_service_(async_service), service_(service), cq_(cq), writer_(&ctx_), done_(this) {
+        this->ctx_.AsyncNotifyWhenDone(&this->done_);
+        this->async_service_->RequestStreamOrderUpdates(&this->ctx_, &this->request_, &this->writer_, this->cq_,
+                                                        this->cq_, this);
+    }
+
+    void Proceed(bool ok) override {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+
+        switch (this->state_) {
+            case State::kRequested:
+                lock.unlock();
+                this->start(ok);
+                return;
+
+            case State::kWriting:
+                if (!ok) {
+                    this->finish(Status(grpc::CANCELLED, "Stream cancelled by client"));
+                } else if (this->last_) {
+                    this->finish(Status::OK);
+                } else {
+                    this->pump();
+                }
+                return;
+
+            case State::kWaking:
+                this->pump();
+                return;
+
+            case State::kFinishing:
+                this->finished_ = true;
+                this->maybe_destroy(lock);
+                return;
+
+            case State::kIdle:
+                return;  // No operation is pending while idle
+        }
+    }
+
+   private:
+    enum class State { kRequested, kWriting, kIdle, kWaking, kFinishing };
+
+    // Separate tag for AsyncNotifyWhenDone
+    class DoneTag final : public Call {
+       public:
+        explicit DoneTag(StreamCall* call) : call_(call) {}
+        void Proceed(bool ok) override { this->call_->on_done(); }
+
+       private:
+        StreamCall* call_;
+    };
+
+    AsyncService* async_service_;
+    OrderService* service_;
+    grpc::ServerCompletionQueue* cq_;
+
+    grpc::ServerContext ctx_;
+    grpc::ByteBuffer request_;
+    grpc::ServerAsyncWriter<grpc::ByteBuffer> writer_;
+    grpc::Alarm alarm_;
+    DoneTag done_;
+
+    // Guards everything below, the change feed wakes the call from the
+    // publishing thread
+    std::mutex mutex_;
+    State state_ = State::kRequested;
+    OrderFeed::EventPtr event_;  // Event being written
+    bool last_ = false;
+    bool finished_ = false;
+    bool done_received_ = false;
+
+    std::unique_ptr<OrderFeed::Subscription> subscription_;
+
+    // Runs without the lock: subscribing takes the feed and store locks, and
+    // the feed calls wake() while holding them
+    void start(bool ok) {
+        if (!ok) {
+            delete this;  // Never started, the done tag will not be delivered
+            return;
+        }
+
+        new StreamCall(this->async_service_, this->service_, this->cq_);
+
+        Status status = this->service_->StartOrderUpdates(&this->ctx_, &this->request_, [this] { this->wake(); },
+                                                          &this->subscription_, &this->event_);
+
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (!status.ok()) {
+            this->finish(status);
+            return;
+        }
+
+        this->last_ = this->event_->last;
+        this->state_ = State::kWriting;
+        this->writer_.Write(this->event_->message, this);
+    }
+
+    // Called with the lock held and no operation pending
+    void pump() {
+        if (this->done_received_) {
+            this->finish(Status(grpc::CANCELLED, "Stream cancelled by client"));
+            return;
+        }
+
+        if (!this->subscription_->TryNext(&this->event_)) {
+            if (this->subscription_->closed()) {
+                this->finish(Status(grpc::UNAVAILABLE, "Server shutting down"));
+                return;
+            }
+            this->state_ = State::kIdle;
+            return;
+        }
+
+        if (this->event_->deleted) {
+            this->finish(Status::OK);
+            return;
+        }
+
+        this->last_ = this->event_->last;
+        this->state_ = State::kWriting;
+        this->writer_.Write(this->event_->message, this);
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (this->state_ == State::kIdle) {
+            this->state_ = State::kWaking;
+            this->alarm_.Set(this->cq_, std::chrono::system_clock::now(), this);
+        }
+    }
+
+    void on_done() {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        this->done_received_ = true;
+
+        if (this->state_ == State::kIdle) {
+            this->finish(Status(grpc::CANCELLED, "Stream cancelled by client"));
+        }
+        this->maybe_destroy(lock);
+    }
+
+    void finish(const Status& status) {
+        this->state_ = State::kFinishing;
+        this->writer_.Finish(status, this);
+    }
+
+    // The call is freed once both Finish and the done tag have come back
+    void maybe_destroy(std::unique_lock<std::mutex>& lock) {
+        if (!this->finished_ || !this->done_received_) {
+            return;
+        }
+
+        // Unsubscribe outside the lock, a concurrent wake() may be waiting on it
+        lock.unlock();
+        this->subscription_.reset();
+        delete this;
+    }
+};
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+AsyncOrderService::AsyncOrderService(std::shared_ptr<OrderService> service, AsyncOptions options)
+    : service_(std::move(service)), options_(options) {
+    if (this->options_.cq_count < 1) {
+        this->options_.cq_count = 1;
+    }
+    if (this->options_.pollers_per_cq < 1) {
+        this->options_.pollers_per_cq = 1;
+    }
+}
+
+AsyncOrderService::~AsyncOrderService() { this->Shutdown(); }
+
+void AsyncOrderService::Attach(grpc::ServerBuilder& builder) {
+    for (int i = 0; i < this->options_.cq_count; i++) {
+        this->cqs_.push_back(builder.AddCompletionQueue());
+    }
+}
+
+void AsyncOrderService::Start() {
+    int index = 0;
+    for (auto& cq : this->cqs_) {
+        this->spawn_calls(cq.get());
+
+        for (int i = 0; i < this->options_.pollers_per_cq; i++) {
+            this->pollers_.emplace_back(&AsyncOrderService::poll, cq.get());
+            if (this->options_.pin_pollers) {
+                this->pin_to_core(this->pollers_.back(), this->options_.first_core + index);
+            }
+            index++;
+        }
+    }
+
+    std::cout << "Async engine started with " << this->cqs_.size() << " completion queues and "
+              << this->pollers_.size() << " pollers" << std::endl;
+}
+
+void AsyncOrderService::Shutdown() {
+    // Only valid once the server has been shut down, which Server::Stop does
+    for (auto& cq : this->cqs_) {
+        cq->Shutdown();
+    }
+
+    for (auto& poller : this->pollers_) {
+        if (poller.joinable()) {
+            poller.join();
+        }
+    }
+
+    // Never started, the queues still have to be drained before destruction
+    if (this->pollers_.empty()) {
+        for (auto& cq : this->cqs_) {
+            this->poll(cq.get());
+        }
+    }
+
+    this->pollers_.clear();
+    this->cqs_.clear();
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+void AsyncOrderService::spawn_calls(grpc::ServerCompletionQueue* cq) {
+    AsyncService* as = &this->async_service_;
+    OrderService* s = this->service_.get();
+
+    UnaryCall<grpc::ByteBuffer, grpc::ByteBuffer, RawMessages>::Spawn(as, s, cq, &AsyncService::RequestGetOrder,
+                                                                      &OrderService::GetOrderRaw);
+    UnaryCall<osv1::ListOrdersRequest, osv1::ListOrdersResponse>::Spawn(as, s, cq, &AsyncService::RequestListOrders,
+                                                                        &OrderService::ListOrders);
+    UnaryCall<osv1::CreateOrderRequest, osv1::CreateOrderResponse>::Spawn(as, s, cq, &AsyncService::RequestCreateOrder,
+                                                                          &OrderService::CreateOrder, true);
+    UnaryCall<osv1::BatchCreateOrdersRequest, osv1::BatchCreateOrdersResponse>::Spawn(
+        as, s, cq, &AsyncService::RequestBatchCreateOrders, &OrderService::BatchCreateOrders, true);
+    UnaryCall<osv1::UpdateOrderResponse, osv1::UpdateOrderRequest>::Spawn(as, s, cq, &AsyncService::RequestUpdateOrder,
+                                                                          &OrderService::UpdateOrder, true);
+    UnaryCall<osv1::DeleteOrderRequest, osv1::DeleteOrderResponse>::Spawn(as, s, cq, &AsyncService::RequestDeleteOrder,
+                                                                          &OrderService::DeleteOrder, true);
+    UnaryCall<osv1::AggregateOrdersRequest, osv1::AggregateOrdersResponse>::Spawn(
+        as, s, cq, &AsyncService::RequestAggregateOrders, &OrderService::AggregateOrders);
+    new IngestCall(as, s, cq);
+    new ListStreamCall(as, s, cq);
+    new StreamCall(as, s, cq);
+}
+
+void AsyncOrderService::poll(grpc::ServerCompletionQueue* cq) {
+    void* tag = nullptr;
+    bool ok = false;
+
+    while (cq->Next(&tag, &ok)) {
+        static_cast<Call*>(tag)->Proceed(ok);
+    }
+}
+
+void AsyncOrderService::pin_to_core(std::thread& thread, int index) {
+#ifdef __linux__
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    if (cores <= 0) {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % cores, &set);
+
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) != 0) {
+        std::cerr << "Failed to pin poller " << index << " to core " << index % cores << std::endl;
+    }
+#endif
+}
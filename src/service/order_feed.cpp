@@ -0,0 +1,224 @@
+#include "service/order_feed.hpp"
+
+#include <grpcpp/impl/codegen/proto_utils.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "metrics/phase_profiler.hpp"
+#include "store/order_record.hpp"
+
+// ---------------------------------------------------------------------------
+// Subscription
+// ---------------------------------------------------------------------------
+OrderFeed::Subscription::Subscription(OrderFeed* feed, std::string order_id, Notifier notifier, std::size_t capacity)
+    : feed_(feed),
+      order_id_(std::move(order_id)),
+      key_(OrderRecord::KeyOf(this->order_id_)),
+      notifier_(std::move(notifier)),
+      capacity_(std::max<std::size_t>(capacity, 1)) {}
+
+OrderFeed::Subscription::~Subscription() { this->feed_->unsubscribe(this); }
+
+bool OrderFeed::Subscription::TryNext(EventPtr* event) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (this->queue_.empty()) {
+        return false;
+    }
+
+    *event = std::move(this->queue_.front());
+    this->queue_.pop_front();
+    return true;
+}
+
+bool OrderFeed::Subscription::WaitNext(EventPtr* event, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    if (!this->cv_.wait_for(lock, timeout, [this] { return !this->queue_.empty() || this->closed_; }) ||
+        this->queue_.empty()) {
+        return false;
+    }
+
+    *event = std::move(this->queue_.front());
+    this->queue_.pop_front();
+    return true;
+}
+
+uint64_t OrderFeed::Subscription::dropped() const {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return this->dropped_;
+}
+
+bool OrderFeed::Subscription::closed() const {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return this->closed_;
+}
+
+void OrderFeed::Subscription::push(const EventPtr& event) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (this->queue_.size() >= this->capacity_) {
+            this->queue_.pop_front();
+            this->dropped_++;
+        }
+        this->queue_.push_back(event);
+    }
+
+    this->cv_.notify_one();
+    if (this->notifier_) {
+        this->notifier_();
+    }
+}
+
+void OrderFeed::Subscription::close() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->closed_ = true;
+    }
+
+    this->cv_.notify_all();
+    if (this->notifier_) {
+        this->notifier_();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+OrderFeed::OrderFeed(std::size_t shard_count) {
+    std::size_t count = 1;
+    while (count < shard_count) {
+        count <<= 1;
+    }
+
+    this->shard_mask_ = count - 1;
+    this->shards_.reset(new Shard[count]);
+}
+
+std::unique_ptr<OrderFeed::Subscription> OrderFeed::Subscribe(const std::string& order_id, Notifier notifier,
+                                                              std::size_t capacity) {
+    std::unique_ptr<Subscription> subscription(new Subscription(this, order_id, std::move(notifier), capacity));
+
+    Shard& shard = this->shard(subscription->key_);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.subscribers[subscription->key_].push_back(subscription.get());
+
+    // Close() sets the flag before taking the shard locks, so a subscription
+    // is either closed here or by Close()
+    subscription->closed_ = this->closed_.load();
+    return subscription;
+}
+
+void OrderFeed::Publish(const OrderStore::OrderPtr& before, const OrderStore::OrderPtr& after) {
+    const OrderStore::OrderPtr& order = after ? after : before;
+
+    Shard& shard = this->shard(order->key());
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+    auto it = shard.subscribers.find(order->key());
+    if (it == shard.subscribers.end()) {
+        return;
+    }
+
+    // One event shared by every subscriber of this order
+    EventPtr event;
+    if (after) {
+        osv1::StreamOrderUpdatesResponse message;
+        after->ToProto(message.mutable_order());
+
+        if (!before) {
+            message.set_status(osv1::UpdateStatus::CREATED);
+        } else if (before->status() != after->status()) {
+            message.set_status(osv1::UpdateStatus::STATUS_CHANGED);
+        } else {
+            message.set_status(osv1::UpdateStatus::UPDATED);
+        }
+
+        message.set_updated_at(
+            std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
+                .count());
+        event = MakeEvent(message);
+    } else {
+        event = deleted_event();
+    }
+
+    // Two non-UUID ids can share a key
+    for (Subscription* subscription : it->second) {
+        if (order->HasId(subscription->order_id_)) {
+            subscription->push(event);
+        }
+    }
+}
+
+void OrderFeed::PublishDeleted(const std::string& order_id) {
+    OrderId key = OrderRecord::KeyOf(order_id);
+    Shard& shard = this->shard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+    auto it = shard.subscribers.find(key);
+    if (it == shard.subscribers.end()) {
+        return;
+    }
+
+    for (Subscription* subscription : it->second) {
+        if (subscription->order_id_ == order_id) {
+            subscription->push(deleted_event());
+        }
+    }
+}
+
+void OrderFeed::Close() {
+    this->closed_.store(true);
+
+    for (std::size_t i = 0; i <= this->shard_mask_; i++) {
+        std::shared_lock<std::shared_mutex> lock(this->shards_[i].mutex);
+        for (const auto& [key, subscriptions] : this->shards_[i].subscribers) {
+            for (Subscription* subscription : subscriptions) {
+                subscription->close();
+            }
+        }
+    }
+}
+
+OrderFeed::EventPtr OrderFeed::MakeEvent(const osv1::StreamOrderUpdatesResponse& message) {
+    auto event = std::make_shared<Event>();
+    event->last = IsFinalStatus(message.order().status());
+
+    ScopedPhase timer(PhaseProfiler::kSerialize);
+    bool own_buffer = false;
+    grpc::SerializationTraits<osv1::StreamOrderUpdatesResponse>::Serialize(message, &event->message, &own_buffer);
+    return event;
+}
+
+bool OrderFeed::IsFinalStatus(osv1::OrderStatus status) {
+    return status == osv1::OrderStatus::COMPLETED || status == osv1::OrderStatus::CANCELLED ||
+           status == osv1::OrderStatus::DELIVERED;
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+OrderFeed::Shard& OrderFeed::shard(const OrderId& key) const {
+    return this->shards_[OrderIdHash{}(key) & this->shard_mask_];
+}
+
+// Deletions carry nothing but the flags, every one shares this event
+const OrderFeed::EventPtr& OrderFeed::deleted_event() {
+    static const EventPtr event = std::make_shared<const Event>(Event{grpc::ByteBuffer(), true, true});
+    return event;
+}
+
+void OrderFeed::unsubscribe(Subscription* subscription) {
+    Shard& shard = this->shard(subscription->key_);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+    auto it = shard.subscribers.find(subscription->key_);
+    if (it == shard.subscribers.end()) {
+        return;
+    }
+
+    auto& list = it->second;
+    list.erase(std::remove(list.begin(), list.end(), subscription), list.end());
+    if (list.empty()) {
+        shard.subscribers.erase(it);
+    }
+}
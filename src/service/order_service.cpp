@@ -3,215 +3,668 @@
 #include <grpcpp/support/status.h>
 #include <time.h>
 
+#include <algorithm>
+#include <charconv>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
-#include <mutex>
-#include <random>
-#include <thread>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <string_view>
+#include <utility>
+#include <vector>
 
+#include "metrics/phase_profiler.hpp"
 #include "order_service/order.pb.h"
+#include "store/order_id.hpp"
 
 namespace osv1 = order_service::v1;
 
 using grpc::ServerContext;
+using grpc::ServerReader;
 using grpc::ServerWriter;
 using grpc::Status;
 
+namespace {
+
+// Set while RunDeferred runs a handler, commit() leaves the wait to it
+thread_local bool defer_commit = false;
+
+// GetOrderRequest has a single string field, so a request in canonical form is
+// exactly its tag (field 1, length delimited), a varint length and the id.
+// Anything else (unknown fields, a repeated field) is not cached.
+bool canonical_order_id(std::string_view wire, std::string_view* order_id) {
+    if (wire.size() < 2 || static_cast<uint8_t>(wire[0]) != 0x0a) {
+        return false;
+    }
+
+    uint64_t length = 0;
+    std::size_t pos = 1;
+    for (int shift = 0; pos < wire.size() && shift < 35; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(wire[pos++]);
+        length |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            if (length != wire.size() - pos) {
+                return false;
+            }
+            *order_id = wire.substr(pos);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Admission control lanes, one per method. GetOrder is a cheap point read and
+// is let in first; scans, batches and streams are shed first. Only methods
+// whose latency reflects the load more than the request feed the limit.
+enum Lane : std::size_t {
+    kGetOrderLane,
+    kListOrdersLane,
+    kCreateOrderLane,
+    kBatchCreateOrdersLane,
+    kIngestOrdersLane,
+    kUpdateOrderLane,
+    kDeleteOrderLane,
+    kAggregateOrdersLane,
+    kStreamOrderUpdatesLane,
+    kStreamListOrdersLane,
+};
+
+std::vector<AdmissionControl::Lane> admission_lanes() {
+    using Priority = AdmissionControl::Priority;
+    return {
+        {"GetOrder", Priority::kHigh, true},
+        {"ListOrders", Priority::kLow, true},
+        {"CreateOrder", Priority::kNormal, true},
+        {"BatchCreateOrders", Priority::kLow, false},
+        {"IngestOrders", Priority::kLow, false},
+        {"UpdateOrder", Priority::kNormal, true},
+        {"DeleteOrder", Priority::kNormal, true},
+        {"AggregateOrders", Priority::kLow, false},
+        {"StreamOrderUpdates", Priority::kLow, false},
+        {"StreamListOrders", Priority::kLow, false},
+    };
+}
+
+// StreamOrderUpdates on the sync server. Idle between events: the change
+// feed's notifier starts the next write, or ends the stream once the feed is
+// closed.
+class UpdatesReactor final : public grpc::ServerWriteReactor<grpc::ByteBuffer> {
+   public:
+    UpdatesReactor(OrderService* service, grpc::CallbackServerContext* ctx, const grpc::ByteBuffer* request) {
+        Status status = service->StartOrderUpdates(ctx, request, [this] { this->wake(); }, &this->subscription_,
+                                                   &this->event_);
+
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (!status.ok()) {
+            this->finish(status);
+            return;
+        }
+        this->StartWrite(&this->event_->message);
+    }
+
+    void OnWriteDone(bool ok) override {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->writing_ = false;
+
+        if (!ok) {
+            this->finish(Status(grpc::CANCELLED, "Stream cancelled by client"));
+        } else if (this->event_->last) {
+            this->finish(Status::OK);
+        } else {
+            this->pump();
+        }
+    }
+
+    void OnCancel() override {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->cancelled_ = true;
+        if (!this->writing_) {
+            this->pump();
+        }
+    }
+
+    void OnDone() override {
+        // Once unsubscribed the feed cannot call wake() any more
+        this->subscription_.reset();
+        delete this;
+    }
+
+   private:
+    std::unique_ptr<OrderFeed::Subscription> subscription_;
+
+    // Guards everything below, the change feed wakes the stream from the
+    // publishing thread
+    std::mutex mutex_;
+    OrderFeed::EventPtr event_;  // Event being written
+    bool writing_ = true;        // Until the first event is written
+    bool cancelled_ = false;
+    bool finished_ = false;
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (!this->writing_) {
+            this->pump();
+        }
+    }
+
+    // Called with the lock held and no write pending
+    void pump() {
+        if (this->finished_) {
+            return;
+        }
+
+        if (this->cancelled_) {
+            this->finish(Status(grpc::CANCELLED, "Stream cancelled by client"));
+            return;
+        }
+
+        if (!this->subscription_->TryNext(&this->event_)) {
+            if (this->subscription_->closed()) {
+                this->finish(Status(grpc::UNAVAILABLE, "Server shutting down"));
+            }
+            return;
+        }
+
+        if (this->event_->deleted) {
+            this->finish(Status::OK);
+            return;
+        }
+
+        this->writing_ = true;
+        this->StartWrite(&this->event_->message);
+    }
+
+    void finish(const Status& status) {
+        if (!this->finished_) {
+            this->finished_ = true;
+            this->Finish(status);
+        }
+    }
+};
+
+}  // namespace
+
 // ---------------------------------------------------------------------------
 // Public methods
 // ---------------------------------------------------------------------------
 //
-// Initialise the class with some mock data to store
-OrderService::OrderService() {
-    osv1::Item item1;
-    item1.set_id(this->generate_id());
-    item1.set_name("Laptop");
-    item1.set_price(100.5);
-    item1.set_quantity(1);
+// Restore the orders from the snapshot and WAL when they are configured,
+// otherwise (or if there is nothing to restore) initialise the class with
+// some mock data to store. The mock data goes in once every observer is
+// attached, so the WAL and the next snapshot keep it like any other order.
+OrderService::OrderService(OrderServiceOptions options)
+    : snapshot_options_(options.snapshot),
+      aggregate_threads_(options.aggregate_threads),
+      compression_threshold_bytes_(options.compression_threshold_bytes),
+      compression_level_(options.compression_level) {
+    if (options.admission) {
+        this->admission_ = std::make_unique<AdmissionControl>(*options.admission, admission_lanes());
+    }
 
-    osv1::Order order1;
-    order1.set_id(this->generate_id());
-    order1.set_amount(100.5);
-    order1.set_status(osv1::OrderStatus::COMPLETED);
-    order1.set_address("123 Maple Street");
-    order1.set_created_at(this->get_current_timestamp());
-    order1.add_items()->CopyFrom(item1);
+    // Every committed change feeds the StreamOrderUpdates subscribers.
+    // Evictions and fault ins only move an order between memory and the
+    // archive, its streams hear neither.
+    this->store_.AddObserver(
+        [this](const OrderStore::OrderPtr& before, const OrderStore::OrderPtr& after) {
+            this->feed_.Publish(before, after);
+        },
+        false, false);
 
-    osv1::Item item2;
-    item2.set_id(this->generate_id());
-    item2.set_name("Smartphone");
-    item2.set_price(34.0);
-    item2.set_quantity(2);
+    // AggregateOrders columns cover every order, snapshot loads included
+    this->store_.AddObserver(
+        [this](const OrderStore::OrderPtr& before, const OrderStore::OrderPtr& after) {
+            this->columns_.Apply(before, after);
+        },
+        true);
 
-    osv1::Order order2;
-    order2.set_id(this->generate_id());
-    order2.set_amount(134.5);
-    order2.set_status(osv1::OrderStatus::PENDING);
-    order2.set_address("567 Wallnut street");
-    order2.set_created_at(this->get_current_timestamp());
-    order2.add_items()->CopyFrom(item2);
+    bool restored = this->restore(options);
 
-    this->orders_[order1.id()] = order1;
-    this->orders_[order2.id()] = order2;
+    // Any change to an order, status changes included, drops its cached
+    // response. Nothing is cached before the restore.
+    if (options.response_cache_bytes > 0) {
+        this->response_cache_ = std::make_unique<ResponseCache>(options.response_cache_bytes);
+        this->store_.AddObserver([this](const OrderStore::OrderPtr& before, const OrderStore::OrderPtr& after) {
+            this->response_cache_->Invalidate(after ? after->id() : before->id());
+        });
+    }
 
-    this->user_orders_["user1"].push_back(order1);
-    this->user_orders_["user1"].push_back(order2);
+    // Attached after the restore so restored orders are not logged again
+    if (options.wal) {
+        this->wal_ = std::make_unique<OrderWal>(*options.wal);
+        this->store_.AddObserver([this](const OrderStore::OrderPtr& before, const OrderStore::OrderPtr& after) {
+            this->wal_->Append(before, after);
+        });
+    }
+
+    if (options.snapshot) {
+        this->store_.AddObserver([this](const OrderStore::OrderPtr&, const OrderStore::OrderPtr&) { this->changes_++; });
+        this->snapshotter_ = std::thread(&OrderService::snapshot_loop, this);
+    }
+
+    if (!restored) {
+        this->seed_mock_data();
+        this->Flush();
+    }
+
+    // Started last, evictions go through every observer above but the feed
+    if (!options.archive_path.empty()) {
+        this->archive_ = std::make_unique<OrderArchive>(options.archive_path);
+        std::cout << "Opened archive of " << this->archive_->size() << " orders at " << options.archive_path
+                  << std::endl;
+    }
+    if (options.retention) {
+        this->retention_ = std::make_unique<OrderRetention>(*options.retention, this->store_, this->archive_.get());
+    }
 }
 
-Status OrderService::GetOrder(ServerContext* ctx, const osv1::GetOrderRequest* request, osv1::GetOrderResponse* response) {
-    std::lock_guard<std::mutex> lock(this->mutex_);
+OrderService::~OrderService() {
+    {
+        std::lock_guard<std::mutex> lock(this->stop_mutex_);
+        this->stopping_ = true;
+    }
+    this->stop_cv_.notify_all();
 
-    std::string order_id = request->order_id();
-    auto it = orders_.find(order_id);
+    if (this->snapshotter_.joinable()) {
+        this->snapshotter_.join();
+    }
+    if (this->loader_.joinable()) {
+        this->loader_.join();
+    }
+}
 
-    if (it != orders_.end()) {
-        response->mutable_order()->CopyFrom(this->orders_[order_id]);
+Status OrderService::GetOrder(ServerContext* ctx, const osv1::GetOrderRequest* request, osv1::GetOrderResponse* response) {
+    ScopedHandler handler("GetOrder");
+    OrderStore::OrderPtr order = this->store_.Get(request->order_id());
+
+    if (order) {
+        order->ToProto(response->mutable_order());
+        return Status::OK;
+    } else if (this->archive_ && this->archive_->Get(request->order_id(), response->mutable_order())) {
         return Status::OK;
     } else {
         return Status(grpc::NOT_FOUND, "Order not found");
     }
 }
 
+grpc::ServerUnaryReactor* OrderService::GetOrder(grpc::CallbackServerContext* ctx, const grpc::ByteBuffer* request,
+                                                 grpc::ByteBuffer* response) {
+    grpc::ServerUnaryReactor* reactor = ctx->DefaultReactor();
+    reactor->Finish(this->get_order_raw(ctx, request, response));
+    return reactor;
+}
+
+Status OrderService::GetOrderRaw(ServerContext* ctx, const grpc::ByteBuffer* request, grpc::ByteBuffer* response) {
+    return this->get_order_raw(ctx, request, response);
+}
+
 Status OrderService::ListOrders(ServerContext* ctx, const osv1::ListOrdersRequest* request, osv1::ListOrdersResponse* response) {
-    std::lock_guard<std::mutex> lock(this->mutex_);
+    ScopedHandler handler("ListOrders");
+    AdmissionControl::Ticket ticket;
+    Status status = this->admit(ctx, kListOrdersLane, &ticket);
+    if (!status.ok()) {
+        return status;
+    }
 
-    std::string user_id = request->user_id();                  // Get the user id from the request object
+    const std::string& user_id = request->user_id();           // Get the user id from the request object
     int limit = request->limit() > 0 ? request->limit() : 10;  // Default limit to 10 if not specified
     int page = request->page() > 0 ? request->page() : 1;      // Default page to 1 if not specified
-    auto filters = request->filters();                         // Get the filters from the request object
 
-    auto it = user_orders_.find(user_id);
+    OrderQuery query;
+    status = this->parse_filters(request->filters(), &query);
+    if (!status.ok()) {
+        return status;
+    }
 
-    response->set_total(it->second.size());
-    if (it != user_orders_.end()) {
-        for (const auto& order : it->second) {
-            response->add_orders()->CopyFrom(order);
-        }
-        return Status::OK;
-    } else {
+    query.limit = std::min(limit, kMaxPageSize);
+    query.offset = static_cast<std::size_t>(page - 1) * query.limit;
+
+    OrderStore::Page result;
+    if (!this->store_.Query(user_id, query, &result)) {
         return Status(grpc::NOT_FOUND, "No orders found for user");
     }
+
+    response->set_total(result.total);
+    response->mutable_orders()->Reserve(static_cast<int>(result.orders.size()));
+    for (const auto& order : result.orders) {
+        order->ToProto(response->add_orders());
+    }
+
+    // Sized only when compression is on, the size is cached for serializing
+    if (ctx && this->compression_threshold_bytes_ > 0 &&
+        response->ByteSizeLong() >= this->compression_threshold_bytes_) {
+        ctx->set_compression_level(this->compression_level_);
+    }
+    return Status::OK;
 }
 
-Status OrderService::CreateOrder(ServerContext* ctx, const osv1::CreateOrderRequest* request, osv1::CreateOrderResponse* response) {
-    std::lock_guard<std::mutex> lock(this->mutex_);
+Status OrderService::StreamListOrders(ServerContext* ctx, const osv1::ListOrdersRequest* request,
+                                      ServerWriter<osv1::ListOrdersResponse>* writer) {
+    ListStream stream;
+    osv1::ListOrdersResponse response;
+    Status status = this->StartListStream(ctx, *request, &stream, &response);
+    if (!status.ok()) {
+        return status;
+    }
 
-    std::string user_id = request->user_id();  // Get the user id from the request object
-    osv1::Order new_order = request->order();  // Get the order from the request object
+    // Write returns once the transport has taken the message, so a slow
+    // client holds the next chunk back instead of letting them pile up
+    do {
+        if (!writer->Write(response, this->ListChunkOptions(response))) {
+            return Status(grpc::CANCELLED, "Stream cancelled by client");
+        }
+    } while (this->NextListChunk(&stream, &response));
 
-    new_order.set_id(this->generate_id());
-    new_order.set_status(osv1::OrderStatus::PENDING);
-    new_order.set_created_at(this->get_current_timestamp());
-    new_order.set_updated_at(this->get_current_timestamp());
+    return Status::OK;
+}
 
-    double total_amount = 0.0;
-    for (const auto& item : new_order.items()) {
-        total_amount += item.price() * item.quantity();  // Calculating the total amount of all of the items
+Status OrderService::CreateOrder(ServerContext* ctx, const osv1::CreateOrderRequest* request, osv1::CreateOrderResponse* response) {
+    ScopedHandler handler("CreateOrder");
+    AdmissionControl::Ticket ticket;
+    Status admission = this->admit(ctx, kCreateOrderLane, &ticket);
+    if (!admission.ok()) {
+        return admission;
     }
 
-    new_order.set_amount(total_amount);  // Settings the total amount
+    Status logged = this->check_wal();
+    if (!logged.ok()) {
+        return logged;
+    }
 
-    this->orders_[new_order.id()] = new_order;
-    this->user_orders_[user_id].push_back(new_order);
+    const std::string& user_id = request->user_id();  // Get the user id from the request object
+    osv1::Order new_order = this->build_order(*request, this->get_current_timestamp());
 
-    response->mutable_order()->CopyFrom(new_order);
+    if (!this->store_.Insert(user_id, new_order)) {
+        return Status(grpc::ALREADY_EXISTS, "Order id collision, please retry");
+    }
 
+    this->commit();
+    response->mutable_order()->Swap(&new_order);
     return Status::OK;
 }
 
+Status OrderService::BatchCreateOrders(ServerContext* ctx, const osv1::BatchCreateOrdersRequest* request,
+                                       osv1::BatchCreateOrdersResponse* response) {
+    ScopedHandler handler("BatchCreateOrders");
+    if (request->orders_size() > kMaxBatchSize) {
+        return Status(grpc::INVALID_ARGUMENT, "At most " + std::to_string(kMaxBatchSize) + " orders per batch");
+    }
+
+    AdmissionControl::Ticket ticket;
+    Status admission = this->admit(ctx, kBatchCreateOrdersLane, &ticket);
+    if (!admission.ok()) {
+        return admission;
+    }
+
+    Status logged = this->check_wal();
+    if (!logged.ok()) {
+        return logged;
+    }
+
+    this->CreateOrders(request->orders(), response->mutable_order_ids());
+    return this->FinishIngest();
+}
+
+// Orders are created a chunk at a time as they arrive. A chunk is only
+// created once the next request is in, so the last one is always created
+// (and its WAL records appended) on the thread that commits.
+Status OrderService::IngestOrders(ServerContext* ctx, ServerReader<osv1::CreateOrderRequest>* reader,
+                                  osv1::IngestOrdersResponse* response) {
+    Status admission = this->StartIngest(ctx);
+    if (!admission.ok()) {
+        return admission;
+    }
+
+    osv1::BatchCreateOrdersRequest chunk;
+    osv1::CreateOrderRequest request;
+
+    while (reader->Read(&request)) {
+        if (chunk.orders_size() == kIngestChunkSize) {
+            this->CreateOrders(chunk.orders(), response->mutable_order_ids());
+            chunk.clear_orders();
+        }
+        chunk.add_orders()->Swap(&request);
+    }
+    this->CreateOrders(chunk.orders(), response->mutable_order_ids());
+
+    return this->FinishIngest();
+}
+
 Status OrderService::UpdateOrder(ServerContext* ctx, const osv1::UpdateOrderResponse* request, osv1::UpdateOrderRequest* response) {
-    std::lock_guard<std::mutex> lock(this->mutex_);
+    ScopedHandler handler("UpdateOrder");
+    AdmissionControl::Ticket ticket;
+    Status admission = this->admit(ctx, kUpdateOrderLane, &ticket);
+    if (!admission.ok()) {
+        return admission;
+    }
 
-    osv1::Order order = request->order();  // Get the order from the request object
-    std::string order_id = order.id();     // Get the order id from the order object
+    Status logged = this->check_wal();
+    if (!logged.ok()) {
+        return logged;
+    }
 
-    if (this->orders_.find(order_id) == this->orders_.end()) {
+    const osv1::Order& order = request->order();  // Get the order from the request object
+
+    if (!this->store_.Update(order) && !(this->fault_in(order.id()) && this->store_.Update(order))) {
         return Status(grpc::NOT_FOUND, "Order not found");
     }
 
-    this->orders_[order_id] = order;  // Update the order in the orders map
+    this->commit();
 
     response->mutable_order()->CopyFrom(order);  // Copy the updated order to the response
     return Status::OK;
 }
 
 Status OrderService::DeleteOrder(ServerContext* ctx, const osv1::DeleteOrderRequest* request, osv1::DeleteOrderResponse* response) {
-    std::lock_guard<std::mutex> lock(this->mutex_);
+    ScopedHandler handler("DeleteOrder");
+    AdmissionControl::Ticket ticket;
+    Status admission = this->admit(ctx, kDeleteOrderLane, &ticket);
+    if (!admission.ok()) {
+        return admission;
+    }
 
-    std::string order_id = request->order_id();  // Get the order id from the request object
+    Status logged = this->check_wal();
+    if (!logged.ok()) {
+        return logged;
+    }
 
-    if (this->orders_.find(order_id) == this->orders_.end()) {
+    const std::string& order_id = request->order_id();  // Get the order id from the request object
+
+    // An archived order, or the archived copy of one that changed after it
+    // was picked for eviction
+    bool erased = this->store_.Erase(order_id);
+    if (this->archive_ && (!erased || this->archive_->Contains(order_id))) {
+        erased = this->erase_archived(order_id) || erased;
+    }
+
+    if (!erased) {
         return Status(grpc::NOT_FOUND, "Order not found");
     }
 
-    this->orders_.erase(order_id);  // Remove the order from the orders map
-    response->set_success(true);    // Indicate that the deletion was successful
+    this->commit();
+
+    response->set_success(true);  // Indicate that the deletion was successful
 
     return Status::OK;
 }
 
-Status OrderService::StreamOrderUpdates(ServerContext* ctx, const osv1::StreamOrderUpdatesRequest* request, ServerWriter<osv1::StreamOrderUpdatesResponse>* writer) {
-    const std::string order_id = request->order_id();  // Get the user id from the request object
-    {
-        std::lock_guard<std::mutex> lock(this->mutex_);
+Status OrderService::AggregateOrders(ServerContext* ctx, const osv1::AggregateOrdersRequest* request,
+                                     osv1::AggregateOrdersResponse* response) {
+    ScopedHandler handler("AggregateOrders");
+    AggregateQuery query;
+    Status status = this->parse_aggregate(*request, &query);
+    if (!status.ok()) {
+        return status;
+    }
 
-        if (order_id.empty()) {
-            return Status(grpc::INVALID_ARGUMENT, "Order ID cannot be empty");
-        }
+    AdmissionControl::Ticket ticket;
+    status = this->admit(ctx, kAggregateOrdersLane, &ticket);
+    if (!status.ok()) {
+        return status;
+    }
+
+    // Snapshot orders only reach the columns as they are loaded
+    this->store_.WaitLoaded();
 
-        auto it = this->orders_.find(order_id);
-        if (it == this->orders_.end()) {
-            return Status(grpc::NOT_FOUND, "Order not found");
+    for (const OrderAggregate& group : this->columns_.Aggregate(query, this->aggregate_threads_)) {
+        osv1::OrderAggregate* out = response->add_groups();
+        out->set_key(group.key);
+        out->set_count(static_cast<int64_t>(group.count));
+        out->set_total_amount(group.amount);
+        if (group.count > 0) {
+            out->set_average_amount(group.amount / static_cast<double>(group.count));
+            out->set_average_items(static_cast<double>(group.items) / static_cast<double>(group.count));
         }
+    }
+    return Status::OK;
+}
 
-        osv1::StreamOrderUpdatesResponse response;
-        *(response.mutable_order()) = it->second;  // Copy the order to the response
-        response.set_status(osv1::UpdateStatus::CREATED);
-        response.set_updated_at(this->get_current_timestamp());
+grpc::ServerWriteReactor<grpc::ByteBuffer>* OrderService::StreamOrderUpdates(grpc::CallbackServerContext* ctx,
+                                                                             const grpc::ByteBuffer* request) {
+    return new UpdatesReactor(this, ctx, request);
+}
 
-        if (!writer->Write(response)) {
-            return Status(grpc::CANCELLED, "Stream cancelled by client");
-        }
+// ---------------------------------------------------------------------------
+// Streaming helpers, shared by the sync handler and the async engine
+// ---------------------------------------------------------------------------
+void OrderService::CreateOrders(const google::protobuf::RepeatedPtrField<osv1::CreateOrderRequest>& requests,
+                                google::protobuf::RepeatedPtrField<std::string>* order_ids) {
+    ScopedHandler handler("IngestOrders");
+    int64_t now = this->get_current_timestamp();
+    int first = order_ids->size();
+    for (int i = 0; i < requests.size(); i++) {
+        order_ids->Add();
     }
 
-    int update_count = 0;
-    while (!ctx->IsCancelled() && update_count < 5) {
-        std::this_thread::sleep_for(std::chrono::seconds(5));
+    // An order whose id collides gets a new id and goes in with the next pass
+    std::vector<int> pending(static_cast<std::size_t>(requests.size()));
+    std::iota(pending.begin(), pending.end(), 0);
 
-        std::lock_guard<std::mutex> lock(this->mutex_);
+    while (!pending.empty()) {
+        std::vector<OrderStore::NewOrder> orders;
+        orders.reserve(pending.size());
+        for (int i : pending) {
+            orders.push_back({requests[i].user_id(), this->build_order(requests[i], now)});
+            *order_ids->Mutable(first + i) = orders.back().order.id();
+        }
+
+        std::vector<bool> inserted = this->store_.InsertBatch(orders);
 
-        if (!order_id.empty()) {
-            auto it = this->orders_.find(order_id);
-            if (it != this->orders_.end()) {
-                osv1::Order& order = it->second;
-                osv1::OrderStatus current_status = order.status();
-
-                if (current_status == osv1::OrderStatus::PENDING) {
-                    order.set_status(osv1::OrderStatus::PROCESSING);
-                } else if (current_status == osv1::OrderStatus::PROCESSING) {
-                    order.set_status(osv1::OrderStatus::SHIPPED);
-                } else if (current_status == osv1::OrderStatus::SHIPPED) {
-                    order.set_status(osv1::OrderStatus::DELIVERED);
-                }
-
-                if (current_status != order.status()) {
-                    order.set_updated_at(this->get_current_timestamp());
-
-                    osv1::StreamOrderUpdatesResponse response;
-                    *(response.mutable_order()) = order;  // Copy the updated order to the response
-                    response.set_status(osv1::UpdateStatus::STATUS_CHANGED);
-                    response.set_updated_at(this->get_current_timestamp());
-
-                    if (!writer->Write(response)) {
-                        break;
-                    }
-
-                    update_count++;
-                }
+        std::vector<int> collided;
+        for (std::size_t k = 0; k < pending.size(); k++) {
+            if (!inserted[k]) {
+                collided.push_back(pending[k]);
             }
         }
+        pending.swap(collided);
     }
+}
+
+Status OrderService::StartListStream(grpc::ServerContextBase* ctx, const osv1::ListOrdersRequest& request,
+                                     ListStream* stream, osv1::ListOrdersResponse* response) {
+    ScopedHandler handler("StreamListOrders");
+    Status status = this->check_admission(ctx, kStreamListOrdersLane);
+    if (!status.ok()) {
+        return status;
+    }
+
+    status = this->parse_filters(request.filters(), &stream->query);
+    if (!status.ok()) {
+        return status;
+    }
+
+    // The first chunk counts the total, the others resume past the last order
+    stream->user_id = request.user_id();
+    stream->query.limit = std::min(request.limit() > 0 ? request.limit() : kListChunkSize, kMaxPageSize);
+
+    OrderStore::Page page;
+    if (!this->store_.Query(stream->user_id, stream->query, &page)) {
+        return Status(grpc::NOT_FOUND, "No orders found for user");
+    }
+    stream->total = static_cast<int>(page.total);
+    this->fill_chunk(page, stream, response);
+
+    if (ctx && this->compression_threshold_bytes_ > 0) {
+        ctx->set_compression_level(this->compression_level_);
+    }
+    return Status::OK;
+}
+
+bool OrderService::NextListChunk(ListStream* stream, osv1::ListOrdersResponse* response) {
+    ScopedHandler handler("StreamListOrders");
+    response->Clear();
+    if (stream->done) {
+        return false;
+    }
+
+    OrderStore::Page page;
+    if (!this->store_.Query(stream->user_id, stream->query, &page) || page.orders.empty()) {
+        stream->done = true;
+        return false;
+    }
+    this->fill_chunk(page, stream, response);
+    return true;
+}
+
+grpc::WriteOptions OrderService::ListChunkOptions(const osv1::ListOrdersResponse& response) const {
+    grpc::WriteOptions options;
+    if (this->compression_threshold_bytes_ > 0 && response.ByteSizeLong() < this->compression_threshold_bytes_) {
+        options.set_no_compression();
+    }
+    return options;
+}
+
+Status OrderService::StartIngest(const grpc::ServerContextBase* ctx) {
+    Status status = this->check_admission(ctx, kIngestOrdersLane);
+    return status.ok() ? this->check_wal() : status;
+}
+
+Status OrderService::FinishIngest() {
+    ScopedHandler handler("IngestOrders");
+    this->commit();
+    return Status::OK;
+}
+
+Status OrderService::StartOrderUpdates(const grpc::ServerContextBase* ctx, const grpc::ByteBuffer* request,
+                                       OrderFeed::Notifier notifier,
+                                       std::unique_ptr<OrderFeed::Subscription>* subscription,
+                                       OrderFeed::EventPtr* first) {
+    ScopedHandler handler("StreamOrderUpdates");
+    grpc::ByteBuffer wire(*request);  // Deserializing consumes the buffer
+    osv1::StreamOrderUpdatesRequest typed_request;
+    if (!grpc::SerializationTraits<osv1::StreamOrderUpdatesRequest>::Deserialize(&wire, &typed_request).ok()) {
+        return Status(grpc::INVALID_ARGUMENT, "Malformed StreamOrderUpdatesRequest");
+    }
+
+    const std::string& order_id = typed_request.order_id();
+    if (order_id.empty()) {
+        return Status(grpc::INVALID_ARGUMENT, "Order ID cannot be empty");
+    }
+
+    Status admission = this->check_admission(ctx, kStreamOrderUpdatesLane);
+    if (!admission.ok()) {
+        return admission;
+    }
+
+    *subscription = this->feed_.Subscribe(order_id, std::move(notifier));
+    if ((*subscription)->closed()) {
+        subscription->reset();
+        return Status(grpc::UNAVAILABLE, "Server shutting down");
+    }
+
+    osv1::StreamOrderUpdatesResponse response;
+    OrderStore::OrderPtr order = this->store_.Get(order_id);
+    if (order) {
+        order->ToProto(response.mutable_order());  // Copy the order to the response
+    } else if (!this->archive_ || !this->archive_->Get(order_id, response.mutable_order())) {
+        subscription->reset();
+        return Status(grpc::NOT_FOUND, "Order not found");
+    }
+
+    response.set_status(osv1::UpdateStatus::CREATED);
+    response.set_updated_at(this->get_current_timestamp());
+    *first = OrderFeed::MakeEvent(response);
 
     return Status::OK;
 }
@@ -219,24 +672,393 @@ Status OrderService::StreamOrderUpdates(ServerContext* ctx, const osv1::StreamOr
 // ---------------------------------------------------------------------------
 // Private methods
 // ---------------------------------------------------------------------------
-int64_t OrderService::get_current_timestamp() {
-    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+Status OrderService::admit(const grpc::ServerContextBase* ctx, std::size_t lane, AdmissionControl::Ticket* ticket) {
+    return this->admission_ ? this->admission_->Admit(ctx, lane, ticket) : Status::OK;
+}
+
+Status OrderService::check_admission(const grpc::ServerContextBase* ctx, std::size_t lane) {
+    return this->admission_ ? this->admission_->Check(ctx, lane) : Status::OK;
+}
+
+Status OrderService::get_order_raw(const grpc::ServerContextBase* ctx, const grpc::ByteBuffer* request,
+                                   grpc::ByteBuffer* response) {
+    ScopedHandler handler("GetOrder");
+    AdmissionControl::Ticket ticket;
+    Status admission = this->admit(ctx, kGetOrderLane, &ticket);
+    if (!admission.ok()) {
+        return admission;
+    }
+
+    grpc::Slice slice;
+    if (!request->TrySingleSlice(&slice).ok() && !request->DumpToSingleSlice(&slice).ok()) {
+        return Status(grpc::INTERNAL, "Failed to read request");
+    }
+    std::string_view wire(reinterpret_cast<const char*>(slice.begin()), slice.size());
+
+    // A hit is the cached bytes as they are, nothing is parsed or serialized
+    std::string_view order_id;
+    uint64_t epoch = 0;
+    bool cacheable = this->response_cache_ && canonical_order_id(wire, &order_id);
+    if (cacheable && this->response_cache_->Lookup(order_id, response, &epoch)) {
+        return Status::OK;
+    }
+
+    osv1::GetOrderRequest typed_request;
+    if (!typed_request.ParseFromArray(wire.data(), static_cast<int>(wire.size()))) {
+        return Status(grpc::INVALID_ARGUMENT, "Malformed GetOrderRequest");
+    }
+
+    osv1::GetOrderResponse typed_response;
+    Status status = this->GetOrder(nullptr, &typed_request, &typed_response);
+    if (!status.ok()) {
+        return status;
+    }
+
+    bool own_buffer = false;
+    {
+        ScopedPhase timer(PhaseProfiler::kSerialize);
+        status = grpc::SerializationTraits<osv1::GetOrderResponse>::Serialize(typed_response, response, &own_buffer);
+    }
+    if (status.ok() && cacheable) {
+        this->response_cache_->Insert(order_id, *response, epoch);
+    }
+    return status;
+}
+
+// A chunk short of the limit is the last one
+void OrderService::fill_chunk(const OrderStore::Page& page, ListStream* stream,
+                              osv1::ListOrdersResponse* response) const {
+    response->set_total(stream->total);
+    response->mutable_orders()->Reserve(static_cast<int>(page.orders.size()));
+    for (const auto& order : page.orders) {
+        order->ToProto(response->add_orders());
+    }
+
+    stream->done = page.orders.size() < stream->query.limit;
+    if (!page.orders.empty()) {
+        stream->query.after = OrderStore::CursorAfter(*page.orders.back());
+    }
+}
+
+// Copies an archived order back into the store so it can change, and drops
+// the archived copy once the store's is durable. Returns false if the order
+// is neither in the store nor in the archive.
+bool OrderService::fault_in(const std::string& order_id) {
+    if (!this->archive_) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->fault_mutex_);
+    if (this->store_.Get(order_id)) {
+        return true;
+    }
+
+    std::string user_id;
+    osv1::Order order;
+    if (!this->archive_->Get(order_id, &order, &user_id)) {
+        return false;
+    }
+
+    // Left in the archive as well if the WAL fails, the store's copy wins.
+    // Waits even for RunDeferred.
+    this->store_.Restore(user_id, order);
+    ScopedPhase timer(PhaseProfiler::kWalWait);
+    if (!this->wal_ || this->wal_->Commit()) {
+        this->archive_->Erase(order_id);
+    }
+    return true;
+}
+
+// Under fault_mutex_, so a fault in cannot copy the order back meanwhile
+bool OrderService::erase_archived(const std::string& order_id) {
+    std::lock_guard<std::mutex> lock(this->fault_mutex_);
+    bool erased = this->store_.Erase(order_id);
+    if (!this->archive_->Erase(order_id)) {
+        return erased;
+    }
+
+    // The feed heard about the store's erase, not about an evicted order's
+    if (!erased) {
+        this->feed_.PublishDeleted(order_id);
+    }
+    return true;
+}
+
+void OrderService::seed_mock_data() {
+    osv1::Item item1;
+    item1.set_id(this->generate_id());
+    item1.set_name("Laptop");
+    item1.set_price(100.5);
+    item1.set_quantity(1);
+
+    osv1::Order order1;
+    order1.set_id(this->generate_id());
+    order1.set_amount(100.5);
+    order1.set_status(osv1::OrderStatus::COMPLETED);
+    order1.set_address("123 Maple Street");
+    order1.set_created_at(this->get_current_timestamp());
+    order1.add_items()->CopyFrom(item1);
+
+    osv1::Item item2;
+    item2.set_id(this->generate_id());
+    item2.set_name("Smartphone");
+    item2.set_price(34.0);
+    item2.set_quantity(2);
+
+    osv1::Order order2;
+    order2.set_id(this->generate_id());
+    order2.set_amount(134.5);
+    order2.set_status(osv1::OrderStatus::PENDING);
+    order2.set_address("567 Wallnut street");
+    order2.set_created_at(this->get_current_timestamp());
+    order2.add_items()->CopyFrom(item2);
+
+    this->store_.Insert("user1", order1);
+    this->store_.Insert("user1", order2);
 }
 
-std::string OrderService::generate_id() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
+// Returns whether the snapshot or the WAL held any order
+bool OrderService::restore(const OrderServiceOptions& options) {
+    bool restored = false;
+
+    // Mapping the snapshot is all it takes to serve GetOrder, the rest of the
+    // store fills in on a background thread
+    if (options.snapshot) {
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<const OrderSnapshot> snapshot = OrderSnapshot::Open(options.snapshot->path);
 
-    static std::uniform_int_distribution<> dis(0, 16);
-    static const char* hex = "123456789abcdef";
+        if (snapshot) {
+            this->store_.AttachSnapshot(snapshot);
+            auto elapsed =
+                std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            std::cout << "Mapped snapshot of " << snapshot->size() << " orders from " << options.snapshot->path
+                      << " in " << elapsed.count() << " ms" << std::endl;
 
-    std::string uuid;
-    for (int i = 0; i < 32; i++) {
-        uuid += hex[dis(gen)];
-        if (i == 7 || i == 11 || i == 15 || i == 19) {
-            uuid += '-';
+            unsigned threads = options.snapshot->load_threads;
+            this->loader_ = std::thread([this, threads, start] {
+                std::size_t loaded = this->store_.LoadSnapshot(threads);
+                auto elapsed =
+                    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+                std::cout << "Loaded " << loaded << " orders from the snapshot in " << elapsed.count() << " ms"
+                          << std::endl;
+            });
+            restored = true;
         }
     }
 
-    return uuid;
+    // The rotated log predates the current one, replay it first
+    if (options.wal) {
+        auto start = std::chrono::steady_clock::now();
+        std::size_t applied = 0;
+        for (const std::string& path : {OrderWal::RotatedPath(options.wal->path), options.wal->path}) {
+            applied += OrderWal::Replay(path, this->store_, options.wal->replay_threads);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+        std::cout << "Replayed " << applied << " orders from " << options.wal->path << " in " << elapsed.count()
+                  << " ms" << std::endl;
+        restored = restored || applied > 0;
+    }
+
+    return restored;
 }
+
+void OrderService::RunDeferred(const std::function<Status()>& handler, std::function<void(const Status&)> done) {
+    defer_commit = true;
+    Status status = handler();
+    defer_commit = false;
+
+    if (!this->wal_) {
+        done(status);
+        return;
+    }
+    this->wal_->CommitAsync([status, done = std::move(done)](bool) { done(status); });
+}
+
+void OrderService::Drain() { this->feed_.Close(); }
+
+bool OrderService::Flush() { return !this->wal_ || this->wal_->Flush(); }
+
+bool OrderService::TakeSnapshot() {
+    if (!this->snapshot_options_) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->snapshot_mutex_);
+    const std::string& path = this->snapshot_options_->path;
+    uint64_t changes = this->changes_.exchange(0);
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+
+        // Everything logged before the rotation is in the store by now and
+        // ends up in the snapshot
+        if (this->wal_ && !this->wal_->Rotate()) {
+            std::cerr << "Previous snapshot did not complete, this one covers "
+                      << OrderWal::RotatedPath(this->wal_->path()) << " as well" << std::endl;
+        }
+
+        std::size_t written = OrderSnapshot::Write(path, this->store_);
+        if (this->wal_) {
+            this->wal_->DropRotated();
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << "Wrote snapshot of " << written << " orders to " << path << " in " << elapsed.count() << " ms"
+                  << std::endl;
+        return true;
+    } catch (const std::exception& e) {
+        this->changes_ += changes;
+        std::cerr << "Snapshot failed: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+void OrderService::snapshot_loop() {
+    std::unique_lock<std::mutex> lock(this->stop_mutex_);
+
+    while (!this->stop_cv_.wait_for(lock, this->snapshot_options_->interval, [this] { return this->stopping_; })) {
+        if (this->changes_.load() == 0) {
+            continue;
+        }
+
+        lock.unlock();
+        this->TakeSnapshot();
+        lock.lock();
+    }
+}
+
+// Changes are turned away once the WAL failed, before they reach the store
+Status OrderService::check_wal() const {
+    if (this->wal_failed()) {
+        return Status(grpc::UNAVAILABLE, "Order log failed, changes are not accepted");
+    }
+    return Status::OK;
+}
+
+// Waits for the WAL to make the calling handler's changes durable. A change
+// whose write fails is kept and answered OK: readers and the feed have seen it
+// already. The failure shows in wal_failed() and the changes after it are
+// turned away.
+void OrderService::commit() {
+    if (defer_commit || !this->wal_) {
+        return;
+    }
+    ScopedPhase timer(PhaseProfiler::kWalWait);
+    this->wal_->Commit();
+}
+
+// Supported filters: "status" (OrderStatus name), "address" (prefix match),
+// "created_after" (inclusive) and "created_before" (exclusive) as unix seconds
+Status OrderService::parse_filters(const google::protobuf::Map<std::string, std::string>& filters, OrderQuery* query) {
+    for (const auto& [key, value] : filters) {
+        if (key == "status") {
+            osv1::OrderStatus status;
+            if (!osv1::OrderStatus_Parse(value, &status)) {
+                return Status(grpc::INVALID_ARGUMENT, "Unknown order status: " + value);
+            }
+            query->status = status;
+        } else if (key == "address") {
+            query->address_prefix = value;
+        } else if (key == "created_after" || key == "created_before") {
+            int64_t timestamp = 0;
+            auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), timestamp);
+            if (ec != std::errc() || end != value.data() + value.size()) {
+                return Status(grpc::INVALID_ARGUMENT, "Invalid timestamp for " + key + ": " + value);
+            }
+            (key == "created_after" ? query->created_after : query->created_before) = timestamp;
+        } else {
+            return Status(grpc::INVALID_ARGUMENT, "Unknown filter: " + key);
+        }
+    }
+
+    return Status::OK;
+}
+
+// created_after and created_before of 0 leave the range open. Grouping by
+// creation time needs both and at most kMaxAggregateBuckets buckets.
+Status OrderService::parse_aggregate(const osv1::AggregateOrdersRequest& request, AggregateQuery* query) {
+    switch (request.group_by()) {
+        case osv1::AggregateGroup::ALL_ORDERS:
+            query->group_by = AggregateQuery::GroupBy::kNone;
+            break;
+        case osv1::AggregateGroup::BY_STATUS:
+            query->group_by = AggregateQuery::GroupBy::kStatus;
+            break;
+        case osv1::AggregateGroup::BY_CREATED_AT:
+            query->group_by = AggregateQuery::GroupBy::kCreatedAt;
+            break;
+        default:
+            return Status(grpc::INVALID_ARGUMENT, "Unknown group_by: " + std::to_string(request.group_by()));
+    }
+
+    for (int status : request.statuses()) {
+        if (!osv1::OrderStatus_IsValid(status)) {
+            return Status(grpc::INVALID_ARGUMENT, "Unknown order status: " + std::to_string(status));
+        }
+        query->statuses.push_back(static_cast<osv1::OrderStatus>(status));
+    }
+
+    if (request.created_after() != 0) {
+        query->created_after = request.created_after();
+    }
+    if (request.created_before() != 0) {
+        query->created_before = request.created_before();
+    }
+
+    if (query->group_by != AggregateQuery::GroupBy::kCreatedAt) {
+        return Status::OK;
+    }
+
+    int64_t width = request.bucket_seconds();
+    if (width <= 0) {
+        return Status(grpc::INVALID_ARGUMENT, "bucket_seconds must be positive");
+    }
+    if (!query->created_after || !query->created_before || *query->created_before <= *query->created_after) {
+        return Status(grpc::INVALID_ARGUMENT, "BY_CREATED_AT needs created_after before created_before");
+    }
+
+    uint64_t range = static_cast<uint64_t>(*query->created_before) - static_cast<uint64_t>(*query->created_after);
+    uint64_t buckets = (range - 1) / static_cast<uint64_t>(width) + 1;
+    if (range > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) || buckets > kMaxAggregateBuckets) {
+        return Status(grpc::INVALID_ARGUMENT, "At most " + std::to_string(kMaxAggregateBuckets) + " buckets");
+    }
+    query->bucket_seconds = width;
+    return Status::OK;
+}
+
+// A new PENDING order built from the request, with a fresh id and the total
+// of its items as the amount
+osv1::Order OrderService::build_order(const osv1::CreateOrderRequest& request, int64_t now) {
+    osv1::Order order = request.order();
+
+    order.set_id(generate_id());
+    order.set_status(osv1::OrderStatus::PENDING);
+    order.set_created_at(now);
+    order.set_updated_at(now);
+
+    // Totalled by the AggregateOrders kernel, a stack buffer at a time
+    constexpr int kChunk = 64;
+    double prices[kChunk];
+    double quantities[kChunk];
+
+    double total_amount = 0.0;
+    for (int begin = 0; begin < order.items_size(); begin += kChunk) {
+        int n = std::min(kChunk, order.items_size() - begin);
+        for (int i = 0; i < n; i++) {
+            prices[i] = order.items(begin + i).price();
+            quantities[i] = order.items(begin + i).quantity();
+        }
+        total_amount += OrderColumns::SumProducts(prices, quantities, static_cast<std::size_t>(n));
+    }
+    order.set_amount(total_amount);
+
+    return order;
+}
+
+int64_t OrderService::get_current_timestamp() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Time-ordered UUIDv7 text, unique across threads without any lock
+std::string OrderService::generate_id() { return OrderId::Generate().ToString(); }
@@ -0,0 +1,138 @@
+#include "service/response_cache.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+ResponseCache::ResponseCache(std::size_t capacity_bytes, std::size_t shard_count)
+    : capacity_(capacity_bytes),
+      shard_capacity_(capacity_bytes / std::max<std::size_t>(shard_count, 1)),
+      shards_(std::max<std::size_t>(shard_count, 1)) {}
+
+bool ResponseCache::Lookup(std::string_view key, grpc::ByteBuffer* value, uint64_t* epoch) {
+    Shard& shard = this->shard_for(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        *epoch = shard.epoch;
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Entry& entry = *shard.slots[it->second];
+    entry.referenced.store(true, std::memory_order_relaxed);
+    *value = entry.value;  // References the slices, the bytes are not copied
+    shard.hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void ResponseCache::Insert(std::string_view key, const grpc::ByteBuffer& value, uint64_t epoch) {
+    std::size_t bytes = key.size() + value.Length() + kEntryOverhead;
+    if (bytes > this->shard_capacity_) {
+        return;
+    }
+
+    Shard& shard = this->shard_for(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+    if (shard.epoch != epoch) {
+        return;
+    }
+
+    // Another miss on the same key got here first, its bytes are as fresh
+    if (shard.index.count(key)) {
+        return;
+    }
+
+    while (shard.bytes + bytes > this->shard_capacity_ && !shard.index.empty()) {
+        evict_one(shard);
+    }
+
+    auto entry = std::make_unique<Entry>();
+    entry->key = std::string(key);
+    entry->value = value;
+    entry->bytes = bytes;
+
+    std::size_t slot;
+    if (shard.free_slots.empty()) {
+        slot = shard.slots.size();
+        shard.slots.push_back(nullptr);
+    } else {
+        slot = shard.free_slots.back();
+        shard.free_slots.pop_back();
+    }
+
+    shard.index.emplace(entry->key, slot);
+    shard.slots[slot] = std::move(entry);
+    shard.bytes += bytes;
+    shard.inserts.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ResponseCache::Invalidate(std::string_view key) {
+    Shard& shard = this->shard_for(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+    // Bumped even when the key is not cached, a fill may be on its way
+    shard.epoch++;
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        remove(shard, it->second);
+        shard.invalidations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+ResponseCache::Stats ResponseCache::stats() const {
+    Stats stats;
+    for (const Shard& shard : this->shards_) {
+        stats.hits += shard.hits.load(std::memory_order_relaxed);
+        stats.misses += shard.misses.load(std::memory_order_relaxed);
+        stats.inserts += shard.inserts.load(std::memory_order_relaxed);
+        stats.evictions += shard.evictions.load(std::memory_order_relaxed);
+        stats.invalidations += shard.invalidations.load(std::memory_order_relaxed);
+
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        stats.entries += shard.index.size();
+        stats.bytes += shard.bytes;
+    }
+    return stats;
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+ResponseCache::Shard& ResponseCache::shard_for(std::string_view key) {
+    return this->shards_[std::hash<std::string_view>{}(key) % this->shards_.size()];
+}
+
+// Called with the shard locked exclusively
+void ResponseCache::remove(Shard& shard, std::size_t slot) {
+    std::unique_ptr<Entry> entry = std::move(shard.slots[slot]);
+    shard.index.erase(entry->key);
+    shard.bytes -= entry->bytes;
+    shard.free_slots.push_back(slot);
+}
+
+// Called with the shard locked exclusively and at least one entry cached
+void ResponseCache::evict_one(Shard& shard) {
+    while (true) {
+        std::size_t slot = shard.hand;
+        shard.hand = (shard.hand + 1) % shard.slots.size();
+
+        Entry* entry = shard.slots[slot].get();
+        if (!entry) {
+            continue;
+        }
+        if (entry->referenced.exchange(false, std::memory_order_relaxed)) {
+            continue;  // Second chance
+        }
+
+        remove(shard, slot);
+        shard.evictions.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+}
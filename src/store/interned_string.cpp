@@ -0,0 +1,96 @@
+#include "store/interned_string.hpp"
+
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+
+// The pool behind every InternedString. Entries are hashed into shards so
+// writers interning different strings rarely meet on a lock; each shard maps
+// a view of an entry's own characters to the entry.
+struct InternPool {
+    static constexpr std::size_t kShardCount = 64;
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string_view, InternedString::Entry*> entries;
+        std::size_t bytes = 0;
+    };
+
+    Shard shards[kShardCount];
+
+    // Never destroyed: handles in static objects may be released after main
+    static InternPool& Instance() {
+        static InternPool* pool = new InternPool();
+        return *pool;
+    }
+};
+
+InternedString::InternedString(std::string_view value) {
+    if (value.empty()) {
+        return;
+    }
+
+    // The map hashes with the low bits, pick the shard with the high ones
+    std::size_t hash = std::hash<std::string_view>{}(value);
+    uint32_t index = static_cast<uint32_t>((hash >> 32) % InternPool::kShardCount);
+    InternPool::Shard& shard = InternPool::Instance().shards[index];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.entries.find(value);
+    if (it != shard.entries.end()) {
+        this->entry_ = it->second;
+        this->entry_->refs.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    void* memory = ::operator new(sizeof(Entry) + value.size());
+    Entry* entry = new (memory) Entry{{1}, static_cast<uint32_t>(value.size()), index};
+    std::memcpy(reinterpret_cast<char*>(entry + 1), value.data(), value.size());
+
+    shard.entries.emplace(std::string_view(entry->data(), entry->size), entry);
+    shard.bytes += value.size();
+    this->entry_ = entry;
+}
+
+InternedString::Stats InternedString::PoolStats() {
+    Stats stats;
+    for (InternPool::Shard& shard : InternPool::Instance().shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        stats.strings += shard.entries.size();
+        stats.bytes += shard.bytes;
+    }
+    return stats;
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+void InternedString::release(Entry* entry) {
+    if (!entry) {
+        return;
+    }
+
+    // Dropping a reference that is not the last one needs no lock
+    uint32_t refs = entry->refs.load(std::memory_order_relaxed);
+    while (refs > 1) {
+        if (entry->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel)) {
+            return;
+        }
+    }
+
+    // Possibly the last one: decide under the lock, so a concurrent intern of
+    // the same string either finds the entry alive or not at all
+    InternPool::Shard& shard = InternPool::Instance().shards[entry->shard];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (entry->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    shard.entries.erase(std::string_view(entry->data(), entry->size));
+    shard.bytes -= entry->size;
+    entry->~Entry();
+    ::operator delete(entry);
+}
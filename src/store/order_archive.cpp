@@ -0,0 +1,276 @@
+#include "store/order_archive.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+#include "store/file_io.hpp"
+#include "store/order_record.hpp"
+#include "store/order_wal.hpp"
+
+namespace {
+
+// The fields of a record payload, views into it
+struct Payload {
+    uint8_t op;
+    std::string_view order_id;
+    std::string_view user_id;
+    std::string_view order;
+};
+
+bool parse_payload(const char* data, std::size_t size, Payload* payload) {
+    if (size < 5) {
+        return false;
+    }
+    std::size_t id_size = load<uint32_t>(data + 1);
+    if (5 + id_size + 4 > size) {
+        return false;
+    }
+    std::size_t user_size = load<uint32_t>(data + 5 + id_size);
+    if (9 + id_size + user_size > size) {
+        return false;
+    }
+
+    payload->op = static_cast<uint8_t>(data[0]);
+    payload->order_id = std::string_view(data + 5, id_size);
+    payload->user_id = std::string_view(data + 9 + id_size, user_size);
+    payload->order = std::string_view(data + 9 + id_size + user_size, size - 9 - id_size - user_size);
+    return true;
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+OrderArchive::OrderArchive(std::string path) : path_(std::move(path)) {
+    this->fd_ = ::open(this->path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (this->fd_ < 0) {
+        throw sys_error("Failed to open archive", this->path_);
+    }
+
+    try {
+        this->rebuild_index();
+    } catch (...) {
+        ::close(this->fd_);
+        throw;
+    }
+}
+
+OrderArchive::~OrderArchive() { ::close(this->fd_); }
+
+bool OrderArchive::Append(const std::vector<OrderStore::OrderPtr>& orders) {
+    if (orders.empty()) {
+        return true;
+    }
+
+    // Records only exist in memory, the archive keeps the protobuf form
+    thread_local osv1::Order order;
+    std::string data;
+    std::vector<std::size_t> ends;
+    ends.reserve(orders.size());
+    for (const OrderStore::OrderPtr& record : orders) {
+        record->ToProto(&order);
+        frame(data, kPut, order.id(), record->user_id(), &order);
+        ends.push_back(data.size());
+    }
+
+    std::lock_guard<std::mutex> lock(this->write_mutex_);
+    if (!this->write_out(data)) {
+        return false;
+    }
+
+    uint64_t begin = this->end_;
+    this->end_ += data.size();
+
+    std::unique_lock<std::shared_mutex> index_lock(this->index_mutex_);
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < orders.size(); i++) {
+        this->index_[orders[i]->key()] = Location{begin + offset, static_cast<uint32_t>(ends[i] - offset)};
+        offset = ends[i];
+    }
+    this->file_bytes_ = this->end_;
+    return true;
+}
+
+bool OrderArchive::Get(std::string_view order_id, osv1::Order* order, std::string* user_id) const {
+    Location location;
+    {
+        std::shared_lock<std::shared_mutex> lock(this->index_mutex_);
+        auto it = this->index_.find(OrderRecord::KeyOf(order_id));
+        if (it == this->index_.end()) {
+            return false;
+        }
+        location = it->second;
+    }
+
+    // Written records never change, so they are read without any lock
+    std::string record(location.size, '\0');
+    ssize_t n = ::pread(this->fd_, record.data(), record.size(), static_cast<off_t>(location.offset));
+    if (n != static_cast<ssize_t>(record.size())) {
+        std::cerr << "Archive " << this->path_ << ": short read at offset " << location.offset << std::endl;
+        return false;
+    }
+
+    const char* data = record.data() + kRecordHeaderSize;
+    std::size_t size = record.size() - kRecordHeaderSize;
+    Payload payload;
+    if (load<uint32_t>(record.data()) != size || load<uint32_t>(record.data() + 4) != OrderWal::Crc32(data, size) ||
+        !parse_payload(data, size, &payload)) {
+        std::cerr << "Archive " << this->path_ << ": corrupt record at offset " << location.offset << std::endl;
+        return false;
+    }
+
+    // Another order whose id has the same key
+    if (payload.order_id != order_id) {
+        return false;
+    }
+
+    if (!order->ParseFromArray(payload.order.data(), static_cast<int>(payload.order.size()))) {
+        return false;
+    }
+    if (user_id) {
+        user_id->assign(payload.user_id);
+    }
+    return true;
+}
+
+bool OrderArchive::Contains(std::string_view order_id) const {
+    std::shared_lock<std::shared_mutex> lock(this->index_mutex_);
+    return this->index_.count(OrderRecord::KeyOf(order_id)) > 0;
+}
+
+bool OrderArchive::Erase(std::string_view order_id) {
+    OrderId key = OrderRecord::KeyOf(order_id);
+
+    std::lock_guard<std::mutex> lock(this->write_mutex_);
+    if (!this->Contains(order_id)) {
+        return false;
+    }
+
+    std::string data;
+    frame(data, kErase, order_id, {}, nullptr);
+    if (!this->write_out(data)) {
+        return false;
+    }
+    this->end_ += data.size();
+
+    std::unique_lock<std::shared_mutex> index_lock(this->index_mutex_);
+    this->index_.erase(key);
+    this->file_bytes_ = this->end_;
+    return true;
+}
+
+std::size_t OrderArchive::size() const {
+    std::shared_lock<std::shared_mutex> lock(this->index_mutex_);
+    return this->index_.size();
+}
+
+uint64_t OrderArchive::file_bytes() const {
+    std::shared_lock<std::shared_mutex> lock(this->index_mutex_);
+    return this->file_bytes_;
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+void OrderArchive::rebuild_index() {
+    struct stat st;
+    if (::fstat(this->fd_, &st) != 0) {
+        throw sys_error("Failed to stat archive", this->path_);
+    }
+
+    // A new archive, or one whose header never made it to disk
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+    if (size < kHeaderSize) {
+        std::string header;
+        put<uint32_t>(header, kMagic);
+        put<uint32_t>(header, kVersion);
+        if (::ftruncate(this->fd_, 0) != 0 || !this->write_out(header)) {
+            throw sys_error("Failed to initialise archive", this->path_);
+        }
+        this->end_ = this->file_bytes_ = kHeaderSize;
+        return;
+    }
+
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, this->fd_, 0);
+    if (mapping == MAP_FAILED) {
+        throw sys_error("Failed to map archive", this->path_);
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    const char* data = static_cast<const char*>(mapping);
+    if (load<uint32_t>(data) != kMagic || load<uint32_t>(data + 4) != kVersion) {
+        ::munmap(mapping, size);
+        throw std::runtime_error("Not an order archive (bad magic or version): " + this->path_);
+    }
+
+    std::size_t pos = kHeaderSize;
+    while (pos + kRecordHeaderSize <= size) {
+        std::size_t length = load<uint32_t>(data + pos);
+        const char* payload_data = data + pos + kRecordHeaderSize;
+        Payload payload;
+        if (pos + kRecordHeaderSize + length > size ||
+            load<uint32_t>(data + pos + 4) != OrderWal::Crc32(payload_data, length) ||
+            !parse_payload(payload_data, length, &payload) || (payload.op != kPut && payload.op != kErase)) {
+            break;
+        }
+
+        OrderId key = OrderRecord::KeyOf(payload.order_id);
+        if (payload.op == kPut) {
+            this->index_[key] = Location{pos, static_cast<uint32_t>(kRecordHeaderSize + length)};
+        } else {
+            this->index_.erase(key);
+        }
+        pos += kRecordHeaderSize + length;
+    }
+    ::munmap(mapping, size);
+
+    // Cut a torn or corrupt tail so the next append starts on a boundary
+    if (pos < size) {
+        std::cerr << "Archive " << this->path_ << ": discarding " << (size - pos) << " bytes after offset " << pos
+                  << std::endl;
+        if (::ftruncate(this->fd_, static_cast<off_t>(pos)) != 0) {
+            throw sys_error("Failed to truncate archive", this->path_);
+        }
+    }
+    this->end_ = this->file_bytes_ = pos;
+}
+
+// A failed write is cut off again, so the records after it still start on a
+// boundary
+bool OrderArchive::write_out(const std::string& data) {
+    if (write_all(this->fd_, data) && ::fdatasync(this->fd_) == 0) {
+        return true;
+    }
+    std::cerr << "Archive " << this->path_ << ": write failed: " << std::strerror(errno) << std::endl;
+    if (::ftruncate(this->fd_, static_cast<off_t>(this->end_)) != 0) {
+        std::cerr << "Archive " << this->path_ << ": failed to cut off the failed write" << std::endl;
+    }
+    return false;
+}
+
+void OrderArchive::frame(std::string& out, Op op, std::string_view order_id, std::string_view user_id,
+                         const osv1::Order* order) {
+    std::string payload;
+    payload.reserve(64 + order_id.size() + user_id.size());
+    put<uint8_t>(payload, op);
+    put<uint32_t>(payload, static_cast<uint32_t>(order_id.size()));
+    payload.append(order_id);
+    put<uint32_t>(payload, static_cast<uint32_t>(user_id.size()));
+    payload.append(user_id);
+    if (order) {
+        order->AppendToString(&payload);
+    }
+
+    put<uint32_t>(out, static_cast<uint32_t>(payload.size()));
+    put<uint32_t>(out, OrderWal::Crc32(payload.data(), payload.size()));
+    out.append(payload);
+}
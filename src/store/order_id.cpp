@@ -0,0 +1,148 @@
+#include "store/order_id.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+namespace {
+
+constexpr uint64_t kRandABits = 12;
+constexpr uint64_t kRandBBits = 62;
+constexpr uint64_t kRandBMask = (uint64_t{1} << kRandBBits) - 1;
+
+// Per-thread sequence: rand_a and rand_b together are a 74-bit counter
+struct Sequence {
+    std::mt19937_64 rng{std::random_device{}()};
+    uint64_t ms = 0;
+    uint64_t rand_a = 0;
+    uint64_t rand_b = 0;
+
+    // The top bit of rand_a starts at zero, which leaves at least 2^73 ids
+    // in the millisecond before the counter runs out
+    void reseed() {
+        this->rand_a = this->rng() & ((uint64_t{1} << (kRandABits - 1)) - 1);
+        this->rand_b = this->rng() & kRandBMask;
+    }
+
+    void next(uint64_t now_ms) {
+        if (now_ms > this->ms) {
+            this->ms = now_ms;
+            this->reseed();
+            return;
+        }
+
+        // Same millisecond, or the clock went back: count up from the last id.
+        // Running out moves to the next millisecond ahead of the clock.
+        if (++this->rand_b > kRandBMask) {
+            this->rand_b = 0;
+            if (++this->rand_a == (uint64_t{1} << kRandABits)) {
+                this->ms++;
+                this->reseed();
+            }
+        }
+    }
+};
+
+// "000102...ff", two chars per byte value
+constexpr std::array<char, 512> kHexPairs = [] {
+    constexpr char kHex[] = "0123456789abcdef";
+    std::array<char, 512> pairs{};
+    for (std::size_t i = 0; i < 256; i++) {
+        pairs[2 * i] = kHex[i >> 4];
+        pairs[2 * i + 1] = kHex[i & 0xf];
+    }
+    return pairs;
+}();
+
+// Digit values by char, -1 for anything that is not a digit
+constexpr std::array<int8_t, 256> hex_values(bool upper) {
+    std::array<int8_t, 256> values{};
+    for (std::size_t c = 0; c < 256; c++) {
+        values[c] = -1;
+    }
+    for (int i = 0; i < 10; i++) {
+        values['0' + i] = static_cast<int8_t>(i);
+    }
+    for (int i = 0; i < 6; i++) {
+        values['a' + i] = static_cast<int8_t>(10 + i);
+        if (upper) {
+            values['A' + i] = static_cast<int8_t>(10 + i);
+        }
+    }
+    return values;
+}
+
+constexpr std::array<int8_t, 256> kHexAnyCase = hex_values(true);
+constexpr std::array<int8_t, 256> kHexLower = hex_values(false);
+
+// Where each of the 16 bytes goes in the text form
+constexpr std::size_t kBytePositions[16] = {0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34};
+
+bool parse(std::string_view text, const std::array<int8_t, 256>& values, OrderId* id) {
+    if (text.size() != OrderId::kTextSize || text[8] != '-' || text[13] != '-' || text[18] != '-' ||
+        text[23] != '-') {
+        return false;
+    }
+
+    // Any invalid digit makes its byte negative, checked once at the end
+    uint64_t words[2] = {0, 0};
+    int invalid = 0;
+    for (std::size_t i = 0; i < 16; i++) {
+        int high = values[static_cast<uint8_t>(text[kBytePositions[i]])];
+        int low = values[static_cast<uint8_t>(text[kBytePositions[i] + 1])];
+        invalid |= high | low;
+        words[i / 8] = (words[i / 8] << 8) | ((static_cast<unsigned>(high) << 4 | static_cast<unsigned>(low)) & 0xff);
+    }
+    if (invalid < 0) {
+        return false;
+    }
+
+    id->hi = words[0];
+    id->lo = words[1];
+    return true;
+}
+
+}  // namespace
+
+OrderId OrderId::Generate() {
+    thread_local Sequence sequence;
+
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    sequence.next(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count()));
+
+    OrderId id;
+    id.hi = (sequence.ms << 16) | (uint64_t{7} << 12) | sequence.rand_a;
+    id.lo = (uint64_t{2} << 62) | sequence.rand_b;
+    return id;
+}
+
+bool OrderId::Parse(std::string_view text, OrderId* id) { return parse(text, kHexAnyCase, id); }
+
+bool OrderId::ParseCanonical(std::string_view text, OrderId* id) { return parse(text, kHexLower, id); }
+
+void OrderId::Format(char* out) const {
+    const uint64_t words[2] = {this->hi, this->lo};
+    for (std::size_t w = 0; w < 2; w++) {
+        for (std::size_t b = 0; b < 8; b++) {
+            std::size_t byte = (words[w] >> (56 - 8 * b)) & 0xff;
+            std::memcpy(out + kBytePositions[w * 8 + b], kHexPairs.data() + 2 * byte, 2);
+        }
+    }
+    out[8] = out[13] = out[18] = out[23] = '-';
+}
+
+std::string OrderId::ToString() const {
+    std::string text(kTextSize, '\0');
+    this->Format(text.data());
+    return text;
+}
+
+uint64_t OrderId::HashText(std::string_view text) {
+    uint64_t h = 14695981039346656037ull;
+    for (char c : text) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
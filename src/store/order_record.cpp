@@ -0,0 +1,166 @@
+#include "store/order_record.hpp"
+
+#include <cstring>
+#include <functional>
+#include <new>
+
+#include "metrics/phase_profiler.hpp"
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+OrderRecord::Ptr OrderRecord::Create(std::string_view user_id, const osv1::Order& order) {
+    return Create(InternedString(user_id), order);
+}
+
+OrderRecord::Ptr OrderRecord::Create(InternedString user_id, const osv1::Order& order) {
+    ScopedPhase timer(PhaseProfiler::kCopy);
+
+    OrderId key;
+    bool binary_id = parse_uuid(order.id(), &key);
+    std::size_t tail_size = binary_id ? 0 : order.id().size();
+
+    OrderId item_id;
+    for (const auto& item : order.items()) {
+        tail_size += parse_uuid(item.id(), &item_id) ? sizeof(OrderId) : item.id().size();
+    }
+
+    std::size_t item_count = static_cast<std::size_t>(order.items_size());
+    void* memory = ::operator new(sizeof(OrderRecord) + item_count * sizeof(Item) + tail_size);
+    OrderRecord* record = new (memory) OrderRecord();
+
+    record->key_ = binary_id ? key : KeyOf(order.id());
+    record->amount_ = order.amount();
+    record->created_at_ = order.created_at();
+    record->updated_at_ = order.updated_at();
+    record->user_id_ = std::move(user_id);
+    record->address_ = InternedString(order.address());
+    record->item_count_ = static_cast<uint32_t>(item_count);
+    record->id_size_ = binary_id ? kBinaryId : static_cast<uint32_t>(order.id().size());
+    record->status_ = order.status();
+
+    char* tail = record->tail();
+    if (!binary_id) {
+        std::memcpy(tail, order.id().data(), order.id().size());
+        tail += order.id().size();
+    }
+
+    Item* items = record->items();
+    for (std::size_t i = 0; i < item_count; i++) {
+        const osv1::Item& item = order.items(static_cast<int>(i));
+        uint32_t id_size = static_cast<uint32_t>(item.id().size());
+
+        if (parse_uuid(item.id(), &item_id)) {
+            std::memcpy(tail, &item_id, sizeof(item_id));
+            tail += sizeof(item_id);
+            id_size = kBinaryId;
+        } else {
+            std::memcpy(tail, item.id().data(), item.id().size());
+            tail += item.id().size();
+        }
+
+        new (&items[i]) Item{InternedString(item.name()), item.price(), item.quantity(), id_size};
+    }
+
+    return Ptr(record);
+}
+
+OrderId OrderRecord::KeyOf(std::string_view order_id) {
+    OrderId key;
+    if (parse_uuid(order_id, &key)) {
+        return key;
+    }
+
+    // Version 0, which parse_uuid never accepts, keeps the two kinds of key apart
+    key.hi = std::hash<std::string_view>{}(order_id) & ~kVersionMask;
+    key.lo = OrderId::HashText(order_id);
+    return key;
+}
+
+void OrderRecord::ToProto(osv1::Order* order) const {
+    ScopedPhase timer(PhaseProfiler::kCopy);
+    order->Clear();
+
+    if (this->id_size_ == kBinaryId) {
+        std::string* id = order->mutable_id();
+        id->resize(OrderId::kTextSize);
+        this->key_.Format(id->data());
+    } else {
+        order->mutable_id()->assign(this->tail(), this->id_size_);
+    }
+
+    order->set_amount(this->amount_);
+    order->set_status(this->status());
+    order->mutable_address()->assign(this->address().data(), this->address().size());
+    order->set_created_at(this->created_at_);
+    order->set_updated_at(this->updated_at_);
+
+    const char* tail = this->tail() + (this->id_size_ == kBinaryId ? 0 : this->id_size_);
+    order->mutable_items()->Reserve(static_cast<int>(this->item_count_));
+    for (uint32_t i = 0; i < this->item_count_; i++) {
+        const Item& item = this->items()[i];
+        osv1::Item* out = order->add_items();
+        std::string_view name = item.name.view();
+        out->mutable_name()->assign(name.data(), name.size());
+        out->set_price(item.price);
+        out->set_quantity(item.quantity);
+
+        if (item.id_size == kBinaryId) {
+            OrderId item_id;
+            std::memcpy(&item_id, tail, sizeof(item_id));
+            tail += sizeof(item_id);
+
+            std::string* id = out->mutable_id();
+            id->resize(OrderId::kTextSize);
+            item_id.Format(id->data());
+        } else {
+            out->mutable_id()->assign(tail, item.id_size);
+            tail += item.id_size;
+        }
+    }
+}
+
+std::string OrderRecord::id() const {
+    if (this->id_size_ == kBinaryId) {
+        return this->key_.ToString();
+    }
+    return std::string(this->tail(), this->id_size_);
+}
+
+bool OrderRecord::HasId(std::string_view order_id) const {
+    // A UUID key is the id itself, only a hashed one can collide
+    return this->id_size_ == kBinaryId || order_id == std::string_view(this->tail(), this->id_size_);
+}
+
+std::size_t OrderRecord::allocated_bytes() const {
+    std::size_t bytes = sizeof(OrderRecord) + this->item_count_ * sizeof(Item);
+    bytes += this->id_size_ == kBinaryId ? 0 : this->id_size_;
+    for (uint32_t i = 0; i < this->item_count_; i++) {
+        const Item& item = this->items()[i];
+        bytes += item.id_size == kBinaryId ? sizeof(OrderId) : item.id_size;
+    }
+    return bytes;
+}
+
+void OrderRecord::Ptr::release(OrderRecord* record) {
+    if (!record || record->refs_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    Item* items = record->items();
+    for (uint32_t i = 0; i < record->item_count_; i++) {
+        items[i].~Item();
+    }
+    record->~OrderRecord();
+    ::operator delete(record);
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+//
+// Only the canonical form, so the text converts back unchanged, and not
+// version 0 (the nil id among others), which is left to hashed keys
+bool OrderRecord::parse_uuid(std::string_view text, OrderId* id) {
+    return OrderId::ParseCanonical(text, id) && (id->hi & kVersionMask) != 0;
+}
@@ -0,0 +1,252 @@
+#include "store/order_retention.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <utility>
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+OrderRetention::OrderRetention(RetentionOptions options, OrderStore& store, OrderArchive* archive)
+    : options_(std::move(options)), store_(store), archive_(archive) {
+    for (const auto& [status, ttl] : this->options_.ttls) {
+        std::size_t index = static_cast<std::size_t>(status);
+        if (this->ttl_by_status_.size() <= index) {
+            this->ttl_by_status_.resize(index + 1, -1);
+        }
+        this->ttl_by_status_[index] = ttl.count();
+    }
+    this->samples_.reserve(kSamples);
+
+    this->sweeper_ = std::thread(&OrderRetention::sweep_loop, this);
+}
+
+OrderRetention::~OrderRetention() {
+    {
+        std::lock_guard<std::mutex> lock(this->stop_mutex_);
+        this->stopping_ = true;
+    }
+    this->stop_cv_.notify_all();
+    this->sweeper_.join();
+}
+
+std::map<osv1::OrderStatus, std::chrono::seconds> OrderRetention::ParseTtls(const std::string& text) {
+    std::map<osv1::OrderStatus, std::chrono::seconds> ttls;
+
+    std::size_t begin = 0;
+    while (begin < text.size()) {
+        std::size_t end = std::min(text.find(',', begin), text.size());
+        std::string entry = text.substr(begin, end - begin);
+        begin = end + 1;
+        if (entry.empty()) {
+            continue;
+        }
+
+        std::size_t eq = entry.find('=');
+        if (eq == std::string::npos || eq + 2 > entry.size()) {
+            throw std::invalid_argument("Invalid TTL '" + entry + "', expected STATUS=<number><s|m|h|d>");
+        }
+
+        osv1::OrderStatus status;
+        if (!osv1::OrderStatus_Parse(entry.substr(0, eq), &status)) {
+            throw std::invalid_argument("Unknown order status in TTL '" + entry + "'");
+        }
+
+        int64_t count = 0;
+        const char* first = entry.data() + eq + 1;
+        const char* last = entry.data() + entry.size() - 1;
+        auto [number_end, ec] = std::from_chars(first, last, count);
+
+        int64_t unit = 0;
+        switch (*last) {
+            case 's':
+                unit = 1;
+                break;
+            case 'm':
+                unit = 60;
+                break;
+            case 'h':
+                unit = 60 * 60;
+                break;
+            case 'd':
+                unit = 24 * 60 * 60;
+                break;
+        }
+        if (ec != std::errc() || number_end != last || count <= 0 || unit == 0) {
+            throw std::invalid_argument("Invalid TTL '" + entry + "', expected STATUS=<number><s|m|h|d>");
+        }
+        ttls[status] = std::chrono::seconds(count * unit);
+    }
+
+    return ttls;
+}
+
+void OrderRetention::WritePrometheus(std::ostream& out) const {
+    out << "# HELP order_service_retention_evicted_total Orders evicted from memory.\n";
+    out << "# TYPE order_service_retention_evicted_total counter\n";
+    out << "order_service_retention_evicted_total " << this->evicted_.load(std::memory_order_relaxed) << "\n";
+
+    out << "# HELP order_service_retention_kept_total Orders picked for eviction that changed before they went.\n";
+    out << "# TYPE order_service_retention_kept_total counter\n";
+    out << "order_service_retention_kept_total " << this->kept_.load(std::memory_order_relaxed) << "\n";
+
+    out << "# HELP order_service_retention_archive_failures_total Evictions put off because the archive failed to "
+           "write.\n";
+    out << "# TYPE order_service_retention_archive_failures_total counter\n";
+    out << "order_service_retention_archive_failures_total "
+        << this->archive_failures_.load(std::memory_order_relaxed) << "\n";
+
+    out << "# HELP order_service_retention_passes_total Sweeps over the whole store.\n";
+    out << "# TYPE order_service_retention_passes_total counter\n";
+    out << "order_service_retention_passes_total " << this->passes_.load(std::memory_order_relaxed) << "\n";
+
+    out << "# HELP order_service_retention_store_bytes Memory of the order records and tables at the last pass.\n";
+    out << "# TYPE order_service_retention_store_bytes gauge\n";
+    out << "order_service_retention_store_bytes " << this->bytes_.load(std::memory_order_relaxed) << "\n";
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+void OrderRetention::sweep_loop() {
+    std::unique_lock<std::mutex> lock(this->stop_mutex_);
+
+    while (!this->stop_cv_.wait_for(lock, this->options_.step_interval, [this] { return this->stopping_; })) {
+        lock.unlock();
+        this->step();
+        lock.lock();
+    }
+}
+
+// Walks slices until step_time is up, the pass ends or enough orders are
+// picked, then evicts them with no lock of the walk held
+void OrderRetention::step() {
+    auto deadline = std::chrono::steady_clock::now() + this->options_.step_time;
+    int64_t now =
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::vector<OrderStore::OrderPtr> victims;
+    bool pass_ended = false;
+    while (!pass_ended && victims.size() < kMaxStepEvictions && std::chrono::steady_clock::now() < deadline) {
+        std::size_t table_bytes = 0;
+        std::size_t capacity = this->store_.ScanSlots(
+            this->shard_, this->slot_, this->slot_ + kSlotsPerSlice,
+            [this, now, &victims](const OrderStore::OrderPtr& order) {
+                if (this->expired(*order, now)) {
+                    victims.push_back(order);
+                    return;
+                }
+                this->pass_record_bytes_ += order->allocated_bytes();
+                this->sample(last_change(*order));
+            },
+            &table_bytes);
+
+        this->slot_ += kSlotsPerSlice;
+        if (this->slot_ >= capacity) {
+            this->pass_bytes_ += table_bytes;
+            this->slot_ = 0;
+            if (++this->shard_ == this->store_.shard_count()) {
+                this->shard_ = 0;
+                this->end_pass();
+                pass_ended = true;
+            }
+        }
+    }
+
+    this->evict(victims);
+}
+
+bool OrderRetention::expired(const OrderRecord& order, int64_t now) {
+    int64_t changed = last_change(order);
+
+    std::size_t status = static_cast<std::size_t>(order.status());
+    if (status < this->ttl_by_status_.size() && this->ttl_by_status_[status] >= 0 &&
+        changed <= now - this->ttl_by_status_[status]) {
+        return true;
+    }
+    if (!this->budget_cutoff_ || changed > *this->budget_cutoff_) {
+        return false;
+    }
+    return changed < *this->budget_cutoff_ || this->random_() % kTieBuckets < this->tie_buckets_;
+}
+
+// Reservoir sampling, every order of the pass is equally likely to be kept
+void OrderRetention::sample(int64_t changed) {
+    this->pass_seen_++;
+    if (this->samples_.size() < kSamples) {
+        this->samples_.push_back(changed);
+        return;
+    }
+
+    uint64_t slot = this->random_() % this->pass_seen_;
+    if (slot < kSamples) {
+        this->samples_[slot] = changed;
+    }
+}
+
+// The share of the orders to evict is the excess over the budget, less the
+// headroom, over the bytes of the records: a table only shrinks once it is
+// mostly empty. Times are in seconds, so many orders may have changed in the
+// cutoff's second: of those, as many go at random as make up the evicted
+// samples.
+void OrderRetention::end_pass() {
+    std::size_t bytes = this->pass_bytes_ + this->pass_record_bytes_;
+    this->bytes_.store(bytes, std::memory_order_relaxed);
+    this->passes_.fetch_add(1, std::memory_order_relaxed);
+
+    this->budget_cutoff_.reset();
+    double target = static_cast<double>(this->options_.memory_budget_bytes) * kBudgetHeadroom;
+    if (this->options_.memory_budget_bytes > 0 && bytes > this->options_.memory_budget_bytes &&
+        !this->samples_.empty()) {
+        double share = std::min(1.0, (static_cast<double>(bytes) - target) /
+                                         static_cast<double>(std::max<std::size_t>(1, this->pass_record_bytes_)));
+        std::size_t evict = std::max<std::size_t>(
+            1, static_cast<std::size_t>(share * static_cast<double>(this->samples_.size()) + 0.5));
+        auto nth = this->samples_.begin() + static_cast<std::ptrdiff_t>(evict - 1);
+        std::nth_element(this->samples_.begin(), nth, this->samples_.end());
+        int64_t cutoff = *nth;
+
+        auto below = std::count_if(this->samples_.begin(), this->samples_.end(),
+                                   [cutoff](int64_t changed) { return changed < cutoff; });
+        auto ties = std::count(this->samples_.begin(), this->samples_.end(), cutoff);
+        this->budget_cutoff_ = cutoff;
+        this->tie_buckets_ = static_cast<uint64_t>(
+            (static_cast<double>(evict) - static_cast<double>(below)) / static_cast<double>(ties) * kTieBuckets + 0.5);
+    }
+
+    this->pass_bytes_ = 0;
+    this->pass_record_bytes_ = 0;
+    this->pass_seen_ = 0;
+    this->samples_.clear();
+}
+
+// Orders that fail to archive stay in memory and are picked again next pass.
+// The archived copy of an order that changed meanwhile is dropped, so it
+// cannot come back once the live one is deleted.
+void OrderRetention::evict(const std::vector<OrderStore::OrderPtr>& orders) {
+    if (orders.empty()) {
+        return;
+    }
+
+    if (this->archive_ && !this->archive_->Append(orders)) {
+        this->archive_failures_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    for (const OrderStore::OrderPtr& order : orders) {
+        if (this->store_.EraseIf(order)) {
+            this->evicted_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        this->kept_.fetch_add(1, std::memory_order_relaxed);
+        if (this->archive_) {
+            this->archive_->Erase(order->id());
+        }
+    }
+}
+
+int64_t OrderRetention::last_change(const OrderRecord& order) {
+    return std::max(order.created_at(), order.updated_at());
+}
@@ -0,0 +1,220 @@
+#include "store/order_snapshot.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "store/file_io.hpp"
+#include "store/order_id.hpp"
+#include "store/order_store.hpp"
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+OrderSnapshot::~OrderSnapshot() {
+    if (this->data_) {
+        ::munmap(const_cast<char*>(this->data_), this->size_);
+    }
+}
+
+std::shared_ptr<const OrderSnapshot> OrderSnapshot::Open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return nullptr;
+        }
+        throw sys_error("Failed to open snapshot", path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw sys_error("Failed to stat snapshot", path);
+    }
+
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+    if (size < kHeaderSize) {
+        ::close(fd);
+        throw std::runtime_error("Snapshot is truncated: " + path);
+    }
+
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw sys_error("Failed to map snapshot", path);
+    }
+
+    // Lookups jump around the file, don't read ahead
+    ::madvise(mapping, size, MADV_RANDOM);
+
+    std::shared_ptr<OrderSnapshot> snapshot(new OrderSnapshot());
+    snapshot->data_ = static_cast<const char*>(mapping);
+    snapshot->size_ = size;
+
+    const char* data = snapshot->data_;
+    if (load<uint32_t>(data) != kMagic || load<uint32_t>(data + 4) != kVersion) {
+        throw std::runtime_error("Not an order snapshot (bad magic or version): " + path);
+    }
+
+    uint64_t count = load<uint64_t>(data + 8);
+    uint64_t index_offset = load<uint64_t>(data + 16);
+    if (index_offset % alignof(IndexEntry) != 0 || index_offset > size ||
+        count > (size - index_offset) / sizeof(IndexEntry)) {
+        throw std::runtime_error("Snapshot index is out of bounds: " + path);
+    }
+
+    snapshot->count_ = static_cast<std::size_t>(count);
+    snapshot->index_ = reinterpret_cast<const IndexEntry*>(data + index_offset);
+    snapshot->created_at_ = load<int64_t>(data + 24);
+    return snapshot;
+}
+
+std::size_t OrderSnapshot::Write(const std::string& path, const OrderStore& store) {
+    struct Item {
+        uint64_t hash;
+        std::string order_id;
+        OrderStore::OrderPtr order;
+    };
+
+    // Holding the records keeps them alive without copying, writers keep
+    // publishing new versions while this one is written
+    std::vector<Item> items;
+    store.Scan([&items](const OrderStore::OrderPtr& order) {
+        std::string order_id = order->id();
+        uint64_t h = OrderId::HashText(order_id);
+        items.push_back(Item{h, std::move(order_id), order});
+    });
+
+    std::sort(items.begin(), items.end(), [](const Item& a, const Item& b) {
+        return a.hash != b.hash ? a.hash < b.hash : a.order_id < b.order_id;
+    });
+
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw sys_error("Failed to create snapshot", tmp_path);
+    }
+
+    auto fail = [&](const std::string& what) {
+        std::runtime_error error = sys_error(what, tmp_path);
+        ::close(fd);
+        ::unlink(tmp_path.c_str());
+        return error;
+    };
+
+    // The header goes in last, once the index offset is known
+    std::string buffer(kHeaderSize, '\0');
+    buffer.reserve(1 << 20);
+
+    std::vector<IndexEntry> index;
+    index.reserve(items.size());
+    uint64_t offset = kHeaderSize;
+    std::string serialized;
+
+    osv1::Order order;
+    for (const Item& item : items) {
+        item.order->ToProto(&order);
+        std::string_view user_id = item.order->user_id();
+        serialized.clear();
+        order.AppendToString(&serialized);
+
+        index.push_back(IndexEntry{item.hash, offset});
+        put<uint32_t>(buffer, static_cast<uint32_t>(item.order_id.size()));
+        put<uint32_t>(buffer, static_cast<uint32_t>(user_id.size()));
+        put<uint32_t>(buffer, static_cast<uint32_t>(serialized.size()));
+        buffer.append(item.order_id);
+        buffer.append(user_id);
+        buffer.append(serialized);
+        offset += kRecordHeaderSize + item.order_id.size() + user_id.size() + serialized.size();
+
+        if (buffer.size() >= (1 << 20)) {
+            if (!write_all(fd, buffer)) {
+                throw fail("Failed to write snapshot");
+            }
+            buffer.clear();
+        }
+    }
+
+    std::size_t padding = (alignof(IndexEntry) - offset % alignof(IndexEntry)) % alignof(IndexEntry);
+    buffer.append(padding, '\0');
+    uint64_t index_offset = offset + padding;
+    buffer.append(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(IndexEntry));
+
+    if (!write_all(fd, buffer)) {
+        throw fail("Failed to write snapshot");
+    }
+
+    std::string header;
+    put<uint32_t>(header, kMagic);
+    put<uint32_t>(header, kVersion);
+    put<uint64_t>(header, items.size());
+    put<uint64_t>(header, index_offset);
+    put<int64_t>(header, std::chrono::duration_cast<std::chrono::seconds>(
+                             std::chrono::system_clock::now().time_since_epoch())
+                             .count());
+    header.resize(kHeaderSize, '\0');
+
+    if (::pwrite(fd, header.data(), header.size(), 0) != static_cast<ssize_t>(header.size())) {
+        throw fail("Failed to write snapshot header");
+    }
+    if (::fdatasync(fd) != 0) {
+        throw fail("Failed to sync snapshot");
+    }
+    ::close(fd);
+
+    if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::runtime_error error = sys_error("Failed to replace snapshot", path);
+        ::unlink(tmp_path.c_str());
+        throw error;
+    }
+    sync_parent(path);
+
+    return items.size();
+}
+
+bool OrderSnapshot::Find(std::string_view order_id, Record* record) const {
+    uint64_t h = OrderId::HashText(order_id);
+    const IndexEntry* first = std::lower_bound(this->index_, this->index_ + this->count_, h,
+                                               [](const IndexEntry& entry, uint64_t value) { return entry.hash < value; });
+
+    for (const IndexEntry* it = first; it != this->index_ + this->count_ && it->hash == h; ++it) {
+        Record candidate = this->at(static_cast<std::size_t>(it - this->index_));
+        if (candidate.order_id == order_id) {
+            *record = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool OrderSnapshot::Parse(const Record& record, osv1::Order* order) {
+    return order->ParseFromArray(record.order.data(), static_cast<int>(record.order.size()));
+}
+
+OrderSnapshot::Record OrderSnapshot::at(std::size_t i) const {
+    std::size_t offset = static_cast<std::size_t>(this->index_[i].offset);
+    if (offset > this->size_ || this->size_ - offset < kRecordHeaderSize) {
+        return Record{};
+    }
+
+    const char* record = this->data_ + offset;
+    std::size_t id_length = load<uint32_t>(record);
+    std::size_t user_length = load<uint32_t>(record + 4);
+    std::size_t order_length = load<uint32_t>(record + 8);
+    if (this->size_ - offset - kRecordHeaderSize < id_length + user_length + order_length) {
+        return Record{};
+    }
+
+    const char* body = record + kRecordHeaderSize;
+    return Record{std::string_view(body, id_length), std::string_view(body + id_length, user_length),
+                  std::string_view(body + id_length + user_length, order_length)};
+}
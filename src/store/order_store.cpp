@@ -0,0 +1,657 @@
+#include "store/order_store.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "metrics/phase_profiler.hpp"
+#include "store/order_snapshot.hpp"
+
+// Round the requested shard count up to a power of two so a shard can be
+// picked with a mask instead of a modulo
+static std::size_t round_up_pow2(std::size_t n) {
+    std::size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+static bool has_prefix(std::string_view value, const std::string& prefix) {
+    return value.size() >= prefix.size() && value.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Shard locks time their wait and hold when the profiler is enabled
+using ReadLock = ProfiledLock<std::shared_lock<std::shared_mutex>>;
+using WriteLock = ProfiledLock<std::unique_lock<std::shared_mutex>>;
+
+OrderStore::OrderStore(std::size_t shard_count)
+    : shard_mask_(round_up_pow2(shard_count == 0 ? 1 : shard_count) - 1),
+      order_shards_(new OrderShard[this->shard_mask_ + 1]),
+      user_shards_(new UserShard[this->shard_mask_ + 1]) {}
+
+OrderStore::OrderPtr OrderStore::Get(std::string_view order_id) const {
+    OrderId key = OrderRecord::KeyOf(order_id);
+    const OrderShard& shard = this->order_shard(key);
+    std::shared_ptr<const OrderSnapshot> snapshot;
+    {
+        ReadLock lock(shard.mutex);
+
+        if (const OrderPtr* order = shard.orders.Find(key)) {
+            return (*order)->HasId(order_id) ? *order : nullptr;
+        }
+
+        snapshot = std::atomic_load(&this->snapshot_);
+        if (!snapshot || shard.erased.count(key)) {
+            return nullptr;
+        }
+    }
+
+    // Not loaded yet, parse it straight from the mapping
+    OrderSnapshot::Record record;
+    osv1::Order order;
+    if (!snapshot->Find(order_id, &record) || !OrderSnapshot::Parse(record, &order)) {
+        return nullptr;
+    }
+    return OrderRecord::Create(record.user_id, order);
+}
+
+std::vector<OrderStore::OrderPtr> OrderStore::ListByUser(const std::string& user_id) const {
+    this->WaitLoaded();
+
+    std::vector<OrderId> keys;
+    {
+        const UserShard& shard = this->user_shard(user_id);
+        ReadLock lock(shard.mutex);
+
+        auto it = shard.users.find(user_id);
+        if (it == shard.users.end()) {
+            return {};
+        }
+
+        keys.reserve(it->second.by_created.size());
+        for (const auto& key : it->second.by_created) {
+            keys.push_back(key.second);
+        }
+    }
+
+    return this->resolve(keys);
+}
+
+bool OrderStore::Query(const std::string& user_id, const OrderQuery& query, Page* page) const {
+    this->WaitLoaded();
+
+    if (query.after) {
+        return this->query_after(user_id, query, page);
+    }
+
+    std::vector<OrderId> keys;
+    {
+        const UserShard& shard = this->user_shard(user_id);
+        ReadLock lock(shard.mutex);
+
+        auto user = shard.users.find(user_id);
+        if (user == shard.users.end()) {
+            return false;
+        }
+
+        IndexSet::const_iterator first, last;
+        if (!index_range(user->second, query, &first, &last)) {
+            page->total = 0;
+            return true;
+        }
+
+        if (query.address_prefix.empty()) {
+            // Everything in [first, last) matches, only the page is resolved
+            page->total = 0;
+            for (auto it = first; it != last; ++it, ++page->total) {
+                if (page->total >= query.offset && keys.size() < query.limit) {
+                    keys.push_back(it->second);
+                }
+            }
+        } else {
+            for (auto it = first; it != last; ++it) {
+                keys.push_back(it->second);
+            }
+        }
+    }
+
+    std::vector<OrderPtr> orders = this->resolve(keys);
+
+    if (query.address_prefix.empty()) {
+        page->orders = std::move(orders);
+        return true;
+    }
+
+    page->total = 0;
+    for (auto& order : orders) {
+        if (!has_prefix(order->address(), query.address_prefix)) {
+            continue;
+        }
+        if (page->total >= query.offset && page->orders.size() < query.limit) {
+            page->orders.push_back(std::move(order));
+        }
+        page->total++;
+    }
+    return true;
+}
+
+bool OrderStore::Insert(const std::string& user_id, const osv1::Order& order) {
+    return this->insert(user_id, order, false);
+}
+
+bool OrderStore::Restore(const std::string& user_id, const osv1::Order& order) {
+    return this->insert(user_id, order, true);
+}
+
+bool OrderStore::Update(const osv1::Order& order) {
+    OrderId key = OrderRecord::KeyOf(order.id());
+    OrderShard& shard = this->order_shard(key);
+    OrderPtr old;  // Released after the lock so the destructor runs outside it
+
+    WriteLock lock(shard.mutex);
+    OrderPtr* current = this->find_locked(shard, key, order.id());
+    if (!current) {
+        return false;
+    }
+
+    // The owner is only known once the order is found
+    OrderPtr record = OrderRecord::Create((*current)->interned_user_id(), order);
+    old = std::exchange(*current, record);
+    this->index_replace(*old, *record);
+    this->notify(old, record);
+    return true;
+}
+
+bool OrderStore::Erase(std::string_view order_id) {
+    OrderId key = OrderRecord::KeyOf(order_id);
+    OrderPtr old;  // Released after the lock so the destructor runs outside it
+
+    OrderShard& shard = this->order_shard(key);
+    WriteLock lock(shard.mutex);
+
+    if (!this->find_locked(shard, key, order_id)) {
+        return false;
+    }
+    old = shard.orders.Erase(key);
+
+    // Keep the snapshot copy from being loaded back in
+    if (std::atomic_load(&this->snapshot_)) {
+        shard.erased.insert(key);
+    }
+
+    this->index_remove(*old);
+    this->notify(old, nullptr);
+    return true;
+}
+
+bool OrderStore::EraseIf(const OrderPtr& expected) {
+    const OrderId& key = expected->key();
+    OrderPtr old;
+
+    OrderShard& shard = this->order_shard(key);
+    WriteLock lock(shard.mutex);
+
+    const OrderPtr* current = shard.orders.Find(key);
+    if (!current || current->get() != expected.get()) {
+        return false;
+    }
+    old = shard.orders.Erase(key);
+
+    if (std::atomic_load(&this->snapshot_)) {
+        shard.erased.insert(key);
+    }
+
+    this->index_remove(*old);
+    this->notify_residency(old, nullptr);
+    return true;
+}
+
+std::vector<bool> OrderStore::InsertBatch(const std::vector<NewOrder>& orders) {
+    std::vector<bool> inserted(orders.size(), false);
+
+    // Records are built before any lock is taken
+    std::vector<OrderPtr> records;
+    std::vector<std::vector<std::size_t>> by_shard(this->shard_count());
+    records.reserve(orders.size());
+    for (std::size_t i = 0; i < orders.size(); i++) {
+        records.push_back(OrderRecord::Create(orders[i].user_id, orders[i].order));
+        by_shard[OrderIdHash{}(records[i]->key()) & this->shard_mask_].push_back(i);
+    }
+
+    std::vector<std::size_t> added;
+    std::vector<std::vector<std::size_t>> by_user_shard(this->shard_count());
+    for (std::size_t s = 0; s <= this->shard_mask_; s++) {
+        if (by_shard[s].empty()) {
+            continue;
+        }
+
+        OrderShard& shard = this->order_shards_[s];
+        WriteLock lock(shard.mutex);
+
+        // find_locked may take a user shard lock itself, so the index is
+        // updated only after every lookup is done
+        added.clear();
+        for (std::size_t i : by_shard[s]) {
+            if (!this->find_locked(shard, records[i]->key(), orders[i].order.id()) &&
+                shard.orders.Insert(records[i])) {
+                inserted[i] = true;
+                added.push_back(i);
+                by_user_shard[this->user_shard_index(orders[i].user_id)].push_back(i);
+            }
+        }
+
+        for (std::size_t u = 0; u <= this->shard_mask_; u++) {
+            if (by_user_shard[u].empty()) {
+                continue;
+            }
+
+            UserShard& user_shard = this->user_shards_[u];
+            WriteLock user_lock(user_shard.mutex);
+            for (std::size_t i : by_user_shard[u]) {
+                user_shard.users[orders[i].user_id].add(*records[i]);
+            }
+            by_user_shard[u].clear();
+        }
+
+        for (std::size_t i : added) {
+            this->notify(nullptr, records[i]);
+        }
+    }
+
+    return inserted;
+}
+
+void OrderStore::Put(const std::string& user_id, const osv1::Order& order) {
+    OrderPtr record = OrderRecord::Create(user_id, order);
+    OrderShard& shard = this->order_shard(record->key());
+    OrderPtr old;
+
+    WriteLock lock(shard.mutex);
+    OrderPtr* current = this->find_locked(shard, record->key(), order.id());
+    if (!current) {
+        if (shard.orders.Insert(record)) {
+            this->index_add(*record);
+            this->notify(nullptr, record);
+        }
+        return;
+    }
+
+    old = std::exchange(*current, record);
+    this->index_replace(*old, *record);
+    this->notify(old, record);
+}
+
+void OrderStore::AddObserver(Observer observer, bool loads, bool evictions) {
+    if (loads) {
+        this->load_observers_.push_back(observer);
+    }
+    if (evictions) {
+        this->eviction_observers_.push_back(observer);
+    }
+    this->observers_.push_back(std::move(observer));
+}
+
+void OrderStore::AttachSnapshot(std::shared_ptr<const OrderSnapshot> snapshot) {
+    std::lock_guard<std::mutex> lock(this->load_mutex_);
+    this->loading_ = snapshot != nullptr;
+    std::atomic_store(&this->snapshot_, std::move(snapshot));
+}
+
+std::size_t OrderStore::LoadSnapshot(unsigned threads) {
+    std::shared_ptr<const OrderSnapshot> snapshot = std::atomic_load(&this->snapshot_);
+    if (!snapshot) {
+        return 0;
+    }
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Records are laid out in index order, so each thread reads one
+    // contiguous stretch of the file
+    std::atomic<std::size_t> loaded{0};
+    std::size_t chunk = (snapshot->size() + threads - 1) / threads;
+
+    auto load = [&](unsigned t) {
+        std::size_t begin = std::min(snapshot->size(), t * chunk);
+        std::size_t end = std::min(snapshot->size(), begin + chunk);
+        std::size_t count = 0;
+        osv1::Order order;
+
+        for (std::size_t i = begin; i < end; i++) {
+            OrderSnapshot::Record record = snapshot->at(i);
+            if (record.order_id.empty() || !OrderSnapshot::Parse(record, &order)) {
+                continue;
+            }
+
+            OrderPtr loaded_record = OrderRecord::Create(record.user_id, order);
+            const OrderId& key = loaded_record->key();
+
+            OrderShard& shard = this->order_shard(key);
+            WriteLock lock(shard.mutex);
+            if (shard.erased.count(key) || shard.orders.Find(key)) {
+                continue;  // Written or erased since the snapshot was attached
+            }
+
+            this->index_add(*loaded_record);
+            this->notify_loaded(loaded_record);
+            shard.orders.Insert(std::move(loaded_record));
+            count++;
+        }
+        loaded += count;
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++) {
+        workers.emplace_back(load, t);
+    }
+    load(0);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    // Every order is in memory now, stop consulting the snapshot
+    std::atomic_store(&this->snapshot_, std::shared_ptr<const OrderSnapshot>());
+    for (std::size_t i = 0; i <= this->shard_mask_; i++) {
+        WriteLock lock(this->order_shards_[i].mutex);
+        std::unordered_set<OrderId, OrderIdHash>().swap(this->order_shards_[i].erased);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->load_mutex_);
+        this->loading_ = false;
+    }
+    this->load_cv_.notify_all();
+
+    return loaded.load();
+}
+
+void OrderStore::WaitLoaded() const {
+    if (!this->loading_.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(this->load_mutex_);
+    this->load_cv_.wait(lock, [this] { return !this->loading_.load(); });
+}
+
+void OrderStore::Scan(const ScanFn& fn) const {
+    this->WaitLoaded();
+
+    std::vector<OrderPtr> orders;
+    for (std::size_t i = 0; i <= this->shard_mask_; i++) {
+        {
+            const OrderShard& shard = this->order_shards_[i];
+            ReadLock lock(shard.mutex);
+
+            orders.clear();
+            orders.reserve(shard.orders.size());
+            shard.orders.ForEach([&orders](const OrderPtr& order) { orders.push_back(order); });
+        }
+
+        for (const OrderPtr& order : orders) {
+            fn(order);
+        }
+    }
+}
+
+std::size_t OrderStore::ScanSlots(std::size_t shard, std::size_t begin, std::size_t end, const ScanFn& fn,
+                                  std::size_t* table_bytes) const {
+    const OrderShard& order_shard = this->order_shards_[shard];
+    ReadLock lock(order_shard.mutex);
+
+    order_shard.orders.ForEachIn(begin, end, fn);
+    if (table_bytes) {
+        *table_bytes = order_shard.orders.allocated_bytes();
+    }
+    return order_shard.orders.capacity();
+}
+
+std::size_t OrderStore::size() const {
+    this->WaitLoaded();
+
+    std::size_t total = 0;
+    for (std::size_t i = 0; i <= this->shard_mask_; i++) {
+        ReadLock lock(this->order_shards_[i].mutex);
+        total += this->order_shards_[i].orders.size();
+    }
+    return total;
+}
+
+std::size_t OrderStore::allocated_bytes() const {
+    std::size_t total = 0;
+    for (std::size_t i = 0; i <= this->shard_mask_; i++) {
+        const OrderShard& shard = this->order_shards_[i];
+        ReadLock lock(shard.mutex);
+
+        total += shard.orders.allocated_bytes();
+        shard.orders.ForEach([&total](const OrderPtr& order) { total += order->allocated_bytes(); });
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+OrderStore::OrderShard& OrderStore::order_shard(const OrderId& key) const {
+    return this->order_shards_[OrderIdHash{}(key) & this->shard_mask_];
+}
+
+OrderStore::UserShard& OrderStore::user_shard(std::string_view user_id) const {
+    return this->user_shards_[this->user_shard_index(user_id)];
+}
+
+std::size_t OrderStore::user_shard_index(std::string_view user_id) const {
+    return std::hash<std::string_view>{}(user_id) & this->shard_mask_;
+}
+
+OrderStore::OrderPtr* OrderStore::find_locked(OrderShard& shard, const OrderId& key, std::string_view order_id) {
+    if (OrderPtr* order = shard.orders.Find(key)) {
+        return (*order)->HasId(order_id) ? order : nullptr;
+    }
+
+    std::shared_ptr<const OrderSnapshot> snapshot = std::atomic_load(&this->snapshot_);
+    if (!snapshot || shard.erased.count(key)) {
+        return nullptr;
+    }
+
+    OrderSnapshot::Record record;
+    osv1::Order order;
+    if (!snapshot->Find(order_id, &record) || !OrderSnapshot::Parse(record, &order)) {
+        return nullptr;
+    }
+
+    // Only load observers hear about the load, the others only about the
+    // change that follows
+    OrderPtr loaded = OrderRecord::Create(record.user_id, order);
+    this->index_add(*loaded);
+    this->notify_loaded(loaded);
+    shard.orders.Insert(std::move(loaded));
+    return shard.orders.Find(key);
+}
+
+void OrderStore::UserIndex::add(const OrderRecord& order) {
+    this->by_created.emplace(order.created_at(), order.key());
+    this->by_status[order.status()].emplace(order.created_at(), order.key());
+}
+
+void OrderStore::UserIndex::remove(const OrderRecord& order) {
+    IndexKey key(order.created_at(), order.key());
+    this->by_created.erase(key);
+
+    auto it = this->by_status.find(order.status());
+    if (it != this->by_status.end()) {
+        it->second.erase(key);
+        if (it->second.empty()) {
+            this->by_status.erase(it);
+        }
+    }
+}
+
+// The index_* helpers are called with the order's shard write locked
+bool OrderStore::insert(const std::string& user_id, const osv1::Order& order, bool restored) {
+    OrderPtr record = OrderRecord::Create(user_id, order);
+
+    OrderShard& shard = this->order_shard(record->key());
+    WriteLock lock(shard.mutex);
+
+    if (this->find_locked(shard, record->key(), order.id()) || !shard.orders.Insert(record)) {
+        return false;
+    }
+
+    this->index_add(*record);
+    if (restored) {
+        this->notify_residency(nullptr, record);
+    } else {
+        this->notify(nullptr, record);
+    }
+    return true;
+}
+
+void OrderStore::index_add(const OrderRecord& order) {
+    UserShard& shard = this->user_shard(order.user_id());
+    WriteLock lock(shard.mutex);
+    shard.users[std::string(order.user_id())].add(order);
+}
+
+void OrderStore::index_remove(const OrderRecord& order) {
+    UserShard& shard = this->user_shard(order.user_id());
+    WriteLock lock(shard.mutex);
+
+    auto it = shard.users.find(std::string(order.user_id()));
+    if (it == shard.users.end()) {
+        return;
+    }
+
+    it->second.remove(order);
+    if (it->second.by_created.empty()) {
+        shard.users.erase(it);
+    }
+}
+
+void OrderStore::index_replace(const OrderRecord& old_order, const OrderRecord& new_order) {
+    if (old_order.interned_user_id() != new_order.interned_user_id()) {
+        this->index_remove(old_order);
+        this->index_add(new_order);
+        return;
+    }
+
+    if (old_order.status() == new_order.status() && old_order.created_at() == new_order.created_at()) {
+        return;
+    }
+
+    UserShard& shard = this->user_shard(new_order.user_id());
+    WriteLock lock(shard.mutex);
+
+    UserIndex& index = shard.users[std::string(new_order.user_id())];
+    index.remove(old_order);
+    index.add(new_order);
+}
+
+void OrderStore::notify(const OrderPtr& before, const OrderPtr& after) const {
+    for (const auto& observer : this->observers_) {
+        observer(before, after);
+    }
+}
+
+void OrderStore::notify_residency(const OrderPtr& before, const OrderPtr& after) const {
+    for (const auto& observer : this->eviction_observers_) {
+        observer(before, after);
+    }
+}
+
+void OrderStore::notify_loaded(const OrderPtr& order) const {
+    for (const auto& observer : this->load_observers_) {
+        observer(nullptr, order);
+    }
+}
+
+// Reads the index a batch of keys at a time from the cursor, so neither the
+// keys nor the records held at once grow with the user's orders. Without an
+// address prefix every key is a match and one batch fills the page, unless
+// orders went away before they were resolved.
+bool OrderStore::query_after(const std::string& user_id, const OrderQuery& query, Page* page) const {
+    page->total = 0;
+
+    OrderQuery batch = query;
+    bool first_batch = true;
+    bool exhausted = false;
+    while (!exhausted && page->orders.size() < query.limit) {
+        std::size_t want = query.address_prefix.empty() ? query.limit - page->orders.size()
+                                                        : std::max(query.limit, kMinFilteredBatch);
+        std::vector<OrderId> keys;
+        {
+            const UserShard& shard = this->user_shard(user_id);
+            ReadLock lock(shard.mutex);
+
+            auto user = shard.users.find(user_id);
+            if (user == shard.users.end()) {
+                return !first_batch;
+            }
+
+            IndexSet::const_iterator first, last;
+            if (!index_range(user->second, batch, &first, &last)) {
+                return true;
+            }
+            for (auto it = first; it != last && keys.size() < want; ++it) {
+                keys.push_back(it->second);
+                batch.after = OrderCursor{it->first, it->second};
+            }
+        }
+        first_batch = false;
+        exhausted = keys.size() < want;
+
+        for (auto& order : this->resolve(keys)) {
+            if (page->orders.size() < query.limit && has_prefix(order->address(), query.address_prefix)) {
+                page->orders.push_back(std::move(order));
+            }
+        }
+    }
+    return true;
+}
+
+// Narrows down to the status index when filtering on status. Returns false if
+// no order has the status.
+bool OrderStore::index_range(const UserIndex& user, const OrderQuery& query, IndexSet::const_iterator* first,
+                             IndexSet::const_iterator* last) {
+    const IndexSet* set = &user.by_created;
+    if (query.status) {
+        auto it = user.by_status.find(*query.status);
+        if (it == user.by_status.end()) {
+            return false;
+        }
+        set = &it->second;
+    }
+
+    *first = query.created_after ? set->lower_bound({*query.created_after, OrderId()}) : set->begin();
+    *last = query.created_before ? set->lower_bound({*query.created_before, OrderId()}) : set->end();
+    if (query.after) {
+        IndexKey resume{query.after->created_at, query.after->key};
+        if (*first == set->end() || !(resume < **first)) {
+            *first = set->upper_bound(resume);
+        }
+    }
+
+    // The range is empty once its start is past its end
+    if (*last != set->end() && (*first == set->end() || !(**first < **last))) {
+        *last = *first;
+    }
+    return true;
+}
+
+std::vector<OrderStore::OrderPtr> OrderStore::resolve(const std::vector<OrderId>& keys) const {
+    // Resolve keys against the live records, skipping any order that was
+    // deleted after the index was read
+    std::vector<OrderPtr> orders;
+    orders.reserve(keys.size());
+    for (const OrderId& key : keys) {
+        const OrderShard& shard = this->order_shard(key);
+        ReadLock lock(shard.mutex);
+        if (const OrderPtr* order = shard.orders.Find(key)) {
+            orders.push_back(*order);
+        }
+    }
+    return orders;
+}
@@ -0,0 +1,110 @@
+#include "store/order_table.hpp"
+
+#include <utility>
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+OrderRecord::Ptr* OrderTable::Find(const OrderId& key) {
+    std::size_t i = this->find_slot(key);
+    return i < this->capacity() ? &this->slots_[i].record : nullptr;
+}
+
+const OrderRecord::Ptr* OrderTable::Find(const OrderId& key) const {
+    std::size_t i = this->find_slot(key);
+    return i < this->capacity() ? &this->slots_[i].record : nullptr;
+}
+
+bool OrderTable::Insert(OrderRecord::Ptr record) {
+    // Grow past three quarters full, linear probing degrades quickly beyond
+    if ((this->size_ + 1) * 4 > this->capacity() * 3) {
+        this->rehash(this->capacity() ? this->capacity() * 2 : kMinCapacity);
+    }
+
+    const OrderId& key = record->key();
+    for (std::size_t i = this->home(key);; i = (i + 1) & this->mask_) {
+        Slot& slot = this->slots_[i];
+        if (!slot.record) {
+            slot.key = key;
+            slot.record = std::move(record);
+            this->size_++;
+            return true;
+        }
+        if (slot.key == key) {
+            return false;
+        }
+    }
+}
+
+OrderRecord::Ptr OrderTable::Erase(const OrderId& key) {
+    std::size_t i = this->find_slot(key);
+    if (i >= this->capacity()) {
+        return nullptr;
+    }
+
+    OrderRecord::Ptr erased = std::move(this->slots_[i].record);
+    this->size_--;
+
+    // Pull back every following entry of the run that may not sit past the
+    // hole, so lookups never stop early at it
+    for (std::size_t j = (i + 1) & this->mask_; this->slots_[j].record; j = (j + 1) & this->mask_) {
+        std::size_t k = this->home(this->slots_[j].key);
+        bool movable = i <= j ? (k <= i || k > j) : (k <= i && k > j);
+        if (movable) {
+            this->slots_[i] = std::move(this->slots_[j]);
+            i = j;
+        }
+    }
+
+    this->slots_[i] = Slot{};
+
+    // Give the memory back once mostly empty, well below the growth point
+    if (this->capacity() > kMinCapacity && this->size_ * 8 < this->capacity()) {
+        this->rehash(this->capacity() / 2);
+    }
+    return erased;
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+//
+// Index of the key's slot, or capacity() when it is not in the table
+std::size_t OrderTable::find_slot(const OrderId& key) const {
+    if (this->size_ == 0) {
+        return this->capacity();
+    }
+
+    for (std::size_t i = this->home(key);; i = (i + 1) & this->mask_) {
+        const Slot& slot = this->slots_[i];
+        if (!slot.record) {
+            return this->capacity();
+        }
+        if (slot.key == key) {
+            return i;
+        }
+    }
+}
+
+void OrderTable::rehash(std::size_t capacity) {
+    std::unique_ptr<Slot[]> old = std::move(this->slots_);
+    std::size_t old_capacity = old ? this->mask_ + 1 : 0;
+
+    this->slots_.reset(new Slot[capacity]);
+    this->mask_ = capacity - 1;
+    this->shift_ = 64;
+    for (std::size_t c = capacity; c > 1; c >>= 1) {
+        this->shift_--;
+    }
+
+    for (std::size_t i = 0; i < old_capacity; i++) {
+        if (!old[i].record) {
+            continue;
+        }
+        std::size_t j = this->home(old[i].key);
+        while (this->slots_[j].record) {
+            j = (j + 1) & this->mask_;
+        }
+        this->slots_[j] = std::move(old[i]);
+    }
+}
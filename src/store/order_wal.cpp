@@ -0,0 +1,461 @@
+#include "store/order_wal.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "store/file_io.hpp"
+
+namespace {
+
+// Sequence number of the last record appended by this thread, so Commit()
+// only waits for its own writes
+struct LastAppend {
+    const OrderWal* wal = nullptr;
+    uint64_t seq = 0;
+};
+thread_local LastAppend last_append;
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// Public methods
+// ---------------------------------------------------------------------------
+OrderWal::OrderWal(WalOptions options) : options_(std::move(options)) {
+    this->fd_ = ::open(this->options_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (this->fd_ < 0) {
+        throw sys_error("Failed to open WAL", this->options_.path);
+    }
+
+    struct stat st;
+    if (::fstat(this->fd_, &st) != 0) {
+        ::close(this->fd_);
+        throw sys_error("Failed to stat WAL", this->options_.path);
+    }
+
+    // A new log, or one whose header never made it to disk. Syncing the
+    // directory makes the new file itself durable.
+    if (static_cast<std::size_t>(st.st_size) < kHeaderSize) {
+        if (::ftruncate(this->fd_, 0) != 0 || !write_out(this->fd_, header())) {
+            ::close(this->fd_);
+            throw sys_error("Failed to initialise WAL", this->options_.path);
+        }
+        sync_parent(this->options_.path);
+    }
+
+    this->flusher_ = std::thread(&OrderWal::flush_loop, this);
+}
+
+OrderWal::~OrderWal() {
+    this->Flush();
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stopping_ = true;
+    }
+    this->flush_cv_.notify_one();
+    this->flusher_.join();
+
+    ::close(this->fd_);
+}
+
+void OrderWal::Append(const OrderStore::OrderPtr& before, const OrderStore::OrderPtr& after) {
+    // Records only exist in memory, the log keeps the protobuf form. The
+    // scratch message keeps its buffers from one append to the next.
+    thread_local osv1::Order order;
+    std::string_view user_id = after ? after->user_id() : before->user_id();
+
+    std::string payload;
+    payload.reserve(64 + user_id.size());
+    put<uint8_t>(payload, after ? kPut : kDelete);
+    put<uint32_t>(payload, static_cast<uint32_t>(user_id.size()));
+    payload.append(user_id);
+
+    if (after) {
+        after->ToProto(&order);
+        order.AppendToString(&payload);
+    } else {
+        payload.append(before->id());
+    }
+
+    uint64_t seq = 0;
+    bool full = false;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        put<uint32_t>(this->buffer_, static_cast<uint32_t>(payload.size()));
+        put<uint32_t>(this->buffer_, Crc32(payload.data(), payload.size()));
+        this->buffer_.append(payload);
+
+        seq = ++this->appended_seq_;
+        full = this->buffer_.size() >= this->options_.sync_bytes;
+    }
+
+    last_append = LastAppend{this, seq};
+    if (full) {
+        this->flush_cv_.notify_one();
+    }
+}
+
+bool OrderWal::Commit() {
+    if (!this->options_.wait_for_sync) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        return !this->failed_;
+    }
+
+    if (last_append.wal == this) {
+        return this->wait_durable(last_append.seq);
+    }
+
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    uint64_t seq = this->appended_seq_;
+    lock.unlock();
+    return this->wait_durable(seq);
+}
+
+void OrderWal::CommitAsync(std::function<void(bool)> done) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    uint64_t seq = last_append.wal == this ? last_append.seq : this->appended_seq_;
+    if (!this->options_.wait_for_sync || this->durable_seq_ >= seq || this->failed_) {
+        bool ok = !this->failed_;
+        lock.unlock();
+        done(ok);
+        return;
+    }
+
+    this->callbacks_.emplace(seq, std::move(done));
+    lock.unlock();
+    this->flush_cv_.notify_one();
+}
+
+bool OrderWal::Flush() {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    uint64_t seq = this->appended_seq_;
+    lock.unlock();
+    return this->wait_durable(seq);
+}
+
+bool OrderWal::Rotate() {
+    // Records still buffered would land in the new log; they are harmless
+    // there but replayed for nothing, so push them into the current one first
+    this->Flush();
+
+    // Holding the I/O lock keeps the flusher out, every batch written so far
+    // is already synced to the current file
+    std::lock_guard<std::mutex> io_lock(this->io_mutex_);
+
+    const std::string& path = this->options_.path;
+    std::string rotated = RotatedPath(path);
+    if (::access(rotated.c_str(), F_OK) == 0) {
+        return false;
+    }
+
+    std::string tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw sys_error("Failed to create WAL", tmp_path);
+    }
+
+    // Recovery copes with a crash between the renames: a missing log replays
+    // as empty
+    if (!write_out(fd, header()) || ::rename(path.c_str(), rotated.c_str()) != 0 ||
+        ::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::runtime_error error = sys_error("Failed to rotate WAL", path);
+        ::close(fd);
+        throw error;
+    }
+    sync_parent(path);
+
+    ::close(this->fd_);
+    this->fd_ = fd;
+    return true;
+}
+
+void OrderWal::DropRotated() {
+    if (::unlink(RotatedPath(this->options_.path).c_str()) == 0) {
+        sync_parent(this->options_.path);
+    }
+}
+
+std::size_t OrderWal::Replay(const std::string& path, OrderStore& store, unsigned threads) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        throw sys_error("Failed to open WAL", path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw sys_error("Failed to stat WAL", path);
+    }
+
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+    if (size < kHeaderSize) {
+        ::close(fd);
+        return 0;
+    }
+
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw sys_error("Failed to map WAL", path);
+    }
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+    const char* data = static_cast<const char*>(mapping);
+    if (load<uint32_t>(data) != kMagic || load<uint32_t>(data + 4) != kVersion) {
+        ::munmap(mapping, size);
+        throw std::runtime_error("Not an order WAL (bad magic or version): " + path);
+    }
+
+    // Record boundaries, a cheap sequential hop over the length prefixes
+    std::vector<std::size_t> offsets;
+    std::size_t pos = kHeaderSize;
+    while (pos + kRecordHeaderSize <= size) {
+        std::size_t length = load<uint32_t>(data + pos);
+        if (pos + kRecordHeaderSize + length > size) {
+            break;
+        }
+        offsets.push_back(pos);
+        pos += kRecordHeaderSize + length;
+    }
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<unsigned>(std::min<std::size_t>(threads, std::max<std::size_t>(offsets.size(), 1)));
+
+    struct Parsed {
+        std::size_t index;
+        bool put;
+        std::string user_id;
+        std::string order_id;
+        osv1::Order order;
+    };
+
+    // Phase 1: verify and parse contiguous chunks of records in parallel,
+    // bucketing them by order id so each order lands in exactly one partition
+    std::vector<std::vector<std::vector<Parsed>>> buckets(threads, std::vector<std::vector<Parsed>>(threads));
+    std::atomic<std::size_t> first_bad{offsets.size()};
+    std::size_t chunk = (offsets.size() + threads - 1) / threads;
+
+    auto parse = [&](unsigned t) {
+        std::size_t begin = std::min(offsets.size(), t * chunk);
+        std::size_t end = std::min(offsets.size(), begin + chunk);
+
+        for (std::size_t i = begin; i < end; i++) {
+            const char* record = data + offsets[i];
+            uint32_t length = load<uint32_t>(record);
+            const char* payload = record + kRecordHeaderSize;
+
+            bool valid = length >= 5 && load<uint32_t>(record + 4) == Crc32(payload, length);
+            uint32_t user_length = valid ? load<uint32_t>(payload + 1) : 0;
+            valid = valid && 5 + static_cast<std::size_t>(user_length) <= length;
+
+            uint8_t op = length > 0 ? static_cast<uint8_t>(payload[0]) : 0;
+            valid = valid && (op == kPut || op == kDelete);
+
+            Parsed parsed{i, false, {}, {}, {}};
+            if (valid) {
+                parsed.put = op == kPut;
+                parsed.user_id.assign(payload + 5, user_length);
+
+                const char* body = payload + 5 + user_length;
+                int body_length = static_cast<int>(length - 5 - user_length);
+                if (parsed.put) {
+                    valid = parsed.order.ParseFromArray(body, body_length);
+                    parsed.order_id = parsed.order.id();
+                } else {
+                    parsed.order_id.assign(body, body_length);
+                }
+            }
+
+            if (!valid) {
+                std::size_t current = first_bad.load();
+                while (i < current && !first_bad.compare_exchange_weak(current, i)) {
+                }
+                return;
+            }
+
+            std::size_t partition = std::hash<std::string>{}(parsed.order_id) % threads;
+            buckets[t][partition].push_back(std::move(parsed));
+        }
+    };
+
+    // Phase 2: every partition keeps the last record per order, in log order,
+    // and inserts the survivors
+    std::atomic<std::size_t> loaded{0};
+    auto apply = [&](unsigned p) {
+        std::unordered_map<std::string, Parsed*> latest;
+        for (unsigned t = 0; t < threads; t++) {
+            for (Parsed& parsed : buckets[t][p]) {
+                if (parsed.index >= first_bad.load()) {
+                    break;
+                }
+                latest[parsed.order_id] = &parsed;
+            }
+        }
+
+        for (auto& [order_id, parsed] : latest) {
+            if (parsed->put) {
+                store.Put(parsed->user_id, std::move(parsed->order));
+            } else {
+                store.Erase(order_id);
+            }
+        }
+        loaded += latest.size();
+    };
+
+    auto run = [threads](const std::function<void(unsigned)>& fn) {
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; t++) {
+            workers.emplace_back(fn, t);
+        }
+        fn(0);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    };
+
+    run(parse);
+    run(apply);
+
+    ::munmap(mapping, size);
+
+    // Cut a torn or corrupt tail so the next append starts on a boundary
+    std::size_t valid_end = first_bad.load() < offsets.size() ? offsets[first_bad.load()] : pos;
+    if (valid_end < size) {
+        std::cerr << "WAL " << path << ": discarding " << (size - valid_end) << " bytes after offset " << valid_end
+                  << std::endl;
+        if (::truncate(path.c_str(), static_cast<off_t>(valid_end)) != 0) {
+            throw sys_error("Failed to truncate WAL", path);
+        }
+    }
+
+    return loaded.load();
+}
+
+uint32_t OrderWal::Crc32(const char* data, std::size_t size) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    uint32_t crc = 0xffffffffu;
+    for (std::size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+// ---------------------------------------------------------------------------
+// Private methods
+// ---------------------------------------------------------------------------
+void OrderWal::flush_loop() {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+
+    while (true) {
+        // Start a batch as soon as someone waits on it, otherwise let appends
+        // pile up for at most sync_interval
+        this->flush_cv_.wait_for(lock, this->options_.sync_interval, [this] {
+            bool waited_on = this->waiters_ > 0 || !this->callbacks_.empty();
+            return this->stopping_ || (waited_on && !this->buffer_.empty()) ||
+                   this->buffer_.size() >= this->options_.sync_bytes;
+        });
+
+        if (this->buffer_.empty()) {
+            if (this->stopping_) {
+                return;
+            }
+            continue;
+        }
+
+        std::string batch;
+        batch.swap(this->buffer_);
+        uint64_t seq = this->appended_seq_;
+
+        // Records past a failed write would not replay anyway, recovery stops
+        // at the torn batch
+        if (this->failed_) {
+            continue;
+        }
+
+        // Appends keep filling the next batch while this one is written
+        lock.unlock();
+        bool ok;
+        {
+            std::lock_guard<std::mutex> io_lock(this->io_mutex_);
+            ok = write_out(this->fd_, batch);
+        }
+        lock.lock();
+
+        if (ok) {
+            this->durable_seq_ = seq;
+        } else {
+            this->failed_.store(true, std::memory_order_release);
+            std::cerr << "WAL " << this->options_.path << ": write failed, no more changes are logged: "
+                      << std::strerror(errno) << std::endl;
+        }
+
+        // Before the committers wake, so a Flush() returns after the
+        // callbacks of what it flushed ran
+        this->run_callbacks();
+        this->durable_cv_.notify_all();
+    }
+}
+
+bool OrderWal::write_out(int fd, const std::string& data) { return write_all(fd, data) && ::fdatasync(fd) == 0; }
+
+std::string OrderWal::header() {
+    std::string header;
+    put<uint32_t>(header, kMagic);
+    put<uint32_t>(header, kVersion);
+    return header;
+}
+
+bool OrderWal::wait_durable(uint64_t seq) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    if (this->durable_seq_ >= seq || this->failed_) {
+        return !this->failed_;
+    }
+
+    this->waiters_++;
+    this->flush_cv_.notify_one();
+    this->durable_cv_.wait(lock, [&] { return this->durable_seq_ >= seq || this->failed_; });
+    this->waiters_--;
+
+    return !this->failed_;
+}
+
+// Called with mutex_ held once a batch was written, or failed
+void OrderWal::run_callbacks() {
+    bool ok = !this->failed_;
+    auto end = ok ? this->callbacks_.upper_bound(this->durable_seq_) : this->callbacks_.end();
+    for (auto it = this->callbacks_.begin(); it != end; ++it) {
+        it->second(ok);
+    }
+    this->callbacks_.erase(this->callbacks_.begin(), end);
+}